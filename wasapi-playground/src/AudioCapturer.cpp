@@ -1,23 +1,48 @@
 #include "AudioCapturer.h"
+#include "SampleConversion.h"
+#include "RealtimeLog.h"
+#include "Trace.h"
+#include "RealtimeCheck.h"
+#include <algorithm>
+#include <cmath>
 #include <future>
 
+namespace {
+	// Upper bound on the wait for the buffer event: a lost endpoint stops signaling it
+	const DWORD bufferEventTimeoutMs = 100;
+
+	// Space reserved for start_recording(), which must not allocate on the capture thread
+	const unsigned int maxRecordingSeconds = 60;
+}
+
 AudioCapturer::AudioCapturer(std::unique_ptr<AudioDevice> devicePointer) :
 	device(std::move(devicePointer)),
 	audioClient(device->get_audio_client()),
-	deviceFormat(get_working_format()),
+	deviceFormat(get_working_format(*device, audioClient)),
 	captureClient(nullptr),
 	streamInfo(std::nullopt),
-	streamingThread(std::nullopt)
+	enginePeriodInFrames(0),
+	running(false),
+	mode(CaptureMode::Streaming),
+	activeDevice(device->get_handle()),
+	metrics(MetricsRegistry::instance().register_stream(StreamDirection::Capture)),
+	worker(std::make_unique<AudioWorker>("capture", [this]() { capture_loop(); }))
 {
 }
 
 AudioCapturer::~AudioCapturer()
 {
 	stop();
+	worker.reset();
+	migrator.reset();
+	MetricsRegistry::instance().unregister_stream(metrics);
 
 	SafeRelease(&audioClient);
 	SafeRelease(&captureClient);
 	CoTaskMemFree(deviceFormat);
+
+	if (streamRequest.bufferEvent != nullptr)
+		CloseHandle(streamRequest.bufferEvent);
 }
 
 std::optional<HRESULT> AudioCapturer::initialize(unsigned int bufferTimeSizeMs)
@@ -27,22 +52,93 @@ std::optional<HRESULT> AudioCapturer::initialize(unsigned int bufferTimeSizeMs)
 		return S_FALSE;
 	}
 
-	auto result = audioClient->Initialize(
-		AUDCLNT_SHAREMODE_SHARED,
-		AUDCLNT_STREAMFLAGS_NOPERSIST,
-		(REFERENCE_TIME)bufferTimeSizeMs * 10000,		// 1 unit --> 100 nanoseconds
-		0,												// only used for EXCLUSIVE mode
-		deviceFormat,
-		NULL);
+	streamRequest.bufferTimeSizeMs = bufferTimeSizeMs;
+	return initialize_client(*device, &audioClient, deviceFormat, &captureClient, &enginePeriodInFrames);
+}
 
-	if (FAILED(result))
+std::optional<HRESULT> AudioCapturer::initialize_low_latency(unsigned int periodInFrames)
+{
+	if (audioClient == nullptr)
 	{
-		printf("Unable to initialize audio client: %x.\n", result);
-		return result;
+		return S_FALSE;
+	}
+
+	// Packets arrive once per period: wait for the engine to signal them instead of polling with Sleep()
+	if (streamRequest.bufferEvent == nullptr)
+		streamRequest.bufferEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+	streamRequest.lowLatency = true;
+	streamRequest.periodInFrames = periodInFrames;
+	return initialize_client(*device, &audioClient, deviceFormat, &captureClient, &enginePeriodInFrames);
+}
+
+std::optional<HRESULT> AudioCapturer::initialize_negotiated(const NegotiationPolicy& policy)
+{
+	if (audioClient == nullptr)
+	{
+		return S_FALSE;
+	}
+
+	auto configuration = device->get_stream_configuration(policy);
+	if (!configuration.has_value())
+	{
+		printf("[AudioCapturer] Unable to negotiate a stream configuration\n");
+		return S_FALSE;
+	}
+
+	if (auto format = allocate_wave_format(configuration.value().format); format != nullptr) {
+		CoTaskMemFree(deviceFormat);
+		deviceFormat = format;
 	}
 
+	if (configuration.value().usesEnginePeriod)
+		return initialize_low_latency(configuration.value().periodInFrames);
 
-	result = audioClient->GetService(__uuidof(IAudioCaptureClient), reinterpret_cast<void**>(&captureClient));
+	// The legacy Initialize() runs at the default engine period: only the buffer is sized for the negotiated latency
+	auto bufferTimeSizeMs = (unsigned int)ceil(configuration.value().latencyMs);
+	return initialize(bufferTimeSizeMs);
+}
+
+std::optional<HRESULT> AudioCapturer::initialize_exclusive(unsigned int bufferTimeSizeMs)
+{
+	if (audioClient == nullptr)
+	{
+		return S_FALSE;
+	}
+
+	auto format = find_exclusive_format(*device, audioClient);
+	if (format == nullptr)
+	{
+		return AUDCLNT_E_UNSUPPORTED_FORMAT;
+	}
+
+	CoTaskMemFree(deviceFormat);
+	deviceFormat = format;
+
+	if (streamRequest.bufferEvent == nullptr)
+		streamRequest.bufferEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+	streamRequest.exclusive = true;
+	streamRequest.bufferTimeSizeMs = bufferTimeSizeMs;
+	return initialize_client(*device, &audioClient, deviceFormat, &captureClient, &enginePeriodInFrames);
+}
+
+UINT32 AudioCapturer::get_engine_period() const
+{
+	return enginePeriodInFrames;
+}
+
+const WAVEFORMATEX* AudioCapturer::get_format() const
+{
+	return deviceFormat;
+}
+
+std::optional<HRESULT> AudioCapturer::initialize_client(AudioDevice& endpoint, IAudioClient3** client, WAVEFORMATEX* format, IAudioCaptureClient** captureClient, UINT32* periodInFrames) const
+{
+	if (auto error = initialize_stream(endpoint, client, format, streamRequest, periodInFrames); error.has_value())
+		return error;
+
+	auto result = (*client)->GetService(__uuidof(IAudioCaptureClient), reinterpret_cast<void**>(captureClient));
 	if (FAILED(result))
 	{
 		printf("Unable to get new capture client: %x.\n", result);
@@ -52,98 +148,204 @@ std::optional<HRESULT> AudioCapturer::initialize(unsigned int bufferTimeSizeMs)
 	return std::nullopt;
 }
 
-void AudioCapturer::capture_data(const std::function<void(BYTE*, UINT32, DWORD)> dataReader)
+template<typename Reader>
+HRESULT AudioCapturer::capture_data(Reader&& dataReader)
 {
 	UINT32 packetLength = 0;
 	BYTE* buffData = nullptr;
 	UINT32 framesAvailable = 0;
 	DWORD flags = 0;
 
+	TRACE_SCOPE("capture_data");
 	auto result = captureClient->GetNextPacketSize(&packetLength);
 	if (FAILED(result))
 	{
-		printf("Failed to GetNextPacketSize(): %x.\n", result);
-		return;
+		realtime_log(LogSite::CaptureGetNextPacketSize, result);
+		return result;
 	}
 
+	metrics->set_fill(packetLength);
+
 	while (packetLength != 0)
 	{
 		// Get the available data in the shared buffer.
-		result = captureClient->GetBuffer(
-			&buffData,
-			&framesAvailable,
-			&flags,
-			NULL,
-			NULL);
+		{
+			TRACE_SCOPE("GetBuffer");
+			result = captureClient->GetBuffer(
+				&buffData,
+				&framesAvailable,
+				&flags,
+				NULL,
+				NULL);
+		}
 
 		if (FAILED(result))
 		{
-			printf("Failed to GetBuffer(): %x.\n", result);
-			return;
+			realtime_log(LogSite::CaptureGetBuffer, result);
+			return result;
 		}
 
-		// data is just silence
+		// The reader was too slow and the engine overwrote data that was not captured yet
+		if (flags & AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY)
+			metrics->add_underrun();
+
+		// data is just silence, readers get nullptr
 		if (flags & AUDCLNT_BUFFERFLAGS_SILENT)
 		{
 			buffData = nullptr;
 		}
 
-		if (buffData != nullptr)
+		// Integer endpoints are converted, readers always get float samples
+		if (buffData != nullptr && !is_float32(sampleFormat)) {
+			auto samples = (size_t)framesAvailable * deviceFormat->nChannels;
+			if (conversionBuffer.size() < samples)
+				conversionBuffer.resize(samples);
+
+			pcm_to_float(buffData, conversionBuffer.data(), samples, sampleFormat);
+			buffData = reinterpret_cast<BYTE*>(conversionBuffer.data());
+		}
+
+		// The effects work on a copy: the endpoint buffer is not ours to write
+		if (effects != nullptr) {
+			auto samples = (size_t)framesAvailable * deviceFormat->nChannels;
+			if (conversionBuffer.size() < samples)
+				conversionBuffer.resize(samples);
+
+			auto floatData = reinterpret_cast<float*>(buffData);
+			if (buffData == nullptr)
+				std::fill(conversionBuffer.begin(), conversionBuffer.begin() + samples, 0.0f);
+			else if (floatData != conversionBuffer.data())
+				std::copy(floatData, floatData + samples, conversionBuffer.begin());
+
+			effects->process(conversionBuffer.data(), framesAvailable);
+			buffData = reinterpret_cast<BYTE*>(conversionBuffer.data());
+			flags &= ~AUDCLNT_BUFFERFLAGS_SILENT;
+		}
+
+		{
+			TRACE_SCOPE("capture callback");
+			auto callbackStart = std::chrono::steady_clock::now();
 			dataReader(buffData, framesAvailable, flags);
 
-		result = captureClient->ReleaseBuffer(framesAvailable);
+			auto callbackTime = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - callbackStart);
+			metrics->add_callback(framesAvailable, callbackTime.count());
+		}
+
+		{
+			TRACE_SCOPE("ReleaseBuffer");
+			result = captureClient->ReleaseBuffer(framesAvailable);
+		}
 		if (FAILED(result))
 		{
-			printf("Failed to ReleaseBuffer(): %x.\n", result);
-			return;
+			realtime_log(LogSite::CaptureReleaseBuffer, result, framesAvailable);
+			return result;
 		}
 
 		result = captureClient->GetNextPacketSize(&packetLength);
 		if (FAILED(result))
 		{
-			printf("Failed to GetNextPacketSize(): %x.\n", result);
-			return;
+			realtime_log(LogSite::CaptureGetNextPacketSize, result);
+			return result;
 		}
 	}
+
+	lastReadTime = std::chrono::steady_clock::now();
+	return S_OK;
 }
 
-std::future<AudioRecording> AudioCapturer::start_recording()
+void AudioCapturer::prepare_conversion()
 {
-	if (running)
-		return std::future<AudioRecording>();
+	sampleFormat = to_stream_format(deviceFormat);
+	if ((!is_float32(sampleFormat) || effects != nullptr) && streamInfo.has_value())
+		conversionBuffer.resize((size_t)streamInfo.value().bufferSizeInFrames * deviceFormat->nChannels);
+	if (effects != nullptr)
+		effects->prepare(deviceFormat->nSamplesPerSec, deviceFormat->nChannels);
+}
+
+void AudioCapturer::wait_for_buffer()
+{
+	TRACE_SCOPE("wait");
+
+	if (streamRequest.bufferEvent != nullptr) {
+		WaitForSingleObject(streamRequest.bufferEvent, bufferEventTimeoutMs);
+		return;
+	}
+
+	auto latency = streamInfo.has_value() ? streamInfo.value().latency / 10000 : 0;
+	Sleep((long)latency / 2);
+}
+
+template<typename Reader>
+HRESULT AudioCapturer::capture_cycle(Reader&& dataReader)
+{
+	if (migrator != nullptr && migrator->has_prepared_stream())
+		switch_to_prepared_stream();
+
+	auto result = capture_data(dataReader);
+	if (FAILED(result))
+		metrics->add_error();
+
+	// The endpoint is gone and nothing is captured anyway: waking the migration worker may block
+	if (result == AUDCLNT_E_DEVICE_INVALIDATED && migrator != nullptr) {
+		NonRealtimeScope exempt;
+		migrator->request_migration(device->get_handle(), true);
+	}
+
+	return result;
+}
+
+bool AudioCapturer::start_stream()
+{
+	// A migration completed while the stream was stopped: start directly on the new endpoint
+	if (migrator != nullptr && migrator->has_prepared_stream()) {
+		if (auto next = migrator->take_prepared_stream(); next.has_value())
+			adopt_stream(next.value());
+	}
+
+	// Packets left over from the previous run would be delivered before the new ones
+	audioClient->Reset();
 
 	HRESULT hr = audioClient->Start();
 	if (FAILED(hr))
 	{
 		printf("FAILED TO START AUDIOCLIENT: %x.\n", hr);
-		return std::future<AudioRecording>();
+		return false;
 	}
 
 	streamInfo = get_stream_info(audioClient);
+	prepare_conversion();
+	if (effects != nullptr)
+		effects->reset();
 	running = true;
-	
-	return std::async(std::launch::async, [this]() {
-		auto latency = streamInfo.has_value() ? streamInfo.value().latency / 10000 : 0;
-		auto interval = (long)latency / 2;
-
-		AudioRecording recordingData;
-		recordingData.channels = deviceFormat->nChannels;
-		recordingData.samplesPerSecond = deviceFormat->nSamplesPerSec;
-
-		while (running) {
-			Sleep(interval);
-			capture_data([&recordingData](BYTE* buffData, UINT32 framesAvailable, DWORD flags) {
-				float* bufferFloat = reinterpret_cast<float*>(buffData);
+	metrics->running = true;
+	update_stream_metrics();
 
-				// assume 32 bit format
-				for (size_t i = 0; i < framesAvailable; i++)
-					recordingData.data.push_back(bufferFloat[i]);
-			});
-		}
-		
-		recordingData.durationMs = (recordingData.data.size() * 1000 / recordingData.samplesPerSecond);
-		return recordingData;
-	});
+	worker->resume();
+	return true;
+}
+
+std::future<AudioRecording> AudioCapturer::start_recording()
+{
+	if (running)
+		return std::future<AudioRecording>();
+
+	mode = CaptureMode::Recording;
+	recordingPromise = std::promise<AudioRecording>();
+	auto result = recordingPromise.get_future();
+
+	recordingData = AudioRecording();
+	recordingData.channels = deviceFormat->nChannels;
+	recordingData.samplesPerSecond = deviceFormat->nSamplesPerSec;
+
+	// The capture thread never grows the recording: it stops when the reserved space is full
+	recordingData.data.reserve((size_t)maxRecordingSeconds * deviceFormat->nSamplesPerSec * deviceFormat->nChannels);
+
+	if (!start_stream()) {
+		mode = CaptureMode::Streaming;
+		return std::future<AudioRecording>();
+	}
+
+	return result;
 }
 
 void AudioCapturer::start_streaming(const std::function<void(BYTE*, UINT32)> callback)
@@ -151,35 +353,84 @@ void AudioCapturer::start_streaming(const std::function<void(BYTE*, UINT32)> cal
 	if (running)
 		return;
 
-	HRESULT hr = audioClient->Start();
-	if (FAILED(hr))
-	{
-		printf("FAILED TO START AUDIOCLIENT: %x.\n", hr);
+	mode = CaptureMode::Streaming;
+	userCallback = callback;
+	start_stream();
+}
+
+void AudioCapturer::start_streaming_packets(const std::function<void(const float*, UINT32, DWORD)> callback)
+{
+	if (running)
 		return;
+
+	mode = CaptureMode::Packets;
+	packetCallback = callback;
+	start_stream();
+}
+
+bool AudioCapturer::start_retroactive(unsigned int seconds)
+{
+	if (running)
+		return false;
+
+	retroactive = std::make_unique<RetroactiveBuffer>(deviceFormat->nChannels, deviceFormat->nSamplesPerSec, seconds);
+	mode = CaptureMode::Retroactive;
+	if (!start_stream()) {
+		mode = CaptureMode::Streaming;
+		return false;
 	}
 
-	running = true;
-	userCallback = callback;
-	streamInfo = get_stream_info(audioClient);
+	return true;
+}
+
+AudioRecording AudioCapturer::snapshot_retroactive(unsigned int milliseconds) const
+{
+	if (retroactive == nullptr)
+		return AudioRecording();
 
-	streamingThread = std::thread([this]() {
-		auto latency = streamInfo.has_value() ? streamInfo.value().latency / 10000 : 0;
-		auto interval = (long)latency / 2;
+	return retroactive->snapshot(milliseconds);
+}
+
+void AudioCapturer::capture_loop()
+{
+	while (running) {
+		wait_for_buffer();
 
-		AudioRecording recordingData;
-		recordingData.channels = deviceFormat->nChannels;
-		recordingData.samplesPerSecond = deviceFormat->nSamplesPerSec;
+		if (mode == CaptureMode::Recording) {
+			capture_cycle([this](BYTE* buffData, UINT32 framesAvailable, DWORD flags) {
+				if (buffData == nullptr)
+					return;
 
-		while (running) {
-			Sleep(interval);
-  			capture_data([this](BYTE* buffData, UINT32 framesAvailable, DWORD flags) {
-				userCallback(buffData, framesAvailable);
+				float* bufferFloat = reinterpret_cast<float*>(buffData);
+
+				// Interleaved samples, whole frames only
+				auto channels = (size_t)deviceFormat->nChannels;
+				auto frames = (std::min)((size_t)framesAvailable, (recordingData.data.capacity() - recordingData.data.size()) / channels);
+				recordingData.data.insert(recordingData.data.end(), bufferFloat, bufferFloat + frames * channels);
+			});
+		}
+		else if (mode == CaptureMode::Retroactive) {
+			capture_cycle([this](BYTE* buffData, UINT32 framesAvailable, DWORD flags) {
+				retroactive->write(reinterpret_cast<const float*>(buffData), framesAvailable, deviceFormat->nChannels);
+			});
+		}
+		else if (mode == CaptureMode::Packets) {
+			capture_cycle([this](BYTE* buffData, UINT32 framesAvailable, DWORD flags) {
+				packetCallback(reinterpret_cast<const float*>(buffData), framesAvailable, flags);
 			});
 		}
+		else {
+			capture_cycle([this](BYTE* buffData, UINT32 framesAvailable, DWORD flags) {
+				if (buffData != nullptr)
+					userCallback(buffData, framesAvailable);
+			});
+		}
+	}
 
-		recordingData.durationMs = (recordingData.data.size() * 1000 / recordingData.samplesPerSecond);
-		return recordingData;
-	});
+	if (mode == CaptureMode::Recording) {
+		recordingData.durationMs = (unsigned long)(recordingData.data.size() / recordingData.channels * 1000 / recordingData.samplesPerSecond);
+		recordingPromise.set_value(std::move(recordingData));
+	}
 }
 
 void AudioCapturer::stop()
@@ -188,6 +439,7 @@ void AudioCapturer::stop()
 		return;
 
 	running = false;
+	metrics->running = false;
 
 	auto result = audioClient->Stop();
 	if (FAILED(result))
@@ -195,16 +447,22 @@ void AudioCapturer::stop()
 		printf("FAILED TO stop AudioCapturer: %x.\n", result);
 	}
 
-	if (streamingThread.has_value())
-		streamingThread.value().join();
+	// The stopped stream no longer signals the event: wake the capture thread so it can exit
+	if (streamRequest.bufferEvent != nullptr)
+		SetEvent(streamRequest.bufferEvent);
+
+	worker->wait_until_idle();
 }
 
-WAVEFORMATEX* AudioCapturer::get_working_format() const
+WAVEFORMATEX* AudioCapturer::get_working_format(AudioDevice& device, IAudioClient3* client)
 {
-	auto defaultFormat = device->get_device_format();
+	if (client == nullptr)
+		return nullptr;
+
+	auto defaultFormat = device.get_device_format();
 	WAVEFORMATEX* outFormat = nullptr;
 
-	auto result = audioClient->IsFormatSupported(AUDCLNT_SHAREMODE_SHARED, defaultFormat, &outFormat);
+	auto result = client->IsFormatSupported(AUDCLNT_SHAREMODE_SHARED, defaultFormat, &outFormat);
 	if (FAILED(result))
 	{
 		CoTaskMemFree(defaultFormat);
@@ -219,4 +477,129 @@ WAVEFORMATEX* AudioCapturer::get_working_format() const
 		outFormat = defaultFormat;
 	}
 	return outFormat;
-}
\ No newline at end of file
+}
+
+void AudioCapturer::follow_default_device(DeviceFactory openDefaultDevice)
+{
+	migrator = std::make_unique<StreamMigrator>(openDefaultDevice, [this](std::unique_ptr<AudioDevice> newDevice) {
+		return open_stream(std::move(newDevice));
+	});
+}
+
+void AudioCapturer::migrate_to_default_device()
+{
+	if (migrator != nullptr)
+		migrator->request_migration(activeDevice, false);
+}
+
+MigrationStats AudioCapturer::get_migration_stats() const
+{
+	return migrator != nullptr ? migrator->get_stats() : MigrationStats{};
+}
+
+const StreamCounters& AudioCapturer::get_metrics() const
+{
+	return *metrics;
+}
+
+void AudioCapturer::set_effects(std::shared_ptr<EffectChain> chain)
+{
+	if (running)
+		return;
+
+	effects = std::move(chain);
+}
+
+void AudioCapturer::update_stream_metrics()
+{
+	if (streamInfo.has_value())
+		metrics->set_stream(activeDevice, deviceFormat->nSamplesPerSec, streamInfo.value().bufferSizeInFrames, streamInfo.value().latency);
+}
+
+std::optional<PreparedStream> AudioCapturer::open_stream(std::unique_ptr<AudioDevice> newDevice) const
+{
+	PreparedStream stream;
+	stream.device = std::move(newDevice);
+	stream.audioClient = stream.device->get_audio_client();
+	if (stream.audioClient == nullptr)
+		return std::nullopt;
+
+	if (streamRequest.exclusive)
+		stream.format = find_exclusive_format(*stream.device, stream.audioClient);
+	else
+		stream.format = get_working_format(*stream.device, stream.audioClient);
+
+	if (stream.format == nullptr)
+		return std::nullopt;
+
+	if (auto error = initialize_client(*stream.device, &stream.audioClient, stream.format, &stream.captureClient, &stream.periodInFrames); error.has_value())
+		return std::nullopt;
+
+	auto info = get_stream_info(stream.audioClient);
+	if (!info.has_value())
+		return std::nullopt;
+
+	stream.info = info.value();
+	return stream;
+}
+
+void AudioCapturer::adopt_stream(PreparedStream& next)
+{
+	SafeRelease(&captureClient);
+	SafeRelease(&audioClient);
+	CoTaskMemFree(deviceFormat);
+
+	device = std::move(next.device);
+	activeDevice = device->get_handle();
+	audioClient = next.audioClient;
+	deviceFormat = next.format;
+	captureClient = next.captureClient;
+	streamInfo = next.info;
+	enginePeriodInFrames = next.periodInFrames;
+	prepare_conversion();
+
+	metrics->migrations++;
+	update_stream_metrics();
+
+	next.audioClient = nullptr;
+	next.format = nullptr;
+	next.captureClient = nullptr;
+}
+
+void AudioCapturer::switch_to_prepared_stream()
+{
+	TRACE_SCOPE("switch_to_prepared_stream");
+
+	// Swapping endpoints releases the old one and sizes the buffers for the new one: it allocates, once per device change
+	NonRealtimeScope exempt;
+
+	auto next = migrator->take_prepared_stream();
+	if (!next.has_value())
+		return;
+
+	auto previousChannels = deviceFormat->nChannels;
+	auto previousRate = deviceFormat->nSamplesPerSec;
+
+	// If the old endpoint is still alive it captured until now, otherwise until the last successful read
+	auto inputEnd = lastReadTime;
+	if (SUCCEEDED(audioClient->Stop()))
+		inputEnd = std::chrono::steady_clock::now();
+
+	adopt_stream(next.value());
+
+	auto result = audioClient->Start();
+	if (FAILED(result))
+	{
+		realtime_log(LogSite::CaptureStartAfterMigration, result);
+		migrator->request_migration(device->get_handle(), true);
+		return;
+	}
+
+	if (deviceFormat->nChannels != previousChannels || deviceFormat->nSamplesPerSec != previousRate)
+		realtime_log(LogSite::CaptureFormatChanged, S_OK, deviceFormat->nChannels, deviceFormat->nSamplesPerSec);
+
+	// The first packet on the new endpoint is available after one period
+	auto gap = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - inputEnd).count();
+	auto latencyMs = (double)streamInfo.value().latency / 10000.0;
+	migrator->record_migration(gap + latencyMs);
+}
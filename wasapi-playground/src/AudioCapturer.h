@@ -3,12 +3,19 @@
 #include <functional>
 #include <future>
 #include <optional>
+#include <vector>
 
 #include <MMDeviceAPI.h>
 #include <AudioClient.h>
 
 #include "common.h"
 #include "AudioDevice.h"
+#include "StreamMigration.h"
+#include "StreamInitialization.h"
+#include "StreamMetrics.h"
+#include "AudioWorker.h"
+#include "RetroactiveBuffer.h"
+#include "EffectChain.h"
 
 class AudioCapturer {
 public:
@@ -17,24 +24,114 @@ public:
 	~AudioCapturer();
 
 	std::optional<HRESULT> initialize(unsigned int bufferTimeSizeMs);
+
+	// Runs the shared-mode engine at the smallest period it supports, or at the requested one rounded up to a
+	// multiple of the fundamental period. The stream becomes event-driven. Falls back to the default period.
+	std::optional<HRESULT> initialize_low_latency(unsigned int periodInFrames = 0);
+
+	// Initializes with the format and period negotiated for the device, see StreamNegotiation.h
+	std::optional<HRESULT> initialize_negotiated(const NegotiationPolicy& policy = NegotiationPolicy());
+
+	// Opens the endpoint in exclusive mode, in the first native format it accepts, see find_exclusive_format().
+	// Event-driven, with one period of bufferTimeSizeMs per buffer (0 for the device minimum period).
+	// Integer formats are converted, the callbacks keep exchanging float samples.
+	std::optional<HRESULT> initialize_exclusive(unsigned int bufferTimeSizeMs = 0);
+
+	// Period of a low-latency or exclusive stream, 0 if it runs at the default engine period
+	UINT32 get_engine_period() const;
+
+	// Format of the endpoint buffers. The callbacks get float samples with the same rate and channels.
+	const WAVEFORMATEX* get_format() const;
+
+	// Both run on the capture thread, which is created with the capturer and reused across start and stop.
+	// The recording is available once stop() returns.
 	std::future<AudioRecording> start_recording();
 	void start_streaming(const std::function<void(BYTE*, UINT32)> callback);
 
+	// Streaming that sees every packet: samples is nullptr for a silent one, which still counts its frames, and
+	// flags are those of the packet, AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY when frames were lost before it.
+	// The samples are float whatever the endpoint format, converted as described by get_format().
+	void start_streaming_packets(const std::function<void(const float*, UINT32, DWORD)> callback);
+
+	// Captures continuously into a circular buffer holding the last seconds of the stream, allocated here:
+	// memory stays bounded however long the stream runs. Silent packets are kept as silence.
+	bool start_retroactive(unsigned int seconds);
+
+	// Any thread, while the stream runs or after it stopped: the last milliseconds captured by
+	// start_retroactive(), 0 for the whole buffer. The capture thread neither waits nor copies for it.
+	// Must not overlap with start_retroactive().
+	AudioRecording snapshot_retroactive(unsigned int milliseconds = 0) const;
+
 	void stop();
+
+	// Follow default device mode: when the endpoint is lost or migrate_to_default_device() is called,
+	// the endpoint returned by the factory is opened in the background and capture continues there.
+	void follow_default_device(DeviceFactory openDefaultDevice);
+	void migrate_to_default_device();
+	MigrationStats get_migration_stats() const;
+
+	// Counters of this stream, also exported by MetricsExporter
+	const StreamCounters& get_metrics() const;
+
+	// Runs the chain on the capture thread before any reader sees the packets. Silent packets go through it
+	// as zeros, so that the tails ring out, and reach the readers as data. nullptr for none. Takes effect at
+	// the next start, which clears the tails of the previous run.
+	void set_effects(std::shared_ptr<EffectChain> chain);
 	
 private:
-	void capture_data(const std::function<void(BYTE*, UINT32, DWORD)> dataReader);
-	WAVEFORMATEX* get_working_format() const;
+	bool start_stream();
+	void capture_loop();
+	// Reader: void(BYTE* data, UINT32 frames, DWORD flags), data is nullptr for a silent packet.
+	// A template, so that passing a lambda never allocates.
+	template<typename Reader>
+	HRESULT capture_data(Reader&& dataReader);
+	template<typename Reader>
+	HRESULT capture_cycle(Reader&& dataReader);
+	void switch_to_prepared_stream();
+	void adopt_stream(PreparedStream& next);
+	std::optional<PreparedStream> open_stream(std::unique_ptr<AudioDevice> newDevice) const;
+
+	static WAVEFORMATEX* get_working_format(AudioDevice& device, IAudioClient3* client);
+	std::optional<HRESULT> initialize_client(AudioDevice& endpoint, IAudioClient3** client, WAVEFORMATEX* format, IAudioCaptureClient** captureClient, UINT32* periodInFrames) const;
+	void prepare_conversion();
+	void wait_for_buffer();
+	void update_stream_metrics();
 
 	std::unique_ptr<AudioDevice> device;
 	IAudioClient3* audioClient;
 	WAVEFORMATEX* deviceFormat;
 	IAudioCaptureClient* captureClient;
 	std::optional<AudioStreamInfo> streamInfo;
+	StreamRequest streamRequest;
+	UINT32 enginePeriodInFrames;
+
+	// Sample format of the endpoint, and scratch space to convert it from/to float
+	StreamFormat sampleFormat;
+	std::vector<float> conversionBuffer;
 
 	std::function<void(BYTE*, UINT32)> userCallback;
-	std::optional<std::thread> streamingThread;
-	std::future<AudioRecording> recordingFuture;
+	std::function<void(const float*, UINT32, DWORD)> packetCallback;
 	std::atomic_bool running;
+	std::shared_ptr<EffectChain> effects;
+
+	enum class CaptureMode {
+		Streaming,
+		Packets,
+		Recording,
+		Retroactive
+	};
+
+	// Only written while the capture thread is idle
+	CaptureMode mode;
+	AudioRecording recordingData;
+	std::promise<AudioRecording> recordingPromise;
+	std::unique_ptr<RetroactiveBuffer> retroactive;
+
+	std::unique_ptr<StreamMigrator> migrator;
+	std::atomic<DeviceHandle> activeDevice;
+	std::shared_ptr<StreamCounters> metrics;
+	std::chrono::steady_clock::time_point lastReadTime;
+
+	std::unique_ptr<AudioWorker> worker;
 };
 
@@ -1,10 +1,48 @@
 #include "AudioDevice.h"
 
+#include <array>
 #include <functiondiscoverykeys.h>
 
 namespace {
     const std::string UNAVAILABLE = "*unabailable*";
     const REFERENCE_TIME PERIOD_TIME = 480 * 10000; // 1 unit = 100-nanosecond
+    const std::array<unsigned int, 4> PROBED_SAMPLE_RATES = { 44100, 48000, 88200, 96000 };
+
+    // Sample formats tried on top of the mix format: 32-bit float, 16-bit and 24-in-32-bit integer
+    std::vector<StreamFormat> get_probed_formats(const StreamFormat& mixFormat) {
+        std::vector<StreamFormat> formats;
+        for (auto sampleRate : PROBED_SAMPLE_RATES) {
+            StreamFormat format = mixFormat;
+            format.sampleRate = sampleRate;
+
+            format.isFloat = true;
+            format.bitsPerSample = format.validBitsPerSample = 32;
+            formats.push_back(format);
+
+            format.isFloat = false;
+            format.bitsPerSample = format.validBitsPerSample = 16;
+            formats.push_back(format);
+
+            format.bitsPerSample = 32;
+            format.validBitsPerSample = 24;
+            formats.push_back(format);
+        }
+        return formats;
+    }
+
+    std::optional<EnginePeriodLimits> get_engine_period_limits(IAudioClient3* audioClient, const WAVEFORMATEX* format) {
+        EnginePeriodLimits limits;
+        auto result = audioClient->GetSharedModeEnginePeriod(
+            format,
+            &limits.defaultPeriodInFrames,
+            &limits.fundamentalPeriodInFrames,
+            &limits.minPeriodInFrames,
+            &limits.maxPeriodInFrames);
+
+        if (FAILED(result))
+            return std::nullopt;
+        return limits;
+    }
 
     AudioDeviceSummary get_summary_from_device(IMMDevice* device) {
 
@@ -18,8 +56,9 @@ namespace {
             summary.id = UNAVAILABLE;
         }
         else {
-            std::wstring w_id(deviceId);
-            summary.id = std::string(w_id.begin(), w_id.end());
+            auto& idTable = DeviceIdTable::instance();
+            summary.handle = idTable.intern(deviceId);
+            summary.id = idTable.get_id(summary.handle);
             CoTaskMemFree(deviceId);
         }
 
@@ -40,8 +79,7 @@ namespace {
                 summary.friendlyName = UNAVAILABLE;
             }
             else {
-                std::wstring w_name(friendlyName.pwszVal);
-                summary.friendlyName = friendlyName.vt != VT_LPWSTR ? "Unknown" : std::string(w_name.begin(), w_name.end());
+                summary.friendlyName = friendlyName.vt != VT_LPWSTR ? "Unknown" : LPCWSTR_to_string(friendlyName.pwszVal);
             }
 
             PropVariantClear(&friendlyName);
@@ -208,16 +246,32 @@ namespace {
             NULL,
             reinterpret_cast<void**>(&volumeEndpoint));
 
-        if (FAILED(result))
+        // Endpoints without a volume control, such as SimulatedDevice, don't implement the interface
+        if (FAILED(result) && result != E_NOINTERFACE)
         {
             printf("Unable to activate IAudioEndpointVolume: %x.\n", result);
         }
         return volumeEndpoint;
     }
+
+    DeviceHandle get_device_handle(IMMDevice* devicePointer) {
+        LPWSTR deviceId;
+        auto hr = devicePointer->GetId(&deviceId);
+        if (FAILED(hr))
+        {
+            printf("Unable to get device id: %x\n", hr);
+            return INVALID_DEVICE_HANDLE;
+        }
+
+        auto handle = DeviceIdTable::instance().intern(deviceId);
+        CoTaskMemFree(deviceId);
+        return handle;
+    }
 }
 
 AudioDevice::AudioDevice(IMMDevice* devicePointer) 
     : device(devicePointer)
+    , handle(get_device_handle(devicePointer))
     , audioEndpoint(get_audio_endpoint(devicePointer)) 
 {
     if (audioEndpoint != nullptr) {
@@ -235,6 +289,11 @@ AudioDevice::~AudioDevice()
     SafeRelease(&audioEndpoint);
 }
 
+DeviceHandle AudioDevice::get_handle() const
+{
+    return handle;
+}
+
 AudioDeviceSummary AudioDevice::get_summary() const
 {
     return get_summary_from_device(device);
@@ -264,7 +323,8 @@ VolumeInfo AudioDevice::get_volume() const
 
     if (FAILED(result))
     {
-        printf("Unable to activate IAudioEndpointVolume: %x.\n", result);
+        if (result != E_NOINTERFACE)
+            printf("Unable to activate IAudioEndpointVolume: %x.\n", result);
     }
     else 
     {
@@ -299,6 +359,7 @@ WAVEFORMATEX* AudioDevice::get_device_format() const
     if (audioClient != nullptr) {
         WAVEFORMATEX* deviceFormat = nullptr;
         auto result = audioClient->GetMixFormat(&deviceFormat);
+        SafeRelease(&audioClient);
         if (FAILED(result)) {
             printf("[AudioDevice.get_device_format()] Unable to get mix format: %x.\n", result);
             return nullptr;
@@ -312,11 +373,34 @@ WAVEFORMATEX* AudioDevice::get_device_format() const
 WAVEFORMATEXTENSIBLE* AudioDevice::get_device_format_extended() const
 {
     auto deviceFormat = get_device_format();
-    if (deviceFormat->cbSize >= 22 && deviceFormat->wFormatTag == WAVE_FORMAT_EXTENSIBLE)
+    if (deviceFormat != nullptr && deviceFormat->cbSize >= 22 && deviceFormat->wFormatTag == WAVE_FORMAT_EXTENSIBLE)
         return reinterpret_cast<WAVEFORMATEXTENSIBLE*>(deviceFormat);
+
+    CoTaskMemFree(deviceFormat);
     return nullptr;
 }
 
+std::optional<StreamFormat> AudioDevice::get_native_format() const
+{
+    IPropertyStore* propertyStore = nullptr;
+    auto result = device->OpenPropertyStore(STGM_READ, &propertyStore);
+    if (FAILED(result)) {
+        printf("[AudioDevice.get_native_format()] Unable to open device property store: %x\n", result);
+        return std::nullopt;
+    }
+
+    std::optional<StreamFormat> nativeFormat;
+    PROPVARIANT value;
+    PropVariantInit(&value);
+    result = propertyStore->GetValue(PKEY_AudioEngine_DeviceFormat, &value);
+    if (SUCCEEDED(result) && value.vt == VT_BLOB && value.blob.cbSize >= sizeof(WAVEFORMATEX))
+        nativeFormat = to_stream_format(reinterpret_cast<const WAVEFORMATEX*>(value.blob.pBlobData));
+
+    PropVariantClear(&value);
+    SafeRelease(&propertyStore);
+    return nativeFormat;
+}
+
 IAudioClient3* AudioDevice::get_audio_client() const
 {
     IAudioClient3* client = nullptr;
@@ -326,3 +410,57 @@ IAudioClient3* AudioDevice::get_audio_client() const
 
     return client;
 }
+
+
+DeviceCapabilities AudioDevice::get_capabilities() const
+{
+    DeviceCapabilities capabilities;
+    auto audioClient = get_audio_client();
+    if (audioClient == nullptr)
+        return capabilities;
+
+    WAVEFORMATEX* mixFormat = nullptr;
+    auto result = audioClient->GetMixFormat(&mixFormat);
+    if (FAILED(result)) {
+        printf("[AudioDevice.get_capabilities()] Unable to get mix format: %x.\n", result);
+        SafeRelease(&audioClient);
+        return capabilities;
+    }
+
+    auto mixStreamFormat = to_stream_format(mixFormat);
+    capabilities.supportedFormats.push_back({ mixStreamFormat, true, get_engine_period_limits(audioClient, mixFormat) });
+
+    REFERENCE_TIME defaultPeriod = 0;
+    if (SUCCEEDED(audioClient->GetDevicePeriod(&defaultPeriod, nullptr)))
+        capabilities.legacyPeriodInFrames = (unsigned int)(defaultPeriod * mixFormat->nSamplesPerSec / 10000000);
+
+    for (const auto& candidate : get_probed_formats(mixStreamFormat)) {
+        if (candidate == mixStreamFormat)
+            continue;
+
+        auto format = make_wave_format(candidate);
+        WAVEFORMATEX* closestMatch = nullptr;
+        result = audioClient->IsFormatSupported(AUDCLNT_SHAREMODE_SHARED, &format.Format, &closestMatch);
+        CoTaskMemFree(closestMatch);
+
+        if (result == S_OK)
+            capabilities.supportedFormats.push_back({ candidate, false, get_engine_period_limits(audioClient, &format.Format) });
+    }
+
+    CoTaskMemFree(mixFormat);
+    SafeRelease(&audioClient);
+    return capabilities;
+}
+
+std::optional<StreamConfiguration> AudioDevice::get_stream_configuration(const NegotiationPolicy& policy) const
+{
+    auto& cache = NegotiationCache::instance();
+    if (auto cached = cache.find(handle, policy); cached.has_value())
+        return cached;
+
+    auto configuration = negotiate_stream_configuration(get_capabilities(), policy);
+    if (configuration.has_value() && handle != INVALID_DEVICE_HANDLE)
+        cache.store(handle, policy, configuration.value());
+
+    return configuration;
+}
\ No newline at end of file
@@ -9,13 +9,16 @@
 #include <DeviceTopology.h>
 
 #include "VolumeNotificationProvider.h"
+#include "DeviceIdTable.h"
+#include "StreamNegotiation.h"
 #include "common.h"
 
 struct AudioDeviceSummary {
+    DeviceHandle handle = INVALID_DEVICE_HANDLE;
     std::string id;
     std::string friendlyName;
     EDataFlow direction;
-    ConnectorType type;
+    ConnectorType type = Unknown_Connector;
 };
 
 struct AudioInfo1 {
@@ -55,6 +58,7 @@ public:
     AudioDevice(const AudioDevice& other) = delete;
     ~AudioDevice();
 
+	DeviceHandle get_handle() const;
 	AudioDeviceSummary get_summary() const;
 	AudioDeviceDetails get_info() const;
     VolumeInfo get_volume() const;
@@ -66,8 +70,18 @@ public:
     WAVEFORMATEX* get_device_format() const;
     WAVEFORMATEXTENSIBLE* get_device_format_extended() const;
 
+    // Format the endpoint was configured to run at in the sound control panel (PKEY_AudioEngine_DeviceFormat)
+    std::optional<StreamFormat> get_native_format() const;
+
+    // Probes the shared-mode formats and engine periods the endpoint accepts
+    DeviceCapabilities get_capabilities() const;
+
+    // Negotiated once per device and policy, then served from NegotiationCache
+    std::optional<StreamConfiguration> get_stream_configuration(const NegotiationPolicy& policy) const;
+
 private:
 	IMMDevice* device;
+    DeviceHandle handle;
     IAudioEndpointVolume* audioEndpoint;
     VolumeNotificationProvider volumeNotifications;
 };
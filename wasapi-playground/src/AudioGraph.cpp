@@ -0,0 +1,480 @@
+#include "AudioGraph.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace {
+    // Schedules the audio thread can hand back before the control side frees them
+    const size_t retiredCapacity = 16;
+}
+
+void mix_node_inputs(const AudioNodeInputs& inputs, float* output, UINT32 frames, WORD channels)
+{
+    std::fill(output, output + (size_t)frames * channels, 0.0f);
+    for (size_t i = 0; i < inputs.count; i++) {
+        const float* input = inputs.blocks[i];
+        auto inputChannels = inputs.channels[i];
+
+        if (inputChannels == channels) {
+            for (size_t sample = 0; sample < (size_t)frames * channels; sample++)
+                output[sample] += input[sample];
+        }
+        else if (inputChannels == 1) {
+            for (UINT32 frame = 0; frame < frames; frame++)
+                for (WORD channel = 0; channel < channels; channel++)
+                    output[(size_t)frame * channels + channel] += input[frame];
+        }
+        else {
+            auto shared = (std::min)(inputChannels, channels);
+            for (UINT32 frame = 0; frame < frames; frame++)
+                for (WORD channel = 0; channel < shared; channel++)
+                    output[(size_t)frame * channels + channel] += input[(size_t)frame * inputChannels + channel];
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------
+
+SourceNode::SourceNode(WORD channels, Render render, const char* name) :
+    channels(channels),
+    render(render),
+    name(name)
+{
+}
+
+const char* SourceNode::get_name() const
+{
+    return name;
+}
+
+WORD SourceNode::get_channels() const
+{
+    return channels;
+}
+
+void SourceNode::process(const AudioNodeInputs& inputs, float* output, UINT32 frames)
+{
+    render(output, frames, channels);
+}
+
+EffectNode::EffectNode(WORD channels, std::shared_ptr<EffectChain> chain, const char* name) :
+    channels(channels),
+    chain(std::move(chain)),
+    name(name)
+{
+}
+
+const char* EffectNode::get_name() const
+{
+    return name;
+}
+
+WORD EffectNode::get_channels() const
+{
+    return channels;
+}
+
+void EffectNode::prepare(DWORD sampleRate, UINT32 maxFrames)
+{
+    chain->prepare(sampleRate, channels);
+}
+
+void EffectNode::process(const AudioNodeInputs& inputs, float* output, UINT32 frames)
+{
+    mix_node_inputs(inputs, output, frames, channels);
+    chain->process(output, frames);
+}
+
+EffectChain& EffectNode::get_chain()
+{
+    return *chain;
+}
+
+MixNode::MixNode(WORD channels, float gain, const char* name) :
+    channels(channels),
+    targetGain(gain),
+    gain(gain),
+    name(name)
+{
+}
+
+const char* MixNode::get_name() const
+{
+    return name;
+}
+
+WORD MixNode::get_channels() const
+{
+    return channels;
+}
+
+void MixNode::process(const AudioNodeInputs& inputs, float* output, UINT32 frames)
+{
+    mix_node_inputs(inputs, output, frames, channels);
+
+    auto target = targetGain.load(std::memory_order_relaxed);
+    auto step = frames != 0 ? (target - gain) / frames : 0.0f;
+    for (UINT32 frame = 0; frame < frames; frame++) {
+        auto frameGain = gain + step * frame;
+        for (WORD channel = 0; channel < channels; channel++)
+            output[(size_t)frame * channels + channel] *= frameGain;
+    }
+    gain = target;
+}
+
+void MixNode::set_gain(float value)
+{
+    targetGain.store(value, std::memory_order_relaxed);
+}
+
+SinkNode::SinkNode(WORD channels, Consume consume, const char* name) :
+    channels(channels),
+    consume(consume),
+    name(name)
+{
+}
+
+const char* SinkNode::get_name() const
+{
+    return name;
+}
+
+WORD SinkNode::get_channels() const
+{
+    return channels;
+}
+
+void SinkNode::process(const AudioNodeInputs& inputs, float* output, UINT32 frames)
+{
+    mix_node_inputs(inputs, output, frames, channels);
+    consume(output, frames, channels);
+}
+
+// ---------------------------------------------------------------------------------------------------------------
+
+struct AudioGraph::Schedule {
+    struct Task {
+        std::shared_ptr<AudioNode> node;
+        std::shared_ptr<BlockCost> cost;
+        WORD channels = 0;
+        std::vector<float> block;
+
+        std::vector<const float*> inputBlocks;
+        std::vector<WORD> inputChannels;
+        std::vector<size_t> dependents;
+        size_t dependencies = 0;
+        std::atomic<size_t> remaining{ 0 };
+    };
+
+    // In topological order
+    std::vector<std::unique_ptr<Task>> tasks;
+    std::vector<size_t> ready;
+    size_t output = 0;
+
+    // Of the period in progress
+    UINT32 frames = 0;
+    WorkStealingPool::Executor executor;
+};
+
+AudioGraph::AudioGraph(const AudioGraphConfig& config) :
+    config(config),
+    nextId(1),
+    outputId(0),
+    outputChannels(0),
+    pending(nullptr),
+    retired(retiredCapacity),
+    current(nullptr),
+    pool(config.workers, config.maxNodes),
+    periods(0),
+    swaps(0),
+    renderedFrames(0),
+    periodNs(0),
+    nodeNs(0)
+{
+}
+
+AudioGraph::~AudioGraph()
+{
+    collect_retired();
+    delete pending.exchange(nullptr);
+    delete current;
+}
+
+UINT64 AudioGraph::add_node(std::shared_ptr<AudioNode> node)
+{
+    std::lock_guard lock(controlMutex);
+    if (node == nullptr || nodes.size() >= config.maxNodes)
+        return 0;
+
+    auto id = nextId++;
+    nodes[id] = Node{ std::move(node), std::make_shared<BlockCost>() };
+    return id;
+}
+
+bool AudioGraph::remove_node(UINT64 id)
+{
+    std::lock_guard lock(controlMutex);
+    if (nodes.erase(id) == 0)
+        return false;
+
+    for (auto& [_, node] : nodes)
+        node.inputs.erase(std::remove(node.inputs.begin(), node.inputs.end(), id), node.inputs.end());
+    if (outputId == id)
+        outputId = 0;
+    return true;
+}
+
+bool AudioGraph::reaches(UINT64 from, UINT64 to) const
+{
+    // Walks the inputs upstream from to
+    std::vector<UINT64> stack{ to };
+    std::vector<UINT64> visited;
+    while (!stack.empty()) {
+        auto id = stack.back();
+        stack.pop_back();
+        if (id == from)
+            return true;
+        if (std::find(visited.begin(), visited.end(), id) != visited.end())
+            continue;
+
+        visited.push_back(id);
+        const auto& inputs = nodes.at(id).inputs;
+        stack.insert(stack.end(), inputs.begin(), inputs.end());
+    }
+    return false;
+}
+
+bool AudioGraph::connect(UINT64 from, UINT64 to)
+{
+    std::lock_guard lock(controlMutex);
+    if (from == to || nodes.count(from) == 0 || nodes.count(to) == 0)
+        return false;
+
+    auto& inputs = nodes.at(to).inputs;
+    if (std::find(inputs.begin(), inputs.end(), from) != inputs.end())
+        return true;
+
+    // from must not already depend on to
+    if (reaches(to, from))
+        return false;
+
+    inputs.push_back(from);
+    return true;
+}
+
+bool AudioGraph::disconnect(UINT64 from, UINT64 to)
+{
+    std::lock_guard lock(controlMutex);
+    if (nodes.count(to) == 0)
+        return false;
+
+    auto& inputs = nodes.at(to).inputs;
+    auto found = std::find(inputs.begin(), inputs.end(), from);
+    if (found == inputs.end())
+        return false;
+
+    inputs.erase(found);
+    return true;
+}
+
+bool AudioGraph::set_output(UINT64 id)
+{
+    std::lock_guard lock(controlMutex);
+    if (nodes.count(id) == 0)
+        return false;
+
+    outputId = id;
+    return true;
+}
+
+std::optional<HRESULT> AudioGraph::commit()
+{
+    std::lock_guard lock(controlMutex);
+    collect_retired();
+
+    if (outputId == 0) {
+        printf("[AudioGraph] No output node\n");
+        return E_INVALIDARG;
+    }
+
+    // Kahn's algorithm: a node is placed once all its inputs are
+    std::map<UINT64, size_t> waiting;
+    std::map<UINT64, std::vector<UINT64>> outputs;
+    std::vector<UINT64> order;
+    for (const auto& [id, node] : nodes) {
+        waiting[id] = node.inputs.size();
+        for (auto input : node.inputs)
+            outputs[input].push_back(id);
+        if (node.inputs.empty())
+            order.push_back(id);
+    }
+    for (size_t i = 0; i < order.size(); i++) {
+        for (auto next : outputs[order[i]]) {
+            if (--waiting[next] == 0)
+                order.push_back(next);
+        }
+    }
+
+    auto schedule = std::make_unique<Schedule>();
+    std::map<UINT64, size_t> taskIndex;
+    for (auto id : order) {
+        auto& node = nodes.at(id);
+        if (!node.prepared) {
+            node.node->prepare(config.sampleRate, config.maxFrames);
+            node.prepared = true;
+        }
+
+        auto task = std::make_unique<Schedule::Task>();
+        task->node = node.node;
+        task->cost = node.cost;
+        task->channels = node.node->get_channels();
+        task->block.assign((size_t)config.maxFrames * task->channels, 0.0f);
+        task->dependencies = node.inputs.size();
+
+        taskIndex[id] = schedule->tasks.size();
+        for (auto input : node.inputs) {
+            auto& source = *schedule->tasks[taskIndex.at(input)];
+            source.dependents.push_back(schedule->tasks.size());
+            task->inputBlocks.push_back(source.block.data());
+            task->inputChannels.push_back(source.channels);
+        }
+        if (task->dependencies == 0)
+            schedule->ready.push_back(schedule->tasks.size());
+
+        schedule->tasks.push_back(std::move(task));
+    }
+    schedule->output = taskIndex.at(outputId);
+    outputChannels = schedule->tasks[schedule->output]->channels;
+
+    auto compiled = schedule.get();
+    schedule->executor = [this, compiled](size_t index, unsigned int lane) {
+        auto& task = *compiled->tasks[index];
+        auto start = std::chrono::steady_clock::now();
+
+        AudioNodeInputs inputs;
+        inputs.blocks = task.inputBlocks.data();
+        inputs.channels = task.inputChannels.data();
+        inputs.count = task.inputBlocks.size();
+        task.node->process(inputs, task.block.data(), compiled->frames);
+
+        auto elapsedNs = (UINT64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        task.cost->add(compiled->frames, elapsedNs);
+        nodeNs.fetch_add(elapsedNs, std::memory_order_relaxed);
+
+        for (auto dependent : task.dependents) {
+            if (compiled->tasks[dependent]->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                pool.push(lane, dependent);
+        }
+    };
+
+    // A schedule the audio thread did not take yet was never used
+    delete pending.exchange(schedule.release(), std::memory_order_acq_rel);
+    return std::nullopt;
+}
+
+void AudioGraph::collect_retired()
+{
+    Schedule* schedule = nullptr;
+    while (retired.pop(schedule))
+        delete schedule;
+}
+
+WORD AudioGraph::get_output_channels()
+{
+    std::lock_guard lock(controlMutex);
+    return outputChannels;
+}
+
+AudioGraphStats AudioGraph::get_stats()
+{
+    std::lock_guard lock(controlMutex);
+    collect_retired();
+
+    AudioGraphStats stats;
+    for (const auto& [id, node] : nodes) {
+        AudioNodeStats nodeStats;
+        nodeStats.id = id;
+        nodeStats.name = node.node->get_name();
+        nodeStats.frames = node.cost->get_frames();
+        nodeStats.nsPerFrame = node.cost->get_ns_per_frame();
+        nodeStats.maxBlockMs = node.cost->get_max_block_ms();
+        stats.nodes.push_back(nodeStats);
+    }
+
+    stats.periods = periods.load(std::memory_order_relaxed);
+    stats.swaps = swaps.load(std::memory_order_relaxed);
+    auto frames = renderedFrames.load(std::memory_order_relaxed);
+    auto wallNs = periodNs.load(std::memory_order_relaxed);
+    stats.nsPerFrame = frames != 0 ? (double)wallNs / frames : 0;
+    stats.parallelism = wallNs != 0 ? (double)nodeNs.load(std::memory_order_relaxed) / wallNs : 0;
+    stats.pool = pool.get_stats();
+    return stats;
+}
+
+void AudioGraph::render_block(Schedule& schedule, UINT32 frames)
+{
+    schedule.frames = frames;
+    for (auto& task : schedule.tasks)
+        task->remaining.store(task->dependencies, std::memory_order_relaxed);
+
+    pool.run(schedule.ready.data(), schedule.ready.size(), schedule.tasks.size(), schedule.executor);
+}
+
+void AudioGraph::render(float* samples, UINT32 frames, WORD channels)
+{
+    TRACE_SCOPE("audio graph");
+    auto start = std::chrono::steady_clock::now();
+
+    // The swap needs room to hand the old schedule back, otherwise it waits for the next period
+    if (retired.size() < retired.capacity()) {
+        if (auto next = pending.exchange(nullptr, std::memory_order_acq_rel); next != nullptr) {
+            if (current != nullptr)
+                retired.push(current);
+            current = next;
+            swaps.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    if (current == nullptr) {
+        std::fill(samples, samples + (size_t)frames * channels, 0.0f);
+        return;
+    }
+
+    const auto& output = *current->tasks[current->output];
+    auto copied = (std::min)(channels, output.channels);
+    for (UINT32 done = 0; done < frames;) {
+        auto count = (std::min)(frames - done, config.maxFrames);
+        render_block(*current, count);
+
+        for (UINT32 frame = 0; frame < count; frame++) {
+            float* destination = samples + (size_t)(done + frame) * channels;
+            const float* source = output.block.data() + (size_t)frame * output.channels;
+            std::copy(source, source + copied, destination);
+            std::fill(destination + copied, destination + channels, 0.0f);
+        }
+        done += count;
+    }
+
+    periods.fetch_add(1, std::memory_order_relaxed);
+    renderedFrames.fetch_add(frames, std::memory_order_relaxed);
+    periodNs.fetch_add((UINT64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+}
+
+AudioRecording AudioGraph::render_offline(UINT64 frames, UINT32 blockFrames)
+{
+    AudioRecording recording;
+    recording.channels = get_output_channels();
+    recording.samplesPerSecond = config.sampleRate;
+    recording.durationMs = (unsigned long)(frames * 1000 / config.sampleRate);
+    recording.data.resize((size_t)frames * recording.channels);
+    if (recording.channels == 0)
+        return recording;
+
+    blockFrames = (std::max)(blockFrames, 1u);
+    for (UINT64 done = 0; done < frames; done += blockFrames) {
+        auto count = (UINT32)(std::min)((UINT64)blockFrames, frames - done);
+        render(recording.data.data() + (size_t)done * recording.channels, count, recording.channels);
+    }
+    return recording;
+}
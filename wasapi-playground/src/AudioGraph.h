@@ -0,0 +1,220 @@
+#pragma once
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <optional>
+
+#include <windows.h>
+
+#include "EffectChain.h"
+#include "BlockCost.h"
+#include "SpscRing.h"
+#include "WorkStealingPool.h"
+#include "common.h"
+
+// The blocks of the nodes connected to a node, in the order they were connected
+struct AudioNodeInputs {
+	const float* const* blocks = nullptr;		// interleaved, blocks[i] has channels[i] samples per frame
+	const WORD* channels = nullptr;
+	size_t count = 0;
+};
+
+// Sums every input into output, frames of channels: an input with as many channels is added as it is, a mono
+// one on every channel, any other on the channels both have
+void mix_node_inputs(const AudioNodeInputs& inputs, float* output, UINT32 frames, WORD channels);
+
+// A step of an AudioGraph. process() runs on one of the graph's audio threads, never on two at once, and
+// must not allocate, lock or wait; prepare() runs on the thread committing the graph, before the node is used.
+class AudioNode
+{
+public:
+	virtual ~AudioNode() = default;
+
+	virtual const char* get_name() const = 0;
+	// Channels of the block the node renders, fixed for its lifetime
+	virtual WORD get_channels() const = 0;
+
+	virtual void prepare(DWORD sampleRate, UINT32 maxFrames) {}
+
+	// Writes frames of get_channels() to output, which is the node's own block and holds anything beforehand
+	virtual void process(const AudioNodeInputs& inputs, float* output, UINT32 frames) = 0;
+};
+
+// Renders a block from a callback, the inputs are ignored
+class SourceNode : public AudioNode
+{
+public:
+	typedef std::function<void(float* samples, UINT32 frames, WORD channels)> Render;
+
+	SourceNode(WORD channels, Render render, const char* name = "source");
+
+	const char* get_name() const override;
+	WORD get_channels() const override;
+	void process(const AudioNodeInputs& inputs, float* output, UINT32 frames) override;
+
+private:
+	const WORD channels;
+	Render render;
+	const char* name;
+};
+
+// Runs an effect chain on the sum of its inputs. The chain is prepared for the node's channels, its parameters
+// are changed and scheduled through the chain itself.
+class EffectNode : public AudioNode
+{
+public:
+	EffectNode(WORD channels, std::shared_ptr<EffectChain> chain, const char* name = "effects");
+
+	const char* get_name() const override;
+	WORD get_channels() const override;
+	void prepare(DWORD sampleRate, UINT32 maxFrames) override;
+	void process(const AudioNodeInputs& inputs, float* output, UINT32 frames) override;
+
+	EffectChain& get_chain();
+
+private:
+	const WORD channels;
+	std::shared_ptr<EffectChain> chain;
+	const char* name;
+};
+
+// Sums its inputs, with a gain that can be changed from any thread and is ramped over a block
+class MixNode : public AudioNode
+{
+public:
+	MixNode(WORD channels, float gain = 1.0f, const char* name = "mix");
+
+	const char* get_name() const override;
+	WORD get_channels() const override;
+	void process(const AudioNodeInputs& inputs, float* output, UINT32 frames) override;
+
+	void set_gain(float gain);
+
+private:
+	const WORD channels;
+	std::atomic<float> targetGain;
+	float gain;
+	const char* name;
+};
+
+// Hands the sum of its inputs to a callback, such as a meter or a recorder, and passes it on
+class SinkNode : public AudioNode
+{
+public:
+	typedef std::function<void(const float* samples, UINT32 frames, WORD channels)> Consume;
+
+	SinkNode(WORD channels, Consume consume, const char* name = "sink");
+
+	const char* get_name() const override;
+	WORD get_channels() const override;
+	void process(const AudioNodeInputs& inputs, float* output, UINT32 frames) override;
+
+private:
+	const WORD channels;
+	Consume consume;
+	const char* name;
+};
+
+struct AudioGraphConfig {
+	DWORD sampleRate = 48000;
+	UINT32 maxFrames = 4096;					// frames rendered at once, longer renders are split
+	size_t maxNodes = 256;
+	unsigned int workers = WorkStealingPool::default_workers();
+};
+
+struct AudioNodeStats {
+	UINT64 id = 0;
+	const char* name = nullptr;
+	UINT64 frames = 0;
+	double nsPerFrame = 0;
+	double maxBlockMs = 0;
+};
+
+struct AudioGraphStats {
+	std::vector<AudioNodeStats> nodes;
+	UINT64 periods = 0;
+	UINT64 swaps = 0;							// compiled graphs taken over by the audio thread
+	double nsPerFrame = 0;						// wall time of a period, per frame
+	double parallelism = 0;						// time spent in the nodes over the wall time of the periods
+	WorkStealingStats pool;
+};
+
+// Processing graph: sources, effects, mixes and sinks connected into a directed acyclic graph, compiled into a
+// schedule in topological order. Each period, the nodes whose inputs are ready run in parallel on a
+// work-stealing pool of audio threads, the thread calling render() being one of them, so that independent
+// branches use several cores.
+// Edits are made on a description from any thread, and commit() compiles it into a new schedule that the audio
+// thread takes over atomically at the start of its next period; the old one is freed on the control side.
+// Nodes keep their state from one schedule to the next.
+class AudioGraph
+{
+public:
+	AudioGraph(const AudioGraphConfig& config = AudioGraphConfig());
+	AudioGraph(const AudioGraph& other) = delete;
+	~AudioGraph();
+
+	// Control side, any thread: edits the description. Return 0 or false when the node is unknown, the graph
+	// full, or the connection would close a cycle.
+	UINT64 add_node(std::shared_ptr<AudioNode> node);
+	bool remove_node(UINT64 id);
+	bool connect(UINT64 from, UINT64 to);
+	bool disconnect(UINT64 from, UINT64 to);
+	// The node whose block render() returns
+	bool set_output(UINT64 id);
+
+	// Prepares the new nodes and hands the schedule to the audio thread. Fails with E_INVALIDARG without
+	// an output node.
+	std::optional<HRESULT> commit();
+
+	WORD get_output_channels();
+	AudioGraphStats get_stats();
+
+	// Audio side, from one thread at a time: a render callback, for instance with
+	// AudioRenderer::start_interleaved(..., get_output_channels()). Channels beyond the output node's are
+	// silent. Silence until the first commit().
+	void render(float* samples, UINT32 frames, WORD channels);
+
+	// Renders frames of the committed graph on the calling thread and the pool, as fast as they go, in
+	// blocks of blockFrames. Not while a stream renders the graph.
+	AudioRecording render_offline(UINT64 frames, UINT32 blockFrames = 512);
+
+private:
+	struct Node {
+		std::shared_ptr<AudioNode> node;
+		std::shared_ptr<BlockCost> cost;
+		std::vector<UINT64> inputs;
+		bool prepared = false;
+	};
+
+	struct Schedule;
+
+	bool reaches(UINT64 from, UINT64 to) const;
+	void collect_retired();
+	void render_block(Schedule& schedule, UINT32 frames);
+
+	const AudioGraphConfig config;
+
+	// Control side
+	std::mutex controlMutex;
+	std::map<UINT64, Node> nodes;
+	UINT64 nextId;
+	UINT64 outputId;
+	WORD outputChannels;
+
+	// A compiled schedule waits in pending until the audio thread swaps it in, and returns through retired
+	std::atomic<Schedule*> pending;
+	SpscRing<Schedule*> retired;
+
+	// Audio side
+	Schedule* current;
+	WorkStealingPool pool;
+
+	std::atomic<UINT64> periods;
+	std::atomic<UINT64> swaps;
+	std::atomic<UINT64> renderedFrames;
+	std::atomic<UINT64> periodNs;
+	std::atomic<UINT64> nodeNs;
+};
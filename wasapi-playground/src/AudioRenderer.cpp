@@ -1,20 +1,62 @@
 #include "AudioRenderer.h"
+#include "SampleConversion.h"
+#include "RealtimeLog.h"
+#include "Trace.h"
+#include "RealtimeCheck.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+	// Short fade applied when the stream resumes on a new endpoint, to avoid a click
+	const unsigned int migrationFadeInMs = 5;
+
+	// Upper bound on the wait for the buffer event: a lost endpoint stops signaling it
+	const DWORD bufferEventTimeoutMs = 100;
+}
 
 AudioRenderer::AudioRenderer(std::unique_ptr<AudioDevice> devicePointer) :
 	device(std::move(devicePointer)),
 	audioClient(device->get_audio_client()),
-	deviceFormat(get_working_format()),
-	renderClient(nullptr)
+	deviceFormat(get_working_format(*device, audioClient)),
+	renderClient(nullptr),
+	enginePeriodInFrames(0),
+	interleavedChannels(0),
+	interleavedMask(0),
+	running(false),
+	globalTime(0),
+	frameCount(0),
+	fadeInFrames(0),
+	fadeInRemaining(0),
+	activeDevice(device->get_handle()),
+	metrics(MetricsRegistry::instance().register_stream(StreamDirection::Render)),
+	renderAheadPeriods(0),
+	renderingAhead(false),
+	generatorRate(0),
+	generatorChannels(1),
+	generatorMask(0),
+	historyEnd(0),
+	historyFrames(0),
+	replayFrames(0),
+	worker(std::make_unique<AudioWorker>("render", [this]() { render_loop(); })),
+	queuedFrames(0)
 {
 }
 
 AudioRenderer::~AudioRenderer()
 {
 	stop();
+	worker.reset();
+	renderAhead.reset();
+	migrator.reset();
+	MetricsRegistry::instance().unregister_stream(metrics);
 
 	SafeRelease(&audioClient);
 	SafeRelease(&renderClient);
 	CoTaskMemFree(deviceFormat);
+
+	if (streamRequest.bufferEvent != nullptr)
+		CloseHandle(streamRequest.bufferEvent);
 }
 
 std::optional<HRESULT> AudioRenderer::initialize(unsigned int bufferTimeSizeMs)
@@ -24,21 +66,93 @@ std::optional<HRESULT> AudioRenderer::initialize(unsigned int bufferTimeSizeMs)
 		return S_FALSE;
 	}
 
-	auto result = audioClient->Initialize(
-		AUDCLNT_SHAREMODE_SHARED,
-		AUDCLNT_STREAMFLAGS_NOPERSIST,
-		(REFERENCE_TIME)bufferTimeSizeMs * 10000,		// 1 unit --> 100 nanoseconds
-		0,												// only used for EXCLUSIVE mode
-		deviceFormat,
-		NULL);
+	streamRequest.bufferTimeSizeMs = bufferTimeSizeMs;
+	return initialize_client(*device, &audioClient, deviceFormat, &renderClient, &enginePeriodInFrames);
+}
 
-	if (FAILED(result))
+std::optional<HRESULT> AudioRenderer::initialize_low_latency(unsigned int periodInFrames)
+{
+	if (audioClient == nullptr)
 	{
-		printf("Unable to initialize audio client: %x.\n", result);
-		return result;
+		return S_FALSE;
 	}
 
-	result = audioClient->GetService(__uuidof(IAudioRenderClient), reinterpret_cast<void**>(&renderClient));
+	// Small periods leave no room for the Sleep() based polling: wait for the engine to signal each period instead
+	if (streamRequest.bufferEvent == nullptr)
+		streamRequest.bufferEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+	streamRequest.lowLatency = true;
+	streamRequest.periodInFrames = periodInFrames;
+	return initialize_client(*device, &audioClient, deviceFormat, &renderClient, &enginePeriodInFrames);
+}
+
+std::optional<HRESULT> AudioRenderer::initialize_negotiated(const NegotiationPolicy& policy)
+{
+	if (audioClient == nullptr)
+	{
+		return S_FALSE;
+	}
+
+	auto configuration = device->get_stream_configuration(policy);
+	if (!configuration.has_value())
+	{
+		printf("[AudioRenderer] Unable to negotiate a stream configuration\n");
+		return S_FALSE;
+	}
+
+	if (auto format = allocate_wave_format(configuration.value().format); format != nullptr) {
+		CoTaskMemFree(deviceFormat);
+		deviceFormat = format;
+	}
+
+	if (configuration.value().usesEnginePeriod)
+		return initialize_low_latency(configuration.value().periodInFrames);
+
+	// The legacy Initialize() runs at the default engine period: only the buffer is sized for the negotiated latency
+	auto bufferTimeSizeMs = (unsigned int)ceil(configuration.value().latencyMs);
+	return initialize(bufferTimeSizeMs);
+}
+
+std::optional<HRESULT> AudioRenderer::initialize_exclusive(unsigned int bufferTimeSizeMs)
+{
+	if (audioClient == nullptr)
+	{
+		return S_FALSE;
+	}
+
+	auto format = find_exclusive_format(*device, audioClient);
+	if (format == nullptr)
+	{
+		return AUDCLNT_E_UNSUPPORTED_FORMAT;
+	}
+
+	CoTaskMemFree(deviceFormat);
+	deviceFormat = format;
+
+	if (streamRequest.bufferEvent == nullptr)
+		streamRequest.bufferEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+	streamRequest.exclusive = true;
+	streamRequest.bufferTimeSizeMs = bufferTimeSizeMs;
+	return initialize_client(*device, &audioClient, deviceFormat, &renderClient, &enginePeriodInFrames);
+}
+
+UINT32 AudioRenderer::get_engine_period() const
+{
+	return enginePeriodInFrames;
+}
+
+const WAVEFORMATEX* AudioRenderer::get_format() const
+{
+	return deviceFormat;
+}
+
+std::optional<HRESULT> AudioRenderer::initialize_client(AudioDevice& endpoint, IAudioClient3** client, WAVEFORMATEX* format, IAudioRenderClient** renderClient, UINT32* periodInFrames) const
+{
+	if (auto error = initialize_stream(endpoint, client, format, streamRequest, periodInFrames); error.has_value())
+		return error;
+
+	auto result = (*client)->GetService(__uuidof(IAudioRenderClient), reinterpret_cast<void**>(renderClient));
 	if (FAILED(result))
 	{
 		printf("Unable to get new render client: %x.\n", result);
@@ -50,15 +164,83 @@ std::optional<HRESULT> AudioRenderer::initialize(unsigned int bufferTimeSizeMs)
 
 void AudioRenderer::start(const std::function<double(FrameInfo)> renderCallback)
 {
-	if (running || renderClient == nullptr)
+	if (running)
 		return;
 
 	userCallback = renderCallback;
+	blockCallback = nullptr;
+	interleavedCallback = nullptr;
+	start_stream();
+}
+
+void AudioRenderer::start_blocks(const std::function<void(float* samples, UINT32 frames)> callback)
+{
+	if (running)
+		return;
+
+	userCallback = nullptr;
+	blockCallback = callback;
+	interleavedCallback = nullptr;
+	start_stream();
+}
+
+void AudioRenderer::start_interleaved(const std::function<void(float* samples, UINT32 frames, WORD channels)> callback, WORD channels, DWORD channelMask)
+{
+	if (running)
+		return;
+
+	userCallback = nullptr;
+	blockCallback = nullptr;
+	interleavedCallback = callback;
+	interleavedChannels = channels;
+	interleavedMask = channelMask;
+	start_stream();
+}
+
+void AudioRenderer::start_stream()
+{
+	// A migration completed while the stream was stopped: start directly on the new endpoint
+	if (migrator != nullptr && migrator->has_prepared_stream()) {
+		if (auto next = migrator->take_prepared_stream(); next.has_value())
+			adopt_stream(next.value());
+	}
+
+	if (renderClient == nullptr)
+		return;
+
 	streamInfo = get_stream_info(audioClient);
-	
-	// Write a packet of silence before starting the audio stream, to avoid glitches
-	write_to_buffer([](UINT32 _, BYTE* __, DWORD* flags) {
-		*flags = AUDCLNT_BUFFERFLAGS_SILENT;
+	prepare_conversion();
+	if (effects != nullptr)
+		effects->reset();
+	globalTime = 0;
+	frameCount = 0;
+	fadeInRemaining = 0;
+	generatorRate = deviceFormat->nSamplesPerSec;
+
+	// The lookahead is generated in blocks of one period, the render thread wakes about that often
+	renderingAhead = renderAhead != nullptr && renderAheadPeriods > 0 && streamInfo.has_value();
+	if (renderingAhead) {
+		auto bufferFrames = streamInfo.value().bufferSizeInFrames;
+		auto blockFrames = enginePeriodInFrames != 0 ? enginePeriodInFrames : bufferFrames / 2;
+		renderAhead->prime(blockFrames, renderAheadPeriods, bufferFrames, generatorChannels);
+	}
+
+	// The history spans the frames a migration can find queued on the endpoint
+	if (!userCallback && !renderingAhead && streamInfo.has_value())
+		history.assign((size_t)streamInfo.value().bufferSizeInFrames * generatorChannels, 0.0f);
+	else
+		history.clear();
+	historyEnd = 0;
+	historyFrames = 0;
+	replayFrames = 0;
+
+	// Frames left over from the previous run would play before the new ones
+	audioClient->Reset();
+
+	// Pre-roll: prime the buffer with the first frames instead of silence, so that the stream is heard as
+	// soon as it starts rather than after a buffer of silence
+	write_to_buffer([this](UINT32 framesAvailable, BYTE* buffer, DWORD* _) {
+		render_frames(framesAvailable, buffer);
 	});
 
 	auto result = audioClient->Start();
@@ -68,83 +250,291 @@ void AudioRenderer::start(const std::function<double(FrameInfo)> renderCallback)
 		return;
 	}
 
+	// The pre-rolled frames start playing now
+	lastWriteTime = std::chrono::steady_clock::now();
 	running = true;
+	metrics->running = true;
+	update_stream_metrics();
+	if (renderingAhead)
+		renderAhead->start();
+	worker->resume();
+}
+
+void AudioRenderer::render_loop()
+{
+	while (running) {
+		bool signaled = wait_for_buffer();
+		if (!running)
+			break;
 
-	renderThread = std::thread([&]() {
-		double globalTime = 0;
-		long frameCount = 0;
-		auto latency = streamInfo.has_value() ? streamInfo.value().latency / 10000 : 0;
-		
-		double timeIncrement = 1.0 / (double)deviceFormat->nSamplesPerSec;
-		auto interval = (long)latency / 2;
-
-		while (running) {
-			Sleep(interval);
-
-			write_to_buffer([&](UINT32 framesAvailable, BYTE* buffer, DWORD* _) {
-				auto bufferLengthInBytes = framesAvailable * deviceFormat->nBlockAlign;
-				float* dataBuffer = reinterpret_cast<float*>(buffer);
-
-				for (size_t i = 0; i < bufferLengthInBytes / sizeof(float); i += deviceFormat->nChannels)
-				{
-					float sample = (float)userCallback({ globalTime, frameCount });
-					for (size_t j = 0; j < deviceFormat->nChannels; j++)
-					{
-						dataBuffer[i + j] = sample;
-					}
-
-					globalTime += timeIncrement;
-					frameCount++;
-				}
-			});
+		if (migrator != nullptr && migrator->has_prepared_stream())
+			switch_to_prepared_stream();
+
+		// Timed out: the endpoint freed nothing and writing would overrun it, only check that it is still there
+		if (!signaled) {
+			UINT32 queued;
+			auto result = audioClient->GetCurrentPadding(&queued);
+			if (result == AUDCLNT_E_DEVICE_INVALIDATED && migrator != nullptr) {
+				NonRealtimeScope exempt;
+				migrator->request_migration(device->get_handle(), true);
+			}
+			continue;
 		}
-	});
+
+		auto previousWrite = lastWriteTime;
+		auto previousQueue = queuedFrames;
+		bool bufferEmpty = false;
+		auto result = write_to_buffer([this, &bufferEmpty](UINT32 framesAvailable, BYTE* buffer, DWORD* _) {
+			bufferEmpty = !streamRequest.exclusive && framesAvailable == streamInfo.value().bufferSizeInFrames;
+			render_frames(framesAvailable, buffer);
+		});
+
+		// The endpoint ran dry before this write if the whole buffer was free, or if the write came after everything
+		// queued by the previous one had played: a missed event, or a callback that stalled after the padding was
+		// read. An exclusive endpoint is always full from its point of view, only the latter tells.
+		if (SUCCEEDED(result) && lastWriteTime != previousWrite) {
+			auto queuedNs = (long long)previousQueue * 1000000000ll / deviceFormat->nSamplesPerSec;
+			if (bufferEmpty || lastWriteTime - previousWrite > std::chrono::nanoseconds(queuedNs))
+				metrics->add_underrun();
+		}
+
+		if (FAILED(result))
+			metrics->add_error();
+
+		// The endpoint is gone and the stream is silent anyway: waking the migration worker may block
+		if (result == AUDCLNT_E_DEVICE_INVALIDATED && migrator != nullptr) {
+			NonRealtimeScope exempt;
+			migrator->request_migration(device->get_handle(), true);
+		}
+	}
+}
+
+bool AudioRenderer::wait_for_buffer()
+{
+	TRACE_SCOPE("wait");
+
+	if (streamRequest.bufferEvent != nullptr)
+		return WaitForSingleObject(streamRequest.bufferEvent, bufferEventTimeoutMs) == WAIT_OBJECT_0;
+
+	auto latency = streamInfo.has_value() ? streamInfo.value().latency / 10000 : 0;
+	Sleep((long)latency / 2);
+	return true;
+}
+
+void AudioRenderer::prepare_conversion()
+{
+	sampleFormat = to_stream_format(deviceFormat);
+
+	// Mono, the layout start_interleaved() asked for, or the endpoint's. A worker rendering ahead keeps
+	// the layout it started with on a new endpoint.
+	if (!(running && renderingAhead)) {
+		bool followEndpoint = interleavedCallback && interleavedChannels == 0;
+		auto previousChannels = generatorChannels;
+		generatorChannels = followEndpoint ? deviceFormat->nChannels : interleavedCallback ? interleavedChannels : 1;
+		generatorMask = followEndpoint ? (DWORD)sampleFormat.channelMask : interleavedCallback ? interleavedMask : 0;
+
+		// The history of a source following the endpoint layout cannot be replayed on an endpoint with other channels
+		if (running && !history.empty() && generatorChannels != previousChannels) {
+			history.assign((history.size() / previousChannels) * generatorChannels, 0.0f);
+			historyEnd = 0;
+			historyFrames = 0;
+			replayFrames = 0;
+		}
+	}
+	channelMatrix = ChannelMatrix::between(generatorChannels, generatorMask, deviceFormat->nChannels, (DWORD)sampleFormat.channelMask);
+
+	if (!is_float32(sampleFormat) && streamInfo.has_value())
+		conversionBuffer.resize((size_t)streamInfo.value().bufferSizeInFrames * deviceFormat->nChannels);
+	if (streamInfo.has_value())
+		blockSamples.resize((size_t)streamInfo.value().bufferSizeInFrames * (std::max)(deviceFormat->nChannels, generatorChannels));
+	if (watchdog != nullptr && streamInfo.has_value())
+		watchdog->prepare(streamInfo.value().bufferSizeInFrames, deviceFormat->nChannels, (bool)userCallback);
+	if (effects != nullptr)
+		effects->prepare(deviceFormat->nSamplesPerSec, deviceFormat->nChannels);
+}
+
+void AudioRenderer::render_frames(UINT32 framesAvailable, BYTE* buffer)
+{
+	TRACE_SCOPE("render callback");
+	auto callbackStart = std::chrono::steady_clock::now();
+
+	auto channels = deviceFormat->nChannels;
+	double timeIncrement = 1.0 / (double)deviceFormat->nSamplesPerSec;
+
+	// Integer endpoints are rendered in float first, then converted
+	bool convert = !is_float32(sampleFormat);
+	float* dataBuffer = convert ? conversionBuffer.data() : reinterpret_cast<float*>(buffer);
+
+	// In render-ahead mode the frames were generated by the worker already, only copy them
+	if (renderingAhead)
+		renderAhead->read(blockSamples.data(), framesAvailable);
+
+	// The watchdog guards the callback only when it runs on this thread
+	bool guarded = !renderingAhead && watchdog != nullptr;
+	if (guarded && !watchdog->should_render()) {
+		watchdog->substitute(dataBuffer, framesAvailable);
+		metrics->add_substituted(framesAvailable);
+
+		// The generator skips the period, to stay in time with the endpoint
+		globalTime += framesAvailable * timeIncrement;
+		frameCount += framesAvailable;
+		guarded = false;
+	}
+	else {
+		if (!history.empty())
+			generate_replayable(blockSamples.data(), framesAvailable);
+		else if (!renderingAhead)
+			generate_frames(blockSamples.data(), framesAvailable);
+
+		// The generator layout to the endpoint's, the effects, then the fade-in on every channel
+		channelMatrix.apply(blockSamples.data(), dataBuffer, framesAvailable);
+		if (effects != nullptr)
+			effects->process(dataBuffer, framesAvailable);
+		for (size_t i = 0; i < (size_t)framesAvailable * channels && fadeInRemaining > 0; i += channels)
+		{
+			float gain = 1.0f - (float)fadeInRemaining / (float)fadeInFrames;
+			fadeInRemaining--;
+			for (size_t j = 0; j < channels; j++)
+				dataBuffer[i + j] *= gain;
+		}
+	}
+
+	if (guarded) {
+		auto elapsedNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - callbackStart).count();
+		auto periodNs = (UINT64)framesAvailable * 1000000000ull / deviceFormat->nSamplesPerSec;
+		if (watchdog->rendered(dataBuffer, framesAvailable, (UINT64)elapsedNs, periodNs))
+			metrics->add_deadline_miss();
+	}
+
+	if (convert)
+		float_to_pcm(dataBuffer, buffer, (size_t)framesAvailable * channels, sampleFormat);
+
+	auto callbackTime = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - callbackStart);
+	metrics->add_callback(framesAvailable, callbackTime.count());
 }
 
-HRESULT AudioRenderer::write_to_buffer(const std::function<void(UINT32, BYTE*, DWORD*)> fill_buffer)
+void AudioRenderer::generate_frames(float* samples, UINT32 frames)
 {
+	double timeIncrement = 1.0 / (double)generatorRate.load(std::memory_order_relaxed);
+
+	if (interleavedCallback) {
+		interleavedCallback(samples, frames, generatorChannels);
+		globalTime += frames * timeIncrement;
+		frameCount += frames;
+		return;
+	}
+
+	if (blockCallback) {
+		blockCallback(samples, frames);
+		globalTime += frames * timeIncrement;
+		frameCount += frames;
+		return;
+	}
+
+	for (UINT32 i = 0; i < frames; i++)
+	{
+		samples[i] = (float)userCallback({ globalTime, frameCount });
+		globalTime += timeIncrement;
+		frameCount++;
+	}
+}
+
+void AudioRenderer::generate_replayable(float* samples, UINT32 frames)
+{
+	auto channels = (size_t)generatorChannels;
+	auto capacity = (UINT32)(history.size() / channels);
+
+	// The frames the previous endpoint never played come first, then the source carries on where it was
+	auto replayed = (std::min)(frames, replayFrames);
+	for (UINT32 i = 0; i < replayed; i++) {
+		auto from = history.begin() + (size_t)((historyEnd + i) % capacity) * channels;
+		std::copy(from, from + channels, samples + i * channels);
+	}
+	replayFrames -= replayed;
+	if (replayed < frames)
+		generate_frames(samples + replayed * channels, frames - replayed);
+
+	// Replayed frames are kept again, in case the next endpoint is lost before playing them
+	for (UINT32 i = 0; i < frames; i++)
+		std::copy(samples + i * channels, samples + (i + 1) * channels, history.begin() + (size_t)((historyEnd + i) % capacity) * channels);
+	historyEnd = (historyEnd + frames) % capacity;
+	historyFrames = (std::min)(capacity, historyFrames + frames);
+}
+
+template<typename Producer>
+HRESULT AudioRenderer::write_to_buffer(Producer&& fillBuffer)
+{
+	TRACE_SCOPE("write_to_buffer");
+
 	DWORD flags = 0;
 	BYTE* buffData = nullptr;
-	auto framesAvailable = get_available_frames_number();
+	UINT32 framesAvailable = 0;
+
+	auto result = get_available_frames_number(&framesAvailable);
+	if (FAILED(result) || framesAvailable == 0)
+		return result;
 
-	auto result = renderClient->GetBuffer(framesAvailable, &buffData);
+	{
+		TRACE_SCOPE("GetBuffer");
+		result = renderClient->GetBuffer(framesAvailable, &buffData);
+	}
 	if (FAILED(result))
 	{
-		printf("RENDER-THREAD Failed to GetBuffer(): %x.\n", result);
+		realtime_log(LogSite::RenderGetBuffer, result, framesAvailable);
 		return result;
 	}
 
-	fill_buffer(framesAvailable, buffData, &flags);
+	fillBuffer(framesAvailable, buffData, &flags);
 
-	result = renderClient->ReleaseBuffer(framesAvailable, flags);
+	{
+		TRACE_SCOPE("ReleaseBuffer");
+		result = renderClient->ReleaseBuffer(framesAvailable, flags);
+	}
 	if (FAILED(result))
 	{
-		printf("RENDER-THREAD Failed to ReleaseBuffer(): %x.\n", result);
+		realtime_log(LogSite::RenderReleaseBuffer, result, framesAvailable, flags);
 		return result;
 	}
 
+	lastWriteTime = std::chrono::steady_clock::now();
+	queuedFrames += framesAvailable;
 	return 0;
 }
 
-UINT32 AudioRenderer::get_available_frames_number()
+HRESULT AudioRenderer::get_available_frames_number(UINT32* framesAvailable)
 {
+	TRACE_SCOPE("GetCurrentPadding");
 	UINT32 numFramesPadding;
 	HRESULT result = audioClient->GetCurrentPadding(&numFramesPadding);
 	if (FAILED(result))
 	{
-		printf("RENDER-THREAD Failed to GetCurrentPadding(): %x.\n", result);
-		return 0;
+		realtime_log(LogSite::RenderGetCurrentPadding, result);
+		*framesAvailable = 0;
+		return result;
 	}
 
-	return streamInfo.value().bufferSizeInFrames - numFramesPadding;
+	// Exclusive event-driven streams are double-buffered by the endpoint: an event frees a whole buffer, once no more
+	// than one is queued. A wake-up that finds both queued, such as a stale event, writes nothing.
+	auto bufferFrames = streamInfo.value().bufferSizeInFrames;
+	if (streamRequest.exclusive)
+		*framesAvailable = numFramesPadding <= bufferFrames ? bufferFrames : 0;
+	else
+		*framesAvailable = bufferFrames - numFramesPadding;
+
+	queuedFrames = numFramesPadding;
+	metrics->set_fill(numFramesPadding);
+	return S_OK;
 }
 
-WAVEFORMATEX* AudioRenderer::get_working_format()
+WAVEFORMATEX* AudioRenderer::get_working_format(AudioDevice& device, IAudioClient3* client)
 {
-	auto defaultFormat = device->get_device_format();
+	if (client == nullptr)
+		return nullptr;
+
+	auto defaultFormat = device.get_device_format();
 	WAVEFORMATEX* outFormat = nullptr;
 
-	auto result = audioClient->IsFormatSupported(AUDCLNT_SHAREMODE_SHARED, defaultFormat, &outFormat);
+	auto result = client->IsFormatSupported(AUDCLNT_SHAREMODE_SHARED, defaultFormat, &outFormat);
 	if (FAILED(result))
 	{
 		CoTaskMemFree(defaultFormat);
@@ -171,11 +561,18 @@ void AudioRenderer::stop()
 	if (FAILED(hr))
 	{
 		printf("FAILED TO stop AudioRenderer: %x.\n", hr);
-		return;
 	}
 
-	renderThread.join();
+	// The stopped stream no longer signals the event: wake the render thread so it can exit
+	if (streamRequest.bufferEvent != nullptr)
+		SetEvent(streamRequest.bufferEvent);
+
+	worker->wait_until_idle();
+	if (renderingAhead)
+		renderAhead->stop();
+
 	streamInfo = std::nullopt;
+	metrics->running = false;
 }
 
 void AudioRenderer::reset()
@@ -190,3 +587,181 @@ void AudioRenderer::reset()
 		return;
 	}
 }
+
+void AudioRenderer::follow_default_device(DeviceFactory openDefaultDevice)
+{
+	migrator = std::make_unique<StreamMigrator>(openDefaultDevice, [this](std::unique_ptr<AudioDevice> newDevice) {
+		return open_stream(std::move(newDevice));
+	});
+}
+
+void AudioRenderer::migrate_to_default_device()
+{
+	if (migrator != nullptr)
+		migrator->request_migration(activeDevice, false);
+}
+
+MigrationStats AudioRenderer::get_migration_stats() const
+{
+	return migrator != nullptr ? migrator->get_stats() : MigrationStats{};
+}
+
+const StreamCounters& AudioRenderer::get_metrics() const
+{
+	return *metrics;
+}
+
+void AudioRenderer::set_render_ahead(unsigned int periods)
+{
+	if (running)
+		return;
+
+	renderAheadPeriods = periods;
+	if (periods > 0 && renderAhead == nullptr)
+		renderAhead = std::make_unique<RenderAhead>([this](float* samples, UINT32 frames) { generate_frames(samples, frames); });
+}
+
+RenderAheadStats AudioRenderer::get_render_ahead_stats() const
+{
+	return renderAhead != nullptr ? renderAhead->get_stats() : RenderAheadStats{};
+}
+
+void AudioRenderer::set_watchdog(const WatchdogConfig& config)
+{
+	if (running)
+		return;
+
+	watchdog = std::make_unique<CallbackWatchdog>(config);
+}
+
+WatchdogStats AudioRenderer::get_watchdog_stats() const
+{
+	return watchdog != nullptr ? watchdog->get_stats() : WatchdogStats{};
+}
+
+void AudioRenderer::set_effects(std::shared_ptr<EffectChain> chain)
+{
+	if (running)
+		return;
+
+	effects = std::move(chain);
+}
+
+void AudioRenderer::update_stream_metrics()
+{
+	if (streamInfo.has_value())
+		metrics->set_stream(activeDevice, deviceFormat->nSamplesPerSec, streamInfo.value().bufferSizeInFrames, streamInfo.value().latency);
+}
+
+std::optional<PreparedStream> AudioRenderer::open_stream(std::unique_ptr<AudioDevice> newDevice) const
+{
+	PreparedStream stream;
+	stream.device = std::move(newDevice);
+	stream.audioClient = stream.device->get_audio_client();
+	if (stream.audioClient == nullptr)
+		return std::nullopt;
+
+	if (streamRequest.exclusive)
+		stream.format = find_exclusive_format(*stream.device, stream.audioClient);
+	else
+		stream.format = get_working_format(*stream.device, stream.audioClient);
+
+	if (stream.format == nullptr)
+		return std::nullopt;
+
+	if (auto error = initialize_client(*stream.device, &stream.audioClient, stream.format, &stream.renderClient, &stream.periodInFrames); error.has_value())
+		return std::nullopt;
+
+	auto info = get_stream_info(stream.audioClient);
+	if (!info.has_value())
+		return std::nullopt;
+
+	stream.info = info.value();
+	return stream;
+}
+
+void AudioRenderer::adopt_stream(PreparedStream& next)
+{
+	SafeRelease(&renderClient);
+	SafeRelease(&audioClient);
+	CoTaskMemFree(deviceFormat);
+
+	device = std::move(next.device);
+	activeDevice = device->get_handle();
+	audioClient = next.audioClient;
+	deviceFormat = next.format;
+	renderClient = next.renderClient;
+	streamInfo = next.info;
+	enginePeriodInFrames = next.periodInFrames;
+	generatorRate = deviceFormat->nSamplesPerSec;
+	prepare_conversion();
+
+	metrics->migrations++;
+	update_stream_metrics();
+
+	next.audioClient = nullptr;
+	next.format = nullptr;
+	next.renderClient = nullptr;
+}
+
+void AudioRenderer::switch_to_prepared_stream()
+{
+	TRACE_SCOPE("switch_to_prepared_stream");
+
+	// Swapping endpoints releases the old one and sizes the buffers for the new one: it allocates, once per device change
+	NonRealtimeScope exempt;
+
+	auto next = migrator->take_prepared_stream();
+	if (!next.has_value())
+		return;
+
+	auto outputEnd = std::chrono::steady_clock::now();
+
+	// Frames still queued on the old endpoint will never be heard: rewind so they are rendered again on the new one,
+	// or replayed for block and interleaved sources. In render-ahead mode the position belongs to the worker and the lookahead plays
+	// on the new endpoint instead.
+	UINT32 unplayedFrames = 0;
+	if (SUCCEEDED(audioClient->GetCurrentPadding(&unplayedFrames))) {
+		audioClient->Stop();
+		if (!history.empty()) {
+			auto rewound = (std::min)(unplayedFrames, historyFrames);
+			auto capacity = (UINT32)(history.size() / generatorChannels);
+			historyEnd = (historyEnd + capacity - rewound) % capacity;
+			historyFrames -= rewound;
+			replayFrames += rewound;
+		}
+		else if (!renderingAhead)
+			globalTime = (std::max)(0.0, globalTime - (double)unplayedFrames / deviceFormat->nSamplesPerSec);
+	}
+	else if (streamInfo.has_value()) {
+		// The old endpoint is gone: the audio stopped once the last written buffer played out
+		auto bufferDurationUs = (long long)streamInfo.value().bufferSizeInFrames * 1000000 / deviceFormat->nSamplesPerSec;
+		outputEnd = lastWriteTime + std::chrono::microseconds(bufferDurationUs);
+	}
+
+	adopt_stream(next.value());
+
+	// The new endpoint might run at a different sample rate
+	if (!renderingAhead)
+		frameCount = (long)(globalTime * deviceFormat->nSamplesPerSec);
+	fadeInFrames = deviceFormat->nSamplesPerSec * migrationFadeInMs / 1000;
+	fadeInRemaining = fadeInFrames;
+
+	write_to_buffer([this](UINT32 framesAvailable, BYTE* buffer, DWORD* _) {
+		render_frames(framesAvailable, buffer);
+	});
+
+	auto result = audioClient->Start();
+	if (FAILED(result))
+	{
+		realtime_log(LogSite::RenderStartAfterMigration, result);
+		migrator->request_migration(device->get_handle(), true);
+		return;
+	}
+	lastWriteTime = std::chrono::steady_clock::now();
+
+	// The first frame is heard once it went through the new stream latency
+	auto silence = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - outputEnd).count();
+	auto latencyMs = (double)streamInfo.value().latency / 10000.0;
+	migrator->record_migration((std::max)(0.0, silence) + latencyMs);
+}
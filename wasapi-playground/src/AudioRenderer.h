@@ -3,11 +3,21 @@
 #include <atomic>
 #include <thread>
 #include <optional>
+#include <vector>
+#include <chrono>
 
 #include <MMDeviceAPI.h>
 #include <AudioClient.h>
 
 #include "AudioDevice.h"
+#include "StreamMigration.h"
+#include "StreamInitialization.h"
+#include "StreamMetrics.h"
+#include "AudioWorker.h"
+#include "RenderAhead.h"
+#include "CallbackWatchdog.h"
+#include "ChannelMatrix.h"
+#include "EffectChain.h"
 #include "common.h"
 
 class AudioRenderer
@@ -19,22 +29,147 @@ public:
 	~AudioRenderer();
 
 	std::optional<HRESULT> initialize(unsigned int bufferTimeSizeMs);
+
+	// Runs the shared-mode engine at the smallest period it supports, or at the requested one rounded up to a
+	// multiple of the fundamental period. The stream becomes event-driven. Falls back to the default period.
+	std::optional<HRESULT> initialize_low_latency(unsigned int periodInFrames = 0);
+
+	// Initializes with the format and period negotiated for the device, see StreamNegotiation.h
+	std::optional<HRESULT> initialize_negotiated(const NegotiationPolicy& policy = NegotiationPolicy());
+
+	// Opens the endpoint in exclusive mode, in the first native format it accepts, see find_exclusive_format().
+	// Event-driven, with one period of bufferTimeSizeMs per buffer (0 for the device minimum period).
+	// Integer formats are converted, the callbacks keep exchanging float samples.
+	std::optional<HRESULT> initialize_exclusive(unsigned int bufferTimeSizeMs = 0);
+
+	// Period of a low-latency or exclusive stream, 0 if it runs at the default engine period
+	UINT32 get_engine_period() const;
+
+	// Format of the endpoint buffers. The callback renders float samples at the same rate, and its channels are
+	// mapped to the layout of the endpoint, see ChannelMatrix.
+	const WAVEFORMATEX* get_format() const;
+
+	// The first frames are rendered on the calling thread to prime the endpoint buffer, so they are
+	// heard as soon as the stream starts; the render thread takes over from there
 	void start(const std::function<double(FrameInfo)> renderCallback);
+
+	// Same, with a callback filling a block of mono samples at a time instead of one frame per call, for sources
+	// that work on buffers such as MappedWavFile. In render-ahead mode it runs on the worker thread.
+	void start_blocks(const std::function<void(float* samples, UINT32 frames)> blockCallback);
+
+	// Same, with the block interleaved, for sources that place their output on the channels themselves, such
+	// as Mixer. The block has the given channels and layout (a mask of 0 for the default one), mapped to the
+	// endpoint's; with 0 channels it follows the layout of the endpoint.
+	void start_interleaved(const std::function<void(float* samples, UINT32 frames, WORD channels)> interleavedCallback,
+		WORD channels = 0, DWORD channelMask = 0);
 	void stop();
 	void reset();
 
+	// Follow default device mode: when the endpoint is lost or migrate_to_default_device() is called,
+	// the endpoint returned by the factory is opened in the background and the stream continues there.
+	void follow_default_device(DeviceFactory openDefaultDevice);
+	void migrate_to_default_device();
+	MigrationStats get_migration_stats() const;
+
+	// Counters of this stream, also exported by MetricsExporter
+	const StreamCounters& get_metrics() const;
+
+	// Render-ahead mode: the callback runs on a worker thread, the given number of periods ahead of the endpoint,
+	// and the render thread only copies its output. Adds that much latency, in exchange a slow callback no longer
+	// makes the stream drop out. 0 renders on the render thread again. Takes effect at the next start().
+	void set_render_ahead(unsigned int periods);
+	RenderAheadStats get_render_ahead_stats() const;
+
+	// Measures every callback against the period it renders, and degrades the stream according to the policy when
+	// the callback keeps running late. Only guards callbacks run on the render thread, not in render-ahead mode.
+	// The policies that substitute periods need start(), whose generator skips them by its time: block and
+	// interleaved sources cannot skip, they are only measured, and can still drop quality.
+	void set_watchdog(const WatchdogConfig& config);
+	WatchdogStats get_watchdog_stats() const;
+
+	// Runs the chain on the render thread, in the layout of the endpoint: after the channel mapping, before the
+	// conversion to its sample format. Also in render-ahead mode, where the worker thread can run heavier effects
+	// with EffectChain::process() from an interleaved callback instead. nullptr for none. Takes effect at the
+	// next start(), which clears the tails of the previous run.
+	void set_effects(std::shared_ptr<EffectChain> chain);
+
 private:
-	HRESULT write_to_buffer(const std::function<void(UINT32, BYTE*, DWORD*)> producer);
-	UINT32 get_available_frames_number();
-	WAVEFORMATEX* get_working_format();
+	void start_stream();
+	void render_loop();
+	// Producer: void(UINT32 frames, BYTE* buffer, DWORD* flags). A template, so that passing a lambda never allocates.
+	template<typename Producer>
+	HRESULT write_to_buffer(Producer&& fillBuffer);
+	HRESULT get_available_frames_number(UINT32* framesAvailable);
+	void render_frames(UINT32 framesAvailable, BYTE* buffer);
+	void generate_frames(float* samples, UINT32 frames);
+	void generate_replayable(float* samples, UINT32 frames);
+	void switch_to_prepared_stream();
+	void adopt_stream(PreparedStream& next);
+	std::optional<PreparedStream> open_stream(std::unique_ptr<AudioDevice> newDevice) const;
+
+	static WAVEFORMATEX* get_working_format(AudioDevice& device, IAudioClient3* client);
+	std::optional<HRESULT> initialize_client(AudioDevice& endpoint, IAudioClient3** client, WAVEFORMATEX* format, IAudioRenderClient** renderClient, UINT32* periodInFrames) const;
+	void prepare_conversion();
+	// false when the buffer event timed out: the endpoint freed nothing
+	bool wait_for_buffer();
+	void update_stream_metrics();
 
 	std::unique_ptr<AudioDevice> device;
 	IAudioClient3* audioClient;
 	WAVEFORMATEX* deviceFormat;
 	IAudioRenderClient* renderClient;
 	std::optional<AudioStreamInfo> streamInfo;
+	StreamRequest streamRequest;
+	UINT32 enginePeriodInFrames;
 
+	// Sample format of the endpoint, and scratch space to convert it from/to float
+	StreamFormat sampleFormat;
+	std::vector<float> conversionBuffer;
+
+	// Only one of them is set, depending on the start() variant
 	std::function<double(FrameInfo)> userCallback;
+	std::function<void(float*, UINT32)> blockCallback;
+	std::function<void(float*, UINT32, WORD)> interleavedCallback;
+	WORD interleavedChannels;
+	DWORD interleavedMask;
 	std::atomic_bool running;
-	std::thread renderThread;
-};
\ No newline at end of file
+
+	// Stream position, owned by the render thread, or by the render-ahead worker in that mode
+	double globalTime;
+	long frameCount;
+	UINT32 fadeInFrames;
+	UINT32 fadeInRemaining;
+
+	std::unique_ptr<StreamMigrator> migrator;
+	std::atomic<DeviceHandle> activeDevice;
+	std::shared_ptr<StreamCounters> metrics;
+
+	// Render-ahead mode, see set_render_ahead()
+	unsigned int renderAheadPeriods;
+	bool renderingAhead;
+	std::atomic<DWORD> generatorRate;
+	WORD generatorChannels;				// layout of the blocks the callbacks render
+	DWORD generatorMask;
+	std::unique_ptr<RenderAhead> renderAhead;
+	std::unique_ptr<CallbackWatchdog> watchdog;
+
+	// One period, read from the render-ahead ring or filled by the callback, in the generator layout.
+	// The matrix maps it to the endpoint.
+	std::vector<float> blockSamples;
+	ChannelMatrix channelMatrix;
+
+	// Block and interleaved sources cannot rewind: the last buffer they rendered, in the generator layout, replayed
+	// on a new endpoint in place of the frames lost with the old one. Empty for start() and in render-ahead mode.
+	std::vector<float> history;
+	UINT32 historyEnd;					// frame after the last one kept
+	UINT32 historyFrames;				// frames kept, up to the size of the history
+	UINT32 replayFrames;				// frames after historyEnd to replay before calling the source again
+	std::shared_ptr<EffectChain> effects;
+
+	// Render thread, created with the renderer and reused across start() and stop()
+	std::unique_ptr<AudioWorker> worker;
+
+	// Time of the last packet released, and the frames queued on the endpoint right after it
+	std::chrono::steady_clock::time_point lastWriteTime;
+	UINT32 queuedFrames;
+};
@@ -0,0 +1,61 @@
+#include "AudioWorker.h"
+#include "RealtimeLog.h"
+#include "Trace.h"
+#include "RealtimeCheck.h"
+
+AudioWorker::AudioWorker(const char* name, std::function<void()> loop) :
+    loop(loop),
+    state(State::Idle)
+{
+    thread = std::thread([this, name]() { run(name); });
+}
+
+AudioWorker::~AudioWorker()
+{
+    {
+        std::unique_lock lock(mutex);
+        stateChanged.wait(lock, [this]() { return state == State::Idle; });
+        state = State::Exiting;
+    }
+    stateChanged.notify_all();
+    thread.join();
+}
+
+void AudioWorker::resume()
+{
+    {
+        std::lock_guard lock(mutex);
+        state = State::Resumed;
+    }
+    stateChanged.notify_all();
+}
+
+void AudioWorker::wait_until_idle()
+{
+    std::unique_lock lock(mutex);
+    stateChanged.wait(lock, [this]() { return state == State::Idle; });
+}
+
+void AudioWorker::run(const char* name)
+{
+    RealtimeLog::instance().register_current_thread(name);
+    TRACE_THREAD(name);
+
+    std::unique_lock lock(mutex);
+    while (true) {
+        stateChanged.wait(lock, [this]() { return state != State::Idle; });
+        if (state == State::Exiting)
+            return;
+
+        state = State::Running;
+        lock.unlock();
+        {
+            RealtimeScope realtime;
+            loop();
+        }
+        lock.lock();
+
+        state = State::Idle;
+        stateChanged.notify_all();
+    }
+}
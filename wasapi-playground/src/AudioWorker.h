@@ -0,0 +1,40 @@
+#pragma once
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Audio thread that lives as long as its stream. It is created idle, already registered with RealtimeLog
+// and the tracer, and runs the stream loop each time it is resumed: starting a stream costs a notification
+// instead of a thread creation.
+class AudioWorker
+{
+public:
+	// The loop runs on the worker until it returns, once per resume()
+	AudioWorker(const char* name, std::function<void()> loop);
+	AudioWorker(const AudioWorker& other) = delete;
+
+	// Waits for the current run of the loop to return
+	~AudioWorker();
+
+	void resume();
+
+	// Blocks until the loop returned. The owner makes it return first, e.g. by clearing its running flag.
+	void wait_until_idle();
+
+private:
+	enum class State {
+		Idle,
+		Resumed,
+		Running,
+		Exiting
+	};
+
+	void run(const char* name);
+
+	std::function<void()> loop;
+	std::mutex mutex;
+	std::condition_variable stateChanged;
+	State state;
+	std::thread thread;
+};
@@ -0,0 +1,27 @@
+#pragma once
+#include <atomic>
+
+#include <windows.h>
+
+// Time a stage of the audio thread spent on its blocks, such as a mixer source, an effect or a graph node.
+// The audio thread is the only writer, with relaxed atomic operations; the stats read them from any thread.
+struct BlockCost {
+	std::atomic<UINT64> frames{ 0 };
+	std::atomic<UINT64> totalNs{ 0 };
+	std::atomic<UINT64> maxBlockNs{ 0 };
+
+	void add(UINT32 blockFrames, UINT64 elapsedNs) {
+		frames.fetch_add(blockFrames, std::memory_order_relaxed);
+		totalNs.fetch_add(elapsedNs, std::memory_order_relaxed);
+		if (elapsedNs > maxBlockNs.load(std::memory_order_relaxed))
+			maxBlockNs.store(elapsedNs, std::memory_order_relaxed);
+	}
+
+	UINT64 get_frames() const { return frames.load(std::memory_order_relaxed); }
+	// Average over every block, 0 before the first one
+	double get_ns_per_frame() const {
+		auto count = get_frames();
+		return count != 0 ? (double)totalNs.load(std::memory_order_relaxed) / count : 0;
+	}
+	double get_max_block_ms() const { return maxBlockNs.load(std::memory_order_relaxed) / 1e6; }
+};
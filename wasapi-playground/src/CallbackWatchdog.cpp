@@ -0,0 +1,196 @@
+#include "CallbackWatchdog.h"
+
+#include <algorithm>
+
+CallbackWatchdog::CallbackWatchdog(const WatchdogConfig& config) :
+    config(config),
+    lastFrames(0),
+    channels(0),
+    tailFrames(0),
+    substituting(false),
+    substituteNext(false),
+    crossfadeNext(false),
+    consecutiveMisses(0),
+    consecutiveOnTime(0),
+    periods(0),
+    deadlineMisses(0),
+    degradations(0),
+    recoveries(0),
+    substitutedPeriods(0),
+    qualityTier(0),
+    degraded(false),
+    worstLoad(0)
+{
+}
+
+void CallbackWatchdog::prepare(UINT32 maxFrames, WORD channelCount, bool canSubstitute)
+{
+    channels = channelCount;
+    substituting = canSubstitute;
+    lastFrames = 0;
+    tailFrames = 0;
+    if (config.policy == DegradationPolicy::RepeatLastBlock || config.policy == DegradationPolicy::Crossfade)
+        lastBlock.resize((size_t)maxFrames * channels);
+    if (config.policy == DegradationPolicy::Crossfade)
+        tail.resize((size_t)(std::min)(maxFrames, (UINT32)config.crossfadeFrames) * channels);
+
+    // A new stream starts at full speed, the quality tier is left to the generator
+    degraded = false;
+    substituteNext = false;
+    crossfadeNext = false;
+    consecutiveMisses = 0;
+    consecutiveOnTime = 0;
+}
+
+bool CallbackWatchdog::should_render()
+{
+    if (!degraded.load(std::memory_order_relaxed))
+        return true;
+
+    // Every other period is substituted, which leaves the callback twice its budget on average
+    substituteNext = !substituteNext;
+    return !substituteNext;
+}
+
+void CallbackWatchdog::substitute(float* samples, UINT32 frames)
+{
+    substitutedPeriods.fetch_add(1, std::memory_order_relaxed);
+    auto count = (size_t)frames * channels;
+
+    if (config.policy == DegradationPolicy::Silence || lastFrames == 0) {
+        std::fill(samples, samples + count, 0.0f);
+        return;
+    }
+
+    // The block is looped if this period is longer than the last one
+    auto lastCount = (size_t)lastFrames * channels;
+    for (size_t i = 0; i < count; i++)
+        samples[i] = lastBlock[i % lastCount];
+
+    if (config.policy == DegradationPolicy::Crossfade) {
+        crossfade_from_tail(samples, frames);
+        keep_tail(samples, frames);
+        crossfadeNext = true;
+    }
+}
+
+bool CallbackWatchdog::rendered(float* samples, UINT32 frames, UINT64 callbackNs, UINT64 periodNs)
+{
+    // The repeat starts from the block as rendered, before the transition below changes its start
+    if (!lastBlock.empty()) {
+        lastFrames = (std::min)(frames, (UINT32)(lastBlock.size() / channels));
+        std::copy(samples, samples + (size_t)lastFrames * channels, lastBlock.begin());
+    }
+
+    if (config.policy == DegradationPolicy::Crossfade) {
+        if (crossfadeNext) {
+            crossfade_from_tail(samples, frames);
+            crossfadeNext = false;
+        }
+        keep_tail(samples, frames);
+    }
+
+    periods.fetch_add(1, std::memory_order_relaxed);
+    auto load = periodNs > 0 ? (double)callbackNs / (double)periodNs : 0.0;
+    if (load > worstLoad.load(std::memory_order_relaxed))
+        worstLoad.store(load, std::memory_order_relaxed);
+
+    if (load <= config.budgetRatio) {
+        consecutiveMisses = 0;
+        if (++consecutiveOnTime >= config.periodsToRecover)
+            recover();
+        return false;
+    }
+
+    deadlineMisses.fetch_add(1, std::memory_order_relaxed);
+    consecutiveOnTime = 0;
+    if (++consecutiveMisses >= config.missesToDegrade)
+        degrade();
+    return true;
+}
+
+// Blends the start of the block with the tail written before it, mirrored so that it carries on from the last
+// sample played without a step
+void CallbackWatchdog::crossfade_from_tail(float* samples, UINT32 frames)
+{
+    auto fadeFrames = (std::min)(frames, tailFrames);
+    for (UINT32 frame = 0; frame < fadeFrames; frame++) {
+        auto gain = (float)(frame + 1) / (float)(fadeFrames + 1);
+        auto previous = &tail[(size_t)(tailFrames - 1 - frame) * channels];
+        for (WORD channel = 0; channel < channels; channel++) {
+            auto& sample = samples[(size_t)frame * channels + channel];
+            sample = previous[channel] * (1.0f - gain) + sample * gain;
+        }
+    }
+}
+
+void CallbackWatchdog::keep_tail(const float* samples, UINT32 frames)
+{
+    tailFrames = (std::min)(frames, (UINT32)(tail.size() / channels));
+    auto start = samples + (size_t)(frames - tailFrames) * channels;
+    std::copy(start, start + (size_t)tailFrames * channels, tail.begin());
+}
+
+void CallbackWatchdog::degrade()
+{
+    consecutiveMisses = 0;
+
+    switch (config.policy) {
+    case DegradationPolicy::None:
+        return;
+    case DegradationPolicy::DropQuality: {
+        auto tier = qualityTier.load(std::memory_order_relaxed);
+        if (tier >= config.maxQualityTier)
+            return;
+
+        qualityTier.store(++tier, std::memory_order_relaxed);
+        degradations.fetch_add(1, std::memory_order_relaxed);
+        if (config.onQualityTier)
+            config.onQualityTier(tier);
+        return;
+    }
+    default:
+        if (!substituting || degraded.load(std::memory_order_relaxed))
+            return;
+
+        degraded.store(true, std::memory_order_relaxed);
+        degradations.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+}
+
+void CallbackWatchdog::recover()
+{
+    consecutiveOnTime = 0;
+
+    if (config.policy == DegradationPolicy::DropQuality) {
+        auto tier = qualityTier.load(std::memory_order_relaxed);
+        if (tier == 0)
+            return;
+
+        qualityTier.store(--tier, std::memory_order_relaxed);
+        recoveries.fetch_add(1, std::memory_order_relaxed);
+        if (config.onQualityTier)
+            config.onQualityTier(tier);
+        return;
+    }
+
+    if (degraded.load(std::memory_order_relaxed)) {
+        degraded.store(false, std::memory_order_relaxed);
+        recoveries.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+WatchdogStats CallbackWatchdog::get_stats() const
+{
+    WatchdogStats stats;
+    stats.periods = periods.load(std::memory_order_relaxed);
+    stats.deadlineMisses = deadlineMisses.load(std::memory_order_relaxed);
+    stats.degradations = degradations.load(std::memory_order_relaxed);
+    stats.recoveries = recoveries.load(std::memory_order_relaxed);
+    stats.substitutedPeriods = substitutedPeriods.load(std::memory_order_relaxed);
+    stats.qualityTier = qualityTier.load(std::memory_order_relaxed);
+    stats.degraded = degraded.load(std::memory_order_relaxed);
+    stats.worstLoad = worstLoad.load(std::memory_order_relaxed);
+    return stats;
+}
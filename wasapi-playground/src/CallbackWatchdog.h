@@ -0,0 +1,93 @@
+#pragma once
+#include <functional>
+#include <vector>
+#include <atomic>
+
+#include <windows.h>
+
+enum class DegradationPolicy {
+	None,						// only count the missed deadlines
+	RepeatLastBlock,			// replay the last rendered block in place of every other callback
+	Crossfade,					// same, crossfaded from the last output into the repeat, and back into the callback
+	Silence,					// silence in place of every other callback
+	DropQuality					// keep rendering, and ask the generator for a cheaper quality tier
+};
+
+struct WatchdogConfig {
+	DegradationPolicy policy = DegradationPolicy::None;
+	double budgetRatio = 0.75;					// share of the period the callback may take
+	unsigned int missesToDegrade = 3;			// consecutive missed budgets before degrading
+	unsigned int periodsToRecover = 100;		// consecutive callbacks on time before going back one step
+	unsigned int maxQualityTier = 3;
+	unsigned int crossfadeFrames = 128;		// Crossfade: length of each transition
+
+	// DropQuality: called on the render thread with the new tier, 0 being the full quality. Must not block.
+	std::function<void(unsigned int tier)> onQualityTier;
+};
+
+struct WatchdogStats {
+	UINT64 periods = 0;							// callbacks measured
+	UINT64 deadlineMisses = 0;					// callbacks over budget
+	UINT64 degradations = 0;					// entered the degraded mode, or dropped a quality tier
+	UINT64 recoveries = 0;						// left the degraded mode, or restored a quality tier
+	UINT64 substitutedPeriods = 0;				// periods written by the policy instead of the callback
+	unsigned int qualityTier = 0;
+	bool degraded = false;
+	double worstLoad = 0;						// longest callback, relative to its period
+};
+
+// Measures the render callback against the period it fills, and applies a degradation policy when it keeps
+// missing its budget. All the methods but prepare() run on the render thread and never allocate.
+class CallbackWatchdog
+{
+public:
+	CallbackWatchdog(const WatchdogConfig& config);
+	CallbackWatchdog(const CallbackWatchdog& other) = delete;
+
+	// Sizes the copy of the last block for the repeat policies. Without canSubstitute, the generator cannot skip
+	// periods and the policies that substitute them only count the misses. Called while the render thread is idle.
+	void prepare(UINT32 maxFrames, WORD channels, bool canSubstitute = true);
+
+	// False when the policy replaces this period: fill it with substitute() instead of calling the callback
+	bool should_render();
+	void substitute(float* samples, UINT32 frames);
+
+	// After the callback filled samples (interleaved) in callbackNs, for a period lasting periodNs.
+	// Returns whether it missed its budget.
+	bool rendered(float* samples, UINT32 frames, UINT64 callbackNs, UINT64 periodNs);
+
+	WatchdogStats get_stats() const;
+
+private:
+	void degrade();
+	void recover();
+	void crossfade_from_tail(float* samples, UINT32 frames);
+	void keep_tail(const float* samples, UINT32 frames);
+
+	const WatchdogConfig config;
+
+	// Last block as the callback rendered it, interleaved
+	std::vector<float> lastBlock;
+	UINT32 lastFrames;
+	WORD channels;
+
+	// Crossfade: end of the last block written, whatever wrote it
+	std::vector<float> tail;
+	UINT32 tailFrames;
+
+	// Render thread state
+	bool substituting;
+	bool substituteNext;
+	bool crossfadeNext;
+	unsigned int consecutiveMisses;
+	unsigned int consecutiveOnTime;
+
+	std::atomic<UINT64> periods;
+	std::atomic<UINT64> deadlineMisses;
+	std::atomic<UINT64> degradations;
+	std::atomic<UINT64> recoveries;
+	std::atomic<UINT64> substitutedPeriods;
+	std::atomic<unsigned int> qualityTier;
+	std::atomic_bool degraded;
+	std::atomic<double> worstLoad;
+};
@@ -0,0 +1,393 @@
+#include "ChannelMatrix.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <utility>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#include <xmmintrin.h>
+#define CHANNEL_MATRIX_SSE
+#endif
+
+namespace {
+    // Speakers defined by WAVEFORMATEXTENSIBLE, from SPEAKER_FRONT_LEFT to SPEAKER_TOP_BACK_RIGHT
+    const int speakerCount = 18;
+    const char* speakerNames[speakerCount] = {
+        "FL", "FR", "FC", "LFE", "BL", "BR", "FLC", "FRC", "BC", "SL", "SR", "TC", "TFL", "TFC", "TFR", "TBL", "TBC", "TBR"
+    };
+
+    // Outputs summed one by one: below this, the vector lanes would mostly add zeros
+    const WORD minColumnOutputs = 3;
+
+    // Folding gives up after this many speakers, for outputs that have none of the fallbacks
+    const int maxFoldDepth = 4;
+
+    // Speaker of every channel, 0 for the channels beyond the mask
+    std::vector<DWORD> channel_speakers(WORD channels, DWORD channelMask) {
+        std::vector<DWORD> speakers(channels, 0);
+        WORD channel = 0;
+        for (int bit = 0; bit < speakerCount && channel < channels; bit++) {
+            if (channelMask & (1ul << bit))
+                speakers[channel++] = 1ul << bit;
+        }
+        return speakers;
+    }
+
+    // Where a speaker the output lacks goes, in order of preference: the first fold whose speakers the output
+    // all has, or the last one, whose speakers are folded in turn
+    struct Fold {
+        DWORD speakers[2];
+        float gains[2];
+    };
+
+    std::vector<Fold> folds_of(DWORD speaker, const ChannelMixOptions& options) {
+        auto center = options.centerGain;
+        auto surround = options.surroundGain;
+
+        switch (speaker) {
+        case SPEAKER_FRONT_LEFT:
+        case SPEAKER_FRONT_RIGHT:
+            return { { { SPEAKER_FRONT_CENTER, 0 }, { center, 0 } } };
+        case SPEAKER_FRONT_CENTER:
+            return { { { SPEAKER_FRONT_LEFT, SPEAKER_FRONT_RIGHT }, { center, center } } };
+        case SPEAKER_LOW_FREQUENCY:
+            if (options.lfeGain == 0)
+                return {};
+            return { { { SPEAKER_FRONT_LEFT, SPEAKER_FRONT_RIGHT }, { options.lfeGain, options.lfeGain } } };
+        case SPEAKER_BACK_LEFT:
+            return { { { SPEAKER_SIDE_LEFT, 0 }, { 1, 0 } }, { { SPEAKER_FRONT_LEFT, 0 }, { surround, 0 } } };
+        case SPEAKER_BACK_RIGHT:
+            return { { { SPEAKER_SIDE_RIGHT, 0 }, { 1, 0 } }, { { SPEAKER_FRONT_RIGHT, 0 }, { surround, 0 } } };
+        case SPEAKER_SIDE_LEFT:
+            return { { { SPEAKER_BACK_LEFT, 0 }, { 1, 0 } }, { { SPEAKER_FRONT_LEFT, 0 }, { surround, 0 } } };
+        case SPEAKER_SIDE_RIGHT:
+            return { { { SPEAKER_BACK_RIGHT, 0 }, { 1, 0 } }, { { SPEAKER_FRONT_RIGHT, 0 }, { surround, 0 } } };
+        case SPEAKER_BACK_CENTER:
+            return { { { SPEAKER_BACK_LEFT, SPEAKER_BACK_RIGHT }, { center, center } } };
+        case SPEAKER_FRONT_LEFT_OF_CENTER:
+            return { { { SPEAKER_FRONT_LEFT, 0 }, { 1, 0 } } };
+        case SPEAKER_FRONT_RIGHT_OF_CENTER:
+            return { { { SPEAKER_FRONT_RIGHT, 0 }, { 1, 0 } } };
+        // Height speakers come down to the floor speaker under them
+        case SPEAKER_TOP_CENTER:
+        case SPEAKER_TOP_FRONT_CENTER:
+            return { { { SPEAKER_FRONT_CENTER, 0 }, { 1, 0 } } };
+        case SPEAKER_TOP_FRONT_LEFT:
+            return { { { SPEAKER_FRONT_LEFT, 0 }, { 1, 0 } } };
+        case SPEAKER_TOP_FRONT_RIGHT:
+            return { { { SPEAKER_FRONT_RIGHT, 0 }, { 1, 0 } } };
+        case SPEAKER_TOP_BACK_LEFT:
+            return { { { SPEAKER_BACK_LEFT, 0 }, { 1, 0 } } };
+        case SPEAKER_TOP_BACK_CENTER:
+            return { { { SPEAKER_BACK_CENTER, 0 }, { 1, 0 } } };
+        case SPEAKER_TOP_BACK_RIGHT:
+            return { { { SPEAKER_BACK_RIGHT, 0 }, { 1, 0 } } };
+        }
+        return {};
+    }
+
+    struct MatrixBuilder {
+        const std::vector<DWORD>& outputSpeakers;
+        const ChannelMixOptions& options;
+        ChannelMatrix& matrix;
+
+        int output_of(DWORD speaker) const {
+            auto found = std::find(outputSpeakers.begin(), outputSpeakers.end(), speaker);
+            return found != outputSpeakers.end() ? (int)(found - outputSpeakers.begin()) : -1;
+        }
+
+        void place(WORD input, DWORD speaker, float gain, int depth) {
+            if (speaker == 0 || gain == 0 || depth >= maxFoldDepth)
+                return;
+
+            if (auto output = output_of(speaker); output >= 0) {
+                matrix.set_gain((WORD)output, input, matrix.get_gain((WORD)output, input) + gain);
+                return;
+            }
+
+            auto folds = folds_of(speaker, options);
+            for (size_t i = 0; i < folds.size(); i++) {
+                const auto& fold = folds[i];
+                bool available = output_of(fold.speakers[0]) >= 0 && (fold.speakers[1] == 0 || output_of(fold.speakers[1]) >= 0);
+                if (available || i + 1 == folds.size()) {
+                    place(input, fold.speakers[0], gain * fold.gains[0], depth + 1);
+                    place(input, fold.speakers[1], gain * fold.gains[1], depth + 1);
+                    return;
+                }
+            }
+        }
+    };
+}
+
+DWORD default_channel_mask(WORD channels)
+{
+    switch (channels) {
+    case 1:
+        return SPEAKER_FRONT_CENTER;
+    case 2:
+        return SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT;
+    case 4:
+        return SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT | SPEAKER_BACK_LEFT | SPEAKER_BACK_RIGHT;
+    case 6:
+        return SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT | SPEAKER_FRONT_CENTER | SPEAKER_LOW_FREQUENCY | SPEAKER_BACK_LEFT | SPEAKER_BACK_RIGHT;
+    case 8:
+        return SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT | SPEAKER_FRONT_CENTER | SPEAKER_LOW_FREQUENCY | SPEAKER_BACK_LEFT | SPEAKER_BACK_RIGHT
+            | SPEAKER_SIDE_LEFT | SPEAKER_SIDE_RIGHT;
+    }
+    return 0;
+}
+
+std::string channel_layout_name(WORD channels, DWORD channelMask)
+{
+    std::string name;
+    for (auto speaker : channel_speakers(channels, channelMask)) {
+        if (!name.empty())
+            name += " ";
+
+        int bit = 0;
+        while (speaker != 0 && (speaker & (1ul << bit)) == 0)
+            bit++;
+        name += speaker != 0 ? speakerNames[bit] : "-";
+    }
+    return name;
+}
+
+ChannelMatrix::ChannelMatrix(WORD channels) :
+    ChannelMatrix(channels, channels)
+{
+    for (WORD channel = 0; channel < channels; channel++)
+        gains[(size_t)channel * inputs + channel] = 1.0f;
+    compile();
+}
+
+ChannelMatrix::ChannelMatrix(WORD inputs, WORD outputs) :
+    inputs(inputs),
+    outputs(outputs),
+    gains((size_t)inputs * outputs, 0.0f),
+    kernel(Kernel::Gather),
+    paddedOutputs(0)
+{
+    compile();
+}
+
+ChannelMatrix ChannelMatrix::between(WORD inputChannels, DWORD inputMask, WORD outputChannels, DWORD outputMask, const ChannelMixOptions& options)
+{
+    ChannelMatrix matrix(inputChannels, outputChannels);
+
+    auto inputSpeakers = channel_speakers(inputChannels, inputMask != 0 ? inputMask : default_channel_mask(inputChannels));
+    auto outputSpeakers = channel_speakers(outputChannels, outputMask != 0 ? outputMask : default_channel_mask(outputChannels));
+    MatrixBuilder builder{ outputSpeakers, options, matrix };
+
+    // Unassigned channels pair up by rank
+    std::vector<WORD> unassignedOutputs;
+    for (WORD output = 0; output < outputChannels; output++) {
+        if (outputSpeakers[output] == 0)
+            unassignedOutputs.push_back(output);
+    }
+
+    size_t unassignedRank = 0;
+    for (WORD input = 0; input < inputChannels; input++) {
+        auto speaker = inputSpeakers[input];
+        if (speaker == 0) {
+            if (unassignedRank < unassignedOutputs.size())
+                matrix.set_gain(unassignedOutputs[unassignedRank], input, 1.0f);
+            unassignedRank++;
+        }
+        else if (inputChannels == 1 && speaker == SPEAKER_FRONT_CENTER && builder.output_of(SPEAKER_FRONT_CENTER) < 0) {
+            // Mono is not a center speaker: on a pair it plays on both sides
+            builder.place(input, SPEAKER_FRONT_LEFT, options.monoGain, 0);
+            builder.place(input, SPEAKER_FRONT_RIGHT, options.monoGain, 0);
+        }
+        else {
+            builder.place(input, speaker, 1.0f, 0);
+        }
+    }
+
+    if (options.normalize) {
+        float loudest = 0;
+        for (WORD output = 0; output < outputChannels; output++) {
+            float sum = 0;
+            for (WORD input = 0; input < inputChannels; input++)
+                sum += std::abs(matrix.gains[(size_t)output * inputChannels + input]);
+            loudest = (std::max)(loudest, sum);
+        }
+
+        if (loudest > 1.0f) {
+            for (auto& gain : matrix.gains)
+                gain /= loudest;
+        }
+    }
+
+    matrix.compile();
+    return matrix;
+}
+
+WORD ChannelMatrix::get_inputs() const
+{
+    return inputs;
+}
+
+WORD ChannelMatrix::get_outputs() const
+{
+    return outputs;
+}
+
+float ChannelMatrix::get_gain(WORD output, WORD input) const
+{
+    return gains[(size_t)output * inputs + input];
+}
+
+void ChannelMatrix::set_gain(WORD output, WORD input, float gain)
+{
+    gains[(size_t)output * inputs + input] = gain;
+    compile();
+}
+
+bool ChannelMatrix::is_identity() const
+{
+    return kernel == Kernel::Copy;
+}
+
+void ChannelMatrix::compile()
+{
+    bool identity = inputs == outputs;
+    bool gather = true;
+    sources.assign(outputs, -1);
+    sourceGains.assign(outputs, 0.0f);
+
+    for (WORD output = 0; output < outputs; output++) {
+        for (WORD input = 0; input < inputs; input++) {
+            auto gain = gains[(size_t)output * inputs + input];
+            if (identity && gain != (input == output ? 1.0f : 0.0f))
+                identity = false;
+            if (gain == 0)
+                continue;
+
+            if (sources[output] >= 0)
+                gather = false;
+            sources[output] = input;
+            sourceGains[output] = gain;
+        }
+    }
+
+    rowStarts.assign(1, 0);
+    rowInputs.clear();
+    rowGains.clear();
+    usedInputs.clear();
+    columns.clear();
+    paddedOutputs = ((size_t)outputs + 3) / 4 * 4;
+
+#ifdef CHANNEL_MATRIX_SSE
+    bool vectorize = outputs >= minColumnOutputs && paddedOutputs <= 8;
+#else
+    bool vectorize = false;
+#endif
+
+    kernel = identity ? Kernel::Copy : gather ? Kernel::Gather : vectorize ? Kernel::Columns : Kernel::Rows;
+    if (kernel == Kernel::Rows) {
+        for (WORD output = 0; output < outputs; output++) {
+            for (WORD input = 0; input < inputs; input++) {
+                auto gain = gains[(size_t)output * inputs + input];
+                if (gain != 0) {
+                    rowInputs.push_back(input);
+                    rowGains.push_back(gain);
+                }
+            }
+            rowStarts.push_back(rowInputs.size());
+        }
+    }
+    if (kernel != Kernel::Columns)
+        return;
+
+    for (WORD input = 0; input < inputs; input++) {
+        bool used = false;
+        for (WORD output = 0; output < outputs; output++)
+            used = used || gains[(size_t)output * inputs + input] != 0;
+        if (!used)
+            continue;
+
+        usedInputs.push_back(input);
+        columns.resize(columns.size() + paddedOutputs, 0.0f);
+        float* column = columns.data() + columns.size() - paddedOutputs;
+        for (WORD output = 0; output < outputs; output++)
+            column[output] = gains[(size_t)output * inputs + input];
+    }
+}
+
+void ChannelMatrix::apply(const float* input, float* output, size_t frames) const
+{
+    switch (kernel) {
+    case Kernel::Copy:
+        memcpy(output, input, frames * inputs * sizeof(float));
+        return;
+
+    case Kernel::Gather:
+        for (size_t frame = 0; frame < frames; frame++) {
+            const float* in = input + frame * inputs;
+            float* out = output + frame * outputs;
+            for (WORD channel = 0; channel < outputs; channel++)
+                out[channel] = sources[channel] >= 0 ? in[sources[channel]] * sourceGains[channel] : 0.0f;
+        }
+        return;
+
+    case Kernel::Rows:
+        for (size_t frame = 0; frame < frames; frame++) {
+            const float* in = input + frame * inputs;
+            float* out = output + frame * outputs;
+            for (WORD channel = 0; channel < outputs; channel++) {
+                float sum = 0;
+                for (size_t term = rowStarts[channel]; term < rowStarts[channel + 1]; term++)
+                    sum += in[rowInputs[term]] * rowGains[term];
+                out[channel] = sum;
+            }
+        }
+        return;
+
+    case Kernel::Columns:
+#ifdef CHANNEL_MATRIX_SSE
+        if (paddedOutputs == 4)
+            sum_columns<1>(input, output, frames);
+        else
+            sum_columns<2>(input, output, frames);
+#endif
+        return;
+    }
+}
+
+#ifdef CHANNEL_MATRIX_SSE
+template<size_t Groups>
+void ChannelMatrix::sum_columns(const float* input, float* output, size_t frames) const
+{
+    const size_t used = usedInputs.size();
+    const WORD* usedInput = usedInputs.data();
+    const float* column = columns.data();
+
+    for (size_t frame = 0; frame < frames; frame++) {
+        const float* in = input + frame * inputs;
+        float* out = output + frame * outputs;
+
+        // Every input sample scales its whole column of gains at once
+        __m128 sums[Groups];
+        for (size_t group = 0; group < Groups; group++)
+            sums[group] = _mm_setzero_ps();
+        for (size_t i = 0; i < used; i++) {
+            auto sample = _mm_set1_ps(in[usedInput[i]]);
+            for (size_t group = 0; group < Groups; group++)
+                sums[group] = _mm_add_ps(sums[group], _mm_mul_ps(sample, _mm_loadu_ps(column + i * Groups * 4 + group * 4)));
+        }
+
+        // The padding lanes spill into the next frame, which overwrites them; the last frame must not spill
+        if (frame + 1 < frames || outputs == Groups * 4) {
+            for (size_t group = 0; group < Groups; group++)
+                _mm_storeu_ps(out + group * 4, sums[group]);
+        }
+        else {
+            float lanes[Groups * 4];
+            for (size_t group = 0; group < Groups; group++)
+                _mm_storeu_ps(lanes + group * 4, sums[group]);
+            std::copy(lanes, lanes + outputs, out);
+        }
+    }
+}
+#endif
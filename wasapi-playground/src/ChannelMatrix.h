@@ -0,0 +1,82 @@
+#pragma once
+#include <string>
+#include <vector>
+
+#include <windows.h>
+#include <mmreg.h>
+
+// Speaker layout of a format without a channel mask: mono, stereo, quad, 5.1 and 7.1 by channel count, none otherwise
+DWORD default_channel_mask(WORD channels);
+
+// The speakers of the first channels, in channel order, "FL FR FC LFE BL BR". Channels beyond the mask are "-".
+std::string channel_layout_name(WORD channels, DWORD channelMask);
+
+struct ChannelMixOptions {
+	float monoGain = 1.0f;			// a mono input on a left and right pair: played at full level on both
+	float centerGain = 0.7071f;		// a center folded into left and right, and left or right folded into a center
+	float surroundGain = 0.7071f;	// a surround folded into the front speaker of its side
+	float lfeGain = 0.0f;			// LFE folded into the front speakers when the output has none, dropped by default
+	bool normalize = true;			// scales the matrix so that full-scale inputs never add up above full scale
+};
+
+// Maps interleaved frames of one channel layout onto another: every output channel is a weighted sum of the input
+// channels. The standard matrices fold the speakers the output lacks into the nearest ones it has (downmix), and
+// leave the speakers the input lacks silent (upmix); any other routing can be set gain by gain.
+// apply() picks a kernel when the gains change: a copy for the identity, a gather for matrices where every output
+// takes at most one input, and for the others sums over the non-zero gains only: output by output for one or two
+// outputs, and with SSE over up to 8 outputs at once for the wider layouts.
+class ChannelMatrix
+{
+public:
+	// Identity on channels channels
+	ChannelMatrix(WORD channels = 1);
+	// All gains 0
+	ChannelMatrix(WORD inputs, WORD outputs);
+
+	// A mask of 0 is the default layout for the channel count. Channels beyond the mask are only
+	// routed to the channel beyond the output mask with the same rank.
+	static ChannelMatrix between(WORD inputChannels, DWORD inputMask, WORD outputChannels, DWORD outputMask,
+		const ChannelMixOptions& options = ChannelMixOptions());
+
+	WORD get_inputs() const;
+	WORD get_outputs() const;
+
+	float get_gain(WORD output, WORD input) const;
+	// Custom routing. Not while another thread applies the matrix.
+	void set_gain(WORD output, WORD input, float gain);
+
+	bool is_identity() const;
+
+	// input holds frames of get_inputs() samples, output frames of get_outputs(). They must not overlap.
+	// Does not allocate.
+	void apply(const float* input, float* output, size_t frames) const;
+
+private:
+	enum class Kernel {
+		Copy,
+		Gather,
+		Rows,
+		Columns
+	};
+
+	void compile();
+	template<size_t Groups>
+	void sum_columns(const float* input, float* output, size_t frames) const;
+
+	WORD inputs;
+	WORD outputs;
+	std::vector<float> gains;				// gains[output * inputs + input]
+
+	Kernel kernel;
+	// Gather: the input and gain of every output, -1 for a silent one
+	std::vector<int> sources;
+	std::vector<float> sourceGains;
+	// Rows: the inputs and gains of every output, from rowStarts[output] to rowStarts[output + 1]
+	std::vector<size_t> rowStarts;
+	std::vector<WORD> rowInputs;
+	std::vector<float> rowGains;
+	// Columns: for every input that reaches an output, its gains padded to a multiple of 4 outputs
+	std::vector<WORD> usedInputs;
+	std::vector<float> columns;
+	size_t paddedOutputs;
+};
@@ -0,0 +1,233 @@
+#include "Convolver.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#include <xmmintrin.h>
+#define CONVOLVER_SSE
+#endif
+
+namespace {
+    // Below this, the FFTs cost more than they save
+    const UINT32 minBlockFrames = 16;
+
+    // accumulator += input * response, complex, over bins that are a multiple of 4:
+    // the real parts first, then the imaginary ones
+    void multiply_accumulate(float* accumulator, const float* input, const float* response, size_t bins) {
+        float* accumulatorImaginary = accumulator + bins;
+        const float* inputImaginary = input + bins;
+        const float* responseImaginary = response + bins;
+
+        size_t i = 0;
+#ifdef CONVOLVER_SSE
+        for (; i < bins; i += 4) {
+            auto xr = _mm_loadu_ps(input + i);
+            auto xi = _mm_loadu_ps(inputImaginary + i);
+            auto hr = _mm_loadu_ps(response + i);
+            auto hi = _mm_loadu_ps(responseImaginary + i);
+            auto real = _mm_sub_ps(_mm_mul_ps(xr, hr), _mm_mul_ps(xi, hi));
+            auto imaginary = _mm_add_ps(_mm_mul_ps(xr, hi), _mm_mul_ps(xi, hr));
+            _mm_storeu_ps(accumulator + i, _mm_add_ps(_mm_loadu_ps(accumulator + i), real));
+            _mm_storeu_ps(accumulatorImaginary + i, _mm_add_ps(_mm_loadu_ps(accumulatorImaginary + i), imaginary));
+        }
+#endif
+        for (; i < bins; i++) {
+            accumulator[i] += input[i] * response[i] - inputImaginary[i] * responseImaginary[i];
+            accumulatorImaginary[i] += input[i] * responseImaginary[i] + inputImaginary[i] * response[i];
+        }
+    }
+
+    // Linear interpolation, enough for a response that mostly decays: it only runs when the rates differ
+    std::vector<float> resample_channel(const AudioRecording& impulse, WORD channel, DWORD sampleRate) {
+        auto frames = impulse.data.size() / impulse.channels;
+        if (impulse.samplesPerSecond == sampleRate || impulse.samplesPerSecond == 0) {
+            std::vector<float> samples(frames);
+            for (size_t i = 0; i < frames; i++)
+                samples[i] = impulse.data[i * impulse.channels + channel];
+            return samples;
+        }
+
+        auto ratio = (double)impulse.samplesPerSecond / sampleRate;
+        auto resampledFrames = (size_t)std::ceil(frames / ratio);
+        std::vector<float> samples(resampledFrames);
+        for (size_t i = 0; i < resampledFrames; i++) {
+            auto position = i * ratio;
+            auto index = (size_t)position;
+            auto fraction = (float)(position - index);
+            auto current = index < frames ? impulse.data[index * impulse.channels + channel] : 0.0f;
+            auto next = index + 1 < frames ? impulse.data[(index + 1) * impulse.channels + channel] : 0.0f;
+            samples[i] = current + fraction * (next - current);
+        }
+
+        // The energy is spread over more or fewer samples
+        for (auto& sample : samples)
+            sample *= (float)ratio;
+        return samples;
+    }
+}
+
+Convolver::Convolver(AudioRecording impulse, UINT32 blockFrames, float mix, float gainDb) :
+    impulse(std::move(impulse)),
+    blockFrames((UINT32)next_power_of_two((std::max)(blockFrames, minBlockFrames))),
+    mix(std::clamp(mix, 0.0f, 1.0f)),
+    gainDb(gainDb),
+    wetGain(std::pow(10.0f, gainDb / 20)),
+    channels(0),
+    impulseChannels(0),
+    partitions(0),
+    paddedBins(0),
+    fft(2 * (size_t)this->blockFrames),
+    newestSpectrum(0),
+    blockPosition(0)
+{
+}
+
+const char* Convolver::get_name() const
+{
+    return "convolver";
+}
+
+float* Convolver::spectrum(std::vector<float>& spectra, size_t index)
+{
+    return spectra.data() + index * 2 * paddedBins;
+}
+
+void Convolver::prepare(DWORD sampleRate, WORD channels)
+{
+    this->channels = channels;
+    impulseChannels = (std::max)(impulse.channels, (unsigned short)1);
+    paddedBins = (fft.get_bins() + 3) / 4 * 4;
+    const size_t spectrumSize = 2 * paddedBins;
+    const size_t fftSize = fft.get_size();
+
+    std::vector<std::vector<float>> responses;
+    size_t responseFrames = 1;
+    for (WORD channel = 0; channel < impulseChannels; channel++) {
+        responses.push_back(impulse.channels != 0 ? resample_channel(impulse, channel, sampleRate) : std::vector<float>{ 1.0f });
+        responseFrames = (std::max)(responseFrames, responses.back().size());
+    }
+    partitions = (responseFrames + blockFrames - 1) / blockFrames;
+
+    // Every partition zero-padded to the FFT size, so that the circular convolution keeps the last block exact
+    responseSpectra.assign(impulseChannels * partitions * spectrumSize, 0.0f);
+    timeBlock.assign(fftSize, 0.0f);
+    for (WORD channel = 0; channel < impulseChannels; channel++) {
+        const auto& response = responses[channel];
+        for (size_t partition = 0; partition < partitions; partition++) {
+            std::fill(timeBlock.begin(), timeBlock.end(), 0.0f);
+            auto first = (std::min)(partition * blockFrames, response.size());
+            auto last = (std::min)(first + blockFrames, response.size());
+            std::copy(response.begin() + first, response.begin() + last, timeBlock.begin());
+
+            auto destination = spectrum(responseSpectra, channel * partitions + partition);
+            fft.forward(timeBlock.data(), destination, destination + paddedBins);
+        }
+    }
+
+    inputSpectra.assign(channels * partitions * spectrumSize, 0.0f);
+    history.assign(channels * fftSize, 0.0f);
+    inputBlock.assign((size_t)channels * blockFrames, 0.0f);
+    dryBlock.assign((size_t)channels * blockFrames, 0.0f);
+    wetBlock.assign((size_t)channels * blockFrames, 0.0f);
+    accumulator.assign(spectrumSize, 0.0f);
+    newestSpectrum = 0;
+    blockPosition = 0;
+}
+
+void Convolver::reset()
+{
+    std::fill(inputSpectra.begin(), inputSpectra.end(), 0.0f);
+    std::fill(history.begin(), history.end(), 0.0f);
+    std::fill(inputBlock.begin(), inputBlock.end(), 0.0f);
+    std::fill(dryBlock.begin(), dryBlock.end(), 0.0f);
+    std::fill(wetBlock.begin(), wetBlock.end(), 0.0f);
+    newestSpectrum = 0;
+    blockPosition = 0;
+}
+
+void Convolver::set_parameter(unsigned int parameter, float value)
+{
+    switch (parameter) {
+    case Mix: mix = std::clamp(value, 0.0f, 1.0f); break;
+    case GainDb:
+        gainDb = value;
+        wetGain = std::pow(10.0f, value / 20);
+        break;
+    }
+}
+
+UINT32 Convolver::get_latency() const
+{
+    return blockFrames;
+}
+
+size_t Convolver::get_partitions() const
+{
+    return partitions;
+}
+
+void Convolver::process_block()
+{
+    TRACE_SCOPE("convolution block");
+
+    const size_t fftSize = fft.get_size();
+    newestSpectrum = newestSpectrum + 1 < partitions ? newestSpectrum + 1 : 0;
+
+    for (WORD channel = 0; channel < channels; channel++) {
+        // Overlap-save: the previous block and the new one
+        float* samples = history.data() + channel * fftSize;
+        std::copy(samples + blockFrames, samples + fftSize, samples);
+        std::copy(inputBlock.begin() + (size_t)channel * blockFrames, inputBlock.begin() + (size_t)(channel + 1) * blockFrames, samples + blockFrames);
+
+        float* channelSpectra = spectrum(inputSpectra, channel * partitions);
+        float* newest = channelSpectra + newestSpectrum * 2 * paddedBins;
+        fft.forward(samples, newest, newest + paddedBins);
+
+        // The input of k blocks ago meets partition k of the response
+        const float* responses = spectrum(responseSpectra, (channel % impulseChannels) * partitions);
+        std::fill(accumulator.begin(), accumulator.end(), 0.0f);
+        for (size_t partition = 0; partition < partitions; partition++) {
+            auto delayed = newestSpectrum >= partition ? newestSpectrum - partition : newestSpectrum + partitions - partition;
+            multiply_accumulate(accumulator.data(), channelSpectra + delayed * 2 * paddedBins, responses + partition * 2 * paddedBins, paddedBins);
+        }
+
+        // The first half wrapped around, the second is the convolution
+        fft.inverse(accumulator.data(), accumulator.data() + paddedBins, timeBlock.data());
+        std::copy(timeBlock.begin() + blockFrames, timeBlock.end(), wetBlock.begin() + (size_t)channel * blockFrames);
+    }
+
+    dryBlock.swap(inputBlock);
+}
+
+void Convolver::process(float* samples, UINT32 frames)
+{
+    TRACE_SCOPE("convolver");
+
+    const float dry = 1 - mix;
+    const float wet = mix * wetGain;
+
+    UINT32 done = 0;
+    while (done < frames) {
+        // Up to the end of the block being filled, while the previous one plays out
+        auto count = (std::min)(frames - done, blockFrames - blockPosition);
+        for (WORD channel = 0; channel < channels; channel++) {
+            float* input = inputBlock.data() + (size_t)channel * blockFrames + blockPosition;
+            const float* dryInput = dryBlock.data() + (size_t)channel * blockFrames + blockPosition;
+            const float* wetOutput = wetBlock.data() + (size_t)channel * blockFrames + blockPosition;
+            float* sample = samples + (size_t)done * channels + channel;
+            for (UINT32 i = 0; i < count; i++, sample += channels) {
+                input[i] = *sample;
+                *sample = dry * dryInput[i] + wet * wetOutput[i];
+            }
+        }
+
+        done += count;
+        blockPosition += count;
+        if (blockPosition == blockFrames) {
+            process_block();
+            blockPosition = 0;
+        }
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <vector>
+
+#include <windows.h>
+
+#include "Effects.h"
+#include "Fft.h"
+#include "common.h"
+
+// Convolution with a long impulse response, such as a room response or a measured correction filter, by
+// uniformly partitioned overlap-save: the response is cut into partitions of blockFrames, transformed once,
+// and every block of input is transformed once and kept in a frequency-domain delay line, where it meets each
+// partition in turn. A block costs two FFTs of 2 * blockFrames and one complex multiply-accumulate per
+// partition, done 4 bins at a time with SSE.
+// The output is late by exactly blockFrames, whatever the blocks process() is given: pick one device period,
+// see AudioRenderer::get_engine_period(). The dry signal is delayed as much, so that Mix blends aligned signals.
+class Convolver : public AudioEffect
+{
+public:
+	enum Parameter : unsigned int {
+		Mix,					// 0 dry, 1 wet only
+		GainDb					// of the wet signal
+	};
+
+	// impulse holds interleaved frames of impulse.channels, see read_wav_file() to load one. Stream channel c
+	// is convolved with channel c % impulse.channels: a mono response applies to every channel. The response
+	// is resampled to the stream rate if needed. blockFrames is rounded up to a power of 2.
+	Convolver(AudioRecording impulse, UINT32 blockFrames, float mix = 1.0f, float gainDb = 0);
+
+	const char* get_name() const override;
+	void prepare(DWORD sampleRate, WORD channels) override;
+	void reset() override;
+	void set_parameter(unsigned int parameter, float value) override;
+	void process(float* samples, UINT32 frames) override;
+
+	UINT32 get_latency() const;
+	size_t get_partitions() const;
+
+private:
+	void process_block();
+	float* spectrum(std::vector<float>& spectra, size_t index);
+
+	const AudioRecording impulse;
+	const UINT32 blockFrames;
+	float mix;
+	float gainDb;
+	float wetGain;
+
+	WORD channels;
+	WORD impulseChannels;
+	size_t partitions;
+	size_t paddedBins;				// bins rounded up to a multiple of 4, the real parts then the imaginary ones
+	RealFft fft;
+
+	// Spectra of every partition of every impulse channel, then the delay line of every stream channel
+	std::vector<float> responseSpectra;
+	std::vector<float> inputSpectra;
+	size_t newestSpectrum;
+
+	// Per channel: the last two blocks of input, the block being filled, the dry and wet blocks being played
+	std::vector<float> history;
+	std::vector<float> inputBlock;
+	std::vector<float> dryBlock;
+	std::vector<float> wetBlock;
+	UINT32 blockPosition;
+
+	std::vector<float> accumulator;
+	std::vector<float> timeBlock;
+};
@@ -74,12 +74,29 @@ void DeviceEnumerator::unregister_notifications(IMMNotificationClient* notifClie
 }
 
 std::unique_ptr<AudioDevice> DeviceEnumerator::get_device_by_id(const std::string& deviceId)
+{
+    auto handle = DeviceIdTable::instance().find(deviceId);
+    if (handle != INVALID_DEVICE_HANDLE)
+        return get_device_by_handle(handle);
+
+    // Not seen yet: only an endpoint that exists gets a handle, when AudioDevice interns its ID,
+    // so that looking up arbitrary IDs does not grow the table
+    IMMDevice* device = nullptr;
+    HRESULT hr = this->deviceEnumerator->GetDevice(string_to_wstring(deviceId).c_str(), &device);
+    if (FAILED(hr)) {
+        printf("Unable to retrieve device %s\n", deviceId.c_str());
+        return nullptr;
+    }
+    return std::make_unique<AudioDevice>(device);
+}
+
+std::unique_ptr<AudioDevice> DeviceEnumerator::get_device_by_handle(DeviceHandle handle)
 {
     IMMDevice* device = nullptr;
-    auto temp_id = string_to_wstring(deviceId);
-    HRESULT hr = this->deviceEnumerator->GetDevice((LPCWSTR)temp_id.c_str(), &device);
+    const auto& wideId = DeviceIdTable::instance().get_wide_id(handle);
+    HRESULT hr = this->deviceEnumerator->GetDevice(wideId.c_str(), &device);
     if (FAILED(hr)) {
-        printf("Unable to retrieve device %s\n", deviceId);
+        printf("Unable to retrieve device %s\n", DeviceIdTable::instance().get_id(handle).c_str());
         return nullptr;
     }
     return std::make_unique<AudioDevice>(device);
@@ -7,6 +7,7 @@
 #include <MMDeviceAPI.h>
 
 #include "AudioDevice.h"
+#include "DeviceIdTable.h"
 #include "common.h"
 
 struct AudioDeviceList {
@@ -23,6 +24,7 @@ public:
 	std::unique_ptr<AudioDevice> get_default_output();
 	std::unique_ptr<AudioDevice> get_default_input();
 	std::unique_ptr<AudioDevice> get_device_by_id(const std::string& deviceId);
+	std::unique_ptr<AudioDevice> get_device_by_handle(DeviceHandle handle);
 
 	std::vector<AudioDeviceSummary> get_output_devices_summary();
 	std::vector<AudioDeviceSummary> get_input_devices_summary();
@@ -0,0 +1,97 @@
+#include "DeviceIdTable.h"
+#include "common.h"
+
+#include <mutex>
+
+namespace {
+    const std::string EMPTY_ID;
+    const std::wstring EMPTY_WIDE_ID;
+}
+
+DeviceIdTable& DeviceIdTable::instance()
+{
+    static DeviceIdTable table;
+    return table;
+}
+
+DeviceHandle DeviceIdTable::intern(LPCWSTR deviceId)
+{
+    if (deviceId == nullptr)
+        return INVALID_DEVICE_HANDLE;
+
+    // Fast path: the ID was already seen, no allocation happens here
+    {
+        std::shared_lock lock(mutex);
+        if (auto entry = wideLookup.find(std::wstring_view(deviceId)); entry != wideLookup.end())
+            return entry->second;
+    }
+
+    return insert(std::wstring(deviceId));
+}
+
+DeviceHandle DeviceIdTable::intern(const std::string& deviceId)
+{
+    {
+        std::shared_lock lock(mutex);
+        if (auto entry = lookup.find(std::string_view(deviceId)); entry != lookup.end())
+            return entry->second;
+    }
+
+    return insert(string_to_wstring(deviceId));
+}
+
+DeviceHandle DeviceIdTable::find(LPCWSTR deviceId) const
+{
+    if (deviceId == nullptr)
+        return INVALID_DEVICE_HANDLE;
+
+    std::shared_lock lock(mutex);
+    if (auto entry = wideLookup.find(std::wstring_view(deviceId)); entry != wideLookup.end())
+        return entry->second;
+
+    return INVALID_DEVICE_HANDLE;
+}
+
+DeviceHandle DeviceIdTable::find(const std::string& deviceId) const
+{
+    std::shared_lock lock(mutex);
+    if (auto entry = lookup.find(std::string_view(deviceId)); entry != lookup.end())
+        return entry->second;
+
+    return INVALID_DEVICE_HANDLE;
+}
+
+const std::string& DeviceIdTable::get_id(DeviceHandle handle) const
+{
+    std::shared_lock lock(mutex);
+    return handle < ids.size() ? ids[handle] : EMPTY_ID;
+}
+
+const std::wstring& DeviceIdTable::get_wide_id(DeviceHandle handle) const
+{
+    std::shared_lock lock(mutex);
+    return handle < wideIds.size() ? wideIds[handle] : EMPTY_WIDE_ID;
+}
+
+size_t DeviceIdTable::size() const
+{
+    std::shared_lock lock(mutex);
+    return ids.size();
+}
+
+DeviceHandle DeviceIdTable::insert(std::wstring wideId)
+{
+    std::unique_lock lock(mutex);
+
+    // Another thread might have inserted the same ID while the lock was released
+    if (auto entry = wideLookup.find(std::wstring_view(wideId)); entry != wideLookup.end())
+        return entry->second;
+
+    auto handle = (DeviceHandle)wideIds.size();
+    auto& storedWideId = wideIds.emplace_back(std::move(wideId));
+    auto& storedId = ids.emplace_back(LPCWSTR_to_string(storedWideId.c_str()));
+
+    wideLookup.insert({ std::wstring_view(storedWideId), handle });
+    lookup.insert({ std::string_view(storedId), handle });
+    return handle;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <deque>
+#include <unordered_map>
+#include <shared_mutex>
+
+#include <windows.h>
+
+// Small dense integer that identifies an endpoint for the lifetime of the process.
+typedef unsigned int DeviceHandle;
+
+const DeviceHandle INVALID_DEVICE_HANDLE = ~0u;
+
+// Process-wide interning table for endpoint IDs. Each ID is converted to UTF-8 only once,
+// the first time it is seen, and from then on devices are referred to by their handle.
+// Handles are assigned in increasing order starting from 0, so they can be used as array indices.
+class DeviceIdTable
+{
+public:
+	static DeviceIdTable& instance();
+
+	DeviceHandle intern(LPCWSTR deviceId);
+	DeviceHandle intern(const std::string& deviceId);
+	// Lookups that never insert, INVALID_DEVICE_HANDLE for an ID not seen yet
+	DeviceHandle find(LPCWSTR deviceId) const;
+	DeviceHandle find(const std::string& deviceId) const;
+
+	const std::string& get_id(DeviceHandle handle) const;
+	const std::wstring& get_wide_id(DeviceHandle handle) const;
+	size_t size() const;
+
+private:
+	DeviceIdTable() = default;
+	DeviceHandle insert(std::wstring wideId);
+
+	mutable std::shared_mutex mutex;
+
+	// std::deque never moves its elements on push_back, so the views below stay valid
+	std::deque<std::wstring> wideIds;
+	std::deque<std::string> ids;
+	std::unordered_map<std::wstring_view, DeviceHandle> wideLookup;
+	std::unordered_map<std::string_view, DeviceHandle> lookup;
+};
@@ -1,5 +1,7 @@
 #include "DeviceNotificationProvider.h"
 #include "common.h"
+#include "StreamNegotiation.h"
+#include "Trace.h"
 
 DeviceEvent state_to_device_event(DWORD state) {
     switch (state)
@@ -30,51 +32,111 @@ DeviceNotificationProvider::~DeviceNotificationProvider()
 SubscriptionId DeviceNotificationProvider::subscribe_to_global_events(GlobalDeviceEventCallback callback)
 {
     auto newId = new_subscription_id();
+    std::lock_guard lock(subscriptionMutex);
     globalSubscriptionMap.insert({ newId, callback });
     return newId;
 }
 
-void DeviceNotificationProvider::unsubscribe(SubscriptionId id)
+SubscriptionId DeviceNotificationProvider::subscribe_to_default_device_changes(DefaultDeviceCallback callback)
 {
-    // this implementation needs to be optimized
-    globalSubscriptionMap.erase(id);
-    deviceSubscriptionMap.erase(id);
+    auto newId = new_subscription_id();
+    std::lock_guard lock(subscriptionMutex);
+    defaultDeviceSubscriptionMap.insert({ newId, callback });
+    return newId;
 }
 
-SubscriptionId DeviceNotificationProvider::subscribe_to_device_events(std::string deviceId, DeviceEventCallback callback)
+void DeviceNotificationProvider::unsubscribe(SubscriptionId id)
 {
-    auto newId = new_subscription_id();
+    std::lock_guard lock(subscriptionMutex);
+    if (globalSubscriptionMap.erase(id) != 0 || defaultDeviceSubscriptionMap.erase(id) != 0)
+        return;
 
-    // Inserts subscription ID into subscription map
-    auto callbackList = deviceEventsMap.find(deviceId);
-    if (callbackList == deviceEventsMap.end()) {
-        deviceEventsMap.insert({deviceId,  std::vector<SubscriptionId>{ newId } });
-    }
-    else {
-        deviceEventsMap[deviceId].push_back(newId);
+    for (auto& subscriptions : deviceSubscriptions) {
+        for (auto it = subscriptions.begin(); it != subscriptions.end(); ++it) {
+            if (it->id == id) {
+                subscriptions.erase(it);
+                return;
+            }
+        }
     }
+}
+
+IMMNotificationClient* DeviceNotificationProvider::get_notification_client()
+{
+    return notificationClient.get();
+}
 
-    deviceSubscriptionMap.insert({ newId, callback });
+SubscriptionId DeviceNotificationProvider::subscribe_to_device_events(DeviceHandle device, DeviceEventCallback callback)
+{
+    if (device == INVALID_DEVICE_HANDLE)
+        return 0;
+
+    auto newId = new_subscription_id();
+    std::lock_guard lock(subscriptionMutex);
 
+    if (device >= deviceSubscriptions.size())
+        deviceSubscriptions.resize((size_t)device + 1);
+
+    deviceSubscriptions[device].push_back({ newId, callback });
     return newId;
 }
 
-void DeviceNotificationProvider::notify_change(std::string deviceId, DeviceEvent newEvent)
+SubscriptionId DeviceNotificationProvider::subscribe_to_device_events(const std::string& deviceId, DeviceEventCallback callback)
+{
+    return subscribe_to_device_events(DeviceIdTable::instance().intern(deviceId), callback);
+}
+
+DeviceHandle DeviceNotificationProvider::resolve(LPCWSTR deviceId)
 {
-    // Notify all subscribers of this specific device ID
-    if (auto entry = deviceEventsMap.find(deviceId); entry != deviceEventsMap.end()) {
-        for (auto const& subscriptionId : entry->second)
-        {
-            if(auto callback = deviceSubscriptionMap.find(subscriptionId); callback != deviceSubscriptionMap.end())
-                callback->second(newEvent);
+    // Endpoints with their own subscribers were interned when they subscribed: a lookup that never inserts.
+    // An endpoint seen for the first time only gets a handle when someone listens to all of them.
+    auto device = DeviceIdTable::instance().find(deviceId);
+    if (device != INVALID_DEVICE_HANDLE || deviceId == nullptr)
+        return device;
+
+    {
+        std::lock_guard lock(subscriptionMutex);
+        if (globalSubscriptionMap.empty() && defaultDeviceSubscriptionMap.empty())
+            return INVALID_DEVICE_HANDLE;
+    }
+    return DeviceIdTable::instance().intern(deviceId);
+}
+
+void DeviceNotificationProvider::notify_change(DeviceHandle device, DeviceEvent newEvent)
+{
+    if (device == INVALID_DEVICE_HANDLE)
+        return;
+
+    std::vector<DeviceEventCallback> deviceCallbacks;
+    std::vector<GlobalDeviceEventCallback> globalCallbacks;
+    {
+        std::lock_guard lock(subscriptionMutex);
+        if (device < deviceSubscriptions.size()) {
+            for (auto const& subscription : deviceSubscriptions[device])
+                deviceCallbacks.push_back(subscription.callback);
         }
+        for (auto it = globalSubscriptionMap.begin(); it != globalSubscriptionMap.end(); ++it)
+            globalCallbacks.push_back(it->second);
     }
 
-    // Notify all global subscribers
-    for (auto it = globalSubscriptionMap.begin(); it != globalSubscriptionMap.end(); ++it)
+    // Notify all subscribers of this specific device, then all global subscribers
+    for (auto const& callback : deviceCallbacks)
+        callback(newEvent);
+    for (auto const& callback : globalCallbacks)
+        callback(device, newEvent);
+}
+
+void DeviceNotificationProvider::notify_default_change(EDataFlow flow, ERole role, DeviceHandle device)
+{
+    std::vector<DefaultDeviceCallback> callbacks;
     {
-        it->second(deviceId, newEvent);
+        std::lock_guard lock(subscriptionMutex);
+        for (auto it = defaultDeviceSubscriptionMap.begin(); it != defaultDeviceSubscriptionMap.end(); ++it)
+            callbacks.push_back(it->second);
     }
+
+    for (auto const& callback : callbacks)
+        callback(flow, role, device);
 }
 
 DeviceNotificationProvider::NotificationClient::NotificationClient(DeviceNotificationProvider* parentRef) : 
@@ -84,19 +146,24 @@ DeviceNotificationProvider::NotificationClient::NotificationClient(DeviceNotific
 
 HRESULT STDMETHODCALLTYPE DeviceNotificationProvider::NotificationClient::OnDefaultDeviceChanged(EDataFlow flow, ERole role, LPCWSTR pwstrDeviceId)
 {
-    if (pwstrDeviceId != nullptr) {
-        parent->notify_change(
-            LPCWSTR_to_string(pwstrDeviceId),
-            DeviceEvent::PropertyChanged);
-    }
+    TRACE_THREAD("device notifications");
+    TRACE_SCOPE("OnDefaultDeviceChanged");
+    auto device = parent->resolve(pwstrDeviceId);
+    parent->notify_change(
+        device,
+        DeviceEvent::PropertyChanged);
+
+    parent->notify_default_change(flow, role, device);
 
     return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE DeviceNotificationProvider::NotificationClient::OnDeviceAdded(LPCWSTR pwstrDeviceId)
 {
+    TRACE_THREAD("device notifications");
+    TRACE_SCOPE("OnDeviceAdded");
     parent->notify_change(
-        LPCWSTR_to_string(pwstrDeviceId),
+        parent->resolve(pwstrDeviceId),
         DeviceEvent::Connected);
 
     return S_OK;
@@ -104,8 +171,12 @@ HRESULT STDMETHODCALLTYPE DeviceNotificationProvider::NotificationClient::OnDevi
 
 HRESULT STDMETHODCALLTYPE DeviceNotificationProvider::NotificationClient::OnDeviceRemoved(LPCWSTR pwstrDeviceId)
 {
+    TRACE_THREAD("device notifications");
+    TRACE_SCOPE("OnDeviceRemoved");
+    auto device = parent->resolve(pwstrDeviceId);
+    NegotiationCache::instance().invalidate(device);
     parent->notify_change(
-        LPCWSTR_to_string(pwstrDeviceId),
+        device,
         DeviceEvent::Disconnected);
 
     return S_OK;
@@ -113,8 +184,12 @@ HRESULT STDMETHODCALLTYPE DeviceNotificationProvider::NotificationClient::OnDevi
 
 HRESULT STDMETHODCALLTYPE DeviceNotificationProvider::NotificationClient::OnDeviceStateChanged(LPCWSTR pwstrDeviceId, DWORD dwNewState)
 {
+    TRACE_THREAD("device notifications");
+    TRACE_SCOPE("OnDeviceStateChanged");
+    auto device = parent->resolve(pwstrDeviceId);
+    NegotiationCache::instance().invalidate(device);
     parent->notify_change(
-        LPCWSTR_to_string(pwstrDeviceId),
+        device,
         state_to_device_event(dwNewState));
 
     return S_OK;
@@ -122,8 +197,16 @@ HRESULT STDMETHODCALLTYPE DeviceNotificationProvider::NotificationClient::OnDevi
 
 HRESULT STDMETHODCALLTYPE DeviceNotificationProvider::NotificationClient::OnPropertyValueChanged(LPCWSTR pwstrDeviceId, const PROPERTYKEY key)
 {
+    TRACE_THREAD("device notifications");
+    TRACE_SCOPE("OnPropertyValueChanged");
+    auto device = parent->resolve(pwstrDeviceId);
+
+    // The negotiated configuration was derived from the previous format, the next stream negotiates again
+    if (IsEqualPropertyKey(key, PKEY_AudioEngine_DeviceFormat))
+        NegotiationCache::instance().invalidate(device);
+
     parent->notify_change(
-        LPCWSTR_to_string(pwstrDeviceId),
+        device,
         DeviceEvent::PropertyChanged);
 
     /*printf("  -->Changed device property "
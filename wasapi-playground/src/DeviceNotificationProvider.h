@@ -2,6 +2,7 @@
 //class AudioDeviceProvider {};
 
 #include <functional>
+#include <mutex>
 #include <MMDeviceAPI.h>
 
 #include "DeviceEnumerator.h"
@@ -17,25 +18,47 @@ enum class DeviceEvent {
 };
 
 typedef std::function<void(DeviceEvent deviceEvent)> DeviceEventCallback;
-typedef std::function<void(std::string deviceId, DeviceEvent deviceEvent)> GlobalDeviceEventCallback;
+typedef std::function<void(DeviceHandle device, DeviceEvent deviceEvent)> GlobalDeviceEventCallback;
+typedef std::function<void(EDataFlow flow, ERole role, DeviceHandle newDefaultDevice)> DefaultDeviceCallback;
 
 class DeviceNotificationProvider {
 public:
     DeviceNotificationProvider();
     ~DeviceNotificationProvider();
 
-    SubscriptionId subscribe_to_device_events(std::string deviceId, DeviceEventCallback callback);
+    SubscriptionId subscribe_to_device_events(DeviceHandle device, DeviceEventCallback callback);
+    SubscriptionId subscribe_to_device_events(const std::string& deviceId, DeviceEventCallback callback);
     SubscriptionId subscribe_to_global_events(GlobalDeviceEventCallback callback);
 
+    // newDefaultDevice is INVALID_DEVICE_HANDLE when no endpoint is left for that flow and role
+    SubscriptionId subscribe_to_default_device_changes(DefaultDeviceCallback callback);
+
     void unsubscribe(SubscriptionId id);
 
+    // The client registered with the device enumerator, simulated endpoints deliver their events to it
+    IMMNotificationClient* get_notification_client();
+
 private:
-    void notify_change(std::string deviceId, DeviceEvent deviceEvent);
+    struct DeviceSubscription {
+        SubscriptionId id;
+        DeviceEventCallback callback;
+    };
+
+    // Resolved once per COM callback, then the events are dispatched by handle
+    DeviceHandle resolve(LPCWSTR deviceId);
+    void notify_change(DeviceHandle device, DeviceEvent deviceEvent);
+    void notify_default_change(EDataFlow flow, ERole role, DeviceHandle device);
 
     DeviceEnumerator enumerator;
-    std::unordered_map<std::string, std::vector<SubscriptionId>> deviceEventsMap;
-    std::unordered_map<SubscriptionId, DeviceEventCallback> deviceSubscriptionMap;
+
+    // The subscriptions change on the caller's thread while COM delivers events on its own. Events are
+    // dispatched to a copy taken under the lock, so that callbacks can subscribe and unsubscribe.
+    std::mutex subscriptionMutex;
+
+    // Indexed by DeviceHandle
+    std::vector<std::vector<DeviceSubscription>> deviceSubscriptions;
     std::unordered_map<SubscriptionId, GlobalDeviceEventCallback> globalSubscriptionMap;
+    std::unordered_map<SubscriptionId, DefaultDeviceCallback> defaultDeviceSubscriptionMap;
 
     
     class NotificationClient : public IMMNotificationClient
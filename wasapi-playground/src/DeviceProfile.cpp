@@ -0,0 +1,589 @@
+#include "DeviceProfile.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <cstdio>
+#include <memory>
+
+namespace {
+    // Streaming JSON writer that appends to a caller-owned string. Numbers are formatted on the stack
+    // with std::to_chars, so the only allocations are the growth of the output string.
+    class JsonWriter
+    {
+    public:
+        JsonWriter(std::string& out) : out(out), depth(0) { first[0] = true; }
+
+        void begin_object(const char* key = nullptr) { open(key, '{'); }
+        void end_object() { close('}'); }
+        void begin_array(const char* key = nullptr) { open(key, '['); }
+        void end_array() { close(']'); }
+
+        void value(const char* key, const std::string& text) {
+            write_key(key);
+            write_string(text);
+        }
+
+        void value(const char* key, const char* text) {
+            write_key(key);
+            write_string(text);
+        }
+
+        void value(const char* key, bool flag) {
+            write_key(key);
+            out += flag ? "true" : "false";
+        }
+
+        template<typename T>
+        void number(const char* key, T number) {
+            write_key(key);
+            char digits[32];
+            auto result = std::to_chars(digits, digits + sizeof(digits), number);
+            out.append(digits, result.ptr);
+        }
+
+    private:
+        void open(const char* key, char bracket) {
+            write_key(key);
+            out += bracket;
+            first[++depth] = true;
+        }
+
+        void close(char bracket) {
+            out += bracket;
+            depth--;
+        }
+
+        void write_key(const char* key) {
+            if (!first[depth])
+                out += ',';
+            first[depth] = false;
+
+            if (key != nullptr) {
+                write_string(key);
+                out += ':';
+            }
+        }
+
+        void write_string(std::string_view text) {
+            out += '"';
+            for (auto c : text) {
+                if (c == '"' || c == '\\') {
+                    out += '\\';
+                    out += c;
+                }
+                else if ((unsigned char)c < 0x20) {
+                    char escape[8];
+                    snprintf(escape, sizeof(escape), "\\u%04x", (unsigned int)c);
+                    out += escape;
+                }
+                else {
+                    out += c;
+                }
+            }
+            out += '"';
+        }
+
+        std::string& out;
+        bool first[16];
+        int depth;
+    };
+
+    // Document tree built by the loader. Profiles are small and loaded once, so this side favors simplicity.
+    struct JsonValue {
+        enum class Type { Null, Bool, Number, String, Array, Object } type = Type::Null;
+        bool flag = false;
+        double number = 0;
+        std::string text;
+        std::vector<JsonValue> items;
+        std::vector<std::pair<std::string, JsonValue>> members;
+
+        const JsonValue* find(std::string_view key) const {
+            for (const auto& member : members)
+                if (member.first == key)
+                    return &member.second;
+            return nullptr;
+        }
+
+        double get_number(std::string_view key, double fallback = 0) const {
+            auto member = find(key);
+            return member != nullptr && member->type == Type::Number ? member->number : fallback;
+        }
+
+        bool get_bool(std::string_view key) const {
+            auto member = find(key);
+            return member != nullptr && member->type == Type::Bool && member->flag;
+        }
+
+        std::string get_string(std::string_view key) const {
+            auto member = find(key);
+            return member != nullptr && member->type == Type::String ? member->text : std::string();
+        }
+    };
+
+    class JsonParser
+    {
+    public:
+        JsonParser(std::string_view text) : text(text), position(0) {}
+
+        std::optional<JsonValue> parse() {
+            JsonValue root;
+            if (!parse_value(root, 0))
+                return std::nullopt;
+
+            skip_whitespace();
+            if (position != text.size())
+                return std::nullopt;
+            return root;
+        }
+
+    private:
+        static const int MAX_DEPTH = 32;
+
+        void skip_whitespace() {
+            while (position < text.size() && (text[position] == ' ' || text[position] == '\t' || text[position] == '\n' || text[position] == '\r'))
+                position++;
+        }
+
+        bool consume(char c) {
+            skip_whitespace();
+            if (position < text.size() && text[position] == c) {
+                position++;
+                return true;
+            }
+            return false;
+        }
+
+        bool consume_literal(std::string_view literal) {
+            if (text.substr(position, literal.size()) != literal)
+                return false;
+            position += literal.size();
+            return true;
+        }
+
+        bool parse_value(JsonValue& value, int depth) {
+            if (depth > MAX_DEPTH)
+                return false;
+
+            skip_whitespace();
+            if (position >= text.size())
+                return false;
+
+            switch (text[position]) {
+            case '{':
+                return parse_object(value, depth);
+            case '[':
+                return parse_array(value, depth);
+            case '"':
+                value.type = JsonValue::Type::String;
+                return parse_string(value.text);
+            case 't':
+                value.type = JsonValue::Type::Bool;
+                value.flag = true;
+                return consume_literal("true");
+            case 'f':
+                value.type = JsonValue::Type::Bool;
+                return consume_literal("false");
+            case 'n':
+                return consume_literal("null");
+            default:
+                return parse_number(value);
+            }
+        }
+
+        bool parse_object(JsonValue& value, int depth) {
+            value.type = JsonValue::Type::Object;
+            position++;
+            if (consume('}'))
+                return true;
+
+            do {
+                skip_whitespace();
+                std::string key;
+                if (!parse_string(key) || !consume(':'))
+                    return false;
+
+                value.members.emplace_back(std::move(key), JsonValue());
+                if (!parse_value(value.members.back().second, depth + 1))
+                    return false;
+            } while (consume(','));
+
+            return consume('}');
+        }
+
+        bool parse_array(JsonValue& value, int depth) {
+            value.type = JsonValue::Type::Array;
+            position++;
+            if (consume(']'))
+                return true;
+
+            do {
+                value.items.emplace_back();
+                if (!parse_value(value.items.back(), depth + 1))
+                    return false;
+            } while (consume(','));
+
+            return consume(']');
+        }
+
+        bool parse_string(std::string& out) {
+            if (position >= text.size() || text[position] != '"')
+                return false;
+            position++;
+
+            while (position < text.size()) {
+                auto c = text[position++];
+                if (c == '"')
+                    return true;
+                if (c != '\\') {
+                    out += c;
+                    continue;
+                }
+
+                if (position >= text.size())
+                    return false;
+
+                c = text[position++];
+                switch (c) {
+                case 'n': out += '\n'; break;
+                case 't': out += '\t'; break;
+                case 'r': out += '\r'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'u': {
+                    unsigned int code = 0;
+                    auto digits = text.substr(position, 4);
+                    auto result = std::from_chars(digits.data(), digits.data() + digits.size(), code, 16);
+                    if (digits.size() != 4 || result.ptr != digits.data() + 4)
+                        return false;
+                    append_utf8(out, code);
+                    position += 4;
+                    break;
+                }
+                default: out += c; break;
+                }
+            }
+
+            return false;
+        }
+
+        // Surrogate pairs are not combined: the writer never produces them
+        static void append_utf8(std::string& out, unsigned int code) {
+            if (code < 0x80) {
+                out += (char)code;
+            }
+            else if (code < 0x800) {
+                out += (char)(0xC0 | (code >> 6));
+                out += (char)(0x80 | (code & 0x3F));
+            }
+            else {
+                out += (char)(0xE0 | (code >> 12));
+                out += (char)(0x80 | ((code >> 6) & 0x3F));
+                out += (char)(0x80 | (code & 0x3F));
+            }
+        }
+
+        bool parse_number(JsonValue& value) {
+            auto start = position;
+            while (position < text.size() && strchr("+-0123456789.eE", text[position]) != nullptr)
+                position++;
+
+            if (position == start)
+                return false;
+
+            // std::from_chars for floating point is not available on every toolchain yet
+            char digits[64];
+            auto length = (std::min)(position - start, sizeof(digits) - 1);
+            memcpy(digits, text.data() + start, length);
+            digits[length] = '\0';
+
+            char* end = nullptr;
+            value.type = JsonValue::Type::Number;
+            value.number = strtod(digits, &end);
+            return end == digits + length;
+        }
+
+        std::string_view text;
+        size_t position;
+    };
+
+    const char* connector_name(ConnectorType type) {
+        switch (type) {
+        case Physical_Internal: return "Physical_Internal";
+        case Physical_External: return "Physical_External";
+        case Software_IO: return "Software_IO";
+        case Software_Fixed: return "Software_Fixed";
+        case Network: return "Network";
+        default: return "Unknown_Connector";
+        }
+    }
+
+    ConnectorType connector_from_name(const std::string& name) {
+        const ConnectorType types[] = { Physical_Internal, Physical_External, Software_IO, Software_Fixed, Network };
+        for (auto type : types)
+            if (name == connector_name(type))
+                return type;
+        return Unknown_Connector;
+    }
+
+    void write_guid(JsonWriter& writer, const char* key, const GUID& guid) {
+        char text[40];
+        snprintf(text, sizeof(text), "%08lx-%04x-%04x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+            (unsigned long)guid.Data1, guid.Data2, guid.Data3,
+            guid.Data4[0], guid.Data4[1], guid.Data4[2], guid.Data4[3],
+            guid.Data4[4], guid.Data4[5], guid.Data4[6], guid.Data4[7]);
+        writer.value(key, (const char*)text);
+    }
+
+    // Reads the layout written by write_guid(), all zeroes if the text is malformed
+    GUID read_guid(const std::string& text) {
+        GUID guid{};
+        unsigned char bytes[16] = {};
+        size_t count = 0;
+
+        for (size_t i = 0; i + 1 < text.size() && count < 16; ) {
+            if (text[i] == '-') {
+                i++;
+                continue;
+            }
+
+            auto result = std::from_chars(text.data() + i, text.data() + i + 2, bytes[count], 16);
+            if (result.ptr != text.data() + i + 2)
+                return GUID{};
+            count++;
+            i += 2;
+        }
+
+        if (count != 16)
+            return GUID{};
+
+        guid.Data1 = ((unsigned long)bytes[0] << 24) | ((unsigned long)bytes[1] << 16) | ((unsigned long)bytes[2] << 8) | bytes[3];
+        guid.Data2 = (unsigned short)((bytes[4] << 8) | bytes[5]);
+        guid.Data3 = (unsigned short)((bytes[6] << 8) | bytes[7]);
+        memcpy(guid.Data4, bytes + 8, 8);
+        return guid;
+    }
+
+    void write_wave_format(JsonWriter& writer, const char* key, const WAVEFORMATEX& format, const WAVEFORMATEXTENSIBLE* extensible) {
+        writer.begin_object(key);
+        writer.number("formatTag", format.wFormatTag);
+        writer.number("channels", format.nChannels);
+        writer.number("samplesPerSec", format.nSamplesPerSec);
+        writer.number("avgBytesPerSec", format.nAvgBytesPerSec);
+        writer.number("blockAlign", format.nBlockAlign);
+        writer.number("bitsPerSample", format.wBitsPerSample);
+        writer.number("cbSize", format.cbSize);
+
+        if (extensible != nullptr) {
+            writer.number("validBitsPerSample", extensible->Samples.wValidBitsPerSample);
+            writer.number("channelMask", extensible->dwChannelMask);
+            write_guid(writer, "subFormat", extensible->SubFormat);
+        }
+        writer.end_object();
+    }
+
+    WAVEFORMATEX read_wave_format(const JsonValue& value) {
+        WAVEFORMATEX format{};
+        format.wFormatTag = (WORD)value.get_number("formatTag");
+        format.nChannels = (WORD)value.get_number("channels");
+        format.nSamplesPerSec = (DWORD)value.get_number("samplesPerSec");
+        format.nAvgBytesPerSec = (DWORD)value.get_number("avgBytesPerSec");
+        format.nBlockAlign = (WORD)value.get_number("blockAlign");
+        format.wBitsPerSample = (WORD)value.get_number("bitsPerSample");
+        format.cbSize = (WORD)value.get_number("cbSize");
+        return format;
+    }
+
+    std::optional<WAVEFORMATEXTENSIBLE> read_extensible_format(const JsonValue& value) {
+        if (value.find("subFormat") == nullptr)
+            return std::nullopt;
+
+        WAVEFORMATEXTENSIBLE format{};
+        format.Format = read_wave_format(value);
+        format.Samples.wValidBitsPerSample = (WORD)value.get_number("validBitsPerSample");
+        format.dwChannelMask = (DWORD)value.get_number("channelMask");
+        format.SubFormat = read_guid(value.get_string("subFormat"));
+        return format;
+    }
+
+    void write_device(JsonWriter& writer, const AudioDeviceDetails& device) {
+        writer.begin_object();
+
+        if (device.summary.has_value()) {
+            const auto& summary = device.summary.value();
+            writer.value("id", summary.id);
+            writer.value("friendlyName", summary.friendlyName);
+            writer.value("direction", summary.direction == EDataFlow::eCapture ? "capture" : "render");
+            writer.value("type", connector_name(summary.type));
+        }
+
+        writer.begin_object("volume");
+        writer.number("master", device.volume.masterVolume);
+        writer.value("muted", device.volume.muted);
+        writer.end_object();
+
+        if (device.extendedInfo1.has_value()) {
+            const auto& info = device.extendedInfo1.value();
+            writer.begin_object("audioClient1");
+            writer.number("defaultDevicePeriod", info.defaultDevicePeriod);
+            writer.number("minDevicePeriod", info.minDevicePeriod);
+
+            if (info.extendedStreamFormat.has_value())
+                write_wave_format(writer, "mixFormat", info.extendedStreamFormat.value().Format, &info.extendedStreamFormat.value());
+            else if (info.streamFormat.has_value())
+                write_wave_format(writer, "mixFormat", info.streamFormat.value(), nullptr);
+            writer.end_object();
+        }
+
+        if (device.extendedInfo2.has_value()) {
+            const auto& info = device.extendedInfo2.value();
+            writer.begin_object("audioClient2");
+            writer.number("minSupportedBufferDuration", info.minSupportedBufferDuration);
+            writer.number("maxSupportedBufferDuration", info.maxSupportedBufferDuration);
+            writer.value("isOffloadCapable", info.isOffloadCapable != FALSE);
+            writer.end_object();
+        }
+
+        if (device.extendedInfo3.has_value()) {
+            const auto& info = device.extendedInfo3.value();
+            writer.begin_object("audioClient3");
+            if (info.currentSharedModeFormat.has_value())
+                write_wave_format(writer, "currentSharedModeFormat", info.currentSharedModeFormat.value(), nullptr);
+            writer.number("currentSharedModePeriodInFrames", info.currentSharedModePeriodInFrames);
+            writer.number("defaultPeriodInFrames", info.defaultPeriodInFrames);
+            writer.number("fundamentalPeriodInFrames", info.fundamentalPeriodInFrames);
+            writer.number("minPeriodInFrames", info.minPeriodInFrames);
+            writer.number("maxPeriodInFrames", info.maxPeriodInFrames);
+            writer.end_object();
+        }
+
+        writer.end_object();
+    }
+
+    AudioDeviceDetails read_device(const JsonValue& value) {
+        AudioDeviceDetails device;
+
+        if (value.find("id") != nullptr) {
+            AudioDeviceSummary summary;
+            summary.id = value.get_string("id");
+            summary.handle = DeviceIdTable::instance().intern(summary.id);
+            summary.friendlyName = value.get_string("friendlyName");
+            summary.direction = value.get_string("direction") == "capture" ? EDataFlow::eCapture : EDataFlow::eRender;
+            summary.type = connector_from_name(value.get_string("type"));
+            device.summary = summary;
+        }
+
+        device.volume = {};
+        if (auto volume = value.find("volume"); volume != nullptr) {
+            device.volume.masterVolume = (float)volume->get_number("master");
+            device.volume.muted = volume->get_bool("muted");
+        }
+
+        if (auto client = value.find("audioClient1"); client != nullptr) {
+            AudioInfo1 info;
+            info.defaultDevicePeriod = (REFERENCE_TIME)client->get_number("defaultDevicePeriod");
+            info.minDevicePeriod = (REFERENCE_TIME)client->get_number("minDevicePeriod");
+
+            if (auto format = client->find("mixFormat"); format != nullptr) {
+                info.extendedStreamFormat = read_extensible_format(*format);
+                info.streamFormat = read_wave_format(*format);
+            }
+            device.extendedInfo1 = info;
+        }
+
+        if (auto client = value.find("audioClient2"); client != nullptr) {
+            AudioInfo2 info{};
+            info.minSupportedBufferDuration = (REFERENCE_TIME)client->get_number("minSupportedBufferDuration");
+            info.maxSupportedBufferDuration = (REFERENCE_TIME)client->get_number("maxSupportedBufferDuration");
+            info.isOffloadCapable = client->get_bool("isOffloadCapable");
+            device.extendedInfo2 = info;
+        }
+
+        if (auto client = value.find("audioClient3"); client != nullptr) {
+            AudioInfo3 info{};
+            if (auto format = client->find("currentSharedModeFormat"); format != nullptr)
+                info.currentSharedModeFormat = read_wave_format(*format);
+            info.currentSharedModePeriodInFrames = (UINT32)client->get_number("currentSharedModePeriodInFrames");
+            info.defaultPeriodInFrames = (UINT32)client->get_number("defaultPeriodInFrames");
+            info.fundamentalPeriodInFrames = (UINT32)client->get_number("fundamentalPeriodInFrames");
+            info.minPeriodInFrames = (UINT32)client->get_number("minPeriodInFrames");
+            info.maxPeriodInFrames = (UINT32)client->get_number("maxPeriodInFrames");
+            device.extendedInfo3 = info;
+        }
+
+        return device;
+    }
+}
+
+void write_device_profiles(const std::vector<AudioDeviceDetails>& devices, std::string& out)
+{
+    JsonWriter writer(out);
+    writer.begin_object();
+    writer.number("version", DEVICE_PROFILE_VERSION);
+    writer.begin_array("devices");
+
+    for (const auto& device : devices)
+        write_device(writer, device);
+
+    writer.end_array();
+    writer.end_object();
+}
+
+std::optional<std::vector<AudioDeviceDetails>> read_device_profiles(std::string_view text)
+{
+    auto root = JsonParser(text).parse();
+    if (!root.has_value() || root.value().type != JsonValue::Type::Object)
+        return std::nullopt;
+
+    if (root.value().get_number("version") > DEVICE_PROFILE_VERSION)
+        return std::nullopt;
+
+    std::vector<AudioDeviceDetails> devices;
+    if (auto list = root.value().find("devices"); list != nullptr) {
+        for (const auto& item : list->items)
+            devices.push_back(read_device(item));
+    }
+
+    return devices;
+}
+
+SimulatedEndpointConfig make_simulated_config(const AudioDeviceDetails& profile)
+{
+    SimulatedEndpointConfig config;
+
+    if (profile.summary.has_value()) {
+        config.id = string_to_wstring(profile.summary.value().id);
+        config.friendlyName = profile.summary.value().friendlyName;
+        config.direction = profile.summary.value().direction;
+    }
+
+    if (profile.extendedInfo1.has_value()) {
+        const auto& info = profile.extendedInfo1.value();
+        config.defaultDevicePeriod = info.defaultDevicePeriod;
+        config.minDevicePeriod = info.minDevicePeriod;
+
+        if (info.extendedStreamFormat.has_value())
+            config.mixFormat = info.extendedStreamFormat.value();
+        else if (info.streamFormat.has_value())
+            config.mixFormat = make_wave_format(to_stream_format(&info.streamFormat.value()));
+    }
+
+    // An engine that reported no periods keeps the defaults of SimulatedEndpointConfig
+    if (profile.extendedInfo3.has_value() && profile.extendedInfo3.value().defaultPeriodInFrames != 0) {
+        const auto& info = profile.extendedInfo3.value();
+        config.defaultPeriodInFrames = info.defaultPeriodInFrames;
+        config.fundamentalPeriodInFrames = info.fundamentalPeriodInFrames;
+        config.minPeriodInFrames = info.minPeriodInFrames;
+        config.maxPeriodInFrames = info.maxPeriodInFrames;
+    }
+
+    // Profiles do not record the exclusive formats: offer the usual integer ones at the mix rate
+    auto rate = (unsigned int)config.mixFormat.Format.nSamplesPerSec;
+    auto channels = config.mixFormat.Format.nChannels;
+    config.exclusiveFormats = {
+        StreamFormat{ rate, channels, 32, 24, false },
+        StreamFormat{ rate, channels, 16, 16, false },
+    };
+
+    return config;
+}
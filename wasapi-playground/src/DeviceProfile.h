@@ -0,0 +1,27 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <optional>
+
+#include "AudioDevice.h"
+#include "SimulatedDevice.h"
+
+// Device profiles: AudioDeviceDetails as JSON, one document per machine with the list of its endpoints.
+//
+//   {"version":1,"devices":[{"id":"...","friendlyName":"...","direction":"render","type":"Physical_Internal",
+//     "volume":{"master":0.5,"muted":false},"audioClient1":{...},"audioClient2":{...},"audioClient3":{...}}]}
+//
+// Wave formats keep every WAVEFORMATEX field, plus the extensible part when there is one, so that a profile
+// captured on one machine can be loaded back bit-for-bit on another.
+const int DEVICE_PROFILE_VERSION = 1;
+
+// Appends the profile document to out. Nothing but out itself is allocated: reuse it across calls.
+void write_device_profiles(const std::vector<AudioDeviceDetails>& devices, std::string& out);
+
+// Parses a document written by write_device_profiles(). Device IDs are interned in DeviceIdTable.
+// std::nullopt if the text is not valid JSON or was written by a newer version.
+std::optional<std::vector<AudioDeviceDetails>> read_device_profiles(std::string_view text);
+
+// Endpoint that reports the formats and periods of a captured profile, see SimulatedDevice
+SimulatedEndpointConfig make_simulated_config(const AudioDeviceDetails& profile);
@@ -0,0 +1,330 @@
+#include "DuplexEngine.h"
+#include "SampleConversion.h"
+#include "RealtimeLog.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace {
+    // Upper bound on the wait for the capture event: a lost endpoint stops signaling it
+    const DWORD bufferEventTimeoutMs = 100;
+
+    WAVEFORMATEX* get_shared_format(AudioDevice& device, IAudioClient3* client) {
+        if (client == nullptr)
+            return nullptr;
+
+        auto format = device.get_device_format();
+        WAVEFORMATEX* closestMatch = nullptr;
+        if (FAILED(client->IsFormatSupported(AUDCLNT_SHAREMODE_SHARED, format, &closestMatch))) {
+            CoTaskMemFree(format);
+            return closestMatch;
+        }
+
+        CoTaskMemFree(closestMatch);
+        return format;
+    }
+}
+
+DuplexEngine::DuplexEngine(std::unique_ptr<AudioDevice> input, std::unique_ptr<AudioDevice> output) :
+    inputDevice(std::move(input)),
+    outputDevice(std::move(output)),
+    inputClient(inputDevice->get_audio_client()),
+    outputClient(outputDevice->get_audio_client()),
+    inputFormat(get_shared_format(*inputDevice, inputClient)),
+    outputFormat(get_shared_format(*outputDevice, outputClient)),
+    captureClient(nullptr),
+    renderClient(nullptr),
+    periodInFrames(0),
+    outputBufferFrames(0),
+    running(false),
+    cycles(0),
+    frames(0),
+    droppedInputFrames(0),
+    outputUnderruns(0),
+    inputDiscontinuities(0),
+    maxCycleNs(0),
+    inputMetrics(MetricsRegistry::instance().register_stream(StreamDirection::Capture)),
+    outputMetrics(MetricsRegistry::instance().register_stream(StreamDirection::Render)),
+    worker(std::make_unique<AudioWorker>("duplex", [this]() { duplex_loop(); }))
+{
+}
+
+DuplexEngine::~DuplexEngine()
+{
+    stop();
+    worker.reset();
+    MetricsRegistry::instance().unregister_stream(inputMetrics);
+    MetricsRegistry::instance().unregister_stream(outputMetrics);
+
+    SafeRelease(&captureClient);
+    SafeRelease(&renderClient);
+    SafeRelease(&inputClient);
+    SafeRelease(&outputClient);
+    CoTaskMemFree(inputFormat);
+    CoTaskMemFree(outputFormat);
+
+    if (inputRequest.bufferEvent != nullptr)
+        CloseHandle(inputRequest.bufferEvent);
+}
+
+std::optional<HRESULT> DuplexEngine::initialize(unsigned int requestedPeriod)
+{
+    if (inputFormat == nullptr || outputFormat == nullptr)
+        return S_FALSE;
+
+    if (inputFormat->nSamplesPerSec != outputFormat->nSamplesPerSec) {
+        printf("[DuplexEngine] The endpoints run at different sample rates: %u and %u\n", inputFormat->nSamplesPerSec, outputFormat->nSamplesPerSec);
+        return AUDCLNT_E_UNSUPPORTED_FORMAT;
+    }
+
+    // Only the capture side is event-driven: its packets pace the cycle, the output is written as they arrive
+    if (inputRequest.bufferEvent == nullptr)
+        inputRequest.bufferEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+    inputRequest.lowLatency = true;
+    inputRequest.periodInFrames = requestedPeriod;
+    if (auto error = initialize_stream(*inputDevice, &inputClient, inputFormat, inputRequest, &periodInFrames); error.has_value())
+        return error;
+
+    // The output runs at the period the input got, so that both engines wake up together
+    UINT32 outputPeriod = 0;
+    outputRequest.lowLatency = true;
+    outputRequest.periodInFrames = periodInFrames;
+    if (auto error = initialize_stream(*outputDevice, &outputClient, outputFormat, outputRequest, &outputPeriod); error.has_value())
+        return error;
+
+    auto result = inputClient->GetService(__uuidof(IAudioCaptureClient), reinterpret_cast<void**>(&captureClient));
+    if (FAILED(result)) {
+        printf("[DuplexEngine] Unable to get the capture client: %x\n", result);
+        return result;
+    }
+
+    result = outputClient->GetService(__uuidof(IAudioRenderClient), reinterpret_cast<void**>(&renderClient));
+    if (FAILED(result)) {
+        printf("[DuplexEngine] Unable to get the render client: %x\n", result);
+        return result;
+    }
+
+    auto inputInfo = get_stream_info(inputClient);
+    auto outputInfo = get_stream_info(outputClient);
+    if (!inputInfo.has_value() || !outputInfo.has_value())
+        return S_FALSE;
+
+    outputBufferFrames = outputInfo.value().bufferSizeInFrames;
+    inputSampleFormat = to_stream_format(inputFormat);
+    outputSampleFormat = to_stream_format(outputFormat);
+    inputBuffer.resize((size_t)inputInfo.value().bufferSizeInFrames * inputFormat->nChannels);
+    outputBuffer.resize((size_t)outputBufferFrames * outputFormat->nChannels);
+    routing = ChannelMatrix::between(inputFormat->nChannels, (DWORD)inputSampleFormat.channelMask, outputFormat->nChannels, (DWORD)outputSampleFormat.channelMask);
+
+    inputMetrics->set_stream(inputDevice->get_handle(), inputFormat->nSamplesPerSec, inputInfo.value().bufferSizeInFrames, inputInfo.value().latency);
+    outputMetrics->set_stream(outputDevice->get_handle(), outputFormat->nSamplesPerSec, outputBufferFrames, outputInfo.value().latency);
+    return std::nullopt;
+}
+
+UINT32 DuplexEngine::get_period() const
+{
+    return periodInFrames;
+}
+
+bool DuplexEngine::set_routing(const ChannelMatrix& matrix)
+{
+    if (running || matrix.get_inputs() != routing.get_inputs() || matrix.get_outputs() != routing.get_outputs())
+        return false;
+
+    routing = matrix;
+    return true;
+}
+
+const ChannelMatrix& DuplexEngine::get_routing() const
+{
+    return routing;
+}
+
+void DuplexEngine::start(DuplexCallback callback, UINT32 primeFrames)
+{
+    if (running || captureClient == nullptr || renderClient == nullptr)
+        return;
+
+    userCallback = callback;
+    inputClient->Reset();
+    outputClient->Reset();
+
+    // The headroom of the output: the first cycle only happens once a whole capture period was recorded
+    if (primeFrames == 0)
+        primeFrames = periodInFrames != 0 ? periodInFrames : outputBufferFrames / 2;
+    primeFrames = (std::min)(primeFrames, outputBufferFrames);
+
+    BYTE* silence = nullptr;
+    if (SUCCEEDED(renderClient->GetBuffer(primeFrames, &silence)))
+        renderClient->ReleaseBuffer(primeFrames, AUDCLNT_BUFFERFLAGS_SILENT);
+
+    auto result = outputClient->Start();
+    if (SUCCEEDED(result))
+        result = inputClient->Start();
+    if (FAILED(result)) {
+        printf("[DuplexEngine] Failed to start the streams: %x\n", result);
+        outputClient->Stop();
+        return;
+    }
+
+    running = true;
+    inputMetrics->running = true;
+    outputMetrics->running = true;
+    worker->resume();
+}
+
+void DuplexEngine::stop()
+{
+    if (!running)
+        return;
+
+    running = false;
+    inputClient->Stop();
+    outputClient->Stop();
+
+    // The stopped stream no longer signals the event: wake the duplex thread so it can exit
+    SetEvent(inputRequest.bufferEvent);
+    worker->wait_until_idle();
+
+    inputMetrics->running = false;
+    outputMetrics->running = false;
+}
+
+void DuplexEngine::duplex_loop()
+{
+    while (running) {
+        {
+            TRACE_SCOPE("wait");
+            WaitForSingleObject(inputRequest.bufferEvent, bufferEventTimeoutMs);
+        }
+
+        if (FAILED(run_cycle())) {
+            inputMetrics->add_error();
+            outputMetrics->add_error();
+        }
+    }
+}
+
+HRESULT DuplexEngine::run_cycle()
+{
+    TRACE_SCOPE("duplex cycle");
+
+    UINT32 packetLength = 0;
+    auto result = captureClient->GetNextPacketSize(&packetLength);
+    if (FAILED(result)) {
+        realtime_log(LogSite::CaptureGetNextPacketSize, result);
+        return result;
+    }
+
+    while (packetLength != 0) {
+        auto cycleStart = std::chrono::steady_clock::now();
+
+        BYTE* inputData = nullptr;
+        UINT32 inputFrames = 0;
+        DWORD flags = 0;
+        result = captureClient->GetBuffer(&inputData, &inputFrames, &flags, NULL, NULL);
+        if (FAILED(result)) {
+            realtime_log(LogSite::CaptureGetBuffer, result);
+            return result;
+        }
+
+        if (flags & AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY) {
+            inputDiscontinuities.fetch_add(1, std::memory_order_relaxed);
+            inputMetrics->add_underrun();
+        }
+
+        UINT32 padding = 0;
+        result = outputClient->GetCurrentPadding(&padding);
+        if (FAILED(result)) {
+            realtime_log(LogSite::RenderGetCurrentPadding, result);
+            captureClient->ReleaseBuffer(inputFrames);
+            return result;
+        }
+
+        if (padding == 0) {
+            outputUnderruns.fetch_add(1, std::memory_order_relaxed);
+            outputMetrics->add_underrun();
+        }
+        outputMetrics->set_fill(padding);
+
+        // The output can not take more than its free space: the rest of the input is lost
+        auto count = (std::min)(inputFrames, outputBufferFrames - padding);
+        if (count < inputFrames)
+            droppedInputFrames.fetch_add(inputFrames - count, std::memory_order_relaxed);
+
+        const float* input = reinterpret_cast<const float*>(inputData);
+        if (flags & AUDCLNT_BUFFERFLAGS_SILENT) {
+            std::fill(inputBuffer.begin(), inputBuffer.begin() + (size_t)count * inputFormat->nChannels, 0.0f);
+            input = inputBuffer.data();
+        }
+        else if (!is_float32(inputSampleFormat)) {
+            pcm_to_float(inputData, inputBuffer.data(), (size_t)count * inputFormat->nChannels, inputSampleFormat);
+            input = inputBuffer.data();
+        }
+
+        BYTE* outputData = nullptr;
+        result = count > 0 ? renderClient->GetBuffer(count, &outputData) : S_OK;
+        if (FAILED(result)) {
+            realtime_log(LogSite::RenderGetBuffer, result, count);
+            captureClient->ReleaseBuffer(inputFrames);
+            return result;
+        }
+
+        if (count > 0) {
+            bool convert = !is_float32(outputSampleFormat);
+            float* output = convert ? outputBuffer.data() : reinterpret_cast<float*>(outputData);
+
+            {
+                TRACE_SCOPE("duplex callback");
+                userCallback({ input, inputFormat->nChannels, output, outputFormat->nChannels, count, outputFormat->nSamplesPerSec, &routing });
+            }
+
+            if (convert)
+                float_to_pcm(output, outputData, (size_t)count * outputFormat->nChannels, outputSampleFormat);
+
+            result = renderClient->ReleaseBuffer(count, 0);
+            if (FAILED(result)) {
+                realtime_log(LogSite::RenderReleaseBuffer, result, count);
+                captureClient->ReleaseBuffer(inputFrames);
+                return result;
+            }
+        }
+
+        result = captureClient->ReleaseBuffer(inputFrames);
+        if (FAILED(result)) {
+            realtime_log(LogSite::CaptureReleaseBuffer, result, inputFrames);
+            return result;
+        }
+
+        auto cycleNs = (UINT64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - cycleStart).count();
+        if (cycleNs > maxCycleNs.load(std::memory_order_relaxed))
+            maxCycleNs.store(cycleNs, std::memory_order_relaxed);
+
+        cycles.fetch_add(1, std::memory_order_relaxed);
+        frames.fetch_add(count, std::memory_order_relaxed);
+        inputMetrics->add_callback(inputFrames, cycleNs);
+        outputMetrics->add_callback(count, cycleNs);
+
+        result = captureClient->GetNextPacketSize(&packetLength);
+        if (FAILED(result)) {
+            realtime_log(LogSite::CaptureGetNextPacketSize, result);
+            return result;
+        }
+    }
+
+    return S_OK;
+}
+
+DuplexStats DuplexEngine::get_stats() const
+{
+    DuplexStats stats;
+    stats.cycles = cycles.load(std::memory_order_relaxed);
+    stats.frames = frames.load(std::memory_order_relaxed);
+    stats.droppedInputFrames = droppedInputFrames.load(std::memory_order_relaxed);
+    stats.outputUnderruns = outputUnderruns.load(std::memory_order_relaxed);
+    stats.inputDiscontinuities = inputDiscontinuities.load(std::memory_order_relaxed);
+    stats.maxCycleMs = maxCycleNs.load(std::memory_order_relaxed) / 1e6;
+    return stats;
+}
@@ -0,0 +1,108 @@
+#pragma once
+#include <functional>
+#include <memory>
+#include <optional>
+#include <vector>
+#include <atomic>
+
+#include <MMDeviceAPI.h>
+#include <AudioClient.h>
+
+#include "AudioDevice.h"
+#include "StreamInitialization.h"
+#include "StreamMetrics.h"
+#include "AudioWorker.h"
+#include "ChannelMatrix.h"
+#include "common.h"
+
+// Buffers of one duplex cycle, interleaved float. Both hold the same number of frames.
+struct DuplexBuffers {
+	const float* input;				// silence when the capture packet was flagged silent
+	WORD inputChannels;
+	float* output;
+	WORD outputChannels;
+	UINT32 frames;
+	DWORD sampleRate;
+	const ChannelMatrix* routing;	// input channels to output channels, for callbacks that pass the input through
+};
+
+typedef std::function<void(const DuplexBuffers& buffers)> DuplexCallback;
+
+struct DuplexStats {
+	UINT64 cycles = 0;
+	UINT64 frames = 0;
+	UINT64 droppedInputFrames = 0;		// captured frames that did not fit in the output buffer
+	UINT64 outputUnderruns = 0;			// the output ran dry before a cycle wrote to it
+	UINT64 inputDiscontinuities = 0;	// the engine overwrote captured frames before they were read
+	double maxCycleMs = 0;
+};
+
+// Services a capture and a render endpoint from one thread: every capture period, the input packet is read,
+// handed to the callback together with the output buffer, and the output is written back in the same cycle.
+// The round trip is then one capture period, the primed output frames and the two engine latencies,
+// without a queue between two independent threads.
+class DuplexEngine
+{
+public:
+	DuplexEngine(std::unique_ptr<AudioDevice> input, std::unique_ptr<AudioDevice> output);
+	DuplexEngine(const DuplexEngine& other) = delete;
+	~DuplexEngine();
+
+	// Opens both endpoints in low-latency shared mode, at their mix format, the capture stream event-driven.
+	// No resampling: both mix formats must have the same sample rate.
+	std::optional<HRESULT> initialize(unsigned int periodInFrames = 0);
+
+	// Capture period, which is also the cycle of the engine
+	UINT32 get_period() const;
+
+	// The routing handed to the callback: after initialize(), the standard mapping of the capture layout onto
+	// the render one. A custom routing must have the channels of both endpoints. Not while the engine runs.
+	bool set_routing(const ChannelMatrix& matrix);
+	const ChannelMatrix& get_routing() const;
+
+	// The output is primed with primeFrames of silence (0 for one period): the headroom the callback has
+	// before the output runs dry. It is also added to the round trip.
+	void start(DuplexCallback callback, UINT32 primeFrames = 0);
+	void stop();
+
+	DuplexStats get_stats() const;
+
+private:
+	void duplex_loop();
+	HRESULT run_cycle();
+
+	std::unique_ptr<AudioDevice> inputDevice;
+	std::unique_ptr<AudioDevice> outputDevice;
+	IAudioClient3* inputClient;
+	IAudioClient3* outputClient;
+	WAVEFORMATEX* inputFormat;
+	WAVEFORMATEX* outputFormat;
+	IAudioCaptureClient* captureClient;
+	IAudioRenderClient* renderClient;
+	StreamRequest inputRequest;
+	StreamRequest outputRequest;
+	UINT32 periodInFrames;
+	UINT32 outputBufferFrames;
+
+	// Float copies of the endpoint buffers, used when an endpoint is silent or takes integer samples
+	StreamFormat inputSampleFormat;
+	StreamFormat outputSampleFormat;
+	std::vector<float> inputBuffer;
+	std::vector<float> outputBuffer;
+	ChannelMatrix routing;
+
+	DuplexCallback userCallback;
+	std::atomic_bool running;
+
+	std::atomic<UINT64> cycles;
+	std::atomic<UINT64> frames;
+	std::atomic<UINT64> droppedInputFrames;
+	std::atomic<UINT64> outputUnderruns;
+	std::atomic<UINT64> inputDiscontinuities;
+	std::atomic<UINT64> maxCycleNs;
+
+	std::shared_ptr<StreamCounters> inputMetrics;
+	std::shared_ptr<StreamCounters> outputMetrics;
+
+	std::unique_ptr<AudioWorker> worker;
+};
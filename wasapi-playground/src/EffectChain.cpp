@@ -0,0 +1,115 @@
+#include "EffectChain.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <chrono>
+
+EffectChain::EffectChain(size_t maxEvents) :
+    events(maxEvents),
+    sampleRate(0),
+    channels(0),
+    position(0)
+{
+}
+
+size_t EffectChain::add(std::unique_ptr<AudioEffect> effect)
+{
+    auto stage = std::make_unique<Stage>();
+    stage->effect = std::move(effect);
+    if (channels != 0)
+        stage->effect->prepare(sampleRate, channels);
+
+    stages.push_back(std::move(stage));
+    return stages.size() - 1;
+}
+
+size_t EffectChain::size() const
+{
+    return stages.size();
+}
+
+bool EffectChain::schedule(size_t effect, unsigned int parameter, float value, UINT64 frame)
+{
+    if (effect >= stages.size())
+        return false;
+
+    return events.push(ParameterEvent{ frame, effect, parameter, value });
+}
+
+bool EffectChain::set_parameter(size_t effect, unsigned int parameter, float value)
+{
+    return schedule(effect, parameter, value, 0);
+}
+
+UINT64 EffectChain::get_position() const
+{
+    return position.load(std::memory_order_relaxed);
+}
+
+EffectChainStats EffectChain::get_stats() const
+{
+    EffectChainStats stats;
+    for (const auto& stage : stages) {
+        EffectStats effect;
+        effect.name = stage->effect->get_name();
+        effect.frames = stage->cost.get_frames();
+        effect.nsPerFrame = stage->cost.get_ns_per_frame();
+        effect.maxBlockMs = stage->cost.get_max_block_ms();
+        stats.effects.push_back(effect);
+    }
+
+    stats.position = get_position();
+    stats.droppedEvents = events.get_dropped();
+    return stats;
+}
+
+void EffectChain::prepare(DWORD sampleRate, WORD channels)
+{
+    if (sampleRate == this->sampleRate && channels == this->channels)
+        return;
+
+    this->sampleRate = sampleRate;
+    this->channels = channels;
+    for (auto& stage : stages)
+        stage->effect->prepare(sampleRate, channels);
+}
+
+void EffectChain::reset()
+{
+    for (auto& stage : stages)
+        stage->effect->reset();
+}
+
+void EffectChain::run_stages(float* samples, UINT32 frames)
+{
+    for (auto& stage : stages) {
+        auto start = std::chrono::steady_clock::now();
+        stage->effect->process(samples, frames);
+        auto elapsedNs = (UINT64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        stage->cost.add(frames, elapsedNs);
+    }
+}
+
+void EffectChain::process(float* samples, UINT32 frames)
+{
+    TRACE_SCOPE("effects");
+
+    if (channels == 0)
+        return;
+
+    events.collect();
+
+    auto start = position.load(std::memory_order_relaxed);
+    UINT32 done = 0;
+    while (done < frames) {
+        auto nextEvent = events.apply_due(start + done, start + frames, [this](const ParameterEvent& event) {
+            stages[event.effect]->effect->set_parameter(event.parameter, event.value);
+        });
+
+        auto length = (UINT32)(nextEvent - (start + done));
+        run_stages(samples + (size_t)done * channels, length);
+        done += length;
+    }
+
+    position.store(start + frames, std::memory_order_relaxed);
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include <atomic>
+
+#include <windows.h>
+
+#include "Effects.h"
+#include "BlockCost.h"
+#include "ScheduledEvents.h"
+
+struct EffectStats {
+	const char* name = nullptr;
+	UINT64 frames = 0;
+	double nsPerFrame = 0;						// average cost of the effect over every block it processed
+	double maxBlockMs = 0;
+};
+
+struct EffectChainStats {
+	std::vector<EffectStats> effects;
+	UINT64 position = 0;
+	UINT64 droppedEvents = 0;					// parameter changes that did not fit in the queue
+};
+
+// Effects run one after the other on a stream, in place, with parameter changes scheduled at an exact frame.
+// The changes reach the audio thread through a lock-free queue; a block is split at every frame a change is
+// due, so that the effects after it see it from that frame on, whatever the block size.
+// Plugged into a stream with AudioRenderer::set_effects() or AudioCapturer::set_effects(), or run from a
+// callback with process().
+class EffectChain
+{
+public:
+	EffectChain(size_t maxEvents = 256);
+	EffectChain(const EffectChain& other) = delete;
+
+	// Before the chain processes anything. Returns the index of the effect.
+	size_t add(std::unique_ptr<AudioEffect> effect);
+	size_t size() const;
+
+	// Control side, any thread. frame counts from the first frame the chain processed, see get_position(); a frame already processed
+	// applies at the start of the next block. Returns false when the queue is full.
+	bool schedule(size_t effect, unsigned int parameter, float value, UINT64 frame);
+	// At the start of the next block
+	bool set_parameter(size_t effect, unsigned int parameter, float value);
+
+	// Frames processed so far
+	UINT64 get_position() const;
+	EffectChainStats get_stats() const;
+
+	// Audio side. prepare() may allocate: it runs while the stream is idle, and does nothing when the format
+	// did not change, so that the tails carry on across a migration to a similar endpoint.
+	void prepare(DWORD sampleRate, WORD channels);
+	void reset();
+	// Interleaved frames of the prepared channels. Does not allocate.
+	void process(float* samples, UINT32 frames);
+
+private:
+	struct ParameterEvent {
+		UINT64 frame;
+		size_t effect;
+		unsigned int parameter;
+		float value;
+	};
+
+	struct Stage {
+		std::unique_ptr<AudioEffect> effect;
+		BlockCost cost;
+	};
+
+	void run_stages(float* samples, UINT32 frames);
+
+	std::vector<std::unique_ptr<Stage>> stages;
+	ScheduledEvents<ParameterEvent> events;
+
+	// Audio side
+	DWORD sampleRate;
+	WORD channels;
+	std::atomic<UINT64> position;
+};
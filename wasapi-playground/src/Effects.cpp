@@ -0,0 +1,592 @@
+#include "Effects.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#include <xmmintrin.h>
+#define EFFECTS_SSE
+#endif
+
+namespace {
+    const float pi = 3.14159265358979f;
+
+    // Beyond this, a cascade of biquads no longer keeps its state in registers
+    const unsigned int maxSections = 8;
+
+    // Chorus: the delay swings around this
+    const float chorusBaseMs = 7.0f;
+
+    // Reverb: mutually prime line lengths, at 48kHz
+    const float reverbLineMs[4] = { 29.7f, 37.1f, 41.1f, 43.7f };
+
+    // Four channels of one frame, or any four values processed together
+    struct Lanes {
+#ifdef EFFECTS_SSE
+        __m128 v;
+
+        static Lanes set(float value) { return { _mm_set1_ps(value) }; }
+        static Lanes load(const float* source) { return { _mm_loadu_ps(source) }; }
+        void store(float* destination) const { _mm_storeu_ps(destination, v); }
+
+        Lanes operator+(Lanes other) const { return { _mm_add_ps(v, other.v) }; }
+        Lanes operator-(Lanes other) const { return { _mm_sub_ps(v, other.v) }; }
+        Lanes operator*(Lanes other) const { return { _mm_mul_ps(v, other.v) }; }
+
+        float sum() const {
+            auto pairs = _mm_add_ps(v, _mm_movehl_ps(v, v));
+            return _mm_cvtss_f32(_mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, 1)));
+        }
+#else
+        float v[4];
+
+        static Lanes set(float value) { return { { value, value, value, value } }; }
+        static Lanes load(const float* source) { return { { source[0], source[1], source[2], source[3] } }; }
+        void store(float* destination) const { std::copy(v, v + 4, destination); }
+
+        Lanes operator+(Lanes other) const { return { { v[0] + other.v[0], v[1] + other.v[1], v[2] + other.v[2], v[3] + other.v[3] } }; }
+        Lanes operator-(Lanes other) const { return { { v[0] - other.v[0], v[1] - other.v[1], v[2] - other.v[2], v[3] - other.v[3] } }; }
+        Lanes operator*(Lanes other) const { return { { v[0] * other.v[0], v[1] * other.v[1], v[2] * other.v[2], v[3] * other.v[3] } }; }
+
+        float sum() const { return v[0] + v[1] + v[2] + v[3]; }
+#endif
+
+        // The last group of channels can be partial: its missing lanes read as 0 and are not written
+        static Lanes load(const float* source, size_t count) {
+#ifdef EFFECTS_SSE
+            switch (count) {
+            case 1: return { _mm_load_ss(source) };
+            case 2: return { _mm_loadl_pi(_mm_setzero_ps(), reinterpret_cast<const __m64*>(source)) };
+            case 3: return { _mm_movelh_ps(_mm_loadl_pi(_mm_setzero_ps(), reinterpret_cast<const __m64*>(source)), _mm_load_ss(source + 2)) };
+            default: return load(source);
+            }
+#else
+            Lanes lanes = set(0);
+            std::copy(source, source + count, lanes.v);
+            return lanes;
+#endif
+        }
+
+        void store(float* destination, size_t count) const {
+#ifdef EFFECTS_SSE
+            switch (count) {
+            case 1: _mm_store_ss(destination, v); break;
+            case 2: _mm_storel_pi(reinterpret_cast<__m64*>(destination), v); break;
+            case 3:
+                _mm_storel_pi(reinterpret_cast<__m64*>(destination), v);
+                _mm_store_ss(destination + 2, _mm_movehl_ps(v, v));
+                break;
+            default: store(destination);
+            }
+#else
+            std::copy(v, v + count, destination);
+#endif
+        }
+    };
+
+    size_t channel_groups(WORD channels) { return ((size_t)channels + 3) / 4; }
+    size_t group_lanes(WORD channels, size_t group) { return (std::min)((size_t)4, (size_t)channels - group * 4); }
+
+    size_t ms_to_frames(float ms, DWORD sampleRate) { return (size_t)std::lround(ms * sampleRate / 1000.0f); }
+}
+
+// ---------------------------------------------------------------------------------------------------------------
+
+BiquadFilter::BiquadFilter(FilterType type, float frequency, float q, float gainDb, unsigned int sections) :
+    type(type),
+    sections(std::clamp(sections, 1u, maxSections)),
+    frequency(frequency),
+    q(q),
+    gainDb(gainDb),
+    sampleRate(48000),
+    channels(0),
+    b0(1), b1(0), b2(0), a1(0), a2(0)
+{
+}
+
+const char* BiquadFilter::get_name() const
+{
+    return "biquad";
+}
+
+void BiquadFilter::prepare(DWORD sampleRate, WORD channels)
+{
+    this->sampleRate = sampleRate;
+    this->channels = channels;
+    state.assign(channel_groups(channels) * 4 * 2 * sections, 0.0f);
+    update_coefficients();
+}
+
+void BiquadFilter::reset()
+{
+    std::fill(state.begin(), state.end(), 0.0f);
+}
+
+void BiquadFilter::set_parameter(unsigned int parameter, float value)
+{
+    switch (parameter) {
+    case Frequency: frequency = value; break;
+    case Q: q = value; break;
+    case GainDb: gainDb = value; break;
+    default: return;
+    }
+    update_coefficients();
+}
+
+void BiquadFilter::update_coefficients()
+{
+    auto w0 = 2 * pi * std::clamp(frequency, 1.0f, 0.49f * sampleRate) / sampleRate;
+    auto cosW0 = std::cos(w0);
+    auto alpha = std::sin(w0) / (2 * (std::max)(q, 0.01f));
+    auto a = std::pow(10.0f, gainDb / 40);
+    auto shelf = 2 * std::sqrt(a) * alpha;
+
+    float nb0 = 1, nb1 = 0, nb2 = 0, na0 = 1, na1 = 0, na2 = 0;
+    switch (type) {
+    case FilterType::LowPass:
+        nb0 = (1 - cosW0) / 2; nb1 = 1 - cosW0; nb2 = nb0;
+        na0 = 1 + alpha; na1 = -2 * cosW0; na2 = 1 - alpha;
+        break;
+    case FilterType::HighPass:
+        nb0 = (1 + cosW0) / 2; nb1 = -(1 + cosW0); nb2 = nb0;
+        na0 = 1 + alpha; na1 = -2 * cosW0; na2 = 1 - alpha;
+        break;
+    case FilterType::BandPass:
+        nb0 = alpha; nb1 = 0; nb2 = -alpha;
+        na0 = 1 + alpha; na1 = -2 * cosW0; na2 = 1 - alpha;
+        break;
+    case FilterType::Notch:
+        nb0 = 1; nb1 = -2 * cosW0; nb2 = 1;
+        na0 = 1 + alpha; na1 = -2 * cosW0; na2 = 1 - alpha;
+        break;
+    case FilterType::Peak:
+        nb0 = 1 + alpha * a; nb1 = -2 * cosW0; nb2 = 1 - alpha * a;
+        na0 = 1 + alpha / a; na1 = -2 * cosW0; na2 = 1 - alpha / a;
+        break;
+    case FilterType::LowShelf:
+        nb0 = a * ((a + 1) - (a - 1) * cosW0 + shelf);
+        nb1 = 2 * a * ((a - 1) - (a + 1) * cosW0);
+        nb2 = a * ((a + 1) - (a - 1) * cosW0 - shelf);
+        na0 = (a + 1) + (a - 1) * cosW0 + shelf;
+        na1 = -2 * ((a - 1) + (a + 1) * cosW0);
+        na2 = (a + 1) + (a - 1) * cosW0 - shelf;
+        break;
+    case FilterType::HighShelf:
+        nb0 = a * ((a + 1) + (a - 1) * cosW0 + shelf);
+        nb1 = -2 * a * ((a - 1) + (a + 1) * cosW0);
+        nb2 = a * ((a + 1) + (a - 1) * cosW0 - shelf);
+        na0 = (a + 1) - (a - 1) * cosW0 + shelf;
+        na1 = 2 * ((a - 1) - (a + 1) * cosW0);
+        na2 = (a + 1) - (a - 1) * cosW0 - shelf;
+        break;
+    }
+
+    b0 = nb0 / na0;
+    b1 = nb1 / na0;
+    b2 = nb2 / na0;
+    a1 = na1 / na0;
+    a2 = na2 / na0;
+}
+
+void BiquadFilter::process(float* samples, UINT32 frames)
+{
+    TRACE_SCOPE("biquad");
+
+    auto cb0 = Lanes::set(b0), cb1 = Lanes::set(b1), cb2 = Lanes::set(b2), ca1 = Lanes::set(a1), ca2 = Lanes::set(a2);
+
+    // Group by group, so that the state of every section stays in registers across the frames
+    for (size_t group = 0; group < channel_groups(channels); group++) {
+        auto lanes = group_lanes(channels, group);
+        float* groupState = state.data() + group * 8 * sections;
+
+        Lanes z1[maxSections], z2[maxSections];
+        for (unsigned int section = 0; section < sections; section++) {
+            z1[section] = Lanes::load(groupState + section * 8);
+            z2[section] = Lanes::load(groupState + section * 8 + 4);
+        }
+
+        float* sample = samples + group * 4;
+        for (UINT32 frame = 0; frame < frames; frame++, sample += channels) {
+            auto x = Lanes::load(sample, lanes);
+            for (unsigned int section = 0; section < sections; section++) {
+                auto y = cb0 * x + z1[section];
+                z1[section] = cb1 * x - ca1 * y + z2[section];
+                z2[section] = cb2 * x - ca2 * y;
+                x = y;
+            }
+            x.store(sample, lanes);
+        }
+
+        for (unsigned int section = 0; section < sections; section++) {
+            z1[section].store(groupState + section * 8);
+            z2[section].store(groupState + section * 8 + 4);
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------
+
+StateVariableFilter::StateVariableFilter(SvfMode mode, float frequency, float resonance) :
+    mode(mode),
+    frequency(frequency),
+    resonance(resonance),
+    sampleRate(48000),
+    channels(0),
+    g(0), k(0), a1(0), a2(0), a3(0)
+{
+}
+
+const char* StateVariableFilter::get_name() const
+{
+    return "state variable filter";
+}
+
+void StateVariableFilter::prepare(DWORD sampleRate, WORD channels)
+{
+    this->sampleRate = sampleRate;
+    this->channels = channels;
+    state.assign(channel_groups(channels) * 4 * 2, 0.0f);
+    update_coefficients();
+}
+
+void StateVariableFilter::reset()
+{
+    std::fill(state.begin(), state.end(), 0.0f);
+}
+
+void StateVariableFilter::set_parameter(unsigned int parameter, float value)
+{
+    switch (parameter) {
+    case Frequency: frequency = value; break;
+    case Resonance: resonance = value; break;
+    default: return;
+    }
+    update_coefficients();
+}
+
+void StateVariableFilter::update_coefficients()
+{
+    g = std::tan(pi * std::clamp(frequency, 1.0f, 0.49f * sampleRate) / sampleRate);
+    k = 1 / (std::max)(resonance, 0.5f);
+    a1 = 1 / (1 + g * (g + k));
+    a2 = g * a1;
+    a3 = g * a2;
+}
+
+void StateVariableFilter::process(float* samples, UINT32 frames)
+{
+    TRACE_SCOPE("state variable filter");
+
+    auto ca1 = Lanes::set(a1), ca2 = Lanes::set(a2), ca3 = Lanes::set(a3), ck = Lanes::set(k), two = Lanes::set(2);
+
+    for (size_t group = 0; group < channel_groups(channels); group++) {
+        auto lanes = group_lanes(channels, group);
+        float* groupState = state.data() + group * 8;
+        auto ic1 = Lanes::load(groupState);
+        auto ic2 = Lanes::load(groupState + 4);
+
+        float* sample = samples + group * 4;
+        for (UINT32 frame = 0; frame < frames; frame++, sample += channels) {
+            auto v0 = Lanes::load(sample, lanes);
+            auto v3 = v0 - ic2;
+            auto v1 = ca1 * ic1 + ca2 * v3;
+            auto v2 = ic2 + ca2 * ic1 + ca3 * v3;
+            ic1 = two * v1 - ic1;
+            ic2 = two * v2 - ic2;
+
+            Lanes y = v2;
+            switch (mode) {
+            case SvfMode::LowPass: y = v2; break;
+            case SvfMode::BandPass: y = v1; break;
+            case SvfMode::HighPass: y = v0 - ck * v1 - v2; break;
+            case SvfMode::Notch: y = v0 - ck * v1; break;
+            }
+            y.store(sample, lanes);
+        }
+
+        ic1.store(groupState);
+        ic2.store(groupState + 4);
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------
+
+Delay::Delay(float maxTimeMs, float timeMs, float feedback, float mix) :
+    maxTimeMs(maxTimeMs),
+    timeMs(timeMs),
+    feedback(feedback),
+    mix(mix),
+    sampleRate(48000),
+    channels(0),
+    stride(0),
+    lineFrames(1),
+    delayFrames(1),
+    writeFrame(0)
+{
+}
+
+const char* Delay::get_name() const
+{
+    return "delay";
+}
+
+void Delay::prepare(DWORD sampleRate, WORD channels)
+{
+    this->sampleRate = sampleRate;
+    this->channels = channels;
+    stride = channel_groups(channels) * 4;
+    lineFrames = ms_to_frames(maxTimeMs, sampleRate) + 1;
+    line.assign(lineFrames * stride, 0.0f);
+    set_parameter(TimeMs, timeMs);
+    writeFrame = 0;
+}
+
+void Delay::reset()
+{
+    std::fill(line.begin(), line.end(), 0.0f);
+    writeFrame = 0;
+}
+
+void Delay::set_parameter(unsigned int parameter, float value)
+{
+    switch (parameter) {
+    case TimeMs:
+        timeMs = value;
+        delayFrames = std::clamp(ms_to_frames(value, sampleRate), (size_t)1, lineFrames - 1);
+        break;
+    case Feedback: feedback = std::clamp(value, 0.0f, 0.99f); break;
+    case Mix: mix = std::clamp(value, 0.0f, 1.0f); break;
+    }
+}
+
+void Delay::process(float* samples, UINT32 frames)
+{
+    TRACE_SCOPE("delay");
+
+    auto cFeedback = Lanes::set(feedback), cMix = Lanes::set(mix);
+    const auto groups = channel_groups(channels);
+
+    float* frameSamples = samples;
+    for (UINT32 frame = 0; frame < frames; frame++, frameSamples += channels) {
+        auto readFrame = writeFrame >= delayFrames ? writeFrame - delayFrames : writeFrame + lineFrames - delayFrames;
+        float* written = line.data() + writeFrame * stride;
+        const float* delayed = line.data() + readFrame * stride;
+
+        for (size_t group = 0; group < groups; group++) {
+            auto lanes = group_lanes(channels, group);
+            auto x = Lanes::load(frameSamples + group * 4, lanes);
+            auto wet = Lanes::load(delayed + group * 4);
+            (x + cFeedback * wet).store(written + group * 4);
+            (x + cMix * (wet - x)).store(frameSamples + group * 4, lanes);
+        }
+
+        if (++writeFrame == lineFrames)
+            writeFrame = 0;
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------
+
+Chorus::Chorus(float rateHz, float depthMs, float mix) :
+    rateHz(rateHz),
+    depthMs(depthMs),
+    mix(mix),
+    sampleRate(48000),
+    channels(0),
+    stride(0),
+    lineFrames(1),
+    writeFrame(0),
+    phase(0)
+{
+}
+
+const char* Chorus::get_name() const
+{
+    return "chorus";
+}
+
+void Chorus::prepare(DWORD sampleRate, WORD channels)
+{
+    this->sampleRate = sampleRate;
+    this->channels = channels;
+    stride = channel_groups(channels) * 4;
+
+    // Room for the deepest setting, plus the frame interpolated with
+    lineFrames = ms_to_frames(chorusBaseMs * 2 + 2, sampleRate) + 2;
+    line.assign(lineFrames * stride, 0.0f);
+    writeFrame = 0;
+    phase = 0;
+}
+
+void Chorus::reset()
+{
+    std::fill(line.begin(), line.end(), 0.0f);
+    writeFrame = 0;
+    phase = 0;
+}
+
+void Chorus::set_parameter(unsigned int parameter, float value)
+{
+    switch (parameter) {
+    case RateHz: rateHz = (std::max)(value, 0.0f); break;
+    case DepthMs: depthMs = std::clamp(value, 0.0f, chorusBaseMs); break;
+    case Mix: mix = std::clamp(value, 0.0f, 1.0f); break;
+    }
+}
+
+void Chorus::process(float* samples, UINT32 frames)
+{
+    TRACE_SCOPE("chorus");
+
+    const auto groups = channel_groups(channels);
+    const float baseFrames = chorusBaseMs * sampleRate / 1000;
+    const float depthFrames = depthMs * sampleRate / 1000;
+    const double phaseStep = (double)rateHz / sampleRate;
+    auto cMix = Lanes::set(mix);
+
+    // The LFO runs as a rotating phasor: channel c reads its sine a quarter period further, (s, c, -s, -c)
+    auto angle = 2 * pi * (float)phase;
+    float lfoSin = std::sin(angle), lfoCos = std::cos(angle);
+    const float stepSin = std::sin(2 * pi * (float)phaseStep), stepCos = std::cos(2 * pi * (float)phaseStep);
+    const float quadrature[4][2] = { { 1, 0 }, { 0, 1 }, { -1, 0 }, { 0, -1 } };
+
+    float* frameSamples = samples;
+    for (UINT32 frame = 0; frame < frames; frame++, frameSamples += channels) {
+        float* written = line.data() + writeFrame * stride;
+
+        for (size_t group = 0; group < groups; group++) {
+            auto lanes = group_lanes(channels, group);
+            auto x = Lanes::load(frameSamples + group * 4, lanes);
+            x.store(written + group * 4);
+
+            float wet[4] = {};
+            for (size_t lane = 0; lane < lanes; lane++) {
+                auto lfo = quadrature[lane][0] * lfoSin + quadrature[lane][1] * lfoCos;
+                auto delay = baseFrames + depthFrames * lfo;
+                auto whole = (size_t)delay;
+                auto fraction = delay - whole;
+
+                auto newer = writeFrame >= whole ? writeFrame - whole : writeFrame + lineFrames - whole;
+                auto older = newer != 0 ? newer - 1 : lineFrames - 1;
+                auto channel = group * 4 + lane;
+                wet[lane] = line[newer * stride + channel] + fraction * (line[older * stride + channel] - line[newer * stride + channel]);
+            }
+
+            (x + cMix * (Lanes::load(wet) - x)).store(frameSamples + group * 4, lanes);
+        }
+
+        auto nextSin = lfoSin * stepCos + lfoCos * stepSin;
+        lfoCos = lfoCos * stepCos - lfoSin * stepSin;
+        lfoSin = nextSin;
+
+        if (++writeFrame == lineFrames)
+            writeFrame = 0;
+    }
+
+    // The phasor drifts in float: the next block starts again from the exact phase
+    phase = std::fmod(phase + phaseStep * frames, 1.0);
+}
+
+// ---------------------------------------------------------------------------------------------------------------
+
+Reverb::Reverb(float decaySeconds, float damping, float mix) :
+    decaySeconds(decaySeconds),
+    damping(damping),
+    mix(mix),
+    sampleRate(48000),
+    channels(0),
+    lengths{ 1, 1, 1, 1 },
+    feedbackGains{},
+    positions{},
+    lowPass{}
+{
+}
+
+const char* Reverb::get_name() const
+{
+    return "reverb";
+}
+
+void Reverb::prepare(DWORD sampleRate, WORD channels)
+{
+    this->sampleRate = sampleRate;
+    this->channels = channels;
+    for (int i = 0; i < 4; i++) {
+        lengths[i] = (std::max)(ms_to_frames(reverbLineMs[i], sampleRate), (size_t)1);
+        lines[i].assign(lengths[i], 0.0f);
+    }
+    reset();
+    update_gains();
+}
+
+void Reverb::reset()
+{
+    for (int i = 0; i < 4; i++) {
+        std::fill(lines[i].begin(), lines[i].end(), 0.0f);
+        positions[i] = 0;
+        lowPass[i] = 0;
+    }
+}
+
+void Reverb::set_parameter(unsigned int parameter, float value)
+{
+    switch (parameter) {
+    case DecaySeconds: decaySeconds = (std::max)(value, 0.01f); break;
+    case Damping: damping = std::clamp(value, 0.0f, 0.99f); break;
+    case Mix: mix = std::clamp(value, 0.0f, 1.0f); break;
+    default: return;
+    }
+    update_gains();
+}
+
+void Reverb::update_gains()
+{
+    // Every pass through a line loses its share of the 60dB over the decay time
+    for (int i = 0; i < 4; i++)
+        feedbackGains[i] = std::pow(10.0f, -3.0f * lengths[i] / (decaySeconds * sampleRate));
+}
+
+void Reverb::process(float* samples, UINT32 frames)
+{
+    TRACE_SCOPE("reverb");
+
+    auto gains = Lanes::load(feedbackGains);
+    auto dampingLanes = Lanes::set(damping);
+    auto brightness = Lanes::set(1 - damping);
+    auto filtered = Lanes::load(lowPass);
+    const float inputGain = 0.5f / (std::max)(channels, (WORD)1);
+    const float dry = 1 - mix;
+
+    float* frameSamples = samples;
+    for (UINT32 frame = 0; frame < frames; frame++, frameSamples += channels) {
+        float input = 0;
+        for (WORD channel = 0; channel < channels; channel++)
+            input += frameSamples[channel];
+        input *= inputGain;
+
+        float outputs[4];
+        for (int i = 0; i < 4; i++)
+            outputs[i] = lines[i][positions[i]];
+
+        // Damped, then mixed by the Householder matrix I - J/2, which keeps the energy of the 4 lines
+        filtered = dampingLanes * filtered + brightness * Lanes::load(outputs);
+        auto mixed = filtered - Lanes::set(0.5f * filtered.sum());
+        auto feedback = gains * mixed + Lanes::set(input);
+
+        float written[4];
+        feedback.store(written);
+        for (int i = 0; i < 4; i++) {
+            lines[i][positions[i]] = written[i];
+            if (++positions[i] == lengths[i])
+                positions[i] = 0;
+        }
+
+        float wet[4];
+        filtered.store(wet);
+        for (WORD channel = 0; channel < channels; channel++)
+            frameSamples[channel] = dry * frameSamples[channel] + mix * wet[channel % 4];
+    }
+
+    filtered.store(lowPass);
+}
@@ -0,0 +1,209 @@
+#pragma once
+#include <vector>
+
+#include <windows.h>
+
+// An effect processing interleaved float frames in place. prepare() runs while the audio thread is idle and
+// may allocate; the other methods run on the audio thread and never allocate, lock or wait.
+// The effects below process up to 4 channels per SSE register, one channel per lane, with a scalar fallback.
+class AudioEffect
+{
+public:
+	virtual ~AudioEffect() = default;
+
+	virtual const char* get_name() const = 0;
+
+	// Sizes the state for the stream and clears it
+	virtual void prepare(DWORD sampleRate, WORD channels) = 0;
+	virtual void reset() = 0;
+
+	// Takes effect from the next frame processed. The indices are the Parameter enum of every effect.
+	virtual void set_parameter(unsigned int parameter, float value) = 0;
+
+	virtual void process(float* samples, UINT32 frames) = 0;
+};
+
+enum class FilterType {
+	LowPass,
+	HighPass,
+	BandPass,
+	Notch,
+	Peak,
+	LowShelf,
+	HighShelf
+};
+
+// Cascade of identical biquad sections (RBJ cookbook), transposed direct form II.
+// Two low-pass sections make a 24dB/octave slope.
+class BiquadFilter : public AudioEffect
+{
+public:
+	enum Parameter : unsigned int {
+		Frequency,				// Hz
+		Q,
+		GainDb					// Peak and shelves only
+	};
+
+	BiquadFilter(FilterType type, float frequency, float q = 0.7071f, float gainDb = 0, unsigned int sections = 1);
+
+	const char* get_name() const override;
+	void prepare(DWORD sampleRate, WORD channels) override;
+	void reset() override;
+	void set_parameter(unsigned int parameter, float value) override;
+	void process(float* samples, UINT32 frames) override;
+
+private:
+	void update_coefficients();
+
+	const FilterType type;
+	const unsigned int sections;
+	float frequency;
+	float q;
+	float gainDb;
+
+	DWORD sampleRate;
+	WORD channels;
+	float b0, b1, b2, a1, a2;
+	// Two state values per section and channel, channels padded to a multiple of 4
+	std::vector<float> state;
+};
+
+enum class SvfMode {
+	LowPass,
+	BandPass,
+	HighPass,
+	Notch
+};
+
+// Trapezoidal state-variable filter: stays stable and free of zipper noise when its frequency is
+// modulated at audio rate, where a biquad's coefficients would not
+class StateVariableFilter : public AudioEffect
+{
+public:
+	enum Parameter : unsigned int {
+		Frequency,				// Hz
+		Resonance				// Q, 0.5 and up
+	};
+
+	StateVariableFilter(SvfMode mode, float frequency, float resonance = 0.7071f);
+
+	const char* get_name() const override;
+	void prepare(DWORD sampleRate, WORD channels) override;
+	void reset() override;
+	void set_parameter(unsigned int parameter, float value) override;
+	void process(float* samples, UINT32 frames) override;
+
+private:
+	void update_coefficients();
+
+	const SvfMode mode;
+	float frequency;
+	float resonance;
+
+	DWORD sampleRate;
+	WORD channels;
+	float g, k, a1, a2, a3;
+	std::vector<float> state;
+};
+
+// Feedback delay. The line holds the frames interleaved, so that one frame of every channel group is one load.
+class Delay : public AudioEffect
+{
+public:
+	enum Parameter : unsigned int {
+		TimeMs,
+		Feedback,				// 0 to below 1
+		Mix						// 0 dry, 1 wet only
+	};
+
+	Delay(float maxTimeMs, float timeMs, float feedback = 0.4f, float mix = 0.3f);
+
+	const char* get_name() const override;
+	void prepare(DWORD sampleRate, WORD channels) override;
+	void reset() override;
+	void set_parameter(unsigned int parameter, float value) override;
+	void process(float* samples, UINT32 frames) override;
+
+private:
+	const float maxTimeMs;
+	float timeMs;
+	float feedback;
+	float mix;
+
+	DWORD sampleRate;
+	WORD channels;
+	size_t stride;				// channels padded to a multiple of 4
+	size_t lineFrames;
+	size_t delayFrames;
+	size_t writeFrame;
+	std::vector<float> line;
+};
+
+// Delay modulated by a sine LFO around a short base delay, read with linear interpolation. Every channel's
+// LFO is offset by a quarter period from the previous one, which widens a stereo image.
+class Chorus : public AudioEffect
+{
+public:
+	enum Parameter : unsigned int {
+		RateHz,
+		DepthMs,
+		Mix
+	};
+
+	Chorus(float rateHz = 0.8f, float depthMs = 2.5f, float mix = 0.5f);
+
+	const char* get_name() const override;
+	void prepare(DWORD sampleRate, WORD channels) override;
+	void reset() override;
+	void set_parameter(unsigned int parameter, float value) override;
+	void process(float* samples, UINT32 frames) override;
+
+private:
+	float rateHz;
+	float depthMs;
+	float mix;
+
+	DWORD sampleRate;
+	WORD channels;
+	size_t stride;
+	size_t lineFrames;
+	size_t writeFrame;
+	double phase;				// of the first channel, in cycles
+	std::vector<float> line;
+};
+
+// Feedback delay network of 4 lines, one per SSE lane, mixed by a Householder matrix, with a low-pass in the
+// feedback for the damping. The input is the mono sum of the channels, and the channels take the lines in turn,
+// so that a stereo output is decorrelated.
+class Reverb : public AudioEffect
+{
+public:
+	enum Parameter : unsigned int {
+		DecaySeconds,			// time for the tail to fall by 60dB
+		Damping,				// 0 bright, towards 1 darker
+		Mix
+	};
+
+	Reverb(float decaySeconds = 1.5f, float damping = 0.3f, float mix = 0.25f);
+
+	const char* get_name() const override;
+	void prepare(DWORD sampleRate, WORD channels) override;
+	void reset() override;
+	void set_parameter(unsigned int parameter, float value) override;
+	void process(float* samples, UINT32 frames) override;
+
+private:
+	void update_gains();
+
+	float decaySeconds;
+	float damping;
+	float mix;
+
+	DWORD sampleRate;
+	WORD channels;
+	size_t lengths[4];
+	float feedbackGains[4];
+	size_t positions[4];
+	float lowPass[4];
+	std::vector<float> lines[4];
+};
@@ -0,0 +1,199 @@
+#include "Fft.h"
+
+#include <cmath>
+#include <utility>
+#include <algorithm>
+
+namespace {
+    const double PI = 3.14159265358979323846;
+}
+
+size_t next_power_of_two(size_t value)
+{
+    size_t power = 1;
+    while (power < value)
+        power <<= 1;
+    return power;
+}
+
+void fft(std::vector<std::complex<double>>& data, bool inverse)
+{
+    const size_t size = data.size();
+    if (size < 2)
+        return;
+
+    // Bit-reversal permutation
+    for (size_t i = 1, j = 0; i < size; i++) {
+        size_t bit = size >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+
+        if (i < j)
+            std::swap(data[i], data[j]);
+    }
+
+    for (size_t length = 2; length <= size; length <<= 1) {
+        double angle = 2 * PI / (double)length * (inverse ? 1 : -1);
+        std::complex<double> step(cos(angle), sin(angle));
+
+        for (size_t start = 0; start < size; start += length) {
+            std::complex<double> twiddle(1);
+            for (size_t k = 0; k < length / 2; k++) {
+                auto even = data[start + k];
+                auto odd = data[start + k + length / 2] * twiddle;
+                data[start + k] = even + odd;
+                data[start + k + length / 2] = even - odd;
+                twiddle *= step;
+            }
+        }
+    }
+
+    if (inverse) {
+        for (auto& value : data)
+            value /= (double)size;
+    }
+}
+
+std::vector<double> cross_correlate(const std::vector<float>& signal, const std::vector<float>& reference)
+{
+    if (signal.empty() || reference.empty())
+        return {};
+
+    // Zero-padded past both lengths, so that the circular correlation does not wrap around
+    auto size = next_power_of_two(signal.size() + reference.size());
+    std::vector<std::complex<double>> signalSpectrum(size);
+    std::vector<std::complex<double>> referenceSpectrum(size);
+    std::copy(signal.begin(), signal.end(), signalSpectrum.begin());
+    std::copy(reference.begin(), reference.end(), referenceSpectrum.begin());
+
+    fft(signalSpectrum);
+    fft(referenceSpectrum);
+    for (size_t i = 0; i < size; i++)
+        signalSpectrum[i] *= std::conj(referenceSpectrum[i]);
+    fft(signalSpectrum, true);
+
+    std::vector<double> correlation(signal.size());
+    for (size_t lag = 0; lag < correlation.size(); lag++)
+        correlation[lag] = signalSpectrum[lag].real();
+    return correlation;
+}
+
+RealFft::RealFft(size_t size) :
+    size(size),
+    half(size / 2),
+    twiddleReal(half / 2),
+    twiddleImaginary(half / 2),
+    splitReal(half),
+    splitImaginary(half),
+    bitReversed(half),
+    workReal(half),
+    workImaginary(half)
+{
+    for (size_t i = 0; i < half / 2; i++) {
+        twiddleReal[i] = (float)cos(2 * PI * i / half);
+        twiddleImaginary[i] = (float)-sin(2 * PI * i / half);
+    }
+    for (size_t i = 0; i < half; i++) {
+        splitReal[i] = (float)cos(2 * PI * i / size);
+        splitImaginary[i] = (float)-sin(2 * PI * i / size);
+    }
+
+    for (size_t i = 1, j = 0; i < half; i++) {
+        size_t bit = half >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        bitReversed[i] = j;
+    }
+}
+
+size_t RealFft::get_size() const
+{
+    return size;
+}
+
+size_t RealFft::get_bins() const
+{
+    return half + 1;
+}
+
+void RealFft::transform(bool inverse)
+{
+    for (size_t i = 1; i < half; i++) {
+        auto j = bitReversed[i];
+        if (i < j) {
+            std::swap(workReal[i], workReal[j]);
+            std::swap(workImaginary[i], workImaginary[j]);
+        }
+    }
+
+    // The inverse transform runs on the conjugate twiddles
+    const float sign = inverse ? -1.0f : 1.0f;
+    for (size_t length = 2; length <= half; length <<= 1) {
+        const size_t span = length / 2;
+        const size_t stride = half / length;
+        for (size_t start = 0; start < half; start += length) {
+            for (size_t k = 0; k < span; k++) {
+                auto wr = twiddleReal[k * stride];
+                auto wi = sign * twiddleImaginary[k * stride];
+                auto even = start + k;
+                auto odd = even + span;
+                auto oddReal = workReal[odd] * wr - workImaginary[odd] * wi;
+                auto oddImaginary = workReal[odd] * wi + workImaginary[odd] * wr;
+                workReal[odd] = workReal[even] - oddReal;
+                workImaginary[odd] = workImaginary[even] - oddImaginary;
+                workReal[even] += oddReal;
+                workImaginary[even] += oddImaginary;
+            }
+        }
+    }
+}
+
+void RealFft::forward(const float* input, float* real, float* imaginary)
+{
+    // The even samples as the real part, the odd ones as the imaginary part
+    for (size_t i = 0; i < half; i++) {
+        workReal[i] = input[2 * i];
+        workImaginary[i] = input[2 * i + 1];
+    }
+    transform(false);
+
+    // X[k] = E[k] + W^k O[k], with E and O the spectra of the even and odd samples:
+    // E[k] = (Z[k] + conj(Z[half - k])) / 2 and O[k] = (Z[k] - conj(Z[half - k])) / 2i
+    real[0] = workReal[0] + workImaginary[0];
+    imaginary[0] = 0;
+    real[half] = workReal[0] - workImaginary[0];
+    imaginary[half] = 0;
+    for (size_t k = 1; k < half; k++) {
+        auto evenReal = 0.5f * (workReal[k] + workReal[half - k]);
+        auto evenImaginary = 0.5f * (workImaginary[k] - workImaginary[half - k]);
+        auto oddReal = 0.5f * (workImaginary[k] + workImaginary[half - k]);
+        auto oddImaginary = -0.5f * (workReal[k] - workReal[half - k]);
+        real[k] = evenReal + splitReal[k] * oddReal - splitImaginary[k] * oddImaginary;
+        imaginary[k] = evenImaginary + splitReal[k] * oddImaginary + splitImaginary[k] * oddReal;
+    }
+}
+
+void RealFft::inverse(const float* real, const float* imaginary, float* output)
+{
+    // E[k] = (X[k] + conj(X[half - k])) / 2 and O[k] = (X[k] - conj(X[half - k])) conj(W^k) / 2,
+    // then Z[k] = E[k] + i O[k] transforms back to the even and odd samples
+    for (size_t k = 0; k < half; k++) {
+        auto evenReal = 0.5f * (real[k] + real[half - k]);
+        auto evenImaginary = 0.5f * (imaginary[k] - imaginary[half - k]);
+        auto differenceReal = 0.5f * (real[k] - real[half - k]);
+        auto differenceImaginary = 0.5f * (imaginary[k] + imaginary[half - k]);
+        auto oddReal = differenceReal * splitReal[k] + differenceImaginary * splitImaginary[k];
+        auto oddImaginary = differenceImaginary * splitReal[k] - differenceReal * splitImaginary[k];
+        workReal[k] = evenReal - oddImaginary;
+        workImaginary[k] = evenImaginary + oddReal;
+    }
+    transform(true);
+
+    const float scale = 1.0f / half;
+    for (size_t i = 0; i < half; i++) {
+        output[2 * i] = workReal[i] * scale;
+        output[2 * i + 1] = workImaginary[i] * scale;
+    }
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <complex>
+#include <vector>
+#include <cstddef>
+
+// Smallest power of 2 not below value
+size_t next_power_of_two(size_t value);
+
+// In-place radix-2 FFT. The size must be a power of 2. The inverse transform is scaled by 1/N,
+// so that a forward and an inverse transform give the input back.
+void fft(std::vector<std::complex<double>>& data, bool inverse = false);
+
+// Cross-correlation of signal with reference, for the lags 0 to signal.size() - 1: the value at lag k
+// is the sum of signal[k + i] * reference[i]. Computed in the frequency domain.
+std::vector<double> cross_correlate(const std::vector<float>& signal, const std::vector<float>& reference);
+
+// FFT of real float signals for block processing, such as convolution on an audio thread: the tables are
+// computed by the constructor, and the transforms never allocate. Runs a complex FFT of half the size.
+// A spectrum is split into its real and imaginary parts, of get_bins() values each.
+class RealFft
+{
+public:
+	// The size must be a power of 2, 4 or more
+	RealFft(size_t size);
+
+	size_t get_size() const;
+	// size / 2 + 1, from DC to Nyquist
+	size_t get_bins() const;
+
+	// Not reentrant: the transforms share a work buffer
+	void forward(const float* input, float* real, float* imaginary);
+	// Scaled by 1/size, so that forward() and inverse() give the input back
+	void inverse(const float* real, const float* imaginary, float* output);
+
+private:
+	void transform(bool inverse);
+
+	const size_t size;
+	const size_t half;
+	// Twiddles of the complex FFT of half points, then those that split its result into the real spectrum
+	std::vector<float> twiddleReal;
+	std::vector<float> twiddleImaginary;
+	std::vector<float> splitReal;
+	std::vector<float> splitImaginary;
+	std::vector<size_t> bitReversed;
+	std::vector<float> workReal;
+	std::vector<float> workImaginary;
+};
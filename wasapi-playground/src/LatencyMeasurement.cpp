@@ -0,0 +1,218 @@
+#include "LatencyMeasurement.h"
+#include "AudioRenderer.h"
+#include "AudioCapturer.h"
+#include "Fft.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iterator>
+#include <numeric>
+
+namespace {
+    // Feedback taps of maximal-length LFSRs, as exponents of the polynomial, indexed by order
+    const unsigned int MLS_TAPS[][4] = {
+        {}, {}, { 2, 1 }, { 3, 2 }, { 4, 3 }, { 5, 3 }, { 6, 5 }, { 7, 6 }, { 8, 6, 5, 4 }, { 9, 5 }, { 10, 7 },
+        { 11, 9 }, { 12, 11, 10, 4 }, { 13, 12, 11, 8 }, { 14, 13, 12, 2 }, { 15, 14 }, { 16, 15, 13, 4 },
+        { 17, 14 }, { 18, 11 }, { 19, 18, 17, 14 }, { 20, 17 },
+    };
+
+    // Pause between two trials, for the tail of the stimulus to die out
+    const unsigned int trialGapMs = 50;
+
+    std::vector<float> make_stimulus(const LatencyTestConfig& config) {
+        std::vector<float> stimulus = config.stimulus == LatencyStimulus::Mls ? make_mls(config.mlsOrder) : std::vector<float>{ 1.0f };
+        for (auto& sample : stimulus)
+            sample *= config.amplitude;
+        return stimulus;
+    }
+
+    template<typename Client>
+    std::optional<HRESULT> initialize_for_test(Client& client, unsigned int bufferTimeSizeMs) {
+        return bufferTimeSizeMs > 0 ? client.initialize(bufferTimeSizeMs) : client.initialize_low_latency();
+    }
+}
+
+std::vector<float> make_mls(unsigned int order)
+{
+    if (order < 2 || order >= std::size(MLS_TAPS))
+        return {};
+
+    uint32_t mask = 0;
+    for (auto tap : MLS_TAPS[order]) {
+        if (tap != 0)
+            mask |= 1u << (tap - 1);
+    }
+
+    std::vector<float> sequence(((size_t)1 << order) - 1);
+    uint32_t state = 1;
+    for (auto& sample : sequence) {
+        sample = (state & 1) ? 1.0f : -1.0f;
+
+        // The new bit is the parity of the tapped bits
+        uint32_t feedback = state & mask;
+        feedback ^= feedback >> 16;
+        feedback ^= feedback >> 8;
+        feedback ^= feedback >> 4;
+        feedback ^= feedback >> 2;
+        feedback ^= feedback >> 1;
+        state = ((state << 1) | (feedback & 1)) & ((1u << order) - 1);
+    }
+    return sequence;
+}
+
+std::optional<double> find_delay(const std::vector<float>& signal, const std::vector<float>& reference, double minPeakRatio, double* peakRatio)
+{
+    auto correlation = cross_correlate(signal, reference);
+    if (correlation.size() < 3)
+        return std::nullopt;
+
+    // The magnitude is used, so that an endpoint that inverts the polarity still gives a peak
+    size_t peak = 0;
+    double sumOfSquares = 0;
+    for (size_t lag = 0; lag < correlation.size(); lag++) {
+        sumOfSquares += correlation[lag] * correlation[lag];
+        if (std::abs(correlation[lag]) > std::abs(correlation[peak]))
+            peak = lag;
+    }
+
+    auto rms = sqrt(sumOfSquares / correlation.size());
+    auto ratio = rms > 0 ? std::abs(correlation[peak]) / rms : 0.0;
+    if (peakRatio != nullptr)
+        *peakRatio = ratio;
+    if (ratio < minPeakRatio)
+        return std::nullopt;
+
+    if (peak == 0 || peak + 1 >= correlation.size())
+        return (double)peak;
+
+    // Vertex of the parabola through the peak and its two neighbours
+    auto before = std::abs(correlation[peak - 1]);
+    auto at = std::abs(correlation[peak]);
+    auto after = std::abs(correlation[peak + 1]);
+    auto curvature = before - 2 * at + after;
+    auto offset = curvature != 0 ? 0.5 * (before - after) / curvature : 0.0;
+    return (double)peak + std::clamp(offset, -0.5, 0.5);
+}
+
+LatencyReport summarize_latencies(std::vector<double> latenciesMs, unsigned int failedTrials)
+{
+    LatencyReport report;
+    report.latenciesMs = latenciesMs;
+    report.failedTrials = failedTrials;
+    if (latenciesMs.empty())
+        return report;
+
+    std::sort(latenciesMs.begin(), latenciesMs.end());
+    auto count = latenciesMs.size();
+    report.minMs = latenciesMs.front();
+    report.maxMs = latenciesMs.back();
+    report.medianMs = count % 2 == 1 ? latenciesMs[count / 2] : (latenciesMs[count / 2 - 1] + latenciesMs[count / 2]) / 2;
+    report.meanMs = std::accumulate(latenciesMs.begin(), latenciesMs.end(), 0.0) / count;
+
+    double variance = 0;
+    for (auto latency : latenciesMs)
+        variance += (latency - report.meanMs) * (latency - report.meanMs);
+    report.standardDeviationMs = sqrt(variance / count);
+    return report;
+}
+
+std::optional<LatencyReport> measure_round_trip(std::unique_ptr<AudioDevice> output, std::unique_ptr<AudioDevice> input, const LatencyTestConfig& config)
+{
+    AudioRenderer renderer(std::move(output));
+    AudioCapturer capturer(std::move(input));
+
+    if (auto error = initialize_for_test(renderer, config.bufferTimeSizeMs); error.has_value()) {
+        printf("[measure_round_trip] Unable to initialize the output: %x\n", error.value());
+        return std::nullopt;
+    }
+    if (auto error = initialize_for_test(capturer, config.bufferTimeSizeMs); error.has_value()) {
+        printf("[measure_round_trip] Unable to initialize the input: %x\n", error.value());
+        return std::nullopt;
+    }
+
+    // The stimulus is searched for sample by sample: there is no resampling between the two streams
+    const auto rate = renderer.get_format()->nSamplesPerSec;
+    const auto channels = capturer.get_format()->nChannels;
+    if (capturer.get_format()->nSamplesPerSec != rate) {
+        printf("[measure_round_trip] The endpoints run at different sample rates: %u and %u\n", rate, capturer.get_format()->nSamplesPerSec);
+        return std::nullopt;
+    }
+
+    const auto stimulus = make_stimulus(config);
+    if (stimulus.empty())
+        return std::nullopt;
+
+    const long leadInFrames = (long)((UINT64)config.leadInMs * rate / 1000);
+    const size_t searchFrames = stimulus.size() + (size_t)config.maxLatencyMs * rate / 1000;
+    const auto stimulusMs = (unsigned int)(stimulus.size() * 1000 / rate);
+
+    // Room for the whole trial, plus one second for the time between the two Start() calls
+    std::vector<float> recorded((size_t)leadInFrames + searchFrames + rate);
+    std::atomic<size_t> recordedFrames = 0;
+    std::atomic_bool discontinuity = false;
+
+    std::vector<double> latencies;
+    unsigned int failedTrials = 0;
+
+    for (unsigned int trial = 0; trial < config.trials; trial++) {
+        recordedFrames = 0;
+        discontinuity = false;
+        capturer.start_streaming_packets([&](const float* samples, UINT32 frames, DWORD flags) {
+            auto position = recordedFrames.load();
+
+            // The recording is indexed by stream position: lost frames would shift what follows. Endpoints commonly
+            // flag the first packet after Start(), before which nothing belonged to the trial.
+            if ((flags & AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY) && position != 0)
+                discontinuity = true;
+
+            // Silent packets take their place in the timeline as zeros
+            auto count = (std::min)((size_t)frames, recorded.size() - position);
+            for (size_t i = 0; i < count; i++)
+                recorded[position + i] = samples != nullptr ? samples[i * channels] : 0.0f;
+            recordedFrames = position + count;
+        });
+        auto captureStart = std::chrono::steady_clock::now();
+
+        renderer.start([&](FrameInfo frame) {
+            auto index = frame.ordinalNumber - leadInFrames;
+            return index >= 0 && index < (long)stimulus.size() ? (double)stimulus[index] : 0.0;
+        });
+        auto renderStart = std::chrono::steady_clock::now();
+
+        Sleep(config.leadInMs + stimulusMs + config.maxLatencyMs + trialGapMs);
+        renderer.stop();
+        capturer.stop();
+
+        if (discontinuity) {
+            printf("[measure_round_trip] Frames were lost during trial %u, discarding it\n", trial);
+            failedTrials++;
+            continue;
+        }
+
+        // Where the stimulus would be in the recording, if the round trip took no time
+        auto startOffset = std::chrono::duration<double>(renderStart - captureStart).count() * rate;
+        auto expected = (size_t)std::lround(startOffset) + leadInFrames;
+        if (expected >= recordedFrames) {
+            failedTrials++;
+            continue;
+        }
+
+        auto end = (std::min)(expected + searchFrames, recordedFrames.load());
+        std::vector<float> window(recorded.begin() + expected, recorded.begin() + end);
+
+        auto delay = find_delay(window, stimulus, config.minPeakRatio);
+        if (!delay.has_value()) {
+            failedTrials++;
+            continue;
+        }
+
+        // The rounding of the expected position is given back
+        auto latencyFrames = delay.value() + (double)expected - (startOffset + leadInFrames);
+        latencies.push_back(1000.0 * latencyFrames / rate);
+    }
+
+    return summarize_latencies(latencies, failedTrials);
+}
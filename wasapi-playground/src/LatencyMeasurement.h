@@ -0,0 +1,51 @@
+#pragma once
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "AudioDevice.h"
+
+enum class LatencyStimulus {
+	Impulse,					// a single full-scale sample: simple, but easily lost in noise
+	Mls							// maximum length sequence: spreads the energy, robust to noise and low levels
+};
+
+struct LatencyTestConfig {
+	LatencyStimulus stimulus = LatencyStimulus::Mls;
+	unsigned int mlsOrder = 14;					// sequence of 2^order - 1 samples, 16383 (0.34s at 48kHz)
+	float amplitude = 0.5f;
+	unsigned int trials = 10;
+
+	// Buffer of both streams, as in the passthrough. 0 opens them in low-latency mode instead.
+	unsigned int bufferTimeSizeMs = 16;
+
+	unsigned int leadInMs = 100;				// silence before the stimulus, while the streams settle
+	unsigned int maxLatencyMs = 500;			// how long after the stimulus it is searched for
+	double minPeakRatio = 8;					// correlation peak over its RMS under which a trial is discarded
+};
+
+struct LatencyReport {
+	std::vector<double> latenciesMs;			// successful trials, in order
+	unsigned int failedTrials = 0;
+	double minMs = 0;
+	double medianMs = 0;
+	double meanMs = 0;
+	double maxMs = 0;
+	double standardDeviationMs = 0;
+};
+
+// Maximum length sequence of 2^order - 1 samples of +-1, from a Fibonacci LFSR. Order from 2 to 20.
+std::vector<float> make_mls(unsigned int order);
+
+// Lag of reference in signal, in samples and with sub-sample accuracy (parabolic interpolation around the
+// correlation peak). Nothing when the peak does not stand out of the correlation by minPeakRatio.
+std::optional<double> find_delay(const std::vector<float>& signal, const std::vector<float>& reference, double minPeakRatio, double* peakRatio = nullptr);
+
+// Statistics of the successful trials
+LatencyReport summarize_latencies(std::vector<double> latenciesMs, unsigned int failedTrials);
+
+// Round trip from output to input: each trial plays the stimulus through an AudioRenderer while an AudioCapturer
+// records, and finds it in the recording. The two streams are aligned on the time their Start() calls returned,
+// so the result covers both buffers, the engines and whatever is between the endpoints (converters, cable, air).
+// Silent capture packets count as zeros; a trial during which captured frames were lost fails.
+std::optional<LatencyReport> measure_round_trip(std::unique_ptr<AudioDevice> output, std::unique_ptr<AudioDevice> input, const LatencyTestConfig& config = LatencyTestConfig());
@@ -0,0 +1,226 @@
+#include "MidiFile.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+namespace {
+    // 120 beats per minute, until the first tempo event
+    const UINT32 defaultMicrosecondsPerQuarter = 500000;
+
+    const BYTE metaEvent = 0xFF;
+    const BYTE metaTempo = 0x51;
+    const BYTE metaEndOfTrack = 0x2F;
+
+    // Big-endian, unlike RIFF
+    WORD read_u16(const BYTE* data) { return (WORD)(data[0] << 8 | data[1]); }
+    UINT32 read_u32(const BYTE* data) { return (UINT32)read_u16(data) << 16 | read_u16(data + 2); }
+
+    bool has_id(const BYTE* data, const char* id) { return memcmp(data, id, 4) == 0; }
+
+    // Variable-length quantity: 7 bits per byte, the high bit set on all but the last, 4 bytes at most
+    bool read_vlq(const BYTE* data, size_t size, size_t& offset, UINT32& value) {
+        value = 0;
+        for (int i = 0; i < 4; i++) {
+            if (offset >= size)
+                return false;
+            auto byte = data[offset++];
+            value = value << 7 | (byte & 0x7F);
+            if ((byte & 0x80) == 0)
+                return true;
+        }
+        return false;
+    }
+
+    struct TrackEvent {
+        UINT64 tick;
+        MidiEvent event;
+    };
+
+    struct TempoChange {
+        UINT64 tick;
+        UINT32 microsecondsPerQuarter;
+    };
+
+    // Appends the channel messages and tempo changes of a track from startTick on. Returns the tick of its end,
+    // or nothing when it is malformed.
+    std::optional<UINT64> parse_track(const BYTE* data, size_t size, UINT64 startTick, std::vector<TrackEvent>& events,
+        std::vector<TempoChange>& tempos) {
+        UINT64 tick = startTick;
+        BYTE runningStatus = 0;
+        size_t offset = 0;
+        while (offset < size) {
+            UINT32 delta;
+            if (!read_vlq(data, size, offset, delta) || offset >= size)
+                return std::nullopt;
+            tick += delta;
+
+            BYTE status = data[offset];
+            if (status & 0x80)
+                offset++;
+            else if (runningStatus != 0)
+                status = runningStatus;
+            else
+                return std::nullopt;
+
+            if (status < 0xF0) {
+                // Program change and channel pressure have one data byte, the others two
+                auto type = status & 0xF0;
+                size_t dataBytes = type == 0xC0 || type == 0xD0 ? 1 : 2;
+                if (offset + dataBytes > size)
+                    return std::nullopt;
+
+                TrackEvent trackEvent;
+                trackEvent.tick = tick;
+                trackEvent.event.status = status;
+                trackEvent.event.data1 = data[offset] & 0x7F;
+                trackEvent.event.data2 = dataBytes == 2 ? data[offset + 1] & 0x7F : 0;
+                events.push_back(trackEvent);
+
+                offset += dataBytes;
+                runningStatus = status;
+                continue;
+            }
+
+            // System exclusive and meta events cancel the running status
+            runningStatus = 0;
+            BYTE metaType = 0;
+            if (status == metaEvent) {
+                if (offset >= size)
+                    return std::nullopt;
+                metaType = data[offset++];
+            }
+            else if (status != 0xF0 && status != 0xF7) {
+                return std::nullopt;
+            }
+
+            UINT32 length;
+            if (!read_vlq(data, size, offset, length) || length > size - offset)
+                return std::nullopt;
+
+            if (status == metaEvent && metaType == metaTempo && length == 3) {
+                auto microseconds = (UINT32)data[offset] << 16 | (UINT32)data[offset + 1] << 8 | data[offset + 2];
+                if (microseconds != 0)
+                    tempos.push_back(TempoChange{ tick, microseconds });
+            }
+            offset += length;
+
+            if (status == metaEvent && metaType == metaEndOfTrack)
+                break;
+        }
+        return tick;
+    }
+}
+
+std::optional<MidiSequence> parse_midi_file(const BYTE* data, size_t size, DWORD sampleRate)
+{
+    if (size < 14 || !has_id(data, "MThd") || sampleRate == 0)
+        return std::nullopt;
+
+    auto headerBytes = read_u32(data + 4);
+    if (headerBytes < 6 || headerBytes > size - 8)
+        return std::nullopt;
+
+    MidiSequence sequence;
+    sequence.sampleRate = sampleRate;
+    sequence.format = read_u16(data + 8);
+    auto division = read_u16(data + 12);
+    if (sequence.format > 2 || division == 0)
+        return std::nullopt;
+
+    // Chunks other than tracks are skipped, as the format requires
+    std::vector<TrackEvent> events;
+    std::vector<TempoChange> tempos;
+    UINT64 endTick = 0;
+    size_t offset = 8 + (size_t)headerBytes;
+    while (offset + 8 <= size) {
+        const BYTE* chunk = data + offset;
+        auto chunkBytes = (std::min)((size_t)read_u32(chunk + 4), size - offset - 8);
+        if (has_id(chunk, "MTrk")) {
+            auto startTick = sequence.format == 2 ? endTick : 0;
+            auto trackEnd = parse_track(chunk + 8, chunkBytes, startTick, events, tempos);
+            if (!trackEnd.has_value())
+                return std::nullopt;
+
+            endTick = (std::max)(endTick, *trackEnd);
+            sequence.tracks++;
+        }
+        offset += 8 + chunkBytes;
+    }
+    if (sequence.tracks == 0)
+        return std::nullopt;
+
+    // The tracks were appended one after the other: a stable sort keeps their order at the same tick
+    std::stable_sort(events.begin(), events.end(), [](const TrackEvent& a, const TrackEvent& b) { return a.tick < b.tick; });
+    std::stable_sort(tempos.begin(), tempos.end(), [](const TempoChange& a, const TempoChange& b) { return a.tick < b.tick; });
+    sequence.tempoChanges = tempos.size();
+
+    // Seconds at the last tempo change, and per tick from there. With SMPTE timing, the high byte is minus the
+    // frames per second, 29 standing for 29.97 drop frame, and the low one the ticks per frame.
+    double changeSeconds = 0;
+    UINT64 changeTick = 0;
+    double secondsPerTick;
+    bool smpte = (division & 0x8000) != 0;
+    if (smpte) {
+        auto framesPerSecond = -(int)(signed char)(division >> 8);
+        auto ticksPerFrame = division & 0xFF;
+        if (framesPerSecond <= 0 || ticksPerFrame == 0)
+            return std::nullopt;
+        secondsPerTick = 1.0 / ((framesPerSecond == 29 ? 29.97 : framesPerSecond) * ticksPerFrame);
+    }
+    else {
+        secondsPerTick = defaultMicrosecondsPerQuarter / 1e6 / division;
+    }
+
+    size_t nextTempo = 0;
+    auto tick_to_frame = [&](UINT64 tick) {
+        while (!smpte && nextTempo < tempos.size() && tempos[nextTempo].tick <= tick) {
+            changeSeconds += (tempos[nextTempo].tick - changeTick) * secondsPerTick;
+            changeTick = tempos[nextTempo].tick;
+            secondsPerTick = tempos[nextTempo].microsecondsPerQuarter / 1e6 / division;
+            nextTempo++;
+        }
+        return (UINT64)std::llround((changeSeconds + (tick - changeTick) * secondsPerTick) * sampleRate);
+    };
+
+    sequence.events.reserve(events.size());
+    for (auto& trackEvent : events) {
+        trackEvent.event.frame = tick_to_frame(trackEvent.tick);
+        sequence.events.push_back(trackEvent.event);
+    }
+    sequence.frames = tick_to_frame(endTick);
+    return sequence;
+}
+
+std::optional<HRESULT> read_midi_file(const std::wstring& path, DWORD sampleRate, MidiSequence& sequence, size_t maxBytes)
+{
+    std::ifstream file(std::filesystem::path(path), std::ios::binary | std::ios::ate);
+    if (!file) {
+        printf("[read_midi_file] Unable to open the file\n");
+        return E_FAIL;
+    }
+
+    auto size = (size_t)file.tellg();
+    if (size > maxBytes) {
+        printf("[read_midi_file] The file holds %zu bytes, more than %zu\n", size, maxBytes);
+        return E_OUTOFMEMORY;
+    }
+
+    std::vector<BYTE> data(size);
+    file.seekg(0);
+    if (!file.read((char*)data.data(), size)) {
+        printf("[read_midi_file] Unable to read the file\n");
+        return E_FAIL;
+    }
+
+    auto parsed = parse_midi_file(data.data(), data.size(), sampleRate);
+    if (!parsed.has_value()) {
+        printf("[read_midi_file] Not a Standard MIDI File, or a malformed one\n");
+        return E_FAIL;
+    }
+
+    sequence = std::move(*parsed);
+    return std::nullopt;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <windows.h>
+
+// A channel message of a track
+struct MidiEvent {
+	UINT64 frame = 0;				// from the start of the sequence
+	BYTE status = 0;				// message in the high nibble, channel in the low one
+	BYTE data1 = 0;
+	BYTE data2 = 0;
+};
+
+struct MidiSequence {
+	DWORD sampleRate = 0;
+	WORD format = 0;
+	WORD tracks = 0;
+	std::vector<MidiEvent> events;	// of every track, in time order, the tracks in file order at the same frame
+	UINT64 frames = 0;				// up to the end of the longest track
+	UINT64 tempoChanges = 0;
+};
+
+// Parses a Standard MIDI File into the channel messages of its tracks, timed in frames at sampleRate through
+// the tempo map, or the SMPTE rate of the file. Formats 0 and 1 play their tracks together, format 2 one
+// after the other. Running status is followed; system exclusive and the meta events other than tempo are
+// skipped. A chunk announcing more than the file holds is cut to what is there.
+std::optional<MidiSequence> parse_midi_file(const BYTE* data, size_t size, DWORD sampleRate);
+
+// Fails with E_OUTOFMEMORY above maxBytes
+std::optional<HRESULT> read_midi_file(const std::wstring& path, DWORD sampleRate, MidiSequence& sequence, size_t maxBytes = 64 << 20);
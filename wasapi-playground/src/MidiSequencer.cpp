@@ -0,0 +1,176 @@
+#include "MidiSequencer.h"
+#include "WavFile.h"
+#include "RealtimeCheck.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+
+namespace {
+    // Notes handed to the synth with one render: a block holding more is rendered in parts
+    const size_t maxNotesPerRender = 128;
+
+    const BYTE percussionChannel = 9;
+
+    const BYTE noteOff = 0x80;
+    const BYTE noteOn = 0x90;
+    const BYTE controlChange = 0xB0;
+    const BYTE controlVolume = 7;
+    const BYTE controlPan = 10;
+}
+
+MidiSequencer::MidiSequencer(std::shared_ptr<PolySynth> synth, MidiSequence sequence) :
+    synth(std::move(synth)),
+    sequence(std::move(sequence)),
+    nextEvent(0),
+    position(0),
+    playedEvents(0),
+    playedNotes(0)
+{
+    notes.reserve(maxNotesPerRender);
+    std::fill(std::begin(channelVolumes), std::end(channelVolumes), 1.0f);
+    std::fill(std::begin(channelPans), std::end(channelPans), 0.5f);
+}
+
+UINT64 MidiSequencer::get_position() const
+{
+    return position.load(std::memory_order_relaxed);
+}
+
+bool MidiSequencer::is_finished() const
+{
+    return playedEvents.load(std::memory_order_relaxed) == sequence.events.size() && get_position() >= sequence.frames
+        && synth->get_active_voices() == 0;
+}
+
+MidiSequencerStats MidiSequencer::get_stats() const
+{
+    MidiSequencerStats stats;
+    stats.position = get_position();
+    stats.events = playedEvents.load(std::memory_order_relaxed);
+    stats.notes = playedNotes.load(std::memory_order_relaxed);
+    stats.finished = is_finished();
+    return stats;
+}
+
+void MidiSequencer::render(float* samples, UINT32 frames, WORD channels)
+{
+    TRACE_SCOPE("midi sequencer");
+
+    auto start = position.load(std::memory_order_relaxed);
+    if (!synthStart.has_value())
+        synthStart = synth->get_position() - start;
+
+    UINT32 done = 0;
+    while (done < frames) {
+        auto end = start + frames;
+        notes.clear();
+        for (; nextEvent < sequence.events.size() && notes.size() < notes.capacity(); nextEvent++) {
+            const auto& event = sequence.events[nextEvent];
+            if (event.frame >= end)
+                break;
+
+            playedEvents.fetch_add(1, std::memory_order_relaxed);
+            auto channel = event.status & 0x0F;
+            auto type = event.status & 0xF0;
+            if (channel == percussionChannel)
+                continue;
+
+            if (type == controlChange) {
+                if (event.data1 == controlVolume)
+                    channelVolumes[channel] = event.data2 / 127.0f;
+                else if (event.data1 == controlPan)
+                    channelPans[channel] = event.data2 / 127.0f;
+                continue;
+            }
+            if (type != noteOn && type != noteOff)
+                continue;
+
+            // A note on with a velocity of 0 is a note off
+            SynthNote note;
+            note.frame = *synthStart + event.frame;
+            note.note = event.data1;
+            note.velocity = type == noteOn ? event.data2 / 127.0f * channelVolumes[channel] : 0;
+            note.pan = channelPans[channel];
+            note.channel = (BYTE)channel;
+            notes.push_back(note);
+            if (note.velocity > 0)
+                playedNotes.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // Up to the first note that did not fit, which comes with the next part
+        auto until = end;
+        if (nextEvent < sequence.events.size() && sequence.events[nextEvent].frame < end)
+            until = sequence.events[nextEvent].frame;
+
+        auto length = (UINT32)(until - (start + done));
+        synth->render(samples + (size_t)done * channels, length, channels, notes.data(), notes.size());
+        done += length;
+    }
+
+    position.store(start + frames, std::memory_order_relaxed);
+}
+
+AudioRecording MidiSequencer::render_offline(WORD channels, UINT32 blockFrames, double tailSeconds)
+{
+    AudioRecording recording;
+    recording.channels = channels;
+    recording.samplesPerSecond = sequence.sampleRate;
+    if (channels == 0)
+        return recording;
+
+    auto maxFrames = sequence.frames + (UINT64)(tailSeconds * sequence.sampleRate);
+    recording.data.resize((size_t)maxFrames * channels);
+
+    blockFrames = (std::max)(blockFrames, 1u);
+    UINT64 done = 0;
+    while (done < maxFrames && !is_finished()) {
+        auto count = (UINT32)(std::min)((UINT64)blockFrames, maxFrames - done);
+        render(recording.data.data() + (size_t)done * channels, count, channels);
+        done += count;
+    }
+
+    recording.data.resize((size_t)done * channels);
+    recording.durationMs = sequence.sampleRate != 0 ? (unsigned long)(done * 1000 / sequence.sampleRate) : 0;
+    return recording;
+}
+
+std::vector<MidiRenderResult> render_midi_files(const std::vector<MidiRenderJob>& jobs, const PolySynthConfig& config, unsigned int workers)
+{
+    std::vector<MidiRenderResult> results(jobs.size());
+    if (jobs.empty())
+        return results;
+
+    auto synthConfig = config;
+    synthConfig.workers = 0;
+
+    std::vector<size_t> ready(jobs.size());
+    std::iota(ready.begin(), ready.end(), (size_t)0);
+
+    WorkStealingPool pool(workers, jobs.size());
+    pool.run(ready.data(), ready.size(), ready.size(), [&](size_t task, unsigned int) {
+        // The pool's workers are audio threads, but a job reads, allocates and writes files: it is offline work
+        NonRealtimeScope exempt;
+        const auto& job = jobs[task];
+        auto& result = results[task];
+
+        MidiSequence sequence;
+        if (auto error = read_midi_file(job.input, synthConfig.sampleRate, sequence); error.has_value()) {
+            result.error = error;
+            return;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        MidiSequencer sequencer(std::make_shared<PolySynth>(synthConfig), std::move(sequence));
+        auto recording = sequencer.render_offline();
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        result.frames = recording.data.size() / recording.channels;
+
+        if (!write_wav_file(job.output, recording)) {
+            printf("[render_midi_files] Unable to write a WAV file\n");
+            result.error = E_FAIL;
+        }
+    });
+    return results;
+}
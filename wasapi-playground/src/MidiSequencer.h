@@ -0,0 +1,74 @@
+#pragma once
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+#include <atomic>
+
+#include <windows.h>
+
+#include "MidiFile.h"
+#include "PolySynth.h"
+#include "common.h"
+
+struct MidiSequencerStats {
+	UINT64 position = 0;
+	UINT64 events = 0;							// messages played so far
+	UINT64 notes = 0;							// of which notes started
+	bool finished = false;
+};
+
+// Plays a MidiSequence on a PolySynth: the notes due in a block are handed to the synth with it, and start on
+// their exact frame. Note on and off, channel volume (CC 7) and pan (CC 10) are followed; the percussion
+// channel, 10, is skipped, the synth having no drums.
+// render() is a render callback, for instance with AudioRenderer::start_interleaved(), and render_offline()
+// plays the whole sequence as fast as the synth goes.
+class MidiSequencer
+{
+public:
+	MidiSequencer(std::shared_ptr<PolySynth> synth, MidiSequence sequence);
+	MidiSequencer(const MidiSequencer& other) = delete;
+
+	// Audio side, from one thread at a time
+	void render(float* samples, UINT32 frames, WORD channels);
+
+	// To the end of the sequence, then as long as its last notes ring, tailSeconds at most
+	AudioRecording render_offline(WORD channels = 2, UINT32 blockFrames = 512, double tailSeconds = 5);
+
+	UINT64 get_position() const;
+	// Past the end of the sequence, the last voice released
+	bool is_finished() const;
+	MidiSequencerStats get_stats() const;
+
+private:
+	std::shared_ptr<PolySynth> synth;
+	const MidiSequence sequence;
+
+	// Audio side
+	size_t nextEvent;
+	std::optional<UINT64> synthStart;			// where the sequence starts on the synth's timeline
+	std::vector<SynthNote> notes;
+	float channelVolumes[16];
+	float channelPans[16];
+
+	std::atomic<UINT64> position;
+	std::atomic<UINT64> playedEvents;
+	std::atomic<UINT64> playedNotes;
+};
+
+struct MidiRenderJob {
+	std::wstring input;							// a Standard MIDI File
+	std::wstring output;						// the WAV file to write
+};
+
+struct MidiRenderResult {
+	std::optional<HRESULT> error;
+	UINT64 frames = 0;
+	double seconds = 0;							// wall time of the rendering, the files left out
+};
+
+// Renders every job offline, each through a synth of its own, the jobs spread over a work-stealing pool of
+// workers plus the calling thread. Each synth renders on its own thread only: the files, rather than the
+// voices, are what runs in parallel.
+std::vector<MidiRenderResult> render_midi_files(const std::vector<MidiRenderJob>& jobs, const PolySynthConfig& config,
+	unsigned int workers = WorkStealingPool::default_workers());
@@ -0,0 +1,310 @@
+#include "Mixer.h"
+#include "BlockCost.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#include <xmmintrin.h>
+#define MIXER_SSE
+#endif
+
+struct Mixer::Slot {
+    UINT64 id = 0;
+    Source source;
+
+    // Written by the control side
+    std::atomic<float> targetGain{ 0 };
+    std::atomic<float> targetPan{ 0 };
+    std::atomic_bool removing{ false };
+
+    // Audio thread: the ramp in progress
+    float gain = 0;
+    float pan = 0;
+    float rampGain = 0;
+    float rampPan = 0;
+    float gainStep = 0;
+    float panStep = 0;
+    UINT32 rampRemaining = 0;
+
+    BlockCost cost;
+};
+
+namespace {
+    const float quarterPi = 0.785398163f;
+
+    // Constant power: the two gains always add up to the same energy
+    void pan_gains(float gain, float pan, float* left, float* right) {
+        auto angle = (std::clamp(pan, -1.0f, 1.0f) + 1.0f) * quarterPi;
+        *left = gain * std::cos(angle);
+        *right = gain * std::sin(angle);
+    }
+
+    // bus[i] += source[i] * (gain + step * i)
+    void accumulate(float* bus, const float* source, UINT32 frames, float gain, float step) {
+        UINT32 i = 0;
+#ifdef MIXER_SSE
+        auto gains = _mm_set_ps(gain + 3 * step, gain + 2 * step, gain + step, gain);
+        auto steps = _mm_set1_ps(4 * step);
+        for (; i + 4 <= frames; i += 4) {
+            auto sum = _mm_add_ps(_mm_loadu_ps(bus + i), _mm_mul_ps(_mm_loadu_ps(source + i), gains));
+            _mm_storeu_ps(bus + i, sum);
+            gains = _mm_add_ps(gains, steps);
+        }
+#endif
+        for (; i < frames; i++)
+            bus[i] += source[i] * (gain + step * i);
+    }
+
+    // Pade approximant of tanh, exact enough below 3 where it reaches 1
+    float soft_clip(float sample) {
+        if (sample >= 3.0f)
+            return 1.0f;
+        if (sample <= -3.0f)
+            return -1.0f;
+        auto square = sample * sample;
+        return sample * (27.0f + square) / (27.0f + 9.0f * square);
+    }
+}
+
+Mixer::Mixer(const MixerConfig& config) :
+    config(config),
+    nextId(1),
+    added(config.maxSources),
+    retired(config.maxSources),
+    sourceBlock(config.maxFrames),
+    busLeft(config.maxFrames),
+    busRight(config.maxFrames),
+    limiterGain(1.0f),
+    releaseCoefficient((float)(1.0 - std::exp(-1000.0 / ((std::max)(config.releaseMs, 1.0) * config.sampleRate)))),
+    limitedFrames(0),
+    peak(0)
+{
+    active.reserve(config.maxSources);
+}
+
+Mixer::~Mixer()
+{
+}
+
+void Mixer::collect_retired()
+{
+    Slot* slot = nullptr;
+    while (retired.pop(slot)) {
+        slots.erase(std::remove_if(slots.begin(), slots.end(), [slot](const std::unique_ptr<Slot>& owned) { return owned.get() == slot; }), slots.end());
+    }
+}
+
+Mixer::Slot* Mixer::find(UINT64 id) const
+{
+    for (const auto& slot : slots) {
+        if (slot->id == id)
+            return slot.get();
+    }
+    return nullptr;
+}
+
+UINT64 Mixer::add_source(Source source, float gain, float pan)
+{
+    std::lock_guard lock(controlMutex);
+    collect_retired();
+
+    // Sources still fading out count too: the audio thread has room for all of them
+    if (slots.size() >= config.maxSources)
+        return 0;
+
+    auto slot = std::make_unique<Slot>();
+    slot->id = nextId++;
+    slot->source = std::move(source);
+    slot->targetGain = gain;
+    slot->targetPan = pan;
+
+    // Starts from silence, at its position
+    slot->pan = pan;
+    slot->rampPan = pan;
+
+    if (!added.push(slot.get()))
+        return 0;
+
+    slots.push_back(std::move(slot));
+    return slots.back()->id;
+}
+
+void Mixer::remove_source(UINT64 id)
+{
+    std::lock_guard lock(controlMutex);
+    collect_retired();
+
+    if (auto slot = find(id); slot != nullptr)
+        slot->removing = true;
+}
+
+void Mixer::set_gain(UINT64 id, float gain)
+{
+    std::lock_guard lock(controlMutex);
+    if (auto slot = find(id); slot != nullptr)
+        slot->targetGain = gain;
+}
+
+void Mixer::set_pan(UINT64 id, float pan)
+{
+    std::lock_guard lock(controlMutex);
+    if (auto slot = find(id); slot != nullptr)
+        slot->targetPan = pan;
+}
+
+MixerStats Mixer::get_stats()
+{
+    std::lock_guard lock(controlMutex);
+    collect_retired();
+
+    MixerStats stats;
+    for (const auto& slot : slots) {
+        if (slot->removing)
+            continue;
+
+        MixerSourceStats source;
+        source.id = slot->id;
+        source.gain = slot->targetGain;
+        source.pan = slot->targetPan;
+        source.frames = slot->cost.get_frames();
+        source.nsPerFrame = slot->cost.get_ns_per_frame();
+        source.maxBlockMs = slot->cost.get_max_block_ms();
+        stats.sources.push_back(source);
+    }
+
+    stats.limitedFrames = limitedFrames.load(std::memory_order_relaxed);
+    stats.peak = peak.exchange(0, std::memory_order_relaxed);
+    return stats;
+}
+
+void Mixer::render(float* samples, UINT32 frames, WORD channels)
+{
+    TRACE_SCOPE("mixer");
+
+    Slot* slot = nullptr;
+    while (active.size() < active.capacity() && added.pop(slot))
+        active.push_back(slot);
+
+    for (UINT32 done = 0; done < frames; ) {
+        auto count = (std::min)(frames - done, config.maxFrames);
+        std::fill(busLeft.begin(), busLeft.begin() + count, 0.0f);
+        std::fill(busRight.begin(), busRight.begin() + count, 0.0f);
+
+        for (auto source : active)
+            mix_source(*source, count);
+
+        process_bus(count);
+
+        float* output = samples + (size_t)done * channels;
+        for (UINT32 i = 0; i < count; i++) {
+            float* frame = output + (size_t)i * channels;
+            if (channels == 1) {
+                frame[0] = 0.5f * (busLeft[i] + busRight[i]);
+                continue;
+            }
+
+            frame[0] = busLeft[i];
+            frame[1] = busRight[i];
+            std::fill(frame + 2, frame + channels, 0.0f);
+        }
+        done += count;
+    }
+
+    // Sources that faded out go back to the control side, which frees them
+    for (size_t i = 0; i < active.size(); ) {
+        auto source = active[i];
+        if (source->removing && source->rampRemaining == 0 && source->gain == 0 && retired.push(source)) {
+            active[i] = active.back();
+            active.pop_back();
+        }
+        else {
+            i++;
+        }
+    }
+}
+
+void Mixer::mix_source(Slot& slot, UINT32 frames)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    // A new target restarts the ramp from where the previous one is
+    auto targetGain = slot.removing ? 0.0f : slot.targetGain.load(std::memory_order_relaxed);
+    auto targetPan = slot.targetPan.load(std::memory_order_relaxed);
+    if (targetGain != slot.rampGain || targetPan != slot.rampPan) {
+        slot.rampGain = targetGain;
+        slot.rampPan = targetPan;
+        slot.rampRemaining = (std::max)(config.rampFrames, 1u);
+        slot.gainStep = (targetGain - slot.gain) / slot.rampRemaining;
+        slot.panStep = (targetPan - slot.pan) / slot.rampRemaining;
+    }
+
+    float startLeft, startRight;
+    pan_gains(slot.gain, slot.pan, &startLeft, &startRight);
+
+    if (slot.rampRemaining > 0) {
+        auto step = (std::min)(frames, slot.rampRemaining);
+        slot.rampRemaining -= step;
+        slot.gain = slot.rampRemaining == 0 ? slot.rampGain : slot.gain + slot.gainStep * step;
+        slot.pan = slot.rampRemaining == 0 ? slot.rampPan : slot.pan + slot.panStep * step;
+    }
+
+    float endLeft, endRight;
+    pan_gains(slot.gain, slot.pan, &endLeft, &endRight);
+
+    // A muted source keeps running, so that it is in time when it is turned up again
+    slot.source(sourceBlock.data(), frames);
+    if (startLeft != 0 || startRight != 0 || endLeft != 0 || endRight != 0) {
+        accumulate(busLeft.data(), sourceBlock.data(), frames, startLeft, (endLeft - startLeft) / frames);
+        accumulate(busRight.data(), sourceBlock.data(), frames, startRight, (endRight - startRight) / frames);
+    }
+
+    auto elapsedNs = (UINT64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    slot.cost.add(frames, elapsedNs);
+}
+
+void Mixer::process_bus(UINT32 frames)
+{
+    float blockPeak = 0;
+    UINT64 limited = 0;
+
+    for (UINT32 i = 0; i < frames; i++) {
+        auto level = (std::max)(std::abs(busLeft[i]), std::abs(busRight[i]));
+        blockPeak = (std::max)(blockPeak, level);
+
+        switch (config.limiter) {
+        case BusLimiter::SoftClip:
+            busLeft[i] = soft_clip(busLeft[i]);
+            busRight[i] = soft_clip(busRight[i]);
+            if (level > config.ceiling)
+                limited++;
+            break;
+
+        case BusLimiter::Limiter: {
+            // Down at once to the gain that keeps the frame under the ceiling, back up slowly
+            auto needed = level > config.ceiling ? config.ceiling / level : 1.0f;
+            limiterGain = needed < limiterGain ? needed : limiterGain + (1.0f - limiterGain) * releaseCoefficient;
+            limiterGain = (std::min)(limiterGain, needed);
+
+            // The release only gets close to 1
+            if (limiterGain > 0.9999f)
+                limiterGain = 1.0f;
+
+            busLeft[i] *= limiterGain;
+            busRight[i] *= limiterGain;
+            if (limiterGain < 1.0f)
+                limited++;
+            break;
+        }
+
+        case BusLimiter::None:
+            break;
+        }
+    }
+
+    limitedFrames.fetch_add(limited, std::memory_order_relaxed);
+    if (blockPeak > peak.load(std::memory_order_relaxed))
+        peak.store(blockPeak, std::memory_order_relaxed);
+}
@@ -0,0 +1,102 @@
+#pragma once
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <atomic>
+
+#include <windows.h>
+
+#include "SpscRing.h"
+
+enum class BusLimiter {
+	None,						// the sum is only clipped by the endpoint
+	SoftClip,					// saturates smoothly towards full scale
+	Limiter						// instant attack, released over releaseMs, never above the ceiling
+};
+
+struct MixerConfig {
+	DWORD sampleRate = 48000;
+	UINT32 maxFrames = 4096;					// frames mixed at once, longer renders are split
+	unsigned int maxSources = 64;
+	UINT32 rampFrames = 480;					// gain and pan changes are spread over this many frames
+	BusLimiter limiter = BusLimiter::Limiter;
+	float ceiling = 0.98f;
+	double releaseMs = 50;
+};
+
+struct MixerSourceStats {
+	UINT64 id = 0;
+	float gain = 0;
+	float pan = 0;
+	UINT64 frames = 0;
+	double nsPerFrame = 0;						// average cost of the source: its callback and its summation
+	double maxBlockMs = 0;
+};
+
+struct MixerStats {
+	std::vector<MixerSourceStats> sources;
+	UINT64 limitedFrames = 0;					// frames the limiter turned down, or over the ceiling when soft clipping
+	float peak = 0;								// highest bus level before the limiter since the last call
+};
+
+// Mixes any number of mono sources into a stereo bus, with a gain and a constant-power pan per source.
+// Sources are added, changed and removed from any thread while the audio thread renders: the changes reach
+// it through lock-free queues and atomics, and every change is ramped so that none of them clicks.
+class Mixer
+{
+public:
+	// Fills samples with the next frames of the source. Runs on the audio thread.
+	typedef std::function<void(float* samples, UINT32 frames)> Source;
+
+	Mixer(const MixerConfig& config = MixerConfig());
+	Mixer(const Mixer& other) = delete;
+	~Mixer();
+
+	// Control side, any thread. A source fades in from silence. Returns its id, 0 when maxSources are playing already.
+	UINT64 add_source(Source source, float gain = 1.0f, float pan = 0.0f);
+
+	// Fades the source out, then the audio thread lets it go: its callback is not called after that
+	void remove_source(UINT64 id);
+
+	void set_gain(UINT64 id, float gain);
+	// -1 is left, 1 right
+	void set_pan(UINT64 id, float pan);
+
+	MixerStats get_stats();
+
+	// Audio thread. The bus is written to the first two channels, the others are silent; a mono endpoint
+	// gets the average of both. Render with 2 channels to have the bus mapped onto other layouts, for instance
+	// with AudioRenderer::start_interleaved(). The audio thread must be stopped before the mixer is destroyed.
+	void render(float* samples, UINT32 frames, WORD channels);
+
+private:
+	struct Slot;
+
+	void collect_retired();
+	Slot* find(UINT64 id) const;
+	void mix_source(Slot& slot, UINT32 frames);
+	void process_bus(UINT32 frames);
+
+	const MixerConfig config;
+
+	// Control side
+	std::mutex controlMutex;
+	std::vector<std::unique_ptr<Slot>> slots;
+	UINT64 nextId;
+
+	// Sources move to the audio thread through added, and back once they faded out through retired
+	SpscRing<Slot*> added;
+	SpscRing<Slot*> retired;
+
+	// Audio thread
+	std::vector<Slot*> active;
+	std::vector<float> sourceBlock;
+	std::vector<float> busLeft;
+	std::vector<float> busRight;
+	float limiterGain;
+	float releaseCoefficient;
+
+	std::atomic<UINT64> limitedFrames;
+	std::atomic<float> peak;
+};
@@ -0,0 +1,70 @@
+#include "PeriodSizing.h"
+
+unsigned int align_engine_period(const EnginePeriodLimits& limits, unsigned int requestedFrames)
+{
+    auto minPeriod = limits.minPeriodInFrames;
+    auto maxPeriod = limits.maxPeriodInFrames;
+    auto fundamental = limits.fundamentalPeriodInFrames;
+
+    if (minPeriod == 0 || requestedFrames <= minPeriod)
+        return minPeriod;
+
+    if (fundamental == 0)
+        return minPeriod;
+
+    // Largest accepted period, in case the maximum itself is not aligned
+    auto alignedMax = maxPeriod >= minPeriod ? minPeriod + (maxPeriod - minPeriod) / fundamental * fundamental : minPeriod;
+    if (requestedFrames >= alignedMax)
+        return alignedMax;
+
+    auto steps = (requestedFrames - minPeriod + fundamental - 1) / fundamental;
+    return minPeriod + steps * fundamental;
+}
+
+bool is_valid_engine_period(const EnginePeriodLimits& limits, unsigned int periodInFrames)
+{
+    if (periodInFrames < limits.minPeriodInFrames || periodInFrames > limits.maxPeriodInFrames)
+        return false;
+
+    if (limits.fundamentalPeriodInFrames == 0)
+        return periodInFrames == limits.minPeriodInFrames;
+
+    return (periodInFrames - limits.minPeriodInFrames) % limits.fundamentalPeriodInFrames == 0;
+}
+
+long long frames_to_hns(unsigned int frames, unsigned int sampleRate)
+{
+    if (sampleRate == 0)
+        return 0;
+
+    // rounded to the nearest unit, so that hns_to_frames() gives back the same number of frames
+    return ((long long)frames * HNS_PER_SECOND + sampleRate / 2) / sampleRate;
+}
+
+unsigned int hns_to_frames(long long duration, unsigned int sampleRate)
+{
+    return (unsigned int)((duration * sampleRate + HNS_PER_SECOND / 2) / HNS_PER_SECOND);
+}
+
+ExclusiveBufferPlan plan_exclusive_buffer(long long requestedHns, long long minDevicePeriodHns, unsigned int sampleRate)
+{
+    ExclusiveBufferPlan plan;
+    auto duration = requestedHns > minDevicePeriodHns ? requestedHns : minDevicePeriodHns;
+
+    // Whole frames, rounded up so the period never drops below the minimum
+    plan.periodInFrames = (unsigned int)((duration * sampleRate + HNS_PER_SECOND - 1) / HNS_PER_SECOND);
+    plan.periodHns = frames_to_hns(plan.periodInFrames, sampleRate);
+    return plan;
+}
+
+std::optional<ExclusiveBufferPlan> realign_exclusive_buffer(const ExclusiveBufferPlan& previous, unsigned int alignedBufferFrames, unsigned int sampleRate)
+{
+    if (previous.attempt >= MAX_EXCLUSIVE_ATTEMPTS || alignedBufferFrames == 0 || alignedBufferFrames == previous.periodInFrames)
+        return std::nullopt;
+
+    ExclusiveBufferPlan plan;
+    plan.periodInFrames = alignedBufferFrames;
+    plan.periodHns = frames_to_hns(alignedBufferFrames, sampleRate);
+    plan.attempt = previous.attempt + 1;
+    return plan;
+}
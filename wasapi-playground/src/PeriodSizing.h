@@ -0,0 +1,39 @@
+#pragma once
+
+#include <optional>
+
+#include "StreamNegotiation.h"
+
+// Buffer and period arithmetic used to initialize streams. Like StreamNegotiation, it only deals
+// with plain numbers so it can be checked against simulated engine limits on any platform.
+
+// Rounds a requested period up to one the shared-mode engine accepts: the minimum period plus a multiple
+// of the fundamental period, never above the maximum. 0 requests the smallest period.
+unsigned int align_engine_period(const EnginePeriodLimits& limits, unsigned int requestedFrames);
+
+// True if InitializeSharedAudioStream() would accept this period
+bool is_valid_engine_period(const EnginePeriodLimits& limits, unsigned int periodInFrames);
+
+// Exclusive-mode buffers, sized in REFERENCE_TIME units (100 ns)
+const long long HNS_PER_SECOND = 10000000;
+long long frames_to_hns(unsigned int frames, unsigned int sampleRate);
+unsigned int hns_to_frames(long long duration, unsigned int sampleRate);
+
+// An event-driven exclusive stream uses the same value for the buffer duration and the periodicity:
+// the endpoint double-buffers, so the client fills one whole buffer per period.
+struct ExclusiveBufferPlan {
+	long long periodHns = 0;
+	unsigned int periodInFrames = 0;
+	unsigned int attempt = 1;
+};
+
+// Initialize() is attempted at most this many times before giving up on the alignment
+const unsigned int MAX_EXCLUSIVE_ATTEMPTS = 3;
+
+// First attempt: the requested duration, never below the device minimum period, rounded to whole frames.
+// A requested duration of 0 asks for the minimum period.
+ExclusiveBufferPlan plan_exclusive_buffer(long long requestedHns, long long minDevicePeriodHns, unsigned int sampleRate);
+
+// Next attempt after AUDCLNT_E_BUFFER_SIZE_NOT_ALIGNED, from the aligned size GetBufferSize() then reports.
+// Empty when out of attempts, or when the reported size would not change the request.
+std::optional<ExclusiveBufferPlan> realign_exclusive_buffer(const ExclusiveBufferPlan& previous, unsigned int alignedBufferFrames, unsigned int sampleRate);
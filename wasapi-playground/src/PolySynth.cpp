@@ -0,0 +1,285 @@
+#include "PolySynth.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace {
+    const double pi = 3.14159265358979;
+
+    float envelope_step(float seconds, DWORD sampleRate) {
+        return 1.0f / (std::max)(seconds * sampleRate, 1.0f);
+    }
+
+}
+
+PolySynth::PolySynth(const PolySynthConfig& config) :
+    config(config),
+    voicesPerTask((std::max)(config.voicesPerTask, (size_t)1)),
+    attackStep(envelope_step(config.attackSeconds, config.sampleRate)),
+    releaseStep(envelope_step(config.releaseSeconds, config.sampleRate)),
+    events(config.maxEvents),
+    voices(config.maxVoices),
+    taskCount(0),
+    blockFrames(0),
+    pool(config.workers, (std::max)((config.maxVoices + voicesPerTask - 1) / voicesPerTask, (size_t)1), config.spinMicroseconds),
+    executor([this](size_t task, unsigned int) { render_task(task); }),
+    position(0),
+    activeVoices(0),
+    peakVoices(0),
+    stolenVoices(0),
+    blocks(0),
+    parallelBlocks(0),
+    renderedFrames(0),
+    renderNs(0)
+{
+    auto maxTasks = (std::max)((config.maxVoices + voicesPerTask - 1) / voicesPerTask, (size_t)1);
+    for (size_t task = 0; task < maxTasks; task++) {
+        taskBlocks.emplace_back((size_t)config.maxFrames * 2, 0.0f);
+        readyTasks.push_back(task);
+    }
+    arrivals.reset(new std::atomic<unsigned int>[maxTasks]);
+
+    active.reserve(config.maxVoices);
+    freeVoices.reserve(config.maxVoices);
+    for (size_t voice = config.maxVoices; voice > 0; voice--)
+        freeVoices.push_back(voice - 1);
+}
+
+bool PolySynth::schedule_note(BYTE note, float velocity, UINT64 frame, float pan)
+{
+    SynthNote event;
+    event.frame = frame;
+    event.note = note;
+    event.velocity = velocity;
+    event.pan = pan;
+    return events.push(event);
+}
+
+bool PolySynth::note_on(BYTE note, float velocity, float pan)
+{
+    return schedule_note(note, velocity, 0, pan);
+}
+
+bool PolySynth::note_off(BYTE note)
+{
+    return schedule_note(note, 0, 0);
+}
+
+UINT64 PolySynth::get_position() const
+{
+    return position.load(std::memory_order_relaxed);
+}
+
+size_t PolySynth::get_active_voices() const
+{
+    return activeVoices.load(std::memory_order_relaxed);
+}
+
+PolySynthStats PolySynth::get_stats() const
+{
+    PolySynthStats stats;
+    stats.position = get_position();
+    stats.blocks = blocks.load(std::memory_order_relaxed);
+    stats.parallelBlocks = parallelBlocks.load(std::memory_order_relaxed);
+    stats.activeVoices = get_active_voices();
+    stats.peakVoices = peakVoices.load(std::memory_order_relaxed);
+    stats.stolenVoices = stolenVoices.load(std::memory_order_relaxed);
+    stats.droppedEvents = events.get_dropped();
+    auto frames = renderedFrames.load(std::memory_order_relaxed);
+    stats.nsPerFrame = frames != 0 ? (double)renderNs.load(std::memory_order_relaxed) / frames : 0;
+    stats.pool = pool.get_stats();
+    return stats;
+}
+
+void PolySynth::start_voice(const SynthNote& event)
+{
+    if (event.velocity <= 0) {
+        for (auto index : active) {
+            auto& voice = voices[index];
+            if (voice.note == event.note && voice.channel == event.channel && voice.stage != Stage::Release)
+                voice.stage = Stage::Release;
+        }
+        return;
+    }
+
+    if (voices.empty())
+        return;
+
+    size_t index;
+    if (!freeVoices.empty()) {
+        index = freeVoices.back();
+        freeVoices.pop_back();
+    }
+    else {
+        // The oldest voice restarts from the level it reached, rather than with a click
+        index = active.front();
+        active.erase(active.begin());
+        stolenVoices.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    auto& voice = voices[index];
+    auto pan = (std::min)((std::max)(event.pan, 0.0f), 1.0f);
+    voice.stage = Stage::Attack;
+    voice.note = event.note;
+    voice.channel = event.channel;
+    voice.phase = 0;
+    voice.increment = get_key_increment(config.tuning, event.note, config.sampleRate);
+    voice.wavetable = get_wavetable(config.waveform, voice.increment);
+    voice.left = event.velocity * config.gain * (float)std::cos(pan * pi / 2);
+    voice.right = event.velocity * config.gain * (float)std::sin(pan * pi / 2);
+    active.push_back(index);
+}
+
+void PolySynth::render_voice(Voice& voice, float* block, UINT32 frames) const
+{
+    for (UINT32 frame = 0; frame < frames; frame++) {
+        if (voice.stage == Stage::Attack) {
+            voice.level += attackStep;
+            if (voice.level >= 1) {
+                voice.level = 1;
+                voice.stage = Stage::Sustain;
+            }
+        }
+        else if (voice.stage == Stage::Release) {
+            voice.level -= releaseStep;
+            if (voice.level <= 0) {
+                voice.level = 0;
+                voice.stage = Stage::Idle;
+                return;
+            }
+        }
+
+        auto value = read_wavetable(voice.wavetable, voice.phase) * voice.level;
+        block[(size_t)frame * 2] += value * voice.left;
+        block[(size_t)frame * 2 + 1] += value * voice.right;
+        voice.phase += voice.increment;
+    }
+}
+
+void PolySynth::render_task(size_t task)
+{
+    float* block = taskBlocks[task].data();
+    std::fill(block, block + (size_t)blockFrames * 2, 0.0f);
+
+    auto last = (std::min)((task + 1) * voicesPerTask, active.size());
+    for (auto i = task * voicesPerTask; i < last; i++)
+        render_voice(voices[active[i]], block, blockFrames);
+
+    // Each pair is summed into its left block by the second of its two sides to finish, which then carries on
+    // with the pair of pairs; the first one leaves
+    for (size_t span = 1; span < taskCount; span <<= 1) {
+        auto left = task & ~(2 * span - 1);
+        auto right = left + span;
+        if (right >= taskCount)
+            continue;
+        if (arrivals[right].fetch_add(1, std::memory_order_acq_rel) == 0)
+            return;
+
+        float* target = taskBlocks[left].data();
+        const float* source = taskBlocks[right].data();
+        for (size_t i = 0; i < (size_t)blockFrames * 2; i++)
+            target[i] += source[i];
+        task = left;
+    }
+}
+
+void PolySynth::render_block(UINT32 frames)
+{
+    blockFrames = frames;
+    taskCount = (active.size() + voicesPerTask - 1) / voicesPerTask;
+
+    if (taskCount == 0) {
+        std::fill(taskBlocks[0].begin(), taskBlocks[0].begin() + (size_t)frames * 2, 0.0f);
+    }
+    else {
+        for (size_t task = 0; task < taskCount; task++)
+            arrivals[task].store(0, std::memory_order_relaxed);
+
+        if (active.size() >= config.parallelVoices && pool.get_lanes() > 1) {
+            pool.run(readyTasks.data(), taskCount, taskCount, executor);
+            parallelBlocks.fetch_add(1, std::memory_order_relaxed);
+        }
+        else {
+            for (size_t task = 0; task < taskCount; task++)
+                render_task(task);
+        }
+    }
+
+    // The voices that ended in this block leave, the others keep their order
+    size_t kept = 0;
+    for (auto index : active) {
+        if (voices[index].stage == Stage::Idle)
+            freeVoices.push_back(index);
+        else
+            active[kept++] = index;
+    }
+    active.resize(kept);
+
+    activeVoices.store(active.size(), std::memory_order_relaxed);
+    if (active.size() > peakVoices.load(std::memory_order_relaxed))
+        peakVoices.store(active.size(), std::memory_order_relaxed);
+    blocks.fetch_add(1, std::memory_order_relaxed);
+}
+
+void PolySynth::render(float* samples, UINT32 frames, WORD channels)
+{
+    render(samples, frames, channels, nullptr, 0);
+}
+
+void PolySynth::render(float* samples, UINT32 frames, WORD channels, const SynthNote* notes, size_t count)
+{
+    TRACE_SCOPE("poly synth");
+    auto startTime = std::chrono::steady_clock::now();
+
+    events.add(notes, count);
+    events.collect();
+
+    auto start = position.load(std::memory_order_relaxed);
+    UINT32 done = 0;
+    while (done < frames) {
+        auto nextEvent = events.apply_due(start + done, start + frames, [this](const SynthNote& event) { start_voice(event); });
+
+        auto length = (UINT32)(std::min)(nextEvent - (start + done), (UINT64)config.maxFrames);
+        render_block(length);
+
+        const float* bus = taskBlocks[0].data();
+        for (UINT32 frame = 0; frame < length; frame++) {
+            float* destination = samples + (size_t)(done + frame) * channels;
+            if (channels == 1) {
+                destination[0] = (bus[(size_t)frame * 2] + bus[(size_t)frame * 2 + 1]) * 0.5f;
+                continue;
+            }
+            if (channels == 0)
+                continue;
+
+            destination[0] = bus[(size_t)frame * 2];
+            destination[1] = bus[(size_t)frame * 2 + 1];
+            std::fill(destination + 2, destination + channels, 0.0f);
+        }
+        done += length;
+    }
+
+    position.store(start + frames, std::memory_order_relaxed);
+    renderedFrames.fetch_add(frames, std::memory_order_relaxed);
+    renderNs.fetch_add((UINT64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count(), std::memory_order_relaxed);
+}
+
+AudioRecording PolySynth::render_offline(UINT64 frames, WORD channels, UINT32 blockFrames)
+{
+    AudioRecording recording;
+    recording.channels = channels;
+    recording.samplesPerSecond = config.sampleRate;
+    recording.durationMs = (unsigned long)(frames * 1000 / config.sampleRate);
+    recording.data.resize((size_t)frames * channels);
+    if (channels == 0)
+        return recording;
+
+    blockFrames = (std::max)(blockFrames, 1u);
+    for (UINT64 done = 0; done < frames; done += blockFrames) {
+        auto count = (UINT32)(std::min)((UINT64)blockFrames, frames - done);
+        render(recording.data.data() + (size_t)done * channels, count, channels);
+    }
+    return recording;
+}
@@ -0,0 +1,145 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include <atomic>
+
+#include <windows.h>
+
+#include "ScheduledEvents.h"
+#include "WorkStealingPool.h"
+#include "Wavetables.h"
+#include "common.h"
+
+struct PolySynthConfig {
+	DWORD sampleRate = 48000;
+	size_t maxVoices = 256;						// a note beyond them takes the voice of the oldest one
+	Waveform waveform = Waveform::Sawtooth;
+	Tuning tuning = Tuning::EqualTemperament;
+	float attackSeconds = 0.005f;
+	float releaseSeconds = 0.2f;
+	float gain = 0.25f;
+	UINT32 maxFrames = 4096;					// frames rendered at once, longer renders are split
+	size_t maxEvents = 1024;					// notes waiting to start
+
+	unsigned int workers = WorkStealingPool::default_workers();
+	size_t voicesPerTask = 16;
+	size_t parallelVoices = 48;					// fewer active voices render on the calling thread alone
+	// How long the workers spin after a block before they sleep: up to the period keeps them awake from one
+	// period to the next, so that joining a block costs no kernel wake-up, at the price of the cores they spin on
+	DWORD spinMicroseconds = 0;
+};
+
+// A note to start, or to release with a velocity of 0, at frame of the synth's timeline
+struct SynthNote {
+	UINT64 frame = 0;
+	BYTE note = 0;
+	float velocity = 0;
+	float pan = 0.5f;
+	BYTE channel = 0;							// a release only ends the voices its channel started
+};
+
+struct PolySynthStats {
+	UINT64 position = 0;
+	UINT64 blocks = 0;
+	UINT64 parallelBlocks = 0;					// blocks spread over the pool rather than rendered on the calling thread
+	size_t activeVoices = 0;
+	size_t peakVoices = 0;
+	UINT64 stolenVoices = 0;					// notes that took the voice of an older one
+	UINT64 droppedEvents = 0;					// notes that did not fit in the queue, or in the block
+	double nsPerFrame = 0;						// wall time of the blocks, per frame
+	WorkStealingStats pool;
+};
+
+// Polyphonic oscillator bank for large voice counts. The active voices are cut into tasks of voicesPerTask
+// that the threads of a work-stealing pool render into blocks of their own, the thread calling render() being
+// one of them. The blocks are summed pairwise, by whichever thread finishes the second of two neighbours, so
+// that no thread waits for the others before the final sum; the pairs being fixed, the output is the same
+// whatever the number of threads. Below parallelVoices the calling thread renders every task itself and the
+// pool is left asleep.
+// Notes reach the audio thread through a lock-free queue and start at an exact frame, as in EffectChain.
+class PolySynth
+{
+public:
+	PolySynth(const PolySynthConfig& config = PolySynthConfig());
+	PolySynth(const PolySynth& other) = delete;
+
+	// Control side, any thread. frame counts from the first frame rendered, see get_position(); a frame already rendered starts at the
+	// start of the next block. A velocity of 0 releases every voice playing note on channel 0, as in MIDI;
+	// the notes handed to render() come with their channel. pan goes from 0, left, to 1, right. Returns false
+	// when the queue is full.
+	bool schedule_note(BYTE note, float velocity, UINT64 frame, float pan = 0.5f);
+	// At the start of the next block
+	bool note_on(BYTE note, float velocity, float pan = 0.5f);
+	bool note_off(BYTE note);
+
+	UINT64 get_position() const;
+	size_t get_active_voices() const;
+	PolySynthStats get_stats() const;
+
+	// Audio side, from one thread at a time: a render callback, for instance with
+	// AudioRenderer::start_interleaved(). The synth renders stereo, a single channel gets both sides and the
+	// channels beyond the second are silent.
+	void render(float* samples, UINT32 frames, WORD channels);
+	// Same, with notes from the audio thread itself, such as a sequencer's, on top of the queued ones: notes
+	// frames are from get_position() on, count at most maxEvents
+	void render(float* samples, UINT32 frames, WORD channels, const SynthNote* notes, size_t count);
+
+	// Renders frames as fast as they go, in blocks of blockFrames. Not while a stream renders the synth.
+	AudioRecording render_offline(UINT64 frames, WORD channels = 2, UINT32 blockFrames = 512);
+
+private:
+	enum class Stage {
+		Idle,
+		Attack,
+		Sustain,
+		Release
+	};
+
+	struct Voice {
+		Stage stage = Stage::Idle;
+		BYTE note = 0;
+		BYTE channel = 0;
+		const float* wavetable = nullptr;
+		UINT32 phase = 0;						// in 2^32 per cycle
+		UINT32 increment = 0;
+		float left = 0;
+		float right = 0;
+		float level = 0;
+	};
+
+	void start_voice(const SynthNote& event);
+	void render_voice(Voice& voice, float* block, UINT32 frames) const;
+	void render_task(size_t task);
+	void render_block(UINT32 frames);
+
+	const PolySynthConfig config;
+	const size_t voicesPerTask;
+	const float attackStep;
+	const float releaseStep;
+
+	ScheduledEvents<SynthNote> events;
+
+	// Audio side. active holds the playing voices, oldest first.
+	std::vector<Voice> voices;
+	std::vector<size_t> active;
+	std::vector<size_t> freeVoices;
+	std::vector<size_t> readyTasks;
+
+	// One stereo block per task: task 0's ends up with the sum of all of them
+	std::vector<std::vector<float>> taskBlocks;
+	// Per pair of neighbouring blocks, indexed by the right one: the threads that finished either side
+	std::unique_ptr<std::atomic<unsigned int>[]> arrivals;
+	size_t taskCount;
+	UINT32 blockFrames;
+	WorkStealingPool pool;
+	const WorkStealingPool::Executor executor;
+
+	std::atomic<UINT64> position;
+	std::atomic<size_t> activeVoices;
+	std::atomic<size_t> peakVoices;
+	std::atomic<UINT64> stolenVoices;
+	std::atomic<UINT64> blocks;
+	std::atomic<UINT64> parallelBlocks;
+	std::atomic<UINT64> renderedFrames;
+	std::atomic<UINT64> renderNs;
+};
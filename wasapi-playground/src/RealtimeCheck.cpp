@@ -0,0 +1,249 @@
+#include "RealtimeCheck.h"
+
+#ifdef WASAPI_REALTIME_CHECKS
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#if defined(_MSC_VER) && defined(_DEBUG)
+#include <crtdbg.h>
+#endif
+
+#include "RealtimeLog.h"
+
+namespace {
+    std::atomic<uint64_t> allocations{ 0 };
+    std::atomic<uint64_t> frees{ 0 };
+    std::atomic<uint64_t> locks{ 0 };
+
+    // Plain thread_local integers: reading them can not allocate
+    thread_local int realtimeDepth = 0;
+    thread_local bool reporting = false;
+    thread_local bool insideOperatorNew = false;
+
+    // Counting is lock-free; the log record is skipped when the logger itself is the one allocating
+    void report(std::atomic<uint64_t>& counter, LogSite site, int64_t size) {
+        counter.fetch_add(1, std::memory_order_relaxed);
+        if (reporting)
+            return;
+
+        reporting = true;
+        realtime_log(site, 0, size);
+        reporting = false;
+    }
+
+    void note_allocation(size_t size) {
+        if (realtimeDepth > 0)
+            report(allocations, LogSite::RealtimeAllocation, (int64_t)size);
+    }
+
+    void note_free() {
+        if (realtimeDepth > 0)
+            report(frees, LogSite::RealtimeFree, 0);
+    }
+
+#if defined(_MSC_VER) && defined(_DEBUG)
+    // Sees the C allocations as well. Those made by operator new were already counted there.
+    int allocation_hook(int type, void*, size_t size, int, long, const unsigned char*, int) {
+        if (insideOperatorNew)
+            return TRUE;
+
+        if (type == _HOOK_FREE)
+            note_free();
+        else
+            note_allocation(size);
+        return TRUE;
+    }
+
+    const bool hookInstalled = (_CrtSetAllocHook(allocation_hook), true);
+#endif
+
+    void* allocate(size_t size) {
+        note_allocation(size);
+
+        insideOperatorNew = true;
+        auto pointer = malloc(size != 0 ? size : 1);
+        insideOperatorNew = false;
+        return pointer;
+    }
+
+    void deallocate(void* pointer) {
+        if (pointer == nullptr)
+            return;
+
+        note_free();
+        insideOperatorNew = true;
+        free(pointer);
+        insideOperatorNew = false;
+    }
+
+    // Over-aligned types. aligned_alloc() wants a size multiple of the alignment, and the CRT has its own pair.
+    void* allocate_aligned(size_t size, std::align_val_t alignment) {
+        note_allocation(size);
+
+        auto bytes = (size_t)alignment;
+        insideOperatorNew = true;
+#ifdef _MSC_VER
+        auto pointer = _aligned_malloc(size != 0 ? size : 1, bytes);
+#else
+        auto pointer = aligned_alloc(bytes, (size + bytes - 1) / bytes * bytes + (size == 0 ? bytes : 0));
+#endif
+        insideOperatorNew = false;
+        return pointer;
+    }
+
+    void deallocate_aligned(void* pointer) {
+        if (pointer == nullptr)
+            return;
+
+        note_free();
+        insideOperatorNew = true;
+#ifdef _MSC_VER
+        _aligned_free(pointer);
+#else
+        free(pointer);
+#endif
+        insideOperatorNew = false;
+    }
+}
+
+RealtimeScope::RealtimeScope()
+{
+    realtimeDepth++;
+}
+
+RealtimeScope::~RealtimeScope()
+{
+    realtimeDepth--;
+}
+
+NonRealtimeScope::NonRealtimeScope() :
+    savedDepth(realtimeDepth)
+{
+    realtimeDepth = 0;
+}
+
+NonRealtimeScope::~NonRealtimeScope()
+{
+    realtimeDepth = savedDepth;
+}
+
+bool is_realtime_thread()
+{
+    return realtimeDepth > 0;
+}
+
+void report_realtime_lock()
+{
+    report(locks, LogSite::RealtimeLock, 0);
+}
+
+RealtimeViolations get_realtime_violations()
+{
+    RealtimeViolations violations;
+    violations.allocations = allocations.load(std::memory_order_relaxed);
+    violations.frees = frees.load(std::memory_order_relaxed);
+    violations.locks = locks.load(std::memory_order_relaxed);
+    return violations;
+}
+
+void* operator new(size_t size)
+{
+    if (auto pointer = allocate(size))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+    if (auto pointer = allocate(size))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    return allocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    return allocate(size);
+}
+
+void operator delete(void* pointer) noexcept
+{
+    deallocate(pointer);
+}
+
+void operator delete[](void* pointer) noexcept
+{
+    deallocate(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept
+{
+    deallocate(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept
+{
+    deallocate(pointer);
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+    if (auto pointer = allocate_aligned(size, alignment))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+    if (auto pointer = allocate_aligned(size, alignment))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    return allocate_aligned(size, alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    return allocate_aligned(size, alignment);
+}
+
+void operator delete(void* pointer, std::align_val_t) noexcept
+{
+    deallocate_aligned(pointer);
+}
+
+void operator delete[](void* pointer, std::align_val_t) noexcept
+{
+    deallocate_aligned(pointer);
+}
+
+void operator delete(void* pointer, size_t, std::align_val_t) noexcept
+{
+    deallocate_aligned(pointer);
+}
+
+void operator delete[](void* pointer, size_t, std::align_val_t) noexcept
+{
+    deallocate_aligned(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t, const std::nothrow_t&) noexcept
+{
+    deallocate_aligned(pointer);
+}
+
+void operator delete[](void* pointer, std::align_val_t, const std::nothrow_t&) noexcept
+{
+    deallocate_aligned(pointer);
+}
+
+#endif
@@ -0,0 +1,81 @@
+#pragma once
+#include <cstdint>
+#include <mutex>
+
+// Debug checks for the audio threads, compiled in when WASAPI_REALTIME_CHECKS is defined (Debug builds).
+// Code inside a RealtimeScope must not allocate, free or lock a CheckedMutex: each time it does, the
+// violation is counted and logged through RealtimeLog. Allocations are caught by replacing the global
+// operator new/delete, aligned ones included, and, with the debug CRT, by an allocation hook that also sees malloc() and free().
+//
+//   RealtimeScope realtime;			the calling thread is an audio thread until the end of the scope
+//   NonRealtimeScope exempt;			suspends the checks, for rare paths such as a device migration
+
+struct RealtimeViolations {
+	uint64_t allocations = 0;
+	uint64_t frees = 0;
+	uint64_t locks = 0;
+
+	uint64_t total() const { return allocations + frees + locks; }
+};
+
+#ifdef WASAPI_REALTIME_CHECKS
+
+class RealtimeScope
+{
+public:
+	RealtimeScope();
+	~RealtimeScope();
+	RealtimeScope(const RealtimeScope& other) = delete;
+};
+
+class NonRealtimeScope
+{
+public:
+	NonRealtimeScope();
+	~NonRealtimeScope();
+	NonRealtimeScope(const NonRealtimeScope& other) = delete;
+
+private:
+	int savedDepth;
+};
+
+bool is_realtime_thread();
+void report_realtime_lock();
+RealtimeViolations get_realtime_violations();
+
+// std::mutex that reports being locked from a realtime thread. try_lock() never blocks, so it is allowed.
+class CheckedMutex
+{
+public:
+	void lock() {
+		if (is_realtime_thread())
+			report_realtime_lock();
+		mutex.lock();
+	}
+
+	bool try_lock() { return mutex.try_lock(); }
+	void unlock() { mutex.unlock(); }
+
+private:
+	std::mutex mutex;
+};
+
+#else
+
+class RealtimeScope
+{
+public:
+	RealtimeScope() {}
+};
+
+class NonRealtimeScope
+{
+public:
+	NonRealtimeScope() {}
+};
+
+typedef std::mutex CheckedMutex;
+
+inline RealtimeViolations get_realtime_violations() { return RealtimeViolations(); }
+
+#endif
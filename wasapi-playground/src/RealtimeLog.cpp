@@ -0,0 +1,202 @@
+#include "RealtimeLog.h"
+
+#include <chrono>
+#include <cstring>
+#include <string>
+
+namespace {
+    const std::chrono::milliseconds flushInterval = std::chrono::milliseconds(20);
+
+    struct SiteDescription {
+        const char* message;
+        bool hasResult;			// the record carries the HRESULT of a failed call
+        const char* arg0;
+        const char* arg1;
+    };
+
+    const SiteDescription SITES[] = {
+        { "RENDER-THREAD Failed to GetCurrentPadding()", true, nullptr, nullptr },
+        { "RENDER-THREAD Failed to GetBuffer()", true, "frames", nullptr },
+        { "RENDER-THREAD Failed to ReleaseBuffer()", true, "frames", "flags" },
+        { "FAILED TO START AUDIOCLIENT after migration", true, nullptr, nullptr },
+        { "Failed to GetNextPacketSize()", true, nullptr, nullptr },
+        { "Failed to GetBuffer()", true, nullptr, nullptr },
+        { "Failed to ReleaseBuffer()", true, "frames", nullptr },
+        { "FAILED TO START AUDIOCLIENT after migration", true, nullptr, nullptr },
+        { "[AudioCapturer] capture format changed after migration", false, "channels", "rate" },
+        { "[RealtimeCheck] allocation on an audio thread", false, "bytes", nullptr },
+        { "[RealtimeCheck] free on an audio thread", false, nullptr, nullptr },
+        { "[RealtimeCheck] mutex locked on an audio thread", false, nullptr, nullptr },
+    };
+    static_assert(sizeof(SITES) / sizeof(SITES[0]) == (size_t)LogSite::Count, "every LogSite needs a description");
+
+    int64_t now() {
+        return std::chrono::steady_clock::now().time_since_epoch().count();
+    }
+
+    double ticks_to_ms(int64_t ticks) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::duration(ticks)).count();
+    }
+}
+
+thread_local RealtimeLog::ThreadSlot RealtimeLog::currentThread;
+
+RealtimeLog::ThreadSlot::~ThreadSlot()
+{
+    if (ring != nullptr)
+        ring->inUse = false;
+}
+
+RealtimeLog& RealtimeLog::instance()
+{
+    static RealtimeLog log;
+    return log;
+}
+
+RealtimeLog::RealtimeLog() :
+    startTime(now()),
+    output(stdout),
+    stopping(false)
+{
+    flusher = std::thread([this]() { flusher_loop(); });
+}
+
+RealtimeLog::~RealtimeLog()
+{
+    {
+        std::lock_guard lock(flushMutex);
+        stopping = true;
+    }
+    flushCondition.notify_all();
+    flusher.join();
+    flush();
+}
+
+void RealtimeLog::register_current_thread(const char* name)
+{
+    if (currentThread.ring != nullptr)
+        currentThread.ring->inUse = false;
+
+    currentThread.ring = acquire_ring(name);
+}
+
+RealtimeLog::ThreadRing* RealtimeLog::acquire_ring(const char* name)
+{
+    std::lock_guard lock(ringsMutex);
+
+    // Reuse the ring of a thread that exited, once the flusher emptied it
+    ThreadRing* ring = nullptr;
+    for (auto& candidate : rings) {
+        if (!candidate->inUse && candidate->head == candidate->tail) {
+            ring = candidate.get();
+            break;
+        }
+    }
+
+    if (ring == nullptr) {
+        rings.push_back(std::make_unique<ThreadRing>());
+        ring = rings.back().get();
+    }
+
+    strncpy(ring->name, name != nullptr ? name : "thread", sizeof(ring->name) - 1);
+    ring->name[sizeof(ring->name) - 1] = '\0';
+    ring->inUse = true;
+    return ring;
+}
+
+void RealtimeLog::write(LogSite site, int32_t result, int64_t arg0, int64_t arg1)
+{
+    if (currentThread.ring == nullptr)
+        currentThread.ring = acquire_ring("unnamed");
+
+    auto& ring = *currentThread.ring;
+    auto head = ring.head.load(std::memory_order_relaxed);
+    auto tail = ring.tail.load(std::memory_order_acquire);
+    if (head - tail >= RING_CAPACITY) {
+        ring.dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    auto& record = ring.records[head & (RING_CAPACITY - 1)];
+    record.timestamp = now();
+    record.result = result;
+    record.site = site;
+    record.args[0] = arg0;
+    record.args[1] = arg1;
+    ring.head.store(head + 1, std::memory_order_release);
+}
+
+void RealtimeLog::drain(ThreadRing& ring)
+{
+    FILE* stream = output;
+    auto head = ring.head.load(std::memory_order_acquire);
+    auto tail = ring.tail.load(std::memory_order_relaxed);
+
+    char line[256];
+    for (; tail != head; tail++) {
+        const auto& record = ring.records[tail & (RING_CAPACITY - 1)];
+        const auto& site = SITES[(size_t)record.site];
+
+        auto length = site.hasResult
+            ? snprintf(line, sizeof(line), "[%.3fms %s] %s: %x.", ticks_to_ms(record.timestamp - startTime), ring.name, site.message, (unsigned int)record.result)
+            : snprintf(line, sizeof(line), "[%.3fms %s] %s.", ticks_to_ms(record.timestamp - startTime), ring.name, site.message);
+        if (site.arg0 != nullptr && length > 0 && (size_t)length < sizeof(line))
+            length += snprintf(line + length, sizeof(line) - length, " %s=%lld", site.arg0, (long long)record.args[0]);
+        if (site.arg1 != nullptr && length > 0 && (size_t)length < sizeof(line))
+            snprintf(line + length, sizeof(line) - length, " %s=%lld", site.arg1, (long long)record.args[1]);
+
+        fprintf(stream, "%s\n", line);
+    }
+    ring.tail.store(tail, std::memory_order_release);
+
+    auto dropped = ring.dropped.load(std::memory_order_relaxed);
+    if (dropped != ring.reportedDrops) {
+        fprintf(stream, "[realtime log] %s dropped %llu records\n", ring.name, (unsigned long long)(dropped - ring.reportedDrops));
+        ring.reportedDrops = dropped;
+    }
+}
+
+void RealtimeLog::flush()
+{
+    // Rings are never deleted, only the list can grow while draining
+    std::vector<ThreadRing*> snapshot;
+    {
+        std::lock_guard lock(ringsMutex);
+        for (auto& ring : rings)
+            snapshot.push_back(ring.get());
+    }
+
+    // One drainer at a time: flush() can be called while the flusher thread runs
+    std::lock_guard lock(drainMutex);
+    for (auto ring : snapshot)
+        drain(*ring);
+
+    fflush(output);
+}
+
+void RealtimeLog::set_output(FILE* stream)
+{
+    output = stream != nullptr ? stream : stdout;
+}
+
+uint64_t RealtimeLog::get_dropped_records() const
+{
+    std::lock_guard lock(ringsMutex);
+
+    uint64_t dropped = 0;
+    for (const auto& ring : rings)
+        dropped += ring->dropped.load(std::memory_order_relaxed);
+    return dropped;
+}
+
+void RealtimeLog::flusher_loop()
+{
+    std::unique_lock lock(flushMutex);
+    while (!stopping) {
+        flushCondition.wait_for(lock, flushInterval, [this]() { return stopping; });
+
+        lock.unlock();
+        flush();
+        lock.lock();
+    }
+}
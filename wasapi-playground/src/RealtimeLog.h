@@ -0,0 +1,100 @@
+#pragma once
+#include <cstdint>
+#include <atomic>
+#include <array>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <cstdio>
+
+#include "RealtimeCheck.h"
+
+// Call sites that can log from an audio thread. The message of each one is in RealtimeLog.cpp.
+enum class LogSite : uint16_t {
+	RenderGetCurrentPadding,
+	RenderGetBuffer,
+	RenderReleaseBuffer,
+	RenderStartAfterMigration,
+	CaptureGetNextPacketSize,
+	CaptureGetBuffer,
+	CaptureReleaseBuffer,
+	CaptureStartAfterMigration,
+	CaptureFormatChanged,
+	RealtimeAllocation,
+	RealtimeFree,
+	RealtimeLock,
+	Count
+};
+
+// Fixed-size record written by the audio threads, formatted later by the flusher
+struct LogRecord {
+	int64_t timestamp;		// std::chrono::steady_clock ticks
+	int32_t result;			// HRESULT
+	LogSite site;
+	int64_t args[2];
+};
+
+// Logger for threads that must never block. Each thread writes into its own single-producer ring,
+// a background thread drains the rings every few milliseconds and prints the records. When a ring
+// is full the record is dropped and counted, and the flusher reports how many were lost.
+class RealtimeLog
+{
+public:
+	static const size_t RING_CAPACITY = 256;		// records per thread, power of 2
+
+	static RealtimeLog& instance();
+	~RealtimeLog();
+
+	// Gives the calling thread its ring ahead of time, so that the first record does not allocate.
+	// The name appears in the output, and is truncated to 15 characters.
+	void register_current_thread(const char* name);
+
+	// Lock-free and allocation-free once the thread is registered
+	void write(LogSite site, int32_t result, int64_t arg0 = 0, int64_t arg1 = 0);
+
+	// Formats everything written so far, from the calling thread
+	void flush();
+	void set_output(FILE* stream);
+	uint64_t get_dropped_records() const;
+
+private:
+	struct ThreadRing {
+		std::array<LogRecord, RING_CAPACITY> records;
+		std::atomic<uint32_t> head{ 0 };		// written by the owner thread
+		std::atomic<uint32_t> tail{ 0 };		// written by the flusher
+		std::atomic<uint64_t> dropped{ 0 };
+		uint64_t reportedDrops = 0;				// flusher only
+		std::atomic_bool inUse{ false };
+		char name[16] = {};
+	};
+
+	// Gives the ring back for reuse when its thread exits
+	struct ThreadSlot {
+		ThreadRing* ring = nullptr;
+		~ThreadSlot();
+	};
+	static thread_local ThreadSlot currentThread;
+
+	RealtimeLog();
+	ThreadRing* acquire_ring(const char* name);
+	void drain(ThreadRing& ring);
+	void flusher_loop();
+
+	int64_t startTime;
+	std::atomic<FILE*> output;
+
+	mutable CheckedMutex ringsMutex;
+	std::vector<std::unique_ptr<ThreadRing>> rings;
+
+	std::mutex drainMutex;
+	std::mutex flushMutex;
+	std::condition_variable flushCondition;
+	bool stopping;
+	std::thread flusher;
+};
+
+inline void realtime_log(LogSite site, int32_t result, int64_t arg0 = 0, int64_t arg1 = 0) {
+	RealtimeLog::instance().write(site, result, arg0, arg1);
+}
@@ -0,0 +1,133 @@
+#include "RenderAhead.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace {
+    // The producer also polls, in case a read signal was missed while it was generating
+    const DWORD consumedTimeoutMs = 20;
+}
+
+RenderAhead::RenderAhead(Generator generator) :
+    generator(generator),
+    blockFrames(0),
+    targetFrames(0),
+    channels(1),
+    consumed(CreateEvent(NULL, FALSE, FALSE, NULL)),
+    running(false),
+    minDepthFrames(0),
+    starvedFrames(0),
+    maxBlockNs(0),
+    worker(std::make_unique<AudioWorker>("render-ahead", [this]() { produce_loop(); }))
+{
+}
+
+RenderAhead::~RenderAhead()
+{
+    stop();
+    worker.reset();
+
+    if (consumed != nullptr)
+        CloseHandle(consumed);
+}
+
+void RenderAhead::prime(UINT32 frames, unsigned int periods, UINT32 maxReadFrames, WORD frameChannels)
+{
+    blockFrames = (std::max)(frames, 1u);
+    targetFrames = blockFrames * (std::max)(periods, 1u);
+    channels = (std::max)(frameChannels, (WORD)1);
+
+    // The ring counts samples, the rest of the class frames
+    auto capacity = ((size_t)targetFrames + (std::max)(maxReadFrames, blockFrames)) * channels;
+    if (ring == nullptr || ring->capacity() < capacity)
+        ring = std::make_unique<SpscRing<float>>(capacity);
+    else
+        ring->clear();
+
+    block.resize((size_t)blockFrames * channels);
+    while (depth() < targetFrames)
+        produce_block();
+
+    minDepthFrames = depth();
+    starvedFrames = 0;
+    maxBlockNs = 0;
+}
+
+void RenderAhead::start()
+{
+    if (running || ring == nullptr)
+        return;
+
+    running = true;
+    worker->resume();
+}
+
+void RenderAhead::stop()
+{
+    if (!running)
+        return;
+
+    running = false;
+    SetEvent(consumed);
+    worker->wait_until_idle();
+}
+
+void RenderAhead::produce_loop()
+{
+    while (running) {
+        // Only whole blocks are generated: wait for the render thread to make room for one
+        if (depth() + blockFrames > targetFrames) {
+            WaitForSingleObject(consumed, consumedTimeoutMs);
+            continue;
+        }
+
+        produce_block();
+    }
+}
+
+void RenderAhead::produce_block()
+{
+    TRACE_SCOPE("render-ahead block");
+    auto blockStart = std::chrono::steady_clock::now();
+
+    generator(block.data(), blockFrames);
+    ring->push(block.data(), block.size());
+
+    auto duration = (UINT64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - blockStart).count();
+    if (duration > maxBlockNs.load(std::memory_order_relaxed))
+        maxBlockNs.store(duration, std::memory_order_relaxed);
+}
+
+UINT32 RenderAhead::depth() const
+{
+    return (UINT32)(ring->size() / channels);
+}
+
+void RenderAhead::read(float* samples, UINT32 frames)
+{
+    auto frameDepth = depth();
+    if (frameDepth < minDepthFrames.load(std::memory_order_relaxed))
+        minDepthFrames.store(frameDepth, std::memory_order_relaxed);
+
+    // Blocks are pushed whole, so the ring always holds whole frames
+    auto wanted = (size_t)frames * channels;
+    auto copied = ring->pop(samples, wanted);
+    if (copied < wanted) {
+        std::fill(samples + copied, samples + wanted, 0.0f);
+        starvedFrames.fetch_add((wanted - copied) / channels, std::memory_order_relaxed);
+    }
+
+    SetEvent(consumed);
+}
+
+RenderAheadStats RenderAhead::get_stats() const
+{
+    RenderAheadStats stats;
+    stats.targetFrames = targetFrames;
+    stats.depthFrames = ring != nullptr ? depth() : 0;
+    stats.minDepthFrames = minDepthFrames.load(std::memory_order_relaxed);
+    stats.starvedFrames = starvedFrames.load(std::memory_order_relaxed);
+    stats.maxBlockMs = maxBlockNs.load(std::memory_order_relaxed) / 1e6;
+    return stats;
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <functional>
+#include <memory>
+#include <vector>
+#include <atomic>
+
+#include <windows.h>
+
+#include "SpscRing.h"
+#include "AudioWorker.h"
+
+struct RenderAheadStats {
+	UINT32 targetFrames = 0;		// lookahead the producer keeps in the ring
+	UINT32 depthFrames = 0;			// frames in the ring now; producer lag is targetFrames - depthFrames
+	UINT32 minDepthFrames = 0;		// lowest depth the render thread found since the stream started
+	UINT64 starvedFrames = 0;		// frames played as silence because the producer fell behind
+	double maxBlockMs = 0;			// slowest block generated by the producer
+};
+
+// Runs a generator on its own thread ahead of the render thread: the generator fills a lock-free ring
+// block by block, up to a target depth, and the render thread only copies from it. A slow block then
+// eats into the lookahead instead of making the endpoint run dry.
+class RenderAhead
+{
+public:
+	// Fills samples with the next frames of the stream, interleaved in the channels given to prime()
+	typedef std::function<void(float* samples, UINT32 frames)> Generator;
+
+	RenderAhead(Generator generator);
+	RenderAhead(const RenderAhead& other) = delete;
+	~RenderAhead();
+
+	// Sizes the ring for periods blocks of blockFrames, plus the largest read, then fills it to the target on
+	// the calling thread, so that the first read already finds the lookahead
+	void prime(UINT32 blockFrames, unsigned int periods, UINT32 maxReadFrames, WORD channels = 1);
+
+	void start();
+	void stop();
+
+	// Render thread. Frames the producer did not deliver yet are silence.
+	void read(float* samples, UINT32 frames);
+
+	RenderAheadStats get_stats() const;
+
+private:
+	void produce_loop();
+	void produce_block();
+	UINT32 depth() const;
+
+	Generator generator;
+	std::unique_ptr<SpscRing<float>> ring;
+	std::vector<float> block;
+	UINT32 blockFrames;
+	UINT32 targetFrames;
+	WORD channels;
+
+	// Signaled by the render thread after each read, the producer waits on it while the ring is full
+	HANDLE consumed;
+	std::atomic_bool running;
+
+	std::atomic<UINT32> minDepthFrames;
+	std::atomic<UINT64> starvedFrames;
+	std::atomic<UINT64> maxBlockNs;
+
+	std::unique_ptr<AudioWorker> worker;
+};
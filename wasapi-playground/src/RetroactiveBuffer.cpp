@@ -0,0 +1,86 @@
+#include "RetroactiveBuffer.h"
+
+#include <algorithm>
+
+RetroactiveBuffer::RetroactiveBuffer(WORD channels, DWORD sampleRate, unsigned int seconds) :
+    channels((std::max)(channels, (WORD)1)),
+    sampleRate(sampleRate),
+    capacityFrames((std::max)((UINT64)seconds * sampleRate, (UINT64)1)),
+    samples((size_t)capacityFrames * this->channels),
+    reservedFrames(0),
+    writtenFrames(0)
+{
+}
+
+void RetroactiveBuffer::write(const float* source, UINT32 frames, WORD sourceChannels)
+{
+    // A packet longer than the whole buffer only leaves its end
+    if (frames > capacityFrames) {
+        if (source != nullptr)
+            source += (size_t)(frames - capacityFrames) * sourceChannels;
+        frames = (UINT32)capacityFrames;
+    }
+
+    auto position = writtenFrames.load(std::memory_order_relaxed);
+    reservedFrames.store(position + frames, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    auto slot = (size_t)(position % capacityFrames);
+    for (UINT32 i = 0; i < frames; i++) {
+        float* frame = samples.data() + slot * channels;
+        for (WORD channel = 0; channel < channels; channel++)
+            frame[channel] = source != nullptr && channel < sourceChannels ? source[(size_t)i * sourceChannels + channel] : 0.0f;
+
+        if (++slot == capacityFrames)
+            slot = 0;
+    }
+
+    writtenFrames.store(position + frames, std::memory_order_release);
+}
+
+AudioRecording RetroactiveBuffer::snapshot(unsigned int milliseconds) const
+{
+    AudioRecording recording;
+    recording.channels = channels;
+    recording.samplesPerSecond = sampleRate;
+
+    auto end = writtenFrames.load(std::memory_order_acquire);
+    auto wanted = milliseconds != 0 ? (std::min)((UINT64)milliseconds * sampleRate / 1000, capacityFrames) : capacityFrames;
+    auto start = end > wanted ? end - wanted : 0;
+
+    // Two spans: from the oldest frame to the end of the storage, then from its beginning
+    auto first = (size_t)(start % capacityFrames);
+    auto count = (size_t)(end - start);
+    auto firstCount = (std::min)(count, (size_t)capacityFrames - first);
+    recording.data.resize(count * channels);
+    std::copy(samples.begin() + first * channels, samples.begin() + (first + firstCount) * channels, recording.data.begin());
+    std::copy(samples.begin(), samples.begin() + (count - firstCount) * channels, recording.data.begin() + firstCount * channels);
+
+    // The capture thread may have lapped the copy: its oldest frames may belong to a newer write
+    std::atomic_thread_fence(std::memory_order_acquire);
+    auto reserved = reservedFrames.load(std::memory_order_relaxed);
+    auto validStart = reserved > capacityFrames ? reserved - capacityFrames : 0;
+    if (validStart > start) {
+        auto overwritten = (size_t)(std::min)(validStart - start, (UINT64)count);
+        recording.data.erase(recording.data.begin(), recording.data.begin() + overwritten * channels);
+    }
+
+    recording.durationMs = (unsigned long)(recording.data.size() / channels * 1000 / sampleRate);
+    return recording;
+}
+
+UINT64 RetroactiveBuffer::get_written_frames() const
+{
+    return writtenFrames.load(std::memory_order_acquire);
+}
+
+UINT64 RetroactiveBuffer::get_capacity_frames() const
+{
+    return capacityFrames;
+}
+
+void RetroactiveBuffer::clear()
+{
+    reservedFrames = 0;
+    writtenFrames = 0;
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <vector>
+#include <atomic>
+
+#include <windows.h>
+
+#include "common.h"
+
+// The last N seconds of a capture stream, in a circular buffer allocated once. The capture thread overwrites
+// the oldest frames and never waits for readers; any other thread can take a snapshot at any moment. A
+// snapshot copies the buffer, then drops the frames the capture thread overwrote during the copy, so that it
+// always holds the most recent frames without gaps.
+class RetroactiveBuffer
+{
+public:
+	RetroactiveBuffer(WORD channels, DWORD sampleRate, unsigned int seconds);
+	RetroactiveBuffer(const RetroactiveBuffer& other) = delete;
+
+	// Capture thread. samples are interleaved with sourceChannels per frame, nullptr for a silent packet.
+	// Extra channels are dropped, missing ones are silent.
+	void write(const float* samples, UINT32 frames, WORD sourceChannels);
+
+	// Any thread. The last milliseconds written, all the buffer for 0, as an interleaved recording.
+	AudioRecording snapshot(unsigned int milliseconds = 0) const;
+
+	UINT64 get_written_frames() const;
+	UINT64 get_capacity_frames() const;
+
+	// Forgets the frames written so far, while the capture thread is idle
+	void clear();
+
+private:
+	const WORD channels;
+	const DWORD sampleRate;
+	const UINT64 capacityFrames;
+	std::vector<float> samples;
+
+	// Frames the capture thread started and finished writing, since the buffer was created or cleared.
+	// A reader only trusts the frames that the next write can not reach: reservedFrames - capacityFrames onwards.
+	std::atomic<UINT64> reservedFrames;
+	std::atomic<UINT64> writtenFrames;
+};
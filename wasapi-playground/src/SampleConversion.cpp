@@ -0,0 +1,88 @@
+#include "SampleConversion.h"
+
+#include <cstdint>
+#include <cstring>
+
+namespace {
+    inline float clip(float sample) {
+        return sample > 1.0f ? 1.0f : sample < -1.0f ? -1.0f : sample;
+    }
+
+    inline int32_t to_int32(float sample) {
+        // computed in double: 2^31 - 1 is not representable as float
+        return (int32_t)((double)clip(sample) * 2147483647.0);
+    }
+}
+
+bool is_float32(const StreamFormat& format)
+{
+    return format.isFloat && format.bitsPerSample == 32;
+}
+
+void float_to_pcm(const float* source, void* destination, size_t samples, const StreamFormat& format)
+{
+    if (is_float32(format)) {
+        memcpy(destination, source, samples * sizeof(float));
+        return;
+    }
+
+    switch (format.bitsPerSample) {
+    case 16: {
+        auto output = reinterpret_cast<int16_t*>(destination);
+        for (size_t i = 0; i < samples; i++)
+            output[i] = (int16_t)(clip(source[i]) * 32767.0f);
+        break;
+    }
+    case 24: {
+        // packed, little endian
+        auto output = reinterpret_cast<uint8_t*>(destination);
+        for (size_t i = 0; i < samples; i++) {
+            auto value = (int32_t)(clip(source[i]) * 8388607.0f);
+            output[i * 3] = (uint8_t)(value & 0xFF);
+            output[i * 3 + 1] = (uint8_t)((value >> 8) & 0xFF);
+            output[i * 3 + 2] = (uint8_t)((value >> 16) & 0xFF);
+        }
+        break;
+    }
+    case 32: {
+        // The bits below the valid ones must be zero
+        auto mask = format.validBitsPerSample < 32 ? ~((1u << (32 - format.validBitsPerSample)) - 1) : ~0u;
+        auto output = reinterpret_cast<int32_t*>(destination);
+        for (size_t i = 0; i < samples; i++)
+            output[i] = (int32_t)((uint32_t)to_int32(source[i]) & mask);
+        break;
+    }
+    }
+}
+
+void pcm_to_float(const void* source, float* destination, size_t samples, const StreamFormat& format)
+{
+    if (is_float32(format)) {
+        memcpy(destination, source, samples * sizeof(float));
+        return;
+    }
+
+    switch (format.bitsPerSample) {
+    case 16: {
+        auto input = reinterpret_cast<const int16_t*>(source);
+        for (size_t i = 0; i < samples; i++)
+            destination[i] = input[i] / 32768.0f;
+        break;
+    }
+    case 24: {
+        auto input = reinterpret_cast<const uint8_t*>(source);
+        for (size_t i = 0; i < samples; i++) {
+            // assemble in the top bytes so the sign is extended by the shift
+            auto value = (int32_t)((uint32_t)input[i * 3] << 8 | (uint32_t)input[i * 3 + 1] << 16 | (uint32_t)input[i * 3 + 2] << 24) >> 8;
+            destination[i] = value / 8388608.0f;
+        }
+        break;
+    }
+    case 32: {
+        auto input = reinterpret_cast<const int32_t*>(source);
+        for (size_t i = 0; i < samples; i++)
+            destination[i] = (float)(input[i] / 2147483648.0);
+        break;
+    }
+    }
+}
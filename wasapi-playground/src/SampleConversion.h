@@ -0,0 +1,13 @@
+#pragma once
+#include <cstddef>
+
+#include "StreamFormat.h"
+
+// The stream classes exchange 32-bit float samples with their users. Exclusive-mode endpoints
+// often only take integer PCM, so buffers are converted on the way in and out.
+
+bool is_float32(const StreamFormat& format);
+
+// Float samples outside [-1, 1] are clipped. Integers in a wider container (24 valid bits in 32) are left-justified.
+void float_to_pcm(const float* source, void* destination, size_t samples, const StreamFormat& format);
+void pcm_to_float(const void* source, float* destination, size_t samples, const StreamFormat& format);
@@ -0,0 +1,88 @@
+#pragma once
+#include <mutex>
+#include <vector>
+#include <atomic>
+#include <cstddef>
+#include <algorithm>
+
+#include <windows.h>
+
+#include "SpscRing.h"
+
+// Events scheduled at an exact frame from any thread, and applied by the audio thread when it reaches that frame.
+// Event has a UINT64 frame. They reach the audio thread through a lock-free queue; the control side serializes
+// its pushes on a lock of its own. The audio side never allocates: what does not fit waits in the queue.
+template<typename Event>
+class ScheduledEvents
+{
+public:
+	ScheduledEvents(size_t maxEvents) :
+		events(maxEvents),
+		dropped(0)
+	{
+		pending.reserve(events.capacity());
+	}
+
+	ScheduledEvents(const ScheduledEvents& other) = delete;
+
+	// Control side, any thread. Returns false when the queue is full.
+	bool push(const Event& event) {
+		std::lock_guard lock(controlMutex);
+		if (!events.push(event)) {
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		return true;
+	}
+
+	// Events that did not fit, from either side
+	UINT64 get_dropped() const { return dropped.load(std::memory_order_relaxed); }
+
+	// Audio side: events handed over directly, before those of the queue
+	void add(const Event* direct, size_t count) {
+		for (size_t i = 0; i < count; i++) {
+			if (pending.size() == pending.capacity()) {
+				dropped.fetch_add(count - i, std::memory_order_relaxed);
+				return;
+			}
+			pending.push_back(direct[i]);
+		}
+	}
+
+	// Audio side, at the start of a block: takes what the control side pushed since the last one
+	void collect() {
+		Event event;
+		while (pending.size() < pending.capacity() && events.pop(event))
+			pending.push_back(event);
+	}
+
+	// Audio side: calls apply(event) for every event due at now, a frame already past included, and returns
+	// the frame of the next one, or end when none is due before it.
+	template<typename Apply>
+	UINT64 apply_due(UINT64 now, UINT64 end, Apply&& apply) {
+		// Compacted in place rather than swapped out, so that two events due at the same frame apply in the
+		// order they were scheduled
+		size_t kept = 0;
+		for (size_t i = 0; i < pending.size(); i++) {
+			const auto& event = pending[i];
+			if (event.frame <= now) {
+				apply(event);
+				continue;
+			}
+
+			end = (std::min)(end, event.frame);
+			pending[kept++] = event;
+		}
+		pending.resize(kept);
+		return end;
+	}
+
+private:
+	// Control side
+	std::mutex controlMutex;
+	SpscRing<Event> events;
+	std::atomic<UINT64> dropped;
+
+	// Audio side: the events taken from the queue that are not due yet, in the order they were scheduled
+	std::vector<Event> pending;
+};
@@ -0,0 +1,845 @@
+#include "SimulatedDevice.h"
+#include "PeriodSizing.h"
+#include "SampleConversion.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functiondiscoverykeys.h>
+
+namespace {
+    const REFERENCE_TIME REFTIMES_PER_SEC = 10000000; // 1 unit = 100-nanosecond
+
+    UINT32 duration_to_frames(REFERENCE_TIME duration, DWORD samplesPerSec) {
+        return (UINT32)((duration * samplesPerSec + REFTIMES_PER_SEC - 1) / REFTIMES_PER_SEC);
+    }
+
+    REFERENCE_TIME frames_to_duration(UINT32 frames, DWORD samplesPerSec) {
+        return (REFERENCE_TIME)frames * REFTIMES_PER_SEC / samplesPerSec;
+    }
+
+    bool is_same_stream_format(const WAVEFORMATEX& a, const WAVEFORMATEX& b) {
+        return a.nChannels == b.nChannels
+            && a.nSamplesPerSec == b.nSamplesPerSec
+            && a.wBitsPerSample == b.wBitsPerSample
+            && a.nBlockAlign == b.nBlockAlign;
+    }
+
+    // Only exposes the friendly name and the device format, which is all AudioDevice reads from the property store
+    class SimulatedPropertyStore : public IPropertyStore
+    {
+    public:
+        SimulatedPropertyStore(const std::string& name, const WAVEFORMATEXTENSIBLE& format) :
+            refCount(1), friendlyName(string_to_wstring(name)), deviceFormat(format) {}
+
+        ULONG STDMETHODCALLTYPE AddRef() { return InterlockedIncrement(&refCount); }
+        ULONG STDMETHODCALLTYPE Release() {
+            ULONG ref = InterlockedDecrement(&refCount);
+            if (ref == 0)
+                delete this;
+            return ref;
+        }
+        HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, VOID** ppvInterface) {
+            if (riid == IID_IUnknown || riid == __uuidof(IPropertyStore)) {
+                AddRef();
+                *ppvInterface = static_cast<IPropertyStore*>(this);
+                return S_OK;
+            }
+            *ppvInterface = NULL;
+            return E_NOINTERFACE;
+        }
+
+        HRESULT STDMETHODCALLTYPE GetCount(DWORD* cProps) { *cProps = 2; return S_OK; }
+        HRESULT STDMETHODCALLTYPE GetAt(DWORD iProp, PROPERTYKEY* pkey) {
+            if (iProp > 1)
+                return E_INVALIDARG;
+            *pkey = iProp == 0 ? PKEY_Device_FriendlyName : PKEY_AudioEngine_DeviceFormat;
+            return S_OK;
+        }
+        HRESULT STDMETHODCALLTYPE GetValue(REFPROPERTYKEY key, PROPVARIANT* pv) {
+            PropVariantInit(pv);
+            if (IsEqualPropertyKey(key, PKEY_AudioEngine_DeviceFormat))
+                return get_device_format(pv);
+            if (!IsEqualPropertyKey(key, PKEY_Device_FriendlyName))
+                return S_OK;
+
+            // released by the caller with PropVariantClear()
+            auto size = (friendlyName.size() + 1) * sizeof(WCHAR);
+            pv->pwszVal = reinterpret_cast<LPWSTR>(CoTaskMemAlloc(size));
+            if (pv->pwszVal == nullptr)
+                return E_OUTOFMEMORY;
+
+            memcpy(pv->pwszVal, friendlyName.c_str(), size);
+            pv->vt = VT_LPWSTR;
+            return S_OK;
+        }
+        HRESULT STDMETHODCALLTYPE SetValue(REFPROPERTYKEY key, REFPROPVARIANT propvar) { return STG_E_ACCESSDENIED; }
+        HRESULT STDMETHODCALLTYPE Commit() { return STG_E_ACCESSDENIED; }
+
+    private:
+        ~SimulatedPropertyStore() = default;
+
+        HRESULT get_device_format(PROPVARIANT* pv) {
+            pv->blob.pBlobData = reinterpret_cast<BYTE*>(CoTaskMemAlloc(sizeof(deviceFormat)));
+            if (pv->blob.pBlobData == nullptr)
+                return E_OUTOFMEMORY;
+
+            memcpy(pv->blob.pBlobData, &deviceFormat, sizeof(deviceFormat));
+            pv->blob.cbSize = sizeof(deviceFormat);
+            pv->vt = VT_BLOB;
+            return S_OK;
+        }
+
+        LONG refCount;
+        std::wstring friendlyName;
+        WAVEFORMATEXTENSIBLE deviceFormat;
+    };
+}
+
+SimulatedDevice::SimulatedDevice(SimulatedEndpointConfig endpointConfig) :
+    refCount(1),
+    config(std::move(endpointConfig)),
+    removed(false),
+    lockedPeriodInFrames(0),
+    exclusiveInUse(false)
+{
+}
+
+void SimulatedDevice::simulate_removal()
+{
+    removed = true;
+}
+
+bool SimulatedDevice::is_removed() const
+{
+    return removed;
+}
+
+void SimulatedDevice::simulate_format_change(const WAVEFORMATEXTENSIBLE& mixFormat, IMMNotificationClient* notificationClient)
+{
+    config.mixFormat = mixFormat;
+    if (notificationClient != nullptr)
+        notificationClient->OnPropertyValueChanged(config.id.c_str(), PKEY_AudioEngine_DeviceFormat);
+}
+
+void SimulatedDevice::lock_engine_period(UINT32 periodInFrames)
+{
+    lockedPeriodInFrames = periodInFrames;
+}
+
+UINT32 SimulatedDevice::get_engine_period() const
+{
+    auto locked = lockedPeriodInFrames.load();
+    return locked != 0 ? locked : config.defaultPeriodInFrames;
+}
+
+bool SimulatedDevice::supports_exclusive_format(const WAVEFORMATEX& format) const
+{
+    if (format.nChannels != config.mixFormat.Format.nChannels)
+        return false;
+
+    auto streamFormat = to_stream_format(&format);
+    for (const auto& supported : config.exclusiveFormats) {
+        if (supported == streamFormat)
+            return true;
+    }
+    return false;
+}
+
+bool SimulatedDevice::claim_exclusive_mode()
+{
+    bool expected = false;
+    return exclusiveInUse.compare_exchange_strong(expected, true);
+}
+
+void SimulatedDevice::release_exclusive_mode()
+{
+    exclusiveInUse = false;
+}
+
+void SimulatedDevice::set_capture_source(SimulatedCaptureSource source)
+{
+    std::lock_guard lock(endpointMutex);
+    captureSource = source;
+}
+
+void SimulatedDevice::set_render_sink(SimulatedRenderSink sink)
+{
+    std::lock_guard lock(endpointMutex);
+    renderSink = sink;
+}
+
+const SimulatedEndpointConfig& SimulatedDevice::get_config() const
+{
+    return config;
+}
+
+void SimulatedDevice::read_capture_data(float* buffer, UINT32 frames, UINT64 position, UINT64 clockPosition)
+{
+    auto channels = config.mixFormat.Format.nChannels;
+
+    std::lock_guard lock(endpointMutex);
+    if (captureSource)
+        captureSource(buffer, frames, channels, position, clockPosition);
+    else
+        std::fill(buffer, buffer + (size_t)frames * channels, 0.0f);
+}
+
+void SimulatedDevice::write_render_data(const float* buffer, UINT32 frames, UINT64 position, UINT64 clockPosition)
+{
+    std::lock_guard lock(endpointMutex);
+    if (renderSink)
+        renderSink(buffer, frames, config.mixFormat.Format.nChannels, position, clockPosition);
+}
+
+ULONG STDMETHODCALLTYPE SimulatedDevice::AddRef()
+{
+    return InterlockedIncrement(&refCount);
+}
+
+ULONG STDMETHODCALLTYPE SimulatedDevice::Release()
+{
+    ULONG ref = InterlockedDecrement(&refCount);
+    if (ref == 0)
+        delete this;
+    return ref;
+}
+
+HRESULT STDMETHODCALLTYPE SimulatedDevice::QueryInterface(REFIID riid, VOID** ppvInterface)
+{
+    if (riid == IID_IUnknown || riid == __uuidof(IMMDevice))
+    {
+        AddRef();
+        *ppvInterface = static_cast<IMMDevice*>(this);
+    }
+    else if (riid == __uuidof(IMMEndpoint))
+    {
+        AddRef();
+        *ppvInterface = static_cast<IMMEndpoint*>(this);
+    }
+    else
+    {
+        *ppvInterface = NULL;
+        return E_NOINTERFACE;
+    }
+    return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE SimulatedDevice::Activate(REFIID iid, DWORD dwClsCtx, PROPVARIANT* pActivationParams, void** ppInterface)
+{
+    if (ppInterface == nullptr)
+        return E_POINTER;
+
+    *ppInterface = nullptr;
+    if (removed)
+        return AUDCLNT_E_DEVICE_INVALIDATED;
+
+    // Volume control and topology are not simulated
+    if (iid != __uuidof(IAudioClient) && iid != __uuidof(IAudioClient2) && iid != __uuidof(IAudioClient3))
+        return E_NOINTERFACE;
+
+    auto client = new SimulatedAudioClient(this);
+    auto result = client->QueryInterface(iid, ppInterface);
+    client->Release();
+    return result;
+}
+
+HRESULT STDMETHODCALLTYPE SimulatedDevice::OpenPropertyStore(DWORD stgmAccess, IPropertyStore** ppProperties)
+{
+    auto deviceFormat = config.exclusiveFormats.empty() ? config.mixFormat : make_wave_format(config.exclusiveFormats.front());
+    *ppProperties = new SimulatedPropertyStore(config.friendlyName, deviceFormat);
+    return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE SimulatedDevice::GetId(LPWSTR* ppstrId)
+{
+    auto size = (config.id.size() + 1) * sizeof(WCHAR);
+    *ppstrId = reinterpret_cast<LPWSTR>(CoTaskMemAlloc(size));
+    if (*ppstrId == nullptr)
+        return E_OUTOFMEMORY;
+
+    memcpy(*ppstrId, config.id.c_str(), size);
+    return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE SimulatedDevice::GetState(DWORD* pdwState)
+{
+    *pdwState = removed ? DEVICE_STATE_NOTPRESENT : DEVICE_STATE_ACTIVE;
+    return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE SimulatedDevice::GetDataFlow(EDataFlow* pDataFlow)
+{
+    *pDataFlow = config.direction;
+    return S_OK;
+}
+
+SimulatedAudioClient::SimulatedAudioClient(SimulatedDevice* parent) :
+    refCount(1),
+    device(parent),
+    initialized(false),
+    running(false),
+    streamFlags(0),
+    format(parent->get_config().mixFormat),
+    exclusive(false),
+    bufferFrames(0),
+    periodFrames(0),
+    capacityFrames(0),
+    alignedBufferFrames(0),
+    eventHandle(nullptr),
+    signaling(false),
+    clockFrames(0),
+    writtenFrames(0),
+    readFrames(0),
+    underrunFrames(0),
+    overflowed(false),
+    silentUntilFrames(0),
+    pendingFrames(0)
+{
+    device->AddRef();
+}
+
+SimulatedAudioClient::~SimulatedAudioClient()
+{
+    stop_signaling();
+    if (exclusive)
+        device->release_exclusive_mode();
+    SafeRelease(&device);
+}
+
+ULONG STDMETHODCALLTYPE SimulatedAudioClient::AddRef()
+{
+    return InterlockedIncrement(&refCount);
+}
+
+ULONG STDMETHODCALLTYPE SimulatedAudioClient::Release()
+{
+    ULONG ref = InterlockedDecrement(&refCount);
+    if (ref == 0)
+        delete this;
+    return ref;
+}
+
+HRESULT STDMETHODCALLTYPE SimulatedAudioClient::QueryInterface(REFIID riid, VOID** ppvInterface)
+{
+    if (riid == IID_IUnknown || riid == __uuidof(IAudioClient) || riid == __uuidof(IAudioClient2) || riid == __uuidof(IAudioClient3))
+    {
+        AddRef();
+        *ppvInterface = static_cast<IAudioClient3*>(this);
+    }
+    else if (riid == __uuidof(IAudioRenderClient))
+    {
+        AddRef();
+        *ppvInterface = static_cast<IAudioRenderClient*>(this);
+    }
+    else if (riid == __uuidof(IAudioCaptureClient))
+    {
+        AddRef();
+        *ppvInterface = static_cast<IAudioCaptureClient*>(this);
+    }
+    else
+    {
+        *ppvInterface = NULL;
+        return E_NOINTERFACE;
+    }
+    return S_OK;
+}
+
+HRESULT SimulatedAudioClient::check_state() const
+{
+    if (device->is_removed())
+        return AUDCLNT_E_DEVICE_INVALIDATED;
+    if (!initialized)
+        return AUDCLNT_E_NOT_INITIALIZED;
+    return S_OK;
+}
+
+void SimulatedAudioClient::initialize_stream(const WAVEFORMATEX* streamFormat, UINT32 streamBufferFrames, UINT32 streamPeriodFrames, DWORD flags)
+{
+    format = device->get_config().mixFormat;
+    format.Format = *streamFormat;
+    bufferFrames = streamBufferFrames;
+    periodFrames = streamPeriodFrames;
+    capacityFrames = exclusive ? bufferFrames * 2 : bufferFrames;
+    streamFlags = flags;
+    sampleFormat = to_stream_format(streamFormat);
+    packet.resize((size_t)bufferFrames * format.Format.nBlockAlign);
+    if (!is_float32(sampleFormat))
+        floatPacket.resize((size_t)bufferFrames * format.Format.nChannels);
+    initialized = true;
+}
+
+HRESULT SimulatedAudioClient::initialize_exclusive(DWORD flags, REFERENCE_TIME bufferDuration, REFERENCE_TIME periodicity, const WAVEFORMATEX* streamFormat)
+{
+    const auto& config = device->get_config();
+    if (config.exclusiveFormats.empty())
+        return AUDCLNT_E_EXCLUSIVE_MODE_NOT_ALLOWED;
+    if (!device->supports_exclusive_format(*streamFormat))
+        return AUDCLNT_E_UNSUPPORTED_FORMAT;
+
+    bool eventDriven = (flags & AUDCLNT_STREAMFLAGS_EVENTCALLBACK) != 0;
+    if (eventDriven && bufferDuration != periodicity)
+        return AUDCLNT_E_BUFDURATION_PERIOD_NOT_EQUAL;
+
+    auto period = periodicity != 0 ? periodicity : config.defaultDevicePeriod;
+    if (period < config.minDevicePeriod)
+        return AUDCLNT_E_INVALID_DEVICE_PERIOD;
+    if (bufferDuration < period)
+        return E_INVALIDARG;
+
+    // Like real drivers, reject a buffer that does not span whole alignment units, and report the next size that does
+    auto frames = hns_to_frames(bufferDuration, streamFormat->nSamplesPerSec);
+    if (config.bufferAlignmentBytes != 0) {
+        auto aligned = frames;
+        while (((UINT64)aligned * streamFormat->nBlockAlign) % config.bufferAlignmentBytes != 0)
+            aligned++;
+
+        if (aligned != frames) {
+            alignedBufferFrames = aligned;
+            return AUDCLNT_E_BUFFER_SIZE_NOT_ALIGNED;
+        }
+    }
+
+    if (!device->claim_exclusive_mode())
+        return AUDCLNT_E_DEVICE_IN_USE;
+
+    exclusive = true;
+    initialize_stream(streamFormat, frames, hns_to_frames(period, streamFormat->nSamplesPerSec), flags);
+    return S_OK;
+}
+
+const float* SimulatedAudioClient::decode_packet(UINT32 frames)
+{
+    if (is_float32(sampleFormat))
+        return reinterpret_cast<const float*>(packet.data());
+
+    pcm_to_float(packet.data(), floatPacket.data(), (size_t)frames * format.Format.nChannels, sampleFormat);
+    return floatPacket.data();
+}
+
+float* SimulatedAudioClient::capture_target()
+{
+    return is_float32(sampleFormat) ? reinterpret_cast<float*>(packet.data()) : floatPacket.data();
+}
+
+void SimulatedAudioClient::encode_packet(UINT32 frames)
+{
+    if (!is_float32(sampleFormat))
+        float_to_pcm(floatPacket.data(), packet.data(), (size_t)frames * format.Format.nChannels, sampleFormat);
+}
+
+void SimulatedAudioClient::advance_clock()
+{
+    auto now = std::chrono::steady_clock::now();
+    if (!running) {
+        lastClockUpdate = now;
+        return;
+    }
+
+    double elapsedFrames = std::chrono::duration<double>(now - lastClockUpdate).count() * format.Format.nSamplesPerSec;
+    lastClockUpdate = now;
+
+    if (device->get_config().direction == EDataFlow::eRender) {
+        // The endpoint can only play what was written, anything beyond that is an underrun
+        double queued = (double)writtenFrames - clockFrames;
+        if (elapsedFrames > queued && exclusive) {
+            // The hardware keeps cycling through its two buffers: the ones not refilled in time are skipped, and
+            // the events stay aligned on the buffer boundaries
+            clockFrames += elapsedFrames;
+            auto skipped = ((UINT64)(clockFrames - (double)writtenFrames) / bufferFrames + 1) * bufferFrames;
+            underrunFrames += skipped;
+            writtenFrames += skipped;
+        }
+        else if (elapsedFrames > queued) {
+            underrunFrames += (UINT64)(elapsedFrames - queued);
+            clockFrames = (double)writtenFrames;
+        }
+        else {
+            clockFrames += elapsedFrames;
+        }
+    }
+    else {
+        clockFrames += elapsedFrames;
+
+        // Capture buffer overflow: the oldest frames are lost
+        if (clockFrames - (double)readFrames > capacityFrames) {
+            readFrames = (UINT64)clockFrames - capacityFrames;
+            overflowed = true;
+        }
+    }
+}
+
+void SimulatedAudioClient::stop_signaling()
+{
+    signaling = false;
+    if (eventThread.joinable())
+        eventThread.join();
+}
+
+WAVEFORMATEX* SimulatedAudioClient::copy_mix_format() const
+{
+    auto copy = reinterpret_cast<WAVEFORMATEXTENSIBLE*>(CoTaskMemAlloc(sizeof(WAVEFORMATEXTENSIBLE)));
+    if (copy != nullptr)
+        *copy = device->get_config().mixFormat;
+    return reinterpret_cast<WAVEFORMATEX*>(copy);
+}
+
+HRESULT STDMETHODCALLTYPE SimulatedAudioClient::Initialize(AUDCLNT_SHAREMODE ShareMode, DWORD StreamFlags, REFERENCE_TIME hnsBufferDuration, REFERENCE_TIME hnsPeriodicity, const WAVEFORMATEX* pFormat, LPCGUID AudioSessionGuid)
+{
+    std::lock_guard lock(clientMutex);
+    if (device->is_removed())
+        return AUDCLNT_E_DEVICE_INVALIDATED;
+    if (initialized)
+        return AUDCLNT_E_ALREADY_INITIALIZED;
+    if (pFormat == nullptr)
+        return E_POINTER;
+    if (ShareMode == AUDCLNT_SHAREMODE_EXCLUSIVE)
+        return initialize_exclusive(StreamFlags, hnsBufferDuration, hnsPeriodicity, pFormat);
+    if (!is_same_stream_format(*pFormat, device->get_config().mixFormat.Format))
+        return AUDCLNT_E_UNSUPPORTED_FORMAT;
+
+    const auto& config = device->get_config();
+    auto period = config.defaultPeriodInFrames;
+    auto requestedFrames = duration_to_frames(hnsBufferDuration, pFormat->nSamplesPerSec);
+
+    initialize_stream(pFormat, (std::max)(requestedFrames, period * 2), period, StreamFlags);
+    return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE SimulatedAudioClient::GetBufferSize(UINT32* pNumBufferFrames)
+{
+    std::lock_guard lock(clientMutex);
+    if (!initialized && alignedBufferFrames != 0) {
+        *pNumBufferFrames = alignedBufferFrames;
+        return S_OK;
+    }
+
+    if (auto state = check_state(); FAILED(state))
+        return state;
+
+    *pNumBufferFrames = bufferFrames;
+    return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE SimulatedAudioClient::GetStreamLatency(REFERENCE_TIME* phnsLatency)
+{
+    std::lock_guard lock(clientMutex);
+    if (auto state = check_state(); FAILED(state))
+        return state;
+
+    *phnsLatency = frames_to_duration(periodFrames, format.Format.nSamplesPerSec);
+    return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE SimulatedAudioClient::GetCurrentPadding(UINT32* pNumPaddingFrames)
+{
+    std::lock_guard lock(clientMutex);
+    if (auto state = check_state(); FAILED(state))
+        return state;
+
+    advance_clock();
+    if (device->get_config().direction == EDataFlow::eRender)
+        *pNumPaddingFrames = (UINT32)(writtenFrames - (UINT64)clockFrames);
+    else
+        *pNumPaddingFrames = (UINT32)((UINT64)clockFrames - readFrames);
+    return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE SimulatedAudioClient::IsFormatSupported(AUDCLNT_SHAREMODE ShareMode, const WAVEFORMATEX* pFormat, WAVEFORMATEX** ppClosestMatch)
+{
+    if (ppClosestMatch != nullptr)
+        *ppClosestMatch = nullptr;
+    if (device->is_removed())
+        return AUDCLNT_E_DEVICE_INVALIDATED;
+    if (pFormat == nullptr)
+        return E_POINTER;
+    if (ShareMode == AUDCLNT_SHAREMODE_EXCLUSIVE)
+        return device->supports_exclusive_format(*pFormat) ? S_OK : AUDCLNT_E_UNSUPPORTED_FORMAT;
+
+    if (is_same_stream_format(*pFormat, device->get_config().mixFormat.Format))
+        return S_OK;
+
+    if (ppClosestMatch == nullptr)
+        return AUDCLNT_E_UNSUPPORTED_FORMAT;
+
+    *ppClosestMatch = copy_mix_format();
+    return S_FALSE;
+}
+
+HRESULT STDMETHODCALLTYPE SimulatedAudioClient::GetMixFormat(WAVEFORMATEX** ppDeviceFormat)
+{
+    if (device->is_removed())
+        return AUDCLNT_E_DEVICE_INVALIDATED;
+
+    *ppDeviceFormat = copy_mix_format();
+    return *ppDeviceFormat != nullptr ? S_OK : E_OUTOFMEMORY;
+}
+
+HRESULT STDMETHODCALLTYPE SimulatedAudioClient::GetDevicePeriod(REFERENCE_TIME* phnsDefaultDevicePeriod, REFERENCE_TIME* phnsMinimumDevicePeriod)
+{
+    if (device->is_removed())
+        return AUDCLNT_E_DEVICE_INVALIDATED;
+
+    if (phnsDefaultDevicePeriod != nullptr)
+        *phnsDefaultDevicePeriod = device->get_config().defaultDevicePeriod;
+    if (phnsMinimumDevicePeriod != nullptr)
+        *phnsMinimumDevicePeriod = device->get_config().minDevicePeriod;
+    return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE SimulatedAudioClient::Start()
+{
+    std::lock_guard lock(clientMutex);
+    if (auto state = check_state(); FAILED(state))
+        return state;
+    if (running)
+        return AUDCLNT_E_NOT_STOPPED;
+
+    running = true;
+    lastClockUpdate = std::chrono::steady_clock::now();
+    silentUntilFrames = (UINT64)clockFrames + device->get_config().silentLeadInFrames;
+
+    if (eventHandle != nullptr) {
+        // The engine wakes the client once per period, until the stream stops or the endpoint disappears
+        auto period = std::chrono::duration<double>((double)periodFrames / format.Format.nSamplesPerSec);
+        signaling = true;
+        eventThread = std::thread([this, period, event = eventHandle, doubleBuffered = exclusive]() {
+            // A double-buffered exclusive endpoint frees the second buffer as soon as it starts playing the first
+            if (doubleBuffered)
+                SetEvent(event);
+
+            auto nextSignal = std::chrono::steady_clock::now();
+            while (signaling && !device->is_removed()) {
+                nextSignal += std::chrono::duration_cast<std::chrono::steady_clock::duration>(period);
+                std::this_thread::sleep_until(nextSignal);
+                SetEvent(event);
+            }
+        });
+    }
+    return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE SimulatedAudioClient::Stop()
+{
+    std::lock_guard lock(clientMutex);
+    if (auto state = check_state(); FAILED(state))
+        return state;
+    if (!running)
+        return S_FALSE;
+
+    advance_clock();
+    running = false;
+    stop_signaling();
+    return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE SimulatedAudioClient::Reset()
+{
+    std::lock_guard lock(clientMutex);
+    if (auto state = check_state(); FAILED(state))
+        return state;
+    if (running)
+        return AUDCLNT_E_NOT_STOPPED;
+
+    clockFrames = 0;
+    writtenFrames = 0;
+    readFrames = 0;
+    overflowed = false;
+    return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE SimulatedAudioClient::SetEventHandle(HANDLE handle)
+{
+    std::lock_guard lock(clientMutex);
+    if (auto state = check_state(); FAILED(state))
+        return state;
+    if ((streamFlags & AUDCLNT_STREAMFLAGS_EVENTCALLBACK) == 0)
+        return AUDCLNT_E_EVENTHANDLE_NOT_EXPECTED;
+
+    eventHandle = handle;
+    return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE SimulatedAudioClient::GetService(REFIID riid, void** ppv)
+{
+    {
+        std::lock_guard lock(clientMutex);
+        if (auto state = check_state(); FAILED(state))
+            return state;
+    }
+
+    auto direction = device->get_config().direction;
+    if (riid == __uuidof(IAudioRenderClient) && direction != EDataFlow::eRender)
+        return AUDCLNT_E_WRONG_ENDPOINT_TYPE;
+    if (riid == __uuidof(IAudioCaptureClient) && direction != EDataFlow::eCapture)
+        return AUDCLNT_E_WRONG_ENDPOINT_TYPE;
+
+    return QueryInterface(riid, ppv);
+}
+
+HRESULT STDMETHODCALLTYPE SimulatedAudioClient::IsOffloadCapable(AUDIO_STREAM_CATEGORY Category, BOOL* pbOffloadCapable)
+{
+    *pbOffloadCapable = FALSE;
+    return device->is_removed() ? AUDCLNT_E_DEVICE_INVALIDATED : S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE SimulatedAudioClient::SetClientProperties(const AudioClientProperties* pProperties)
+{
+    return device->is_removed() ? AUDCLNT_E_DEVICE_INVALIDATED : S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE SimulatedAudioClient::GetBufferSizeLimits(const WAVEFORMATEX* pFormat, BOOL bEventDriven, REFERENCE_TIME* phnsMinBufferDuration, REFERENCE_TIME* phnsMaxBufferDuration)
+{
+    // only meaningful for hardware-offloaded streams, which are not simulated
+    return E_NOTIMPL;
+}
+
+HRESULT STDMETHODCALLTYPE SimulatedAudioClient::GetSharedModeEnginePeriod(const WAVEFORMATEX* pFormat, UINT32* pDefaultPeriodInFrames, UINT32* pFundamentalPeriodInFrames, UINT32* pMinPeriodInFrames, UINT32* pMaxPeriodInFrames)
+{
+    if (device->is_removed())
+        return AUDCLNT_E_DEVICE_INVALIDATED;
+
+    const auto& config = device->get_config();
+    *pDefaultPeriodInFrames = config.defaultPeriodInFrames;
+    *pFundamentalPeriodInFrames = config.fundamentalPeriodInFrames;
+    *pMinPeriodInFrames = config.minPeriodInFrames;
+    *pMaxPeriodInFrames = config.maxPeriodInFrames;
+    return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE SimulatedAudioClient::GetCurrentSharedModeEnginePeriod(WAVEFORMATEX** ppFormat, UINT32* pCurrentPeriodInFrames)
+{
+    if (device->is_removed())
+        return AUDCLNT_E_DEVICE_INVALIDATED;
+
+    *ppFormat = copy_mix_format();
+    *pCurrentPeriodInFrames = device->get_engine_period();
+    return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE SimulatedAudioClient::InitializeSharedAudioStream(DWORD StreamFlags, UINT32 PeriodInFrames, const WAVEFORMATEX* pFormat, LPCGUID AudioSessionGuid)
+{
+    std::lock_guard lock(clientMutex);
+    if (device->is_removed())
+        return AUDCLNT_E_DEVICE_INVALIDATED;
+    if (initialized)
+        return AUDCLNT_E_ALREADY_INITIALIZED;
+    if (pFormat == nullptr)
+        return E_POINTER;
+    if (!is_same_stream_format(*pFormat, device->get_config().mixFormat.Format))
+        return AUDCLNT_E_UNSUPPORTED_FORMAT;
+
+    // Same rules as the real engine: the period must be in range and a multiple of the fundamental period
+    const auto& config = device->get_config();
+    if (PeriodInFrames < config.minPeriodInFrames || PeriodInFrames > config.maxPeriodInFrames)
+        return E_INVALIDARG;
+    if (config.fundamentalPeriodInFrames != 0 && (PeriodInFrames - config.minPeriodInFrames) % config.fundamentalPeriodInFrames != 0)
+        return E_INVALIDARG;
+
+    // Another stream already runs the engine at a custom period
+    auto enginePeriod = device->get_engine_period();
+    if (enginePeriod != config.defaultPeriodInFrames && PeriodInFrames != enginePeriod)
+        return AUDCLNT_E_ENGINE_PERIODICITY_LOCKED;
+
+    initialize_stream(pFormat, PeriodInFrames * 2, PeriodInFrames, StreamFlags);
+    return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE SimulatedAudioClient::GetBuffer(UINT32 NumFramesRequested, BYTE** ppData)
+{
+    std::lock_guard lock(clientMutex);
+    if (auto state = check_state(); FAILED(state))
+        return state;
+    if (pendingFrames != 0)
+        return AUDCLNT_E_OUT_OF_ORDER;
+
+    advance_clock();
+    auto padding = (UINT32)(writtenFrames - (UINT64)clockFrames);
+    if (NumFramesRequested > bufferFrames || NumFramesRequested > capacityFrames - padding)
+        return AUDCLNT_E_BUFFER_TOO_LARGE;
+
+    pendingFrames = NumFramesRequested;
+    *ppData = packet.data();
+    return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE SimulatedAudioClient::ReleaseBuffer(UINT32 NumFramesWritten, DWORD dwFlags)
+{
+    std::lock_guard lock(clientMutex);
+    if (auto state = check_state(); FAILED(state))
+        return state;
+    if (NumFramesWritten > pendingFrames)
+        return E_INVALIDARG;
+
+    if (dwFlags & AUDCLNT_BUFFERFLAGS_SILENT)
+        std::fill(packet.begin(), packet.begin() + (size_t)NumFramesWritten * format.Format.nBlockAlign, (BYTE)0);
+
+    // The clock as of now, not as of GetBuffer: the sink learns when the packet really starts playing
+    advance_clock();
+    device->write_render_data(decode_packet(NumFramesWritten), NumFramesWritten, writtenFrames, (UINT64)clockFrames);
+    writtenFrames += NumFramesWritten;
+    pendingFrames = 0;
+    return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE SimulatedAudioClient::GetBuffer(BYTE** ppData, UINT32* pNumFramesToRead, DWORD* pdwFlags, UINT64* pu64DevicePosition, UINT64* pu64QPCPosition)
+{
+    std::lock_guard lock(clientMutex);
+    if (auto state = check_state(); FAILED(state))
+        return state;
+    if (pendingFrames != 0)
+        return AUDCLNT_E_OUT_OF_ORDER;
+
+    advance_clock();
+    auto available = (UINT32)((UINT64)clockFrames - readFrames);
+    if (available < periodFrames) {
+        *pNumFramesToRead = 0;
+        return AUDCLNT_S_BUFFER_EMPTY;
+    }
+
+    // Like the shared-mode engine, data is delivered one period at a time
+    pendingFrames = periodFrames;
+    device->read_capture_data(capture_target(), pendingFrames, readFrames, (UINT64)clockFrames);
+    encode_packet(pendingFrames);
+
+    *ppData = packet.data();
+    *pNumFramesToRead = pendingFrames;
+    *pdwFlags = overflowed ? AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY : 0;
+    if (readFrames < silentUntilFrames)
+        *pdwFlags |= AUDCLNT_BUFFERFLAGS_SILENT;
+    overflowed = false;
+    if (pu64DevicePosition != nullptr)
+        *pu64DevicePosition = readFrames;
+    if (pu64QPCPosition != nullptr)
+        *pu64QPCPosition = 0;
+    return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE SimulatedAudioClient::ReleaseBuffer(UINT32 NumFramesRead)
+{
+    std::lock_guard lock(clientMutex);
+    if (auto state = check_state(); FAILED(state))
+        return state;
+    if (NumFramesRead != 0 && NumFramesRead != pendingFrames)
+        return E_INVALIDARG;
+
+    readFrames += NumFramesRead;
+    pendingFrames = 0;
+    return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE SimulatedAudioClient::GetNextPacketSize(UINT32* pNumFramesInNextPacket)
+{
+    std::lock_guard lock(clientMutex);
+    if (auto state = check_state(); FAILED(state))
+        return state;
+
+    advance_clock();
+    auto available = (UINT32)((UINT64)clockFrames - readFrames);
+    *pNumFramesInNextPacket = available >= periodFrames ? periodFrames : 0;
+    return S_OK;
+}
+
+UINT64 SimulatedAudioClient::get_underrun_frames() const
+{
+    return underrunFrames;
+}
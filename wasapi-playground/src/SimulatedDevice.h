@@ -0,0 +1,214 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <functional>
+
+#include <MMDeviceAPI.h>
+#include <AudioClient.h>
+
+#include "common.h"
+
+// Produces the frames returned by a simulated capture endpoint. Buffer is interleaved float. position is the
+// stream position of the first frame, clockPosition the frames the endpoint recorded so far: the buffer
+// starts (clockPosition - position) frames in the past.
+typedef std::function<void(float* buffer, UINT32 frames, WORD channels, UINT64 position, UINT64 clockPosition)> SimulatedCaptureSource;
+
+// Receives every packet released to a simulated render endpoint. Buffer is interleaved float. position is the
+// stream position of the first frame, clockPosition the frames the endpoint played so far: the buffer
+// starts playing (position - clockPosition) frames from now.
+typedef std::function<void(const float* buffer, UINT32 frames, WORD channels, UINT64 position, UINT64 clockPosition)> SimulatedRenderSink;
+
+struct SimulatedEndpointConfig {
+	std::wstring id = L"{0.0.0.00000000}.{simulated}";
+	std::string friendlyName = "Simulated endpoint";
+	EDataFlow direction = EDataFlow::eRender;
+	WAVEFORMATEXTENSIBLE mixFormat = make_float_format(48000, 2);
+
+	// Values reported by IAudioClient::GetDevicePeriod(), 1 unit = 100-nanosecond
+	REFERENCE_TIME defaultDevicePeriod = 100000;
+	REFERENCE_TIME minDevicePeriod = 30000;
+
+	// Values reported by IAudioClient3::GetSharedModeEnginePeriod()
+	UINT32 defaultPeriodInFrames = 480;
+	UINT32 fundamentalPeriodInFrames = 48;
+	UINT32 minPeriodInFrames = 144;
+	UINT32 maxPeriodInFrames = 480;
+
+	// Formats accepted in exclusive mode, with the channel count of the mix format. The first one is reported
+	// as PKEY_AudioEngine_DeviceFormat. Empty: exclusive mode is not allowed.
+	std::vector<StreamFormat> exclusiveFormats = {
+		StreamFormat{ 48000, 2, 32, 24, false },
+		StreamFormat{ 48000, 2, 16, 16, false },
+	};
+
+	// Capture: packets starting within this many frames of Start() are flagged AUDCLNT_BUFFERFLAGS_SILENT, as
+	// endpoints do while they settle
+	UINT32 silentLeadInFrames = 0;
+
+	// Exclusive buffers must span a multiple of this many bytes, or Initialize() fails with AUDCLNT_E_BUFFER_SIZE_NOT_ALIGNED
+	UINT32 bufferAlignmentBytes = 128;
+};
+
+// An IMMDevice that lives entirely in memory. It can be wrapped in an AudioDevice and handed to
+// AudioRenderer or AudioCapturer like a real endpoint, which makes it possible to exercise the stream
+// classes without audio hardware and to inject failures such as a device removal.
+// The stream clock advances with the wall clock, as a real endpoint would.
+class SimulatedDevice : public IMMDevice, public IMMEndpoint
+{
+public:
+	SimulatedDevice(SimulatedEndpointConfig config);
+	SimulatedDevice(const SimulatedDevice& other) = delete;
+
+	// From now on every call on this device, and on the audio clients it activated, fails with AUDCLNT_E_DEVICE_INVALIDATED
+	void simulate_removal();
+	bool is_removed() const;
+
+	// Changes the mix format, as picking another default format in the sound control panel does, and delivers the
+	// PKEY_AudioEngine_DeviceFormat change to notificationClient like the audio service would. Only while no stream is open.
+	void simulate_format_change(const WAVEFORMATEXTENSIBLE& mixFormat, IMMNotificationClient* notificationClient = nullptr);
+
+	// Simulates another stream holding the shared-mode engine at this period, 0 releases it.
+	// While locked, InitializeSharedAudioStream() fails with any other period.
+	void lock_engine_period(UINT32 periodInFrames);
+	UINT32 get_engine_period() const;
+
+	void set_capture_source(SimulatedCaptureSource source);
+	void set_render_sink(SimulatedRenderSink sink);
+
+	const SimulatedEndpointConfig& get_config() const;
+	bool supports_exclusive_format(const WAVEFORMATEX& format) const;
+
+	// Only one client at a time can open the endpoint in exclusive mode
+	bool claim_exclusive_mode();
+	void release_exclusive_mode();
+
+	void read_capture_data(float* buffer, UINT32 frames, UINT64 position, UINT64 clockPosition);
+	void write_render_data(const float* buffer, UINT32 frames, UINT64 position, UINT64 clockPosition);
+
+	// IUnknown
+	ULONG STDMETHODCALLTYPE AddRef();
+	ULONG STDMETHODCALLTYPE Release();
+	HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, VOID** ppvInterface);
+
+	// IMMDevice
+	HRESULT STDMETHODCALLTYPE Activate(REFIID iid, DWORD dwClsCtx, PROPVARIANT* pActivationParams, void** ppInterface);
+	HRESULT STDMETHODCALLTYPE OpenPropertyStore(DWORD stgmAccess, IPropertyStore** ppProperties);
+	HRESULT STDMETHODCALLTYPE GetId(LPWSTR* ppstrId);
+	HRESULT STDMETHODCALLTYPE GetState(DWORD* pdwState);
+
+	// IMMEndpoint
+	HRESULT STDMETHODCALLTYPE GetDataFlow(EDataFlow* pDataFlow);
+
+private:
+	~SimulatedDevice() = default;
+
+	LONG refCount;
+	SimulatedEndpointConfig config;
+	std::atomic_bool removed;
+	std::atomic<UINT32> lockedPeriodInFrames;
+	std::atomic_bool exclusiveInUse;
+
+	std::mutex endpointMutex;
+	SimulatedCaptureSource captureSource;
+	SimulatedRenderSink renderSink;
+};
+
+// IAudioClient3 activated from a SimulatedDevice. It also serves IAudioRenderClient and
+// IAudioCaptureClient through GetService(), depending on the direction of the endpoint.
+// Event-driven streams get their event signaled once per period while running.
+class SimulatedAudioClient : public IAudioClient3, public IAudioRenderClient, public IAudioCaptureClient
+{
+public:
+	SimulatedAudioClient(SimulatedDevice* parent);
+	SimulatedAudioClient(const SimulatedAudioClient& other) = delete;
+
+	// IUnknown
+	ULONG STDMETHODCALLTYPE AddRef();
+	ULONG STDMETHODCALLTYPE Release();
+	HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, VOID** ppvInterface);
+
+	// IAudioClient
+	HRESULT STDMETHODCALLTYPE Initialize(AUDCLNT_SHAREMODE ShareMode, DWORD StreamFlags, REFERENCE_TIME hnsBufferDuration, REFERENCE_TIME hnsPeriodicity, const WAVEFORMATEX* pFormat, LPCGUID AudioSessionGuid);
+	HRESULT STDMETHODCALLTYPE GetBufferSize(UINT32* pNumBufferFrames);
+	HRESULT STDMETHODCALLTYPE GetStreamLatency(REFERENCE_TIME* phnsLatency);
+	HRESULT STDMETHODCALLTYPE GetCurrentPadding(UINT32* pNumPaddingFrames);
+	HRESULT STDMETHODCALLTYPE IsFormatSupported(AUDCLNT_SHAREMODE ShareMode, const WAVEFORMATEX* pFormat, WAVEFORMATEX** ppClosestMatch);
+	HRESULT STDMETHODCALLTYPE GetMixFormat(WAVEFORMATEX** ppDeviceFormat);
+	HRESULT STDMETHODCALLTYPE GetDevicePeriod(REFERENCE_TIME* phnsDefaultDevicePeriod, REFERENCE_TIME* phnsMinimumDevicePeriod);
+	HRESULT STDMETHODCALLTYPE Start();
+	HRESULT STDMETHODCALLTYPE Stop();
+	HRESULT STDMETHODCALLTYPE Reset();
+	HRESULT STDMETHODCALLTYPE SetEventHandle(HANDLE eventHandle);
+	HRESULT STDMETHODCALLTYPE GetService(REFIID riid, void** ppv);
+
+	// IAudioClient2
+	HRESULT STDMETHODCALLTYPE IsOffloadCapable(AUDIO_STREAM_CATEGORY Category, BOOL* pbOffloadCapable);
+	HRESULT STDMETHODCALLTYPE SetClientProperties(const AudioClientProperties* pProperties);
+	HRESULT STDMETHODCALLTYPE GetBufferSizeLimits(const WAVEFORMATEX* pFormat, BOOL bEventDriven, REFERENCE_TIME* phnsMinBufferDuration, REFERENCE_TIME* phnsMaxBufferDuration);
+
+	// IAudioClient3
+	HRESULT STDMETHODCALLTYPE GetSharedModeEnginePeriod(const WAVEFORMATEX* pFormat, UINT32* pDefaultPeriodInFrames, UINT32* pFundamentalPeriodInFrames, UINT32* pMinPeriodInFrames, UINT32* pMaxPeriodInFrames);
+	HRESULT STDMETHODCALLTYPE GetCurrentSharedModeEnginePeriod(WAVEFORMATEX** ppFormat, UINT32* pCurrentPeriodInFrames);
+	HRESULT STDMETHODCALLTYPE InitializeSharedAudioStream(DWORD StreamFlags, UINT32 PeriodInFrames, const WAVEFORMATEX* pFormat, LPCGUID AudioSessionGuid);
+
+	// IAudioRenderClient
+	HRESULT STDMETHODCALLTYPE GetBuffer(UINT32 NumFramesRequested, BYTE** ppData);
+	HRESULT STDMETHODCALLTYPE ReleaseBuffer(UINT32 NumFramesWritten, DWORD dwFlags);
+
+	// IAudioCaptureClient
+	HRESULT STDMETHODCALLTYPE GetBuffer(BYTE** ppData, UINT32* pNumFramesToRead, DWORD* pdwFlags, UINT64* pu64DevicePosition, UINT64* pu64QPCPosition);
+	HRESULT STDMETHODCALLTYPE ReleaseBuffer(UINT32 NumFramesRead);
+	HRESULT STDMETHODCALLTYPE GetNextPacketSize(UINT32* pNumFramesInNextPacket);
+
+	// Frames the render side could not play because the buffer ran empty
+	UINT64 get_underrun_frames() const;
+
+private:
+	~SimulatedAudioClient();
+
+	HRESULT check_state() const;
+	void initialize_stream(const WAVEFORMATEX* format, UINT32 bufferFrames, UINT32 periodFrames, DWORD flags);
+	HRESULT initialize_exclusive(DWORD flags, REFERENCE_TIME bufferDuration, REFERENCE_TIME periodicity, const WAVEFORMATEX* format);
+	const float* decode_packet(UINT32 frames);
+	float* capture_target();
+	void encode_packet(UINT32 frames);
+	void advance_clock();
+	void stop_signaling();
+	WAVEFORMATEX* copy_mix_format() const;
+
+	LONG refCount;
+	SimulatedDevice* device;
+
+	std::mutex clientMutex;
+	bool initialized;
+	bool running;
+	DWORD streamFlags;
+	WAVEFORMATEXTENSIBLE format;
+	bool exclusive;
+	UINT32 bufferFrames;
+	UINT32 periodFrames;
+	UINT32 capacityFrames;			// exclusive streams are double-buffered: twice the reported buffer
+	UINT32 alignedBufferFrames;		// reported by GetBufferSize() after AUDCLNT_E_BUFFER_SIZE_NOT_ALIGNED
+	HANDLE eventHandle;
+	std::thread eventThread;
+	std::atomic_bool signaling;
+
+	// Stream clock: frames the endpoint consumed (render) or produced (capture) so far
+	std::chrono::steady_clock::time_point lastClockUpdate;
+	double clockFrames;
+	UINT64 writtenFrames;
+	UINT64 readFrames;
+	UINT64 underrunFrames;
+	bool overflowed;				// capture: frames were lost, the next packet is flagged as a discontinuity
+	UINT64 silentUntilFrames;		// capture: packets starting before are flagged as silent
+
+	// Packet in the stream format, and its float copy for the endpoint when the stream format is an integer one
+	std::vector<BYTE> packet;
+	std::vector<float> floatPacket;
+	StreamFormat sampleFormat;
+	UINT32 pendingFrames;
+};
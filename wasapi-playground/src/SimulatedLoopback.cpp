@@ -0,0 +1,77 @@
+#include "SimulatedLoopback.h"
+
+#include <cmath>
+
+SimulatedLoopback::SimulatedLoopback(SimulatedDevice* renderDevice, SimulatedDevice* captureDevice, double latencyFrames) :
+    render(renderDevice),
+    capture(captureDevice),
+    latencyFrames(latencyFrames),
+    sampleRate(renderDevice->get_config().mixFormat.Format.nSamplesPerSec),
+    renderChannels(renderDevice->get_config().mixFormat.Format.nChannels),
+    origin(std::chrono::steady_clock::now()),
+    timeline((size_t)sampleRate * renderChannels),
+    slotFrames(sampleRate, -1)
+{
+    render->AddRef();
+    capture->AddRef();
+
+    render->set_render_sink([this](const float* buffer, UINT32 frames, WORD channels, UINT64 position, UINT64 clockPosition) {
+        play(buffer, frames, channels, position - clockPosition);
+    });
+    capture->set_capture_source([this](float* buffer, UINT32 frames, WORD channels, UINT64 position, UINT64 clockPosition) {
+        record(buffer, frames, channels, clockPosition - position);
+    });
+}
+
+SimulatedLoopback::~SimulatedLoopback()
+{
+    render->set_render_sink(nullptr);
+    capture->set_capture_source(nullptr);
+    render->Release();
+    capture->Release();
+}
+
+double SimulatedLoopback::now_in_frames() const
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - origin).count() * sampleRate;
+}
+
+void SimulatedLoopback::play(const float* buffer, UINT32 frames, WORD channels, UINT64 framesAhead)
+{
+    std::lock_guard lock(mutex);
+
+    // The first frame plays once the frames still queued in the endpoint were played
+    auto start = now_in_frames() + (double)framesAhead;
+    for (UINT32 i = 0; i < frames; i++) {
+        auto frame = (int64_t)start + i;
+        auto slot = (size_t)(frame % sampleRate);
+        slotFrames[slot] = frame;
+        for (WORD channel = 0; channel < renderChannels; channel++)
+            timeline[slot * renderChannels + channel] = channel < channels ? buffer[(size_t)i * channels + channel] : 0.0f;
+    }
+}
+
+float SimulatedLoopback::played_sample(int64_t frame, WORD channel) const
+{
+    auto slot = (size_t)((frame % sampleRate + sampleRate) % sampleRate);
+    if (frame < 0 || slotFrames[slot] != frame)
+        return 0.0f;
+
+    return timeline[slot * renderChannels + channel % renderChannels];
+}
+
+void SimulatedLoopback::record(float* buffer, UINT32 frames, WORD channels, UINT64 framesAgo)
+{
+    std::lock_guard lock(mutex);
+
+    // The first frame was recorded framesAgo, and left the render endpoint latencyFrames before that
+    auto first = now_in_frames() - (double)framesAgo - latencyFrames;
+    for (UINT32 i = 0; i < frames; i++) {
+        auto time = first + i;
+        auto frame = (int64_t)floor(time);
+        auto fraction = (float)(time - (double)frame);
+
+        for (WORD channel = 0; channel < channels; channel++)
+            buffer[(size_t)i * channels + channel] = (1 - fraction) * played_sample(frame, channel) + fraction * played_sample(frame + 1, channel);
+    }
+}
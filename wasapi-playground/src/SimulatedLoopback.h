@@ -0,0 +1,40 @@
+#pragma once
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+
+#include "SimulatedDevice.h"
+
+// A cable from a simulated render endpoint to a simulated capture endpoint: the capture endpoint records
+// what the render endpoint was playing at that moment. Written frames are played when the render endpoint's
+// clock reaches them, so the round trip measured through it includes the render and capture buffering.
+// latencyFrames adds the delay of the converters of real hardware; fractions of a frame are interpolated.
+class SimulatedLoopback
+{
+public:
+	SimulatedLoopback(SimulatedDevice* render, SimulatedDevice* capture, double latencyFrames = 0);
+	SimulatedLoopback(const SimulatedLoopback& other) = delete;
+
+	// Disconnects the endpoints
+	~SimulatedLoopback();
+
+private:
+	void play(const float* buffer, UINT32 frames, WORD channels, UINT64 framesAhead);
+	void record(float* buffer, UINT32 frames, WORD channels, UINT64 framesAgo);
+	double now_in_frames() const;
+	float played_sample(int64_t frame, WORD channel) const;
+
+	SimulatedDevice* render;
+	SimulatedDevice* capture;
+	double latencyFrames;
+	UINT32 sampleRate;
+	WORD renderChannels;
+	std::chrono::steady_clock::time_point origin;
+
+	// One second of played frames, indexed by their play time in frames since origin. Each slot remembers
+	// which frame it holds, so that a slot that was not written in this lap reads as silence.
+	std::mutex mutex;
+	std::vector<float> timeline;
+	std::vector<int64_t> slotFrames;
+};
@@ -0,0 +1,76 @@
+#pragma once
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+
+// Bounded single-producer single-consumer queue for passing samples between two audio threads.
+// The storage is allocated by the constructor; push and pop never allocate, lock or wait.
+template<typename T>
+class SpscRing
+{
+public:
+	// Rounded up to a power of 2
+	SpscRing(size_t minimumCapacity) :
+		mask(round_up(minimumCapacity) - 1),
+		items(mask + 1),
+		head(0),
+		tail(0)
+	{
+	}
+
+	SpscRing(const SpscRing& other) = delete;
+
+	size_t capacity() const { return mask + 1; }
+
+	// Producer side. Returns how many of the items fit, the rest are not written.
+	size_t push(const T* source, size_t count) {
+		auto writePosition = head.load(std::memory_order_relaxed);
+		auto readPosition = tail.load(std::memory_order_acquire);
+		count = (std::min)(count, capacity() - (writePosition - readPosition));
+
+		for (size_t i = 0; i < count; i++)
+			items[(writePosition + i) & mask] = source[i];
+
+		head.store(writePosition + count, std::memory_order_release);
+		return count;
+	}
+
+	bool push(const T& item) { return push(&item, 1) == 1; }
+
+	// Consumer side. Returns how many items were read.
+	size_t pop(T* destination, size_t count) {
+		auto readPosition = tail.load(std::memory_order_relaxed);
+		auto writePosition = head.load(std::memory_order_acquire);
+		count = (std::min)(count, writePosition - readPosition);
+
+		for (size_t i = 0; i < count; i++)
+			destination[i] = items[(readPosition + i) & mask];
+
+		tail.store(readPosition + count, std::memory_order_release);
+		return count;
+	}
+
+	bool pop(T& item) { return pop(&item, 1) == 1; }
+
+	// Consumer side: drops everything written so far
+	void clear() { tail.store(head.load(std::memory_order_acquire), std::memory_order_release); }
+
+	// Approximate when called from a third thread
+	size_t size() const { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire); }
+
+private:
+	static size_t round_up(size_t value) {
+		size_t capacity = 1;
+		while (capacity < value)
+			capacity <<= 1;
+		return capacity;
+	}
+
+	const size_t mask;
+	std::vector<T> items;
+
+	// Free-running positions, on separate cache lines so the two threads do not invalidate each other
+	alignas(64) std::atomic<size_t> head;
+	alignas(64) std::atomic<size_t> tail;
+};
@@ -0,0 +1,23 @@
+#pragma once
+
+// Plain description of a PCM stream format, free of Windows types so the logic built on it
+// (format negotiation, period sizing) can be compiled and checked on any platform.
+struct StreamFormat {
+	unsigned int sampleRate = 48000;
+	unsigned short channels = 2;
+	unsigned short bitsPerSample = 32;		// container size
+	unsigned short validBitsPerSample = 32;
+	bool isFloat = true;
+	unsigned long channelMask = 0;
+
+	unsigned int block_align() const { return channels * bitsPerSample / 8; }
+
+	bool operator==(const StreamFormat& other) const {
+		return sampleRate == other.sampleRate
+			&& channels == other.channels
+			&& bitsPerSample == other.bitsPerSample
+			&& validBitsPerSample == other.validBitsPerSample
+			&& isFloat == other.isFloat;
+	}
+	bool operator!=(const StreamFormat& other) const { return !(*this == other); }
+};
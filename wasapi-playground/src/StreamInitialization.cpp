@@ -0,0 +1,186 @@
+#include "StreamInitialization.h"
+#include "PeriodSizing.h"
+
+#include <cstdio>
+
+namespace {
+    HRESULT initialize_engine_period(IAudioClient3* client, const WAVEFORMATEX* format, DWORD streamFlags, unsigned int requestedFrames, UINT32* periodInFrames)
+    {
+        EnginePeriodLimits limits;
+        auto result = client->GetSharedModeEnginePeriod(
+            format,
+            &limits.defaultPeriodInFrames,
+            &limits.fundamentalPeriodInFrames,
+            &limits.minPeriodInFrames,
+            &limits.maxPeriodInFrames);
+
+        if (FAILED(result))
+            return result;
+
+        auto period = align_engine_period(limits, requestedFrames);
+        result = client->InitializeSharedAudioStream(streamFlags, period, format, NULL);
+
+        if (result == AUDCLNT_E_ENGINE_PERIODICITY_LOCKED) {
+            // Another stream already runs the engine at a different period: join it at that period
+            WAVEFORMATEX* engineFormat = nullptr;
+            UINT32 currentPeriod = 0;
+            result = client->GetCurrentSharedModeEnginePeriod(&engineFormat, &currentPeriod);
+            CoTaskMemFree(engineFormat);
+            if (FAILED(result))
+                return result;
+
+            printf("[initialize_shared_stream()] engine period locked at %d frames, requested %d\n", currentPeriod, period);
+            period = currentPeriod;
+            result = client->InitializeSharedAudioStream(streamFlags, period, format, NULL);
+        }
+
+        if (SUCCEEDED(result))
+            *periodInFrames = period;
+        return result;
+    }
+}
+
+std::optional<HRESULT> initialize_shared_stream(IAudioClient3* client, const WAVEFORMATEX* format, const StreamRequest& request, UINT32* periodInFrames)
+{
+    DWORD streamFlags = AUDCLNT_STREAMFLAGS_NOPERSIST;
+    if (request.bufferEvent != nullptr)
+        streamFlags |= AUDCLNT_STREAMFLAGS_EVENTCALLBACK;
+
+    *periodInFrames = 0;
+    HRESULT result = E_FAIL;
+
+    if (request.lowLatency) {
+        result = initialize_engine_period(client, format, streamFlags, request.periodInFrames, periodInFrames);
+
+        // A failed initialization leaves the client uninitialized, so the legacy path can still be tried on it
+        if (FAILED(result))
+            printf("[initialize_shared_stream()] low-latency initialization failed: %x, using the default period\n", result);
+    }
+
+    if (!request.lowLatency || FAILED(result)) {
+        result = client->Initialize(
+            AUDCLNT_SHAREMODE_SHARED,
+            streamFlags,
+            (REFERENCE_TIME)request.bufferTimeSizeMs * 10000,   // 1 unit --> 100 nanoseconds
+            0,                                                  // only used for EXCLUSIVE mode
+            format,
+            NULL);
+    }
+
+    if (FAILED(result))
+    {
+        printf("Unable to initialize audio client: %x.\n", result);
+        return result;
+    }
+
+    if (request.bufferEvent != nullptr) {
+        result = client->SetEventHandle(request.bufferEvent);
+        if (FAILED(result))
+        {
+            printf("Unable to set the buffer event: %x.\n", result);
+            return result;
+        }
+    }
+
+    return std::nullopt;
+}
+
+std::optional<HRESULT> initialize_exclusive_stream(AudioDevice& device, IAudioClient3** client, const WAVEFORMATEX* format, const StreamRequest& request, UINT32* periodInFrames)
+{
+    *periodInFrames = 0;
+    if (request.bufferEvent == nullptr)
+    {
+        printf("Exclusive streams are event-driven: a buffer event is required.\n");
+        return E_INVALIDARG;
+    }
+
+    REFERENCE_TIME minDevicePeriod = 0;
+    auto result = (*client)->GetDevicePeriod(NULL, &minDevicePeriod);
+    if (FAILED(result))
+    {
+        printf("Unable to get the device period: %x.\n", result);
+        return result;
+    }
+
+    auto plan = plan_exclusive_buffer((REFERENCE_TIME)request.bufferTimeSizeMs * 10000, minDevicePeriod, format->nSamplesPerSec);
+    while (true) {
+        // Event-driven exclusive streams need the buffer duration to be equal to the periodicity
+        result = (*client)->Initialize(
+            AUDCLNT_SHAREMODE_EXCLUSIVE,
+            AUDCLNT_STREAMFLAGS_EVENTCALLBACK | AUDCLNT_STREAMFLAGS_NOPERSIST,
+            plan.periodHns,
+            plan.periodHns,
+            format,
+            NULL);
+
+        if (result != AUDCLNT_E_BUFFER_SIZE_NOT_ALIGNED)
+            break;
+
+        // After this error GetBufferSize() reports the next aligned buffer size
+        UINT32 alignedFrames = 0;
+        if (FAILED((*client)->GetBufferSize(&alignedFrames)))
+            break;
+
+        auto next = realign_exclusive_buffer(plan, alignedFrames, format->nSamplesPerSec);
+        if (!next.has_value())
+            break;
+
+        printf("[initialize_exclusive_stream()] buffer of %d frames not aligned, retrying with %d\n", plan.periodInFrames, alignedFrames);
+
+        SafeRelease(client);
+        *client = device.get_audio_client();
+        if (*client == nullptr)
+            return AUDCLNT_E_DEVICE_INVALIDATED;
+
+        plan = next.value();
+    }
+
+    if (FAILED(result))
+    {
+        printf("Unable to initialize audio client in exclusive mode: %x.\n", result);
+        return result;
+    }
+
+    result = (*client)->SetEventHandle(request.bufferEvent);
+    if (FAILED(result))
+    {
+        printf("Unable to set the buffer event: %x.\n", result);
+        return result;
+    }
+
+    *periodInFrames = plan.periodInFrames;
+    return std::nullopt;
+}
+
+std::optional<HRESULT> initialize_stream(AudioDevice& device, IAudioClient3** client, const WAVEFORMATEX* format, const StreamRequest& request, UINT32* periodInFrames)
+{
+    if (request.exclusive)
+        return initialize_exclusive_stream(device, client, format, request, periodInFrames);
+
+    return initialize_shared_stream(*client, format, request, periodInFrames);
+}
+
+WAVEFORMATEX* find_exclusive_format(AudioDevice& device, IAudioClient3* client)
+{
+    if (client == nullptr)
+        return nullptr;
+
+    auto preferred = device.get_native_format();
+    if (!preferred.has_value()) {
+        WAVEFORMATEX* mixFormat = nullptr;
+        if (FAILED(client->GetMixFormat(&mixFormat)))
+            return nullptr;
+
+        preferred = to_stream_format(mixFormat);
+        CoTaskMemFree(mixFormat);
+    }
+
+    for (const auto& candidate : exclusive_format_candidates(preferred.value())) {
+        auto format = make_wave_format(candidate);
+        if (client->IsFormatSupported(AUDCLNT_SHAREMODE_EXCLUSIVE, &format.Format, NULL) == S_OK)
+            return allocate_wave_format(candidate);
+    }
+
+    printf("[find_exclusive_format()] no format is supported in exclusive mode\n");
+    return nullptr;
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <optional>
+
+#include <AudioClient.h>
+
+#include "AudioDevice.h"
+
+// How AudioRenderer and AudioCapturer initialize their IAudioClient
+struct StreamRequest {
+	unsigned int bufferTimeSizeMs = 0;		// legacy Initialize() buffer, or exclusive period; 0 picks the minimum
+	bool lowLatency = false;				// run the engine at a custom period with InitializeSharedAudioStream()
+	unsigned int periodInFrames = 0;		// requested engine period, 0 for the smallest one the engine supports
+	bool exclusive = false;					// bypass the audio engine, requires bufferEvent
+	HANDLE bufferEvent = nullptr;			// event-driven stream: signaled by the engine once per period
+};
+
+// Initializes the client in exclusive or shared mode, as requested. In exclusive mode the client can be
+// replaced by a new one activated from the device. periodInFrames receives the period the stream runs at,
+// or 0 for the legacy shared path.
+std::optional<HRESULT> initialize_stream(AudioDevice& device, IAudioClient3** client, const WAVEFORMATEX* format, const StreamRequest& request, UINT32* periodInFrames);
+
+// Initializes the client in shared mode. In low-latency mode the requested period is aligned to the engine's
+// fundamental period; if the engine is locked at another period by a different stream, that period is used
+// instead, and if the engine does not accept a custom period at all, the legacy Initialize() is used.
+std::optional<HRESULT> initialize_shared_stream(IAudioClient3* client, const WAVEFORMATEX* format, const StreamRequest& request, UINT32* periodInFrames);
+
+// Initializes an event-driven exclusive stream, where the client fills one whole buffer per period while the
+// endpoint plays the other one. If the endpoint rejects the buffer size with AUDCLNT_E_BUFFER_SIZE_NOT_ALIGNED,
+// a new client is activated (the failed one cannot be initialized again) and the aligned size is used instead.
+std::optional<HRESULT> initialize_exclusive_stream(AudioDevice& device, IAudioClient3** client, const WAVEFORMATEX* format, const StreamRequest& request, UINT32* periodInFrames);
+
+// First format the endpoint accepts in exclusive mode, searched from its native format, see exclusive_format_candidates().
+// Allocated with CoTaskMemAlloc(), nullptr if there is none.
+WAVEFORMATEX* find_exclusive_format(AudioDevice& device, IAudioClient3* client);
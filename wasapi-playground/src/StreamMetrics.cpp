@@ -0,0 +1,255 @@
+#include "StreamMetrics.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <iterator>
+#include <filesystem>
+#include <fstream>
+
+namespace {
+    struct MetricDescription {
+        const char* name;
+        const char* type;
+        const char* help;
+    };
+
+    // Same order as the values written by format_prometheus()
+    const MetricDescription STREAM_METRICS[] = {
+        { "wasapi_stream_running", "gauge", "1 while the stream is started" },
+        { "wasapi_stream_frames_total", "counter", "Frames rendered or captured" },
+        { "wasapi_stream_callbacks_total", "counter", "Buffers passed to the stream callback" },
+        { "wasapi_stream_callback_seconds_total", "counter", "Time spent in the stream callback" },
+        { "wasapi_stream_callback_max_microseconds", "gauge", "Longest callback since the previous export" },
+        { "wasapi_stream_underruns_total", "counter", "Render: the endpoint ran out of frames. Capture: packets were lost" },
+        { "wasapi_stream_errors_total", "counter", "Failed buffer operations on the audio thread" },
+        { "wasapi_stream_migrations_total", "counter", "Moves to another endpoint" },
+        { "wasapi_stream_deadline_misses_total", "counter", "Render callbacks over the watchdog budget" },
+        { "wasapi_stream_substituted_frames_total", "counter", "Frames written by the degradation policy instead of the callback" },
+        { "wasapi_stream_sample_rate_hertz", "gauge", "Sample rate of the endpoint" },
+        { "wasapi_stream_buffer_frames", "gauge", "Size of the endpoint buffer" },
+        { "wasapi_stream_fill_frames", "gauge", "Render: frames queued on the endpoint. Capture: frames waiting to be read" },
+        { "wasapi_stream_latency_microseconds", "gauge", "Stream latency reported by the audio engine" },
+    };
+
+    const char* direction_name(StreamDirection direction) {
+        return direction == StreamDirection::Render ? "render" : "capture";
+    }
+
+    void append(std::string& out, const char* format, ...) {
+        char line[256];
+        va_list args;
+        va_start(args, format);
+        auto length = vsnprintf(line, sizeof(line), format, args);
+        va_end(args);
+
+        if (length > 0)
+            out.append(line, (std::min)((size_t)length, sizeof(line) - 1));
+    }
+
+    // The exposition format only knows \\, \" and \n in label values: other control characters are dropped
+    void append_label_value(std::string& out, const std::string& text) {
+        for (auto c : text) {
+            if (c == '"' || c == '\\')
+                out += '\\';
+            if (c == '\n')
+                out += "\\n";
+            else if ((unsigned char)c >= 0x20)
+                out += c;
+        }
+    }
+
+    // Quotes, backslashes and control characters, the latter as \u escapes
+    void append_json_string(std::string& out, const std::string& text) {
+        for (auto c : text) {
+            if (c == '"' || c == '\\')
+                out += '\\';
+            if ((unsigned char)c < 0x20)
+                append(out, "\\u%04x", c);
+            else
+                out += c;
+        }
+    }
+
+    void format_prometheus(const MetricsSnapshot& snapshot, std::string& out) {
+        append(out, "# HELP wasapi_known_devices Endpoints seen by the process\n# TYPE wasapi_known_devices gauge\n");
+        append(out, "wasapi_known_devices %zu\n", snapshot.knownDevices);
+
+        for (size_t metric = 0; metric < std::size(STREAM_METRICS); metric++) {
+            const auto& description = STREAM_METRICS[metric];
+            append(out, "# HELP %s %s\n# TYPE %s %s\n", description.name, description.help, description.name, description.type);
+
+            for (const auto& stream : snapshot.streams) {
+                append(out, "%s{direction=\"%s\",stream=\"%u\",device=\"", description.name, direction_name(stream.direction), stream.id);
+                append_label_value(out, stream.device);
+                out += "\"} ";
+
+                switch (metric) {
+                case 0: append(out, "%d\n", stream.running ? 1 : 0); break;
+                case 1: append(out, "%llu\n", (unsigned long long)stream.frames); break;
+                case 2: append(out, "%llu\n", (unsigned long long)stream.callbacks); break;
+                case 3: append(out, "%.6f\n", stream.callbackSeconds); break;
+                case 4: append(out, "%.1f\n", stream.maxCallbackUs); break;
+                case 5: append(out, "%llu\n", (unsigned long long)stream.underruns); break;
+                case 6: append(out, "%llu\n", (unsigned long long)stream.errors); break;
+                case 7: append(out, "%llu\n", (unsigned long long)stream.migrations); break;
+                case 8: append(out, "%llu\n", (unsigned long long)stream.deadlineMisses); break;
+                case 9: append(out, "%llu\n", (unsigned long long)stream.substitutedFrames); break;
+                case 10: append(out, "%u\n", stream.sampleRate); break;
+                case 11: append(out, "%u\n", stream.bufferFrames); break;
+                case 12: append(out, "%u\n", stream.fillFrames); break;
+                case 13: append(out, "%u\n", stream.latencyUs); break;
+                }
+            }
+        }
+    }
+
+    void format_json(const MetricsSnapshot& snapshot, std::string& out) {
+        auto timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        append(out, "{\"timestamp\":%lld,\"knownDevices\":%zu,\"streams\":[", (long long)timestamp, snapshot.knownDevices);
+
+        bool first = true;
+        for (const auto& stream : snapshot.streams) {
+            append(out, "%s\n{\"id\":%u,\"direction\":\"%s\",\"device\":\"", first ? "" : ",", stream.id, direction_name(stream.direction));
+            append_json_string(out, stream.device);
+            append(out, "\",\"running\":%s,\"frames\":%llu,\"callbacks\":%llu,\"callbackSeconds\":%.6f,\"maxCallbackUs\":%.1f,",
+                stream.running ? "true" : "false", (unsigned long long)stream.frames, (unsigned long long)stream.callbacks,
+                stream.callbackSeconds, stream.maxCallbackUs);
+            append(out, "\"underruns\":%llu,\"errors\":%llu,\"migrations\":%llu,\"deadlineMisses\":%llu,\"substitutedFrames\":%llu,",
+                (unsigned long long)stream.underruns, (unsigned long long)stream.errors, (unsigned long long)stream.migrations,
+                (unsigned long long)stream.deadlineMisses, (unsigned long long)stream.substitutedFrames);
+            append(out, "\"sampleRate\":%u,\"bufferFrames\":%u,\"fillFrames\":%u,\"latencyUs\":%u}",
+                stream.sampleRate, stream.bufferFrames, stream.fillFrames, stream.latencyUs);
+            first = false;
+        }
+
+        out += "\n]}\n";
+    }
+}
+
+MetricsRegistry& MetricsRegistry::instance()
+{
+    static MetricsRegistry registry;
+    return registry;
+}
+
+std::shared_ptr<StreamCounters> MetricsRegistry::register_stream(StreamDirection direction)
+{
+    auto counters = std::make_shared<StreamCounters>();
+    counters->direction = direction;
+
+    std::lock_guard lock(mutex);
+    counters->id = nextId++;
+    streams.push_back(counters);
+    return counters;
+}
+
+void MetricsRegistry::unregister_stream(const std::shared_ptr<StreamCounters>& counters)
+{
+    std::lock_guard lock(mutex);
+    streams.erase(std::remove(streams.begin(), streams.end(), counters), streams.end());
+}
+
+MetricsSnapshot MetricsRegistry::take_snapshot()
+{
+    // The counters are kept alive by the copied pointers, even if their stream is destroyed meanwhile
+    std::vector<std::shared_ptr<StreamCounters>> registered;
+    {
+        std::lock_guard lock(mutex);
+        registered = streams;
+    }
+
+    MetricsSnapshot snapshot;
+    snapshot.knownDevices = DeviceIdTable::instance().size();
+    snapshot.streams.reserve(registered.size());
+
+    for (const auto& counters : registered) {
+        StreamSnapshot stream;
+        stream.direction = counters->direction;
+        stream.id = counters->id;
+        stream.running = counters->running.load(std::memory_order_relaxed);
+        stream.frames = counters->frames.load(std::memory_order_relaxed);
+        stream.callbacks = counters->callbacks.load(std::memory_order_relaxed);
+        stream.underruns = counters->underruns.load(std::memory_order_relaxed);
+        stream.errors = counters->errors.load(std::memory_order_relaxed);
+        stream.migrations = counters->migrations.load(std::memory_order_relaxed);
+        stream.deadlineMisses = counters->deadlineMisses.load(std::memory_order_relaxed);
+        stream.substitutedFrames = counters->substitutedFrames.load(std::memory_order_relaxed);
+        stream.callbackSeconds = counters->callbackNs.load(std::memory_order_relaxed) / 1e9;
+        stream.maxCallbackUs = counters->maxCallbackNs.exchange(0, std::memory_order_relaxed) / 1e3;
+        stream.sampleRate = counters->sampleRate.load(std::memory_order_relaxed);
+        stream.bufferFrames = counters->bufferFrames.load(std::memory_order_relaxed);
+        stream.fillFrames = counters->fillFrames.load(std::memory_order_relaxed);
+        stream.latencyUs = counters->latencyUs.load(std::memory_order_relaxed);
+
+        auto device = counters->device.load(std::memory_order_relaxed);
+        if (device != INVALID_DEVICE_HANDLE)
+            stream.device = DeviceIdTable::instance().get_id(device);
+
+        snapshot.streams.push_back(std::move(stream));
+    }
+
+    return snapshot;
+}
+
+void format_metrics(const MetricsSnapshot& snapshot, MetricsFormat format, std::string& out)
+{
+    if (format == MetricsFormat::Prometheus)
+        format_prometheus(snapshot, out);
+    else
+        format_json(snapshot, out);
+}
+
+MetricsExporter::MetricsExporter(const std::string& path, MetricsFormat format, unsigned int intervalMs) :
+    path(path),
+    temporaryPath(path + ".tmp"),
+    format(format),
+    intervalMs(intervalMs),
+    stopping(false)
+{
+    worker = std::thread([this]() { run(); });
+}
+
+MetricsExporter::~MetricsExporter()
+{
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    stopCondition.notify_all();
+    worker.join();
+    export_now();
+}
+
+void MetricsExporter::run()
+{
+    std::unique_lock lock(mutex);
+    while (!stopping) {
+        if (stopCondition.wait_for(lock, std::chrono::milliseconds(intervalMs), [this]() { return stopping; }))
+            break;
+
+        lock.unlock();
+        export_now();
+        lock.lock();
+    }
+}
+
+bool MetricsExporter::export_now()
+{
+    std::lock_guard lock(exportMutex);
+
+    text.clear();
+    format_metrics(MetricsRegistry::instance().take_snapshot(), format, text);
+
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        file.write(text.data(), text.size());
+        if (!file)
+            return false;
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporaryPath, path, error);
+    return !error;
+}
@@ -0,0 +1,148 @@
+#pragma once
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include "DeviceIdTable.h"
+
+enum class StreamDirection {
+	Render,
+	Capture
+};
+
+// Counters of one stream. The audio thread of the stream is the only writer, with relaxed atomic operations
+// so it never waits on a reader; the exporter reads them from its own thread.
+struct StreamCounters {
+	StreamDirection direction = StreamDirection::Render;
+	unsigned int id = 0;
+
+	std::atomic<uint64_t> frames{ 0 };
+	std::atomic<uint64_t> callbacks{ 0 };
+	std::atomic<uint64_t> callbackNs{ 0 };			// total time spent in the callbacks
+	std::atomic<uint64_t> maxCallbackNs{ 0 };		// longest callback since the last export, reset by the exporter
+	std::atomic<uint64_t> underruns{ 0 };			// render: the endpoint ran out of queued frames. capture: packets were lost
+	std::atomic<uint64_t> errors{ 0 };
+	std::atomic<uint64_t> migrations{ 0 };
+	std::atomic<uint64_t> deadlineMisses{ 0 };		// render callbacks over the watchdog budget, see CallbackWatchdog
+	std::atomic<uint64_t> substitutedFrames{ 0 };	// frames written by the degradation policy instead of the callback
+
+	// Current stream configuration and buffer state
+	std::atomic<DeviceHandle> device{ INVALID_DEVICE_HANDLE };
+	std::atomic<uint32_t> sampleRate{ 0 };
+	std::atomic<uint32_t> bufferFrames{ 0 };
+	std::atomic<uint32_t> fillFrames{ 0 };			// render: frames queued on the endpoint. capture: frames waiting to be read
+	std::atomic<uint32_t> latencyUs{ 0 };			// stream latency reported by the engine
+	std::atomic_bool running{ false };
+
+	void add_callback(uint32_t frameCount, uint64_t durationNs) {
+		frames.store(frames.load(std::memory_order_relaxed) + frameCount, std::memory_order_relaxed);
+		callbacks.store(callbacks.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		callbackNs.store(callbackNs.load(std::memory_order_relaxed) + durationNs, std::memory_order_relaxed);
+
+		// The exporter can reset the maximum concurrently
+		auto max = maxCallbackNs.load(std::memory_order_relaxed);
+		while (durationNs > max && !maxCallbackNs.compare_exchange_weak(max, durationNs, std::memory_order_relaxed)) {}
+	}
+
+	void add_underrun() { underruns.fetch_add(1, std::memory_order_relaxed); }
+	void add_error() { errors.fetch_add(1, std::memory_order_relaxed); }
+	void add_deadline_miss() { deadlineMisses.fetch_add(1, std::memory_order_relaxed); }
+	void add_substituted(uint32_t frameCount) { substitutedFrames.fetch_add(frameCount, std::memory_order_relaxed); }
+	void set_fill(uint32_t frameCount) { fillFrames.store(frameCount, std::memory_order_relaxed); }
+	void set_stream(DeviceHandle handle, uint32_t rate, uint32_t frameCount, int64_t latencyHns) {
+		device.store(handle, std::memory_order_relaxed);
+		sampleRate.store(rate, std::memory_order_relaxed);
+		bufferFrames.store(frameCount, std::memory_order_relaxed);
+		latencyUs.store((uint32_t)(latencyHns / 10), std::memory_order_relaxed);
+	}
+};
+
+// Values of a stream at the time of an export
+struct StreamSnapshot {
+	StreamDirection direction;
+	unsigned int id;
+	std::string device;
+	bool running;
+	uint64_t frames;
+	uint64_t callbacks;
+	uint64_t underruns;
+	uint64_t errors;
+	uint64_t migrations;
+	uint64_t deadlineMisses;
+	uint64_t substitutedFrames;
+	double callbackSeconds;
+	double maxCallbackUs;
+	uint32_t sampleRate;
+	uint32_t bufferFrames;
+	uint32_t fillFrames;
+	uint32_t latencyUs;
+};
+
+struct MetricsSnapshot {
+	std::vector<StreamSnapshot> streams;
+	size_t knownDevices;							// endpoints seen by the process, see DeviceIdTable
+};
+
+enum class MetricsFormat {
+	Prometheus,
+	Json
+};
+
+// Process-wide list of the streams to export. AudioRenderer and AudioCapturer register themselves on construction.
+class MetricsRegistry
+{
+public:
+	static MetricsRegistry& instance();
+
+	std::shared_ptr<StreamCounters> register_stream(StreamDirection direction);
+	void unregister_stream(const std::shared_ptr<StreamCounters>& counters);
+
+	// Resets the per-interval maximums
+	MetricsSnapshot take_snapshot();
+
+private:
+	MetricsRegistry() = default;
+
+	std::mutex mutex;
+	std::vector<std::shared_ptr<StreamCounters>> streams;
+	unsigned int nextId = 1;
+};
+
+// Appends the snapshot to out, in the Prometheus text exposition format or as a JSON document
+void format_metrics(const MetricsSnapshot& snapshot, MetricsFormat format, std::string& out);
+
+// Background thread that writes the metrics of all the streams to a file at a fixed interval. The file is
+// written next to the target and renamed over it, so readers (e.g. the node_exporter textfile collector)
+// never see a partial snapshot.
+class MetricsExporter
+{
+public:
+	MetricsExporter(const std::string& path, MetricsFormat format, unsigned int intervalMs = 1000);
+	MetricsExporter(const MetricsExporter& other) = delete;
+
+	// Writes a last snapshot before returning
+	~MetricsExporter();
+
+	bool export_now();
+
+private:
+	void run();
+
+	std::string path;
+	std::string temporaryPath;
+	MetricsFormat format;
+	unsigned int intervalMs;
+
+	std::mutex exportMutex;
+	std::string text;								// reused across exports
+
+	std::mutex mutex;
+	std::condition_variable stopCondition;
+	bool stopping;
+	std::thread worker;
+};
@@ -0,0 +1,167 @@
+#include "StreamMigration.h"
+
+namespace {
+    // Avoids hammering the device enumerator while no replacement endpoint exists yet
+    const std::chrono::milliseconds minRetryPause = std::chrono::milliseconds(100);
+    const std::chrono::milliseconds maxRetryPause = std::chrono::milliseconds(3200);
+}
+
+PreparedStream::PreparedStream(PreparedStream&& other) noexcept
+{
+    *this = std::move(other);
+}
+
+PreparedStream& PreparedStream::operator=(PreparedStream&& other) noexcept
+{
+    if (this == &other)
+        return *this;
+
+    SafeRelease(&renderClient);
+    SafeRelease(&captureClient);
+    SafeRelease(&audioClient);
+    CoTaskMemFree(format);
+
+    device = std::move(other.device);
+    audioClient = other.audioClient;
+    format = other.format;
+    renderClient = other.renderClient;
+    captureClient = other.captureClient;
+    info = other.info;
+    periodInFrames = other.periodInFrames;
+
+    other.audioClient = nullptr;
+    other.format = nullptr;
+    other.renderClient = nullptr;
+    other.captureClient = nullptr;
+    return *this;
+}
+
+PreparedStream::~PreparedStream()
+{
+    SafeRelease(&renderClient);
+    SafeRelease(&captureClient);
+    SafeRelease(&audioClient);
+    CoTaskMemFree(format);
+}
+
+StreamMigrator::StreamMigrator(DeviceFactory deviceFactory, StreamOpener streamOpener) :
+    factory(deviceFactory),
+    opener(streamOpener),
+    running(true),
+    requested(false),
+    requestedFrom(INVALID_DEVICE_HANDLE),
+    requestedOnLoss(false),
+    retryPause(minRetryPause),
+    ready(false)
+{
+    worker = std::thread(&StreamMigrator::run, this);
+}
+
+StreamMigrator::~StreamMigrator()
+{
+    {
+        std::lock_guard lock(mutex);
+        running = false;
+    }
+    requestCondition.notify_one();
+    worker.join();
+}
+
+void StreamMigrator::request_migration(DeviceHandle currentDevice, bool currentDeviceLost)
+{
+    {
+        std::lock_guard lock(mutex);
+
+        // The render thread repeats its request on every pass while the endpoint is lost, only a new one skips the retry pause
+        bool repeated = requested && requestedFrom == currentDevice && requestedOnLoss == currentDeviceLost;
+        if (!repeated)
+            retryAt = std::chrono::steady_clock::time_point();
+        if (!requested || currentDeviceLost) {
+            requested = true;
+            requestedFrom = currentDevice;
+            requestedOnLoss = requestedOnLoss || currentDeviceLost;
+        }
+    }
+    requestCondition.notify_one();
+}
+
+bool StreamMigrator::has_prepared_stream() const
+{
+    return ready;
+}
+
+std::optional<PreparedStream> StreamMigrator::take_prepared_stream()
+{
+    std::lock_guard lock(mutex);
+    ready = false;
+    return std::move(prepared);
+}
+
+void StreamMigrator::record_migration(double gapMs)
+{
+    std::lock_guard lock(mutex);
+    stats.migrations++;
+    stats.lastGapMs = gapMs;
+    if (gapMs > stats.maxGapMs)
+        stats.maxGapMs = gapMs;
+}
+
+MigrationStats StreamMigrator::get_stats() const
+{
+    std::lock_guard lock(mutex);
+    return stats;
+}
+
+void StreamMigrator::run()
+{
+    // The device enumerator and the audio clients are free-threaded COM objects
+    CoInitializeEx(NULL, COINIT_MULTITHREADED);
+
+    std::unique_lock lock(mutex);
+    while (true) {
+        requestCondition.wait(lock, [this]() { return requested || !running; });
+        if (!running)
+            break;
+
+        if (std::chrono::steady_clock::now() < retryAt) {
+            requestCondition.wait_until(lock, retryAt, [this]() { return !running || std::chrono::steady_clock::now() >= retryAt; });
+            continue;
+        }
+
+        auto currentDevice = requestedFrom;
+        auto currentDeviceLost = requestedOnLoss;
+        requested = false;
+        requestedOnLoss = false;
+
+        // Opening an endpoint can take tens of milliseconds, don't keep the audio thread waiting on the lock
+        lock.unlock();
+
+        std::optional<PreparedStream> stream;
+        auto newDevice = factory();
+        bool isSameDevice = newDevice != nullptr && newDevice->get_handle() == currentDevice;
+
+        if (newDevice != nullptr && !(isSameDevice && !currentDeviceLost))
+            stream = opener(std::move(newDevice));
+
+        lock.lock();
+        if (stream.has_value()) {
+            prepared = std::move(stream);
+            ready = true;
+            retryPause = minRetryPause;
+        }
+        else if (!isSameDevice || currentDeviceLost) {
+            // Queued again instead of sleeping here, so that a request coming in meanwhile is taken right away
+            stats.failedAttempts++;
+            if (!requested) {
+                requested = true;
+                requestedFrom = currentDevice;
+                retryAt = std::chrono::steady_clock::now() + retryPause;
+                retryPause = (std::min)(retryPause * 2, maxRetryPause);
+            }
+            requestedOnLoss = requestedOnLoss || currentDeviceLost;
+        }
+    }
+
+    lock.unlock();
+    CoUninitialize();
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include <memory>
+#include <functional>
+#include <optional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+
+#include <AudioClient.h>
+
+#include "AudioDevice.h"
+#include "RealtimeCheck.h"
+#include "common.h"
+
+// Returns the endpoint a stream should follow, usually the current default device
+typedef std::function<std::unique_ptr<AudioDevice>()> DeviceFactory;
+
+struct MigrationStats {
+	unsigned int migrations = 0;
+	unsigned int failedAttempts = 0;
+
+	// Time during which no audio reached an endpoint, measured on the last and on the worst migration
+	double lastGapMs = 0;
+	double maxGapMs = 0;
+};
+
+// An endpoint that was opened and initialized ahead of time, ready to replace the one a stream is using.
+// Owns its device and COM pointers until they are moved out.
+struct PreparedStream {
+	PreparedStream() = default;
+	PreparedStream(PreparedStream&& other) noexcept;
+	PreparedStream& operator=(PreparedStream&& other) noexcept;
+	PreparedStream(const PreparedStream& other) = delete;
+	~PreparedStream();
+
+	std::unique_ptr<AudioDevice> device;
+	IAudioClient3* audioClient = nullptr;
+	WAVEFORMATEX* format = nullptr;
+	IAudioRenderClient* renderClient = nullptr;
+	IAudioCaptureClient* captureClient = nullptr;
+	AudioStreamInfo info{};
+	UINT32 periodInFrames = 0;					// engine period of a low-latency stream, 0 for the legacy path
+};
+
+typedef std::function<std::optional<PreparedStream>(std::unique_ptr<AudioDevice>)> StreamOpener;
+
+// Background worker that opens the replacement endpoint of a stream, so the audio thread
+// only has to swap pointers when the new endpoint is ready.
+class StreamMigrator
+{
+public:
+	StreamMigrator(DeviceFactory deviceFactory, StreamOpener streamOpener);
+	StreamMigrator(const StreamMigrator& other) = delete;
+	~StreamMigrator();
+
+	// Can be called from any thread, including device notification callbacks: the endpoint is opened on the worker thread.
+	// If the new endpoint turns out to be the current one, nothing happens unless the current one was lost.
+	void request_migration(DeviceHandle currentDevice, bool currentDeviceLost);
+
+	bool has_prepared_stream() const;
+	std::optional<PreparedStream> take_prepared_stream();
+
+	void record_migration(double gapMs);
+	MigrationStats get_stats() const;
+
+private:
+	void run();
+
+	DeviceFactory factory;
+	StreamOpener opener;
+
+	std::thread worker;
+	mutable CheckedMutex mutex;
+	std::condition_variable_any requestCondition;
+	bool running;
+	bool requested;
+	DeviceHandle requestedFrom;
+	bool requestedOnLoss;
+
+	// A request whose endpoint failed to open stays queued until retryAt, the pause doubling on each failure.
+	// Another request retries it right away.
+	std::chrono::steady_clock::time_point retryAt;
+	std::chrono::milliseconds retryPause;
+
+	std::atomic_bool ready;
+	std::optional<PreparedStream> prepared;
+	MigrationStats stats;
+};
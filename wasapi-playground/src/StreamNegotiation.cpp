@@ -0,0 +1,198 @@
+#include "StreamNegotiation.h"
+
+namespace {
+    // Upper bound on the periods evaluated per format, enough for any real engine
+    const size_t maxCandidatePeriods = 64;
+
+    const unsigned int EXCLUSIVE_SAMPLE_RATES[] = { 48000, 44100, 96000, 88200, 192000 };
+
+    // Sample types by preference: float needs no conversion, then the highest resolution first
+    struct SampleType {
+        bool isFloat;
+        unsigned short bitsPerSample;
+        unsigned short validBitsPerSample;
+    };
+    const SampleType EXCLUSIVE_SAMPLE_TYPES[] = {
+        { true, 32, 32 },
+        { false, 32, 32 },
+        { false, 32, 24 },
+        { false, 24, 24 },
+        { false, 16, 16 },
+    };
+
+    struct Candidate {
+        StreamConfiguration configuration;
+        bool fitsBudget;
+    };
+
+    // true if a is preferable over b
+    bool is_better(const Candidate& a, const Candidate& b) {
+        if (a.fitsBudget != b.fitsBudget)
+            return a.fitsBudget;
+
+        if (!a.fitsBudget)
+            return a.configuration.estimatedCpuLoad < b.configuration.estimatedCpuLoad;
+
+        if (a.configuration.latencyMs != b.configuration.latencyMs)
+            return a.configuration.latencyMs < b.configuration.latencyMs;
+
+        return a.configuration.estimatedCpuLoad < b.configuration.estimatedCpuLoad;
+    }
+}
+
+bool NegotiationPolicy::operator==(const NegotiationPolicy& other) const
+{
+    return cpuBudget == other.cpuBudget
+        && callbackOverheadUs == other.callbackOverheadUs
+        && sampleCostNs == other.sampleCostNs
+        && conversionCostNs == other.conversionCostNs
+        && bufferPeriods == other.bufferPeriods
+        && allowIntegerFormats == other.allowIntegerFormats;
+}
+
+double estimate_cpu_load(const StreamFormat& format, unsigned int periodInFrames, bool needsConversion, const NegotiationPolicy& policy)
+{
+    if (periodInFrames == 0 || format.sampleRate == 0)
+        return 0;
+
+    double callbacksPerSecond = (double)format.sampleRate / periodInFrames;
+    double samplesPerSecond = (double)format.sampleRate * format.channels;
+    double sampleCostNs = policy.sampleCostNs + (needsConversion ? policy.conversionCostNs : 0);
+
+    return callbacksPerSecond * policy.callbackOverheadUs / 1e6 + samplesPerSecond * sampleCostNs / 1e9;
+}
+
+std::vector<unsigned int> candidate_periods(const EnginePeriodLimits& limits)
+{
+    std::vector<unsigned int> periods;
+    if (limits.minPeriodInFrames == 0)
+        return periods;
+
+    // The engine accepts the minimum period plus any multiple of the fundamental period, up to the maximum
+    auto step = limits.fundamentalPeriodInFrames != 0 ? limits.fundamentalPeriodInFrames : limits.maxPeriodInFrames;
+    for (auto period = limits.minPeriodInFrames; period <= limits.maxPeriodInFrames && periods.size() < maxCandidatePeriods; period += step) {
+        periods.push_back(period);
+        if (step == 0)
+            break;
+    }
+
+    bool hasDefault = false;
+    for (auto period : periods)
+        hasDefault = hasDefault || period == limits.defaultPeriodInFrames;
+
+    if (!hasDefault && limits.defaultPeriodInFrames != 0)
+        periods.push_back(limits.defaultPeriodInFrames);
+
+    return periods;
+}
+
+std::optional<StreamConfiguration> negotiate_stream_configuration(const DeviceCapabilities& capabilities, const NegotiationPolicy& policy)
+{
+    std::optional<Candidate> best;
+
+    auto evaluate = [&](const FormatCapability& capability, unsigned int period, bool usesEnginePeriod) {
+        Candidate candidate;
+        candidate.configuration.format = capability.format;
+        candidate.configuration.periodInFrames = period;
+        candidate.configuration.usesEnginePeriod = usesEnginePeriod;
+        candidate.configuration.latencyMs = 1000.0 * period * policy.bufferPeriods / capability.format.sampleRate;
+        candidate.configuration.estimatedCpuLoad = estimate_cpu_load(capability.format, period, !capability.isMixFormat, policy);
+        candidate.fitsBudget = candidate.configuration.estimatedCpuLoad <= policy.cpuBudget;
+
+        if (!best.has_value() || is_better(candidate, best.value()))
+            best = candidate;
+    };
+
+    for (const auto& capability : capabilities.supportedFormats) {
+        if (capability.format.sampleRate == 0 || capability.format.channels == 0)
+            continue;
+        if (!capability.format.isFloat && !policy.allowIntegerFormats)
+            continue;
+
+        if (capability.periods.has_value()) {
+            for (auto period : candidate_periods(capability.periods.value()))
+                evaluate(capability, period, period != capability.periods.value().defaultPeriodInFrames);
+        }
+
+        // The legacy path is always available, and runs at the default period
+        if (capabilities.legacyPeriodInFrames != 0) {
+            auto legacyPeriod = capabilities.legacyPeriodInFrames;
+            bool sameAsEngineDefault = capability.periods.has_value() && capability.periods.value().defaultPeriodInFrames == legacyPeriod;
+            if (!sameAsEngineDefault)
+                evaluate(capability, legacyPeriod, false);
+        }
+    }
+
+    if (!best.has_value())
+        return std::nullopt;
+
+    return best.value().configuration;
+}
+
+std::vector<StreamFormat> exclusive_format_candidates(const StreamFormat& preferred)
+{
+    std::vector<StreamFormat> candidates;
+    auto add = [&candidates](const StreamFormat& format) {
+        for (const auto& candidate : candidates) {
+            if (candidate == format)
+                return;
+        }
+        candidates.push_back(format);
+    };
+
+    add(preferred);
+
+    std::vector<unsigned int> sampleRates = { preferred.sampleRate };
+    for (auto sampleRate : EXCLUSIVE_SAMPLE_RATES) {
+        if (sampleRate != preferred.sampleRate)
+            sampleRates.push_back(sampleRate);
+    }
+
+    for (auto sampleRate : sampleRates) {
+        for (const auto& type : EXCLUSIVE_SAMPLE_TYPES) {
+            StreamFormat format = preferred;
+            format.sampleRate = sampleRate;
+            format.isFloat = type.isFloat;
+            format.bitsPerSample = type.bitsPerSample;
+            format.validBitsPerSample = type.validBitsPerSample;
+            add(format);
+        }
+    }
+
+    return candidates;
+}
+
+NegotiationCache& NegotiationCache::instance()
+{
+    static NegotiationCache cache;
+    return cache;
+}
+
+std::optional<StreamConfiguration> NegotiationCache::find(unsigned int deviceHandle, const NegotiationPolicy& policy) const
+{
+    std::lock_guard lock(mutex);
+    if (deviceHandle >= entries.size() || !entries[deviceHandle].has_value())
+        return std::nullopt;
+
+    const auto& entry = entries[deviceHandle].value();
+    if (!(entry.policy == policy))
+        return std::nullopt;
+
+    return entry.configuration;
+}
+
+void NegotiationCache::store(unsigned int deviceHandle, const NegotiationPolicy& policy, const StreamConfiguration& configuration)
+{
+    std::lock_guard lock(mutex);
+    if (deviceHandle >= entries.size())
+        entries.resize((size_t)deviceHandle + 1);
+
+    entries[deviceHandle] = Entry{ policy, configuration };
+}
+
+void NegotiationCache::invalidate(unsigned int deviceHandle)
+{
+    std::lock_guard lock(mutex);
+    if (deviceHandle < entries.size())
+        entries[deviceHandle] = std::nullopt;
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include <vector>
+#include <optional>
+#include <mutex>
+
+#include "StreamFormat.h"
+
+// Shared-mode engine period limits for one format, as reported by IAudioClient3::GetSharedModeEnginePeriod()
+struct EnginePeriodLimits {
+	unsigned int defaultPeriodInFrames = 0;
+	unsigned int fundamentalPeriodInFrames = 0;
+	unsigned int minPeriodInFrames = 0;
+	unsigned int maxPeriodInFrames = 0;
+};
+
+struct FormatCapability {
+	StreamFormat format;
+	bool isMixFormat = false;
+	std::optional<EnginePeriodLimits> periods = std::nullopt;
+};
+
+// Everything the negotiation needs to know about an endpoint. Filled by AudioDevice::get_capabilities(),
+// or by hand to check the negotiation against a synthetic device.
+struct DeviceCapabilities {
+	std::vector<FormatCapability> supportedFormats;
+
+	// Period used by the legacy IAudioClient::Initialize(), in frames of the mix format
+	unsigned int legacyPeriodInFrames = 0;
+};
+
+// Cost model used to estimate the CPU load of a configuration, expressed as a fraction of one core
+struct NegotiationPolicy {
+	double cpuBudget = 0.05;
+	double callbackOverheadUs = 40.0;		// wake-up, GetCurrentPadding, GetBuffer, ReleaseBuffer
+	double sampleCostNs = 5.0;				// per sample of the user callback and the buffer copy
+	double conversionCostNs = 15.0;			// extra per sample when the engine converts to the mix format
+	unsigned int bufferPeriods = 2;			// latency is counted as this many periods of buffering
+	bool allowIntegerFormats = false;		// the stream classes exchange 32-bit float samples
+
+	bool operator==(const NegotiationPolicy& other) const;
+};
+
+struct StreamConfiguration {
+	StreamFormat format;
+	unsigned int periodInFrames = 0;
+	bool usesEnginePeriod = false;			// false: the legacy Initialize() with the default period
+	double latencyMs = 0;
+	double estimatedCpuLoad = 0;
+};
+
+double estimate_cpu_load(const StreamFormat& format, unsigned int periodInFrames, bool needsConversion, const NegotiationPolicy& policy);
+std::vector<unsigned int> candidate_periods(const EnginePeriodLimits& limits);
+
+// Picks the configuration with the lowest latency whose estimated load fits the CPU budget.
+// If nothing fits, the configuration with the lowest load is returned.
+std::optional<StreamConfiguration> negotiate_stream_configuration(const DeviceCapabilities& capabilities, const NegotiationPolicy& policy);
+
+// Formats to probe for an exclusive-mode stream, in order of preference. Exclusive mode has no
+// closest match: the endpoint takes its native formats or nothing. The preferred format (usually
+// PKEY_AudioEngine_DeviceFormat, or the mix format) comes first, then the same rate and channel count
+// at other sample types, then the common rates.
+std::vector<StreamFormat> exclusive_format_candidates(const StreamFormat& preferred);
+
+// Remembers the winning configuration of each device, indexed by DeviceHandle
+class NegotiationCache
+{
+public:
+	static NegotiationCache& instance();
+
+	std::optional<StreamConfiguration> find(unsigned int deviceHandle, const NegotiationPolicy& policy) const;
+	void store(unsigned int deviceHandle, const NegotiationPolicy& policy, const StreamConfiguration& configuration);
+	void invalidate(unsigned int deviceHandle);
+
+private:
+	struct Entry {
+		NegotiationPolicy policy;
+		StreamConfiguration configuration;
+	};
+
+	NegotiationCache() = default;
+
+	mutable std::mutex mutex;
+	std::vector<std::optional<Entry>> entries;
+};
@@ -1,13 +1,13 @@
-#define _USE_MATH_DEFINES
-
 #include "Synthesizer.h"
+#include "Trace.h"
+#include "Wavetables.h"
 #include <array>
+#include <cstdint>
 #include <windows.h>
-#include <math.h>
 
 namespace {
-    const double octaveBaseFrequency = 440.0;     			// frequency of octave represented by keyboard
-    const double d12thRootOf2 = pow(2.0, 1.0 / 12.0);		// assuming western 12 notes per ocatve
+    const BYTE octaveBaseKey = 69;     						// A4 at 440Hz: the octave represented by keyboard
+    const DWORD tableSampleRate = 44100;					// the frames carry no rate: tables that do not alias at the lowest usual one
     const std::chrono::milliseconds threadPause = std::chrono::milliseconds(10);
     const std::array<unsigned int, 15> keys = { 'Z','S','X','C','F','V','G','B','N','J','M','K', VK_OEM_COMMA, VK_OEM_PERIOD, VK_OEM_2 };
 
@@ -16,10 +16,22 @@ namespace {
         auto currentCycleTime = currentTime - (cycles / frequency);
         return currentCycleTime * frequency;
     }
+
+    double read_waveform(Waveform waveform, FrameInfo frame, int key) {
+        if (key < 0)
+            return 0;
+
+        auto frequency = get_key_frequency(Tuning::EqualTemperament, (BYTE)key);
+        auto increment = get_key_increment(Tuning::EqualTemperament, (BYTE)key, tableSampleRate);
+        // Through a signed integer, so that a progress rounded to 1 wraps to 0
+        auto phase = (UINT32)(std::int64_t)(wavePeriodProgression(frame.time, frequency) * 4294967296.0);
+        return read_wavetable(get_wavetable(waveform, increment), phase);
+    }
 }
 
 Synthesizer::Synthesizer()
 {
+    keyOutput = -1;
     running = true;
     inputLoop = std::thread(&Synthesizer::read_keystrokes, this);
 }
@@ -32,54 +44,39 @@ Synthesizer::~Synthesizer()
 
 double Synthesizer::sine_from_keystrokes(FrameInfo frame) const
 {
-    return sin((frequencyOutput * M_PI * 2) * frame.time);
+    return read_waveform(Waveform::Sine, frame, keyOutput);
 }
 
 double Synthesizer::square_from_keystrokes(FrameInfo frame) const
 {
-    if (frequencyOutput == 0)
-        return 0;
-
-    return wavePeriodProgression(frame.time, frequencyOutput) <= 0.5 ? 1 : -1;
+    return read_waveform(Waveform::Square, frame, keyOutput);
 }
 
 double Synthesizer::sawtooth_from_keystrokes(FrameInfo frame) const
 {
-    if (frequencyOutput == 0)
-        return 0;
-
-    return (wavePeriodProgression(frame.time, frequencyOutput) * 2) - 1;
+    return read_waveform(Waveform::Sawtooth, frame, keyOutput);
 }
 
 double Synthesizer::triangle_from_keystrokes(FrameInfo frame) const
 {
-    if (frequencyOutput == 0)
-        return 0;
-
-    auto progress = wavePeriodProgression(frame.time, frequencyOutput);
-    if (progress <= 0.25)
-    {
-        return progress / 0.25;
-    }
-    else if (progress <= 0.75) {
-        return 2 - (progress * 4);
-    }
-    else {
-        return (progress / 0.25) - 4;
-    }
+    return read_waveform(Waveform::Triangle, frame, keyOutput);
 }
 
 void Synthesizer::read_keystrokes()
 {
+    TRACE_THREAD("keyboard");
+
     int currentKeyIndex = -1;
     bool isAnyKeyDown = false;
 
     while (running) {
+        TRACE_SCOPE("read_keystrokes");
         isAnyKeyDown = false;
         for (size_t k = 0; k < keys.size(); k++) {
             if (GetAsyncKeyState(keys[k]) & 0x8000) {
                 if (currentKeyIndex != k){
-                    frequencyOutput = octaveBaseFrequency * pow(d12thRootOf2, k);
+                    TRACE_INSTANT("note on");
+                    keyOutput = (int)(octaveBaseKey + k);
                     currentKeyIndex = k;
                 }
 
@@ -91,7 +88,7 @@ void Synthesizer::read_keystrokes()
             if (currentKeyIndex != -1)
                 currentKeyIndex = -1;
 
-            frequencyOutput = 0.0;
+            keyOutput = -1;
         }
 
         std::this_thread::sleep_for(threadPause);
@@ -21,6 +21,7 @@ private:
 
 	std::thread inputLoop;
 	std::atomic_bool running;
-	std::atomic<double> frequencyOutput;
+	// MIDI key held, -1 for none
+	std::atomic_int keyOutput;
 };
 
@@ -0,0 +1,162 @@
+#include "Trace.h"
+
+#ifdef WASAPI_TRACE
+
+#include <chrono>
+#include <fstream>
+
+namespace {
+    double ticks_to_us(int64_t ticks) {
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::duration(ticks)).count();
+    }
+
+    // Trace point names are literals from this code base, only quotes and backslashes need escaping
+    void write_json_string(std::ostream& out, const std::string& text) {
+        out << '"';
+        for (auto c : text) {
+            if (c == '"' || c == '\\')
+                out << '\\';
+            out << c;
+        }
+        out << '"';
+    }
+}
+
+thread_local TraceRecorder::ThreadRegistration TraceRecorder::currentThread;
+
+TraceRecorder::ThreadRegistration::~ThreadRegistration()
+{
+    if (buffer != nullptr)
+        buffer->inUse.store(false, std::memory_order_release);
+}
+
+TraceRecorder& TraceRecorder::instance()
+{
+    static TraceRecorder recorder;
+    return recorder;
+}
+
+int64_t TraceRecorder::now()
+{
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+}
+
+TraceRecorder::TraceRecorder() :
+    startTime(now()),
+    unregisteredDropped(0)
+{
+}
+
+void TraceRecorder::register_current_thread(const char* name)
+{
+    if (currentThread.buffer != nullptr)
+        return;
+
+    {
+        std::lock_guard lock(buffersMutex);
+        currentThread.buffer = reuse_buffer(name);
+        if (currentThread.buffer != nullptr)
+            return;
+    }
+
+    // The events are allocated outside the lock, which the exporter holds for the whole export
+    auto buffer = std::make_unique<ThreadBuffer>();
+    buffer->events.resize(EVENTS_PER_THREAD);
+    buffer->name = name != nullptr ? name : "thread";
+
+    std::lock_guard lock(buffersMutex);
+    buffer->id = (unsigned int)buffers.size() + 1;
+    buffers.push_back(std::move(buffer));
+    currentThread.buffer = buffers.back().get();
+}
+
+TraceRecorder::ThreadBuffer* TraceRecorder::reuse_buffer(const char* name)
+{
+    for (const auto& buffer : buffers) {
+        if (buffer->inUse.load(std::memory_order_acquire))
+            continue;
+
+        // The tid stays, the name changes. From record(), "unnamed" fits in the string already there.
+        buffer->inUse.store(true, std::memory_order_relaxed);
+        buffer->count.store(0, std::memory_order_relaxed);
+        buffer->name = name != nullptr ? name : "thread";
+        return buffer.get();
+    }
+    return nullptr;
+}
+
+void TraceRecorder::record(const char* name, int64_t start, int64_t duration)
+{
+    // Without a buffer, only a released one is taken, and never by waiting for the exporter
+    if (currentThread.buffer == nullptr) {
+        std::unique_lock lock(buffersMutex, std::try_to_lock);
+        if (lock.owns_lock())
+            currentThread.buffer = reuse_buffer("unnamed");
+        if (currentThread.buffer == nullptr) {
+            unregisteredDropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    auto& buffer = *currentThread.buffer;
+    auto index = buffer.count.load(std::memory_order_relaxed);
+    if (index >= buffer.events.size()) {
+        buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    buffer.events[index] = { name, start, duration };
+    buffer.count.store(index + 1, std::memory_order_release);
+}
+
+bool TraceRecorder::export_chrome_trace(const std::string& path) const
+{
+    std::ofstream out(path);
+    if (!out)
+        return false;
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+
+    std::lock_guard lock(buffersMutex);
+    for (const auto& buffer : buffers) {
+        out << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->id << ",\"args\":{\"name\":";
+        write_json_string(out, buffer->name);
+        out << "}}";
+        first = false;
+
+        auto count = buffer->count.load(std::memory_order_acquire);
+        for (size_t i = 0; i < count; i++) {
+            const auto& event = buffer->events[i];
+            out << ",\n{\"name\":";
+            write_json_string(out, event.name);
+            out << ",\"pid\":1,\"tid\":" << buffer->id << ",\"ts\":" << ticks_to_us(event.start - startTime);
+
+            if (event.duration < 0)
+                out << ",\"ph\":\"i\",\"s\":\"t\"}";
+            else
+                out << ",\"ph\":\"X\",\"dur\":" << ticks_to_us(event.duration) << "}";
+        }
+    }
+
+    out << "\n]}\n";
+    return out.good();
+}
+
+uint64_t TraceRecorder::get_dropped_events() const
+{
+    std::lock_guard lock(buffersMutex);
+
+    uint64_t dropped = unregisteredDropped.load(std::memory_order_relaxed);
+    for (const auto& buffer : buffers)
+        dropped += buffer->dropped.load(std::memory_order_relaxed);
+    return dropped;
+}
+
+size_t TraceRecorder::get_buffer_count() const
+{
+    std::lock_guard lock(buffersMutex);
+    return buffers.size();
+}
+
+#endif
@@ -0,0 +1,109 @@
+#pragma once
+
+// Scoped trace points for the audio paths, exported in the Chrome trace-event format so that a capture
+// opens directly in chrome://tracing or Perfetto. Trace points only exist when WASAPI_TRACE is defined
+// (Debug builds): otherwise the macros expand to nothing.
+//
+//   TRACE_THREAD("render");		names the calling thread in the trace and preallocates its buffer
+//   TRACE_SCOPE("GetBuffer");		records the time until the end of the enclosing scope
+//   TRACE_INSTANT("note");			records a point in time
+//
+// Names must be string literals: only the pointer is stored.
+//
+// Buffers are only allocated by TRACE_THREAD, and go back to the recorder when their thread exits, for the
+// next thread to register: memory follows the number of live threads, not the thread churn. A thread that
+// records without registering takes a released buffer if one is free, and drops its events otherwise.
+
+#ifdef WASAPI_TRACE
+
+#include <cstdint>
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "RealtimeCheck.h"
+
+struct TraceEvent {
+	const char* name;
+	int64_t start;			// steady_clock ticks (QueryPerformanceCounter on Windows)
+	int64_t duration;		// negative for instant events
+};
+
+class TraceRecorder
+{
+public:
+	static const size_t EVENTS_PER_THREAD = 1 << 15;
+
+	static TraceRecorder& instance();
+	static int64_t now();
+
+	// Reuses the buffer of an exited thread, or allocates one
+	void register_current_thread(const char* name);
+
+	// Lock-free once the thread has its buffer, never allocates. Events past the buffer capacity, or of a thread
+	// without a buffer, are dropped and counted.
+	void record(const char* name, int64_t start, int64_t duration);
+
+	// Can run while threads are recording: only the events complete at the time of the call are written
+	bool export_chrome_trace(const std::string& path) const;
+	uint64_t get_dropped_events() const;
+	// Allocated so far, those of live threads and those waiting for reuse
+	size_t get_buffer_count() const;
+
+private:
+	struct ThreadBuffer {
+		std::vector<TraceEvent> events;
+		std::atomic<size_t> count{ 0 };
+		std::atomic<uint64_t> dropped{ 0 };
+		std::atomic_bool inUse{ true };
+		std::string name;			// the events of an exited thread are exported under it until the buffer is reused
+		unsigned int id = 0;
+	};
+
+	// Hands the buffer back when its thread exits
+	struct ThreadRegistration {
+		ThreadBuffer* buffer = nullptr;
+		~ThreadRegistration();
+	};
+
+	TraceRecorder();
+	// Under the lock
+	ThreadBuffer* reuse_buffer(const char* name);
+
+	int64_t startTime;
+	mutable CheckedMutex buffersMutex;
+	std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+	std::atomic<uint64_t> unregisteredDropped;
+
+	static thread_local ThreadRegistration currentThread;
+};
+
+class TraceScope
+{
+public:
+	TraceScope(const char* name) : name(name), start(TraceRecorder::now()) {}
+	~TraceScope() { TraceRecorder::instance().record(name, start, TraceRecorder::now() - start); }
+
+	TraceScope(const TraceScope& other) = delete;
+
+private:
+	const char* name;
+	int64_t start;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+#define TRACE_THREAD(name) TraceRecorder::instance().register_current_thread(name)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#define TRACE_INSTANT(name) TraceRecorder::instance().record(name, TraceRecorder::now(), -1)
+
+#else
+
+#define TRACE_THREAD(name)
+#define TRACE_SCOPE(name)
+#define TRACE_INSTANT(name)
+
+#endif
@@ -1,4 +1,5 @@
 #include "VolumeNotificationProvider.h"
+#include "Trace.h"
 
 VolumeNotificationProvider::VolumeNotificationProvider(void) : m_RefCount(1)
 {
@@ -41,6 +42,8 @@ STDMETHODIMP VolumeNotificationProvider::QueryInterface(REFIID IID, void** Retur
 
 STDMETHODIMP VolumeNotificationProvider::OnNotify(PAUDIO_VOLUME_NOTIFICATION_DATA notification)
 {
+    TRACE_THREAD("volume notifications");
+    TRACE_SCOPE("OnNotify");
     VolumeInfo info = { (bool)notification ->bMuted, notification->fMasterVolume };
     for (auto it = volumeSubscriptionMap.begin(); it != volumeSubscriptionMap.end(); ++it)
         it->second(info);
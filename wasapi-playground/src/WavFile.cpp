@@ -0,0 +1,348 @@
+#include "WavFile.h"
+#include "SampleConversion.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+namespace {
+    const UINT32 rf64PlaceholderSize = 0xFFFFFFFF;
+
+    // Frames decoded at once by read_mono()
+    const UINT32 scratchFrames = 1024;
+
+    WORD read_u16(const BYTE* data) { return (WORD)(data[0] | data[1] << 8); }
+    UINT32 read_u32(const BYTE* data) { return (UINT32)read_u16(data) | (UINT32)read_u16(data + 2) << 16; }
+    UINT64 read_u64(const BYTE* data) { return (UINT64)read_u32(data) | (UINT64)read_u32(data + 4) << 32; }
+
+    bool has_id(const BYTE* data, const char* id) { return memcmp(data, id, 4) == 0; }
+
+    void put_id(std::vector<BYTE>& out, const char* id) { out.insert(out.end(), id, id + 4); }
+    void put_u16(std::vector<BYTE>& out, WORD value) { out.push_back((BYTE)value); out.push_back((BYTE)(value >> 8)); }
+    void put_u32(std::vector<BYTE>& out, UINT32 value) { put_u16(out, (WORD)value); put_u16(out, (WORD)(value >> 16)); }
+    void put_u64(std::vector<BYTE>& out, UINT64 value) { put_u32(out, (UINT32)value); put_u32(out, (UINT32)(value >> 32)); }
+
+    bool is_supported(const StreamFormat& format) {
+        if (format.channels == 0 || format.sampleRate == 0)
+            return false;
+        if (format.isFloat)
+            return format.bitsPerSample == 32;
+        return format.bitsPerSample == 16 || format.bitsPerSample == 24 || format.bitsPerSample == 32;
+    }
+}
+
+std::optional<WavLayout> parse_wav_layout(const BYTE* header, size_t headerBytes, UINT64 fileSize)
+{
+    if (headerBytes < 12 || !has_id(header + 8, "WAVE"))
+        return std::nullopt;
+
+    bool rf64 = has_id(header, "RF64") || has_id(header, "BW64");
+    if (!rf64 && !has_id(header, "RIFF"))
+        return std::nullopt;
+
+    WavLayout layout;
+    UINT64 ds64DataBytes = 0;
+    bool hasFormat = false;
+
+    size_t offset = 12;
+    while (offset + 8 <= headerBytes) {
+        const BYTE* chunk = header + offset;
+        UINT64 size = read_u32(chunk + 4);
+        const BYTE* body = chunk + 8;
+        auto bodyBytes = (std::min)((size_t)size, headerBytes - offset - 8);
+
+        if (has_id(chunk, "ds64") && bodyBytes >= 16) {
+            ds64DataBytes = read_u64(body + 8);
+        }
+        else if (has_id(chunk, "fmt ") && bodyBytes >= 16) {
+            // Copied out of the file, which has no alignment guarantee
+            WAVEFORMATEXTENSIBLE format = {};
+            memcpy(&format, body, (std::min)(bodyBytes, sizeof(format)));
+            if (bodyBytes < sizeof(WAVEFORMATEX))
+                format.Format.cbSize = 0;
+
+            auto tag = format.Format.wFormatTag;
+            if (tag == WAVE_FORMAT_EXTENSIBLE && format.Format.cbSize >= 22) {
+                if (format.SubFormat != KSDATAFORMAT_SUBTYPE_PCM && format.SubFormat != KSDATAFORMAT_SUBTYPE_IEEE_FLOAT)
+                    return std::nullopt;
+            }
+            else if (tag != WAVE_FORMAT_PCM && tag != WAVE_FORMAT_IEEE_FLOAT) {
+                return std::nullopt;
+            }
+
+            layout.format = to_stream_format(&format.Format);
+            hasFormat = true;
+        }
+        else if (has_id(chunk, "data")) {
+            if (!hasFormat || !is_supported(layout.format))
+                return std::nullopt;
+
+            if (rf64 && size == rf64PlaceholderSize)
+                size = ds64DataBytes;
+
+            layout.dataOffset = offset + 8;
+            layout.dataBytes = (std::min)(size, fileSize > layout.dataOffset ? fileSize - layout.dataOffset : 0);
+            layout.frames = layout.dataBytes / layout.format.block_align();
+            return layout;
+        }
+
+        // Chunks are padded to an even size
+        offset += 8 + (size_t)((size + 1) & ~1ull);
+    }
+
+    return std::nullopt;
+}
+
+bool write_wav_file(const std::wstring& path, const AudioRecording& recording)
+{
+    if (recording.channels == 0)
+        return false;
+
+    UINT64 dataBytes = recording.data.size() * sizeof(float);
+    bool rf64 = dataBytes + 74 > 0xFFFFFFFFull;
+    auto blockAlign = (WORD)(recording.channels * sizeof(float));
+
+    // The ds64 chunk of RF64 is a JUNK chunk of the same size in a plain WAV, so that both have the same layout
+    std::vector<BYTE> header;
+    put_id(header, rf64 ? "RF64" : "RIFF");
+    put_u32(header, rf64 ? rf64PlaceholderSize : (UINT32)(dataBytes + 74));
+    put_id(header, "WAVE");
+
+    put_id(header, rf64 ? "ds64" : "JUNK");
+    put_u32(header, 28);
+    put_u64(header, dataBytes + 74);
+    put_u64(header, dataBytes);
+    put_u64(header, recording.data.size() / recording.channels);
+    put_u32(header, 0);
+
+    put_id(header, "fmt ");
+    put_u32(header, 18);
+    put_u16(header, WAVE_FORMAT_IEEE_FLOAT);
+    put_u16(header, recording.channels);
+    put_u32(header, recording.samplesPerSecond);
+    put_u32(header, recording.samplesPerSecond * blockAlign);
+    put_u16(header, blockAlign);
+    put_u16(header, 32);
+    put_u16(header, 0);
+
+    put_id(header, "data");
+    put_u32(header, rf64 ? rf64PlaceholderSize : (UINT32)dataBytes);
+
+    std::ofstream file(std::filesystem::path(path), std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(header.data()), header.size());
+    file.write(reinterpret_cast<const char*>(recording.data.data()), dataBytes);
+    return (bool)file;
+}
+
+MappedWavFile::MappedWavFile(size_t windowBytes) :
+    windowBytes(windowBytes),
+    granularity(0),
+    file(INVALID_HANDLE_VALUE),
+    mapping(nullptr),
+    fileSize(0),
+    view(nullptr),
+    viewOffset(0),
+    viewBytes(0),
+    position(0),
+    mappedViews(0),
+    mappedBytes(0)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    granularity = info.dwAllocationGranularity;
+
+    auto granules = (std::max)((windowBytes + granularity - 1) / granularity, (size_t)2);
+    this->windowBytes = granules * granularity;
+}
+
+MappedWavFile::~MappedWavFile()
+{
+    close();
+}
+
+std::optional<HRESULT> MappedWavFile::open(const std::wstring& path)
+{
+    close();
+
+    file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        auto error = HRESULT_FROM_WIN32(GetLastError());
+        printf("[MappedWavFile] Unable to open the file: %x\n", error);
+        return error;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        printf("[MappedWavFile] The file is empty\n");
+        close();
+        return E_FAIL;
+    }
+    fileSize = (UINT64)size.QuadPart;
+
+    mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == nullptr) {
+        auto error = HRESULT_FROM_WIN32(GetLastError());
+        printf("[MappedWavFile] Unable to map the file: %x\n", error);
+        close();
+        return error;
+    }
+
+    // The chunks before the samples are expected in the first window
+    if (!map_window(0)) {
+        close();
+        return E_FAIL;
+    }
+
+    auto parsed = parse_wav_layout(view, viewBytes, fileSize);
+    if (!parsed.has_value()) {
+        printf("[MappedWavFile] Not a WAV file, or an unsupported format\n");
+        close();
+        return AUDCLNT_E_UNSUPPORTED_FORMAT;
+    }
+
+    layout = parsed.value();
+    position = 0;
+    scratch.resize((size_t)scratchFrames * layout.format.channels);
+    return std::nullopt;
+}
+
+void MappedWavFile::close()
+{
+    unmap_window();
+
+    if (mapping != nullptr)
+        CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE)
+        CloseHandle(file);
+
+    mapping = nullptr;
+    file = INVALID_HANDLE_VALUE;
+    fileSize = 0;
+    layout = WavLayout();
+    position = 0;
+}
+
+const WavLayout& MappedWavFile::get_layout() const
+{
+    return layout;
+}
+
+bool MappedWavFile::map_window(UINT64 fileOffset)
+{
+    unmap_window();
+
+    viewOffset = fileOffset / granularity * granularity;
+    viewBytes = (size_t)(std::min)((UINT64)windowBytes, fileSize - viewOffset);
+    view = static_cast<const BYTE*>(MapViewOfFile(mapping, FILE_MAP_READ, (DWORD)(viewOffset >> 32), (DWORD)viewOffset, viewBytes));
+    if (view == nullptr) {
+        printf("[MappedWavFile] Unable to map a view of the file: %x\n", HRESULT_FROM_WIN32(GetLastError()));
+        viewBytes = 0;
+        return false;
+    }
+
+    // Starts reading the whole window from the disk now, rather than one page fault at a time
+    WIN32_MEMORY_RANGE_ENTRY range = { const_cast<BYTE*>(view), viewBytes };
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+
+    mappedViews.fetch_add(1, std::memory_order_relaxed);
+    mappedBytes.store(viewBytes, std::memory_order_relaxed);
+    return true;
+}
+
+void MappedWavFile::unmap_window()
+{
+    if (view != nullptr)
+        UnmapViewOfFile(view);
+
+    view = nullptr;
+    viewBytes = 0;
+    mappedBytes.store(0, std::memory_order_relaxed);
+}
+
+UINT32 MappedWavFile::read(float* samples, UINT32 frames)
+{
+    if (mapping == nullptr)
+        return 0;
+
+    const auto blockAlign = layout.format.block_align();
+    frames = (UINT32)(std::min)((UINT64)frames, layout.frames - (std::min)(position, layout.frames));
+
+    UINT32 done = 0;
+    while (done < frames) {
+        auto offset = layout.dataOffset + position * blockAlign;
+        if (view == nullptr || offset < viewOffset || offset + blockAlign > viewOffset + viewBytes) {
+            if (!map_window(offset))
+                break;
+        }
+
+        auto framesInView = (UINT32)(std::min)((UINT64)(frames - done), (viewOffset + viewBytes - offset) / blockAlign);
+        pcm_to_float(view + (offset - viewOffset), samples + (size_t)done * layout.format.channels, (size_t)framesInView * layout.format.channels, layout.format);
+        done += framesInView;
+        position += framesInView;
+    }
+
+    return done;
+}
+
+UINT32 MappedWavFile::read_mono(float* samples, UINT32 frames)
+{
+    const auto channels = layout.format.channels;
+
+    UINT32 done = 0;
+    while (done < frames) {
+        auto count = read(scratch.data(), (std::min)(frames - done, scratchFrames));
+        if (count == 0)
+            break;
+
+        for (UINT32 i = 0; i < count; i++) {
+            float sum = 0;
+            for (WORD channel = 0; channel < channels; channel++)
+                sum += scratch[(size_t)i * channels + channel];
+            samples[done + i] = sum / channels;
+        }
+        done += count;
+    }
+
+    return done;
+}
+
+void MappedWavFile::seek(UINT64 frame)
+{
+    position = (std::min)(frame, layout.frames);
+}
+
+UINT64 MappedWavFile::get_position() const
+{
+    return position;
+}
+
+MappedWavStats MappedWavFile::get_stats() const
+{
+    MappedWavStats stats;
+    stats.views = mappedViews.load(std::memory_order_relaxed);
+    stats.mappedBytes = mappedBytes.load(std::memory_order_relaxed);
+    return stats;
+}
+
+std::optional<HRESULT> read_wav_file(const std::wstring& path, AudioRecording& recording, UINT64 maxFrames)
+{
+    MappedWavFile file;
+    if (auto error = file.open(path); error.has_value())
+        return error;
+
+    const auto& layout = file.get_layout();
+    if (layout.frames > maxFrames) {
+        printf("[read_wav_file] The file holds %llu frames, more than %llu\n", layout.frames, maxFrames);
+        return E_OUTOFMEMORY;
+    }
+
+    recording.channels = layout.format.channels;
+    recording.samplesPerSecond = layout.format.sampleRate;
+    recording.data.resize((size_t)layout.frames * layout.format.channels);
+
+    auto frames = file.read(recording.data.data(), (UINT32)layout.frames);
+    recording.data.resize((size_t)frames * layout.format.channels);
+    recording.durationMs = (unsigned long)(frames * 1000 / layout.format.sampleRate);
+    return std::nullopt;
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include <optional>
+#include <string>
+#include <vector>
+#include <atomic>
+
+#include <windows.h>
+
+#include "StreamFormat.h"
+#include "common.h"
+
+// Where the samples of a WAV or RF64 file are, and how they are encoded
+struct WavLayout {
+	StreamFormat format;
+	UINT64 dataOffset = 0;			// from the start of the file
+	UINT64 dataBytes = 0;
+	UINT64 frames = 0;
+};
+
+// Parses the chunks before the samples. header holds the start of the file, fileSize the size of the whole file:
+// a data chunk announcing more than the file holds is cut to what is there. RF64 and BW64 sizes are read from
+// their ds64 chunk. Integer PCM of 16, 24 and 32 bits and 32-bit float are supported.
+std::optional<WavLayout> parse_wav_layout(const BYTE* header, size_t headerBytes, UINT64 fileSize);
+
+// Writes a 32-bit float WAV file, switching to RF64 when the samples do not fit in 4GB
+bool write_wav_file(const std::wstring& path, const AudioRecording& recording);
+
+// Reads a whole WAV or RF64 file into memory through MappedWavFile, for short files such as impulse responses.
+// Fails with E_OUTOFMEMORY above maxFrames.
+std::optional<HRESULT> read_wav_file(const std::wstring& path, AudioRecording& recording, UINT64 maxFrames = 1 << 24);
+
+struct MappedWavStats {
+	UINT64 views = 0;				// windows of the file mapped since open()
+	UINT64 mappedBytes = 0;			// size of the current window: the part of the file that can be resident
+};
+
+// Streams the samples of a WAV or RF64 file through a window of the file mapped in memory, so that a file
+// of any size is read with the footprint of one window. The window slides forward with the reads, and
+// every new window is prefetched asynchronously, so that sequential reads seldom wait for the disk.
+// Reads can still fault pages in: call them from a background thread, such as the render-ahead worker of
+// AudioRenderer, never from a render thread.
+class MappedWavFile
+{
+public:
+	// Rounded up to the allocation granularity, at least two of them
+	MappedWavFile(size_t windowBytes = 16 << 20);
+	MappedWavFile(const MappedWavFile& other) = delete;
+	~MappedWavFile();
+
+	std::optional<HRESULT> open(const std::wstring& path);
+	void close();
+
+	const WavLayout& get_layout() const;
+
+	// Decodes frames from the read position, interleaved float in the channels of the file.
+	// Returns how many were read: fewer at the end of the file.
+	UINT32 read(float* samples, UINT32 frames);
+
+	// Same, with the channels averaged to one sample per frame
+	UINT32 read_mono(float* samples, UINT32 frames);
+
+	void seek(UINT64 frame);
+	UINT64 get_position() const;
+
+	MappedWavStats get_stats() const;
+
+private:
+	bool map_window(UINT64 fileOffset);
+	void unmap_window();
+
+	size_t windowBytes;
+	DWORD granularity;
+
+	HANDLE file;
+	HANDLE mapping;
+	UINT64 fileSize;
+	const BYTE* view;
+	UINT64 viewOffset;
+	size_t viewBytes;
+
+	WavLayout layout;
+	UINT64 position;
+
+	// Interleaved frames decoded by read_mono() before the downmix
+	std::vector<float> scratch;
+
+	std::atomic<UINT64> mappedViews;
+	std::atomic<UINT64> mappedBytes;
+};
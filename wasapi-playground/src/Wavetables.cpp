@@ -0,0 +1,275 @@
+#include "Wavetables.h"
+
+#include <array>
+
+// Everything below is constexpr and evaluated by the compiler: the tables land in the binary as constants.
+// The band-limited tables are inverse FFTs of the harmonics, around ten million steps of evaluation per
+// waveform: far above MSVC's default limit, hence /constexpr:steps in the project.
+
+namespace {
+    constexpr double pi = 3.14159265358979323846;
+
+    // The lowest table holds every harmonic the table size can represent, each octave above half as many
+    constexpr unsigned int wavetableOctaves = 9;
+    constexpr unsigned int lowestOctaveIncrementBits = 22;
+
+    constexpr unsigned int keys = 128;
+    constexpr unsigned int tunings = 3;
+    constexpr DWORD tabulatedRates[] = { 44100, 48000, 88200, 96000 };
+
+    typedef std::array<float, wavetableSize + 1> Wavetable;
+    typedef std::array<double, keys> KeyFrequencies;
+    typedef std::array<UINT32, keys> KeyIncrements;
+
+    // Taylor series around 0, after bringing x within a half cycle of it
+    constexpr double constexpr_sin(double x) {
+        while (x > pi)
+            x -= 2 * pi;
+        while (x < -pi)
+            x += 2 * pi;
+
+        double term = x, sum = x;
+        for (int n = 1; n < 30; n++) {
+            term *= -x * x / ((2 * n) * (2 * n + 1));
+            sum += term;
+        }
+        return sum;
+    }
+
+    // Newton's method from above
+    constexpr double constexpr_root(double value, int degree) {
+        double root = value > 1 ? value : 1;
+        for (int i = 0; i < 200; i++) {
+            double power = 1;
+            for (int p = 1; p < degree; p++)
+                power *= root;
+            auto next = ((degree - 1) * root + value / power) / degree;
+            if (next >= root)
+                break;
+            root = next;
+        }
+        return root;
+    }
+
+    // Plain arrays rather than std::array where the evaluation loops, which compilers evaluate much faster
+    struct Cycle {
+        double samples[wavetableSize] = {};
+    };
+
+    constexpr Cycle make_sine() {
+        Cycle sine;
+        for (unsigned int i = 0; i < wavetableSize; i++)
+            sine.samples[i] = constexpr_sin(2 * pi * i / wavetableSize);
+        return sine;
+    }
+
+    constexpr Cycle sine = make_sine();
+
+    // Fourier series of the Synthesizer's shapes, in sines of the phase
+    constexpr double harmonic_amplitude(Waveform waveform, unsigned int harmonic) {
+        switch (waveform) {
+        case Waveform::Sine:
+            return harmonic == 1 ? 1 : 0;
+        case Waveform::Square:
+            return harmonic % 2 == 1 ? 4 / (pi * harmonic) : 0;
+        case Waveform::Sawtooth:
+            return -2 / (pi * harmonic);
+        case Waveform::Triangle:
+            if (harmonic % 2 == 0)
+                return 0;
+            return (harmonic % 4 == 1 ? 8 : -8) / (pi * pi * harmonic * harmonic);
+        }
+        return 0;
+    }
+
+    struct Spectrum {
+        double real[wavetableSize] = {};
+        double imag[wavetableSize] = {};
+    };
+
+    // In place inverse FFT, unscaled: x[n] = sum of X[k] e^(2 pi i k n / size)
+    constexpr void inverse_fft(Spectrum& spectrum) {
+        auto& real = spectrum.real;
+        auto& imag = spectrum.imag;
+        for (unsigned int i = 1, j = 0; i < wavetableSize; i++) {
+            auto bit = wavetableSize >> 1;
+            for (; j & bit; bit >>= 1)
+                j ^= bit;
+            j ^= bit;
+            if (i < j) {
+                auto swapReal = real[i], swapImag = imag[i];
+                real[i] = real[j];
+                imag[i] = imag[j];
+                real[j] = swapReal;
+                imag[j] = swapImag;
+            }
+        }
+
+        for (unsigned int length = 2; length <= wavetableSize; length <<= 1) {
+            auto stride = wavetableSize / length;
+            for (unsigned int start = 0; start < wavetableSize; start += length) {
+                for (unsigned int k = 0; k < length / 2; k++) {
+                    auto twiddleReal = sine.samples[(k * stride + wavetableSize / 4) & (wavetableSize - 1)];
+                    auto twiddleImag = sine.samples[k * stride];
+                    auto a = start + k, b = a + length / 2;
+                    auto productReal = real[b] * twiddleReal - imag[b] * twiddleImag;
+                    auto productImag = real[b] * twiddleImag + imag[b] * twiddleReal;
+                    real[b] = real[a] - productReal;
+                    imag[b] = imag[a] - productImag;
+                    real[a] += productReal;
+                    imag[a] += productImag;
+                }
+            }
+        }
+    }
+
+    // One table per octave, each holding the harmonics below Nyquist at the highest increment it is used for:
+    // the sum of a_h sin(2 pi h i / size) is the imaginary part of the inverse transform of the a_h
+    constexpr std::array<Wavetable, wavetableOctaves> make_wavetables(Waveform waveform) {
+        std::array<Wavetable, wavetableOctaves> tables{};
+        for (unsigned int octave = 0; octave < wavetableOctaves; octave++) {
+            Spectrum spectrum;
+            for (unsigned int harmonic = 1; harmonic <= (wavetableSize / 2) >> octave; harmonic++)
+                spectrum.real[harmonic] = harmonic_amplitude(waveform, harmonic);
+            inverse_fft(spectrum);
+
+            for (unsigned int i = 0; i < wavetableSize; i++)
+                tables[octave][i] = (float)spectrum.imag[i];
+            tables[octave][wavetableSize] = tables[octave][0];
+        }
+        return tables;
+    }
+
+    constexpr auto squareTables = make_wavetables(Waveform::Square);
+    constexpr auto sawtoothTables = make_wavetables(Waveform::Sawtooth);
+    constexpr auto triangleTables = make_wavetables(Waveform::Triangle);
+
+    constexpr Wavetable make_sine_table() {
+        Wavetable table{};
+        for (unsigned int i = 0; i < wavetableSize; i++)
+            table[i] = (float)sine.samples[i];
+        table[wavetableSize] = table[0];
+        return table;
+    }
+
+    constexpr auto sineTable = make_sine_table();
+
+    // Ratios of the 12 degrees of the scale to its tonic
+    constexpr std::array<double, 12> degree_ratios(Tuning tuning) {
+        switch (tuning) {
+        case Tuning::JustIntonation:
+            return { 1.0, 16.0 / 15, 9.0 / 8, 6.0 / 5, 5.0 / 4, 4.0 / 3, 45.0 / 32, 3.0 / 2, 8.0 / 5, 5.0 / 3, 9.0 / 5, 15.0 / 8 };
+        case Tuning::Pythagorean:
+            return { 1.0, 256.0 / 243, 9.0 / 8, 32.0 / 27, 81.0 / 64, 4.0 / 3, 729.0 / 512, 3.0 / 2, 128.0 / 81, 27.0 / 16, 16.0 / 9, 243.0 / 128 };
+        default:
+            break;
+        }
+
+        std::array<double, 12> ratios{};
+        for (int degree = 0; degree < 12; degree++)
+            ratios[degree] = constexpr_root((double)(1 << degree), 12);
+        return ratios;
+    }
+
+    constexpr KeyFrequencies make_key_frequencies(Tuning tuning) {
+        const int c4 = 60;
+        auto ratios = degree_ratios(tuning);
+        auto c4Frequency = 440.0 / degree_ratios(Tuning::EqualTemperament)[9];
+
+        KeyFrequencies frequencies{};
+        for (int key = 0; key < (int)keys; key++) {
+            auto octave = key >= c4 ? (key - c4) / 12 : -((c4 - key + 11) / 12);
+            auto frequency = c4Frequency * ratios[key - c4 - octave * 12];
+            for (int i = 0; i < octave; i++)
+                frequency *= 2;
+            for (int i = 0; i > octave; i--)
+                frequency /= 2;
+            frequencies[key] = frequency;
+        }
+        return frequencies;
+    }
+
+    constexpr KeyFrequencies keyFrequencies[tunings] = {
+        make_key_frequencies(Tuning::EqualTemperament),
+        make_key_frequencies(Tuning::JustIntonation),
+        make_key_frequencies(Tuning::Pythagorean)
+    };
+
+    constexpr UINT32 constexpr_phase_increment(double frequency, DWORD sampleRate) {
+        auto cycles = frequency / sampleRate;
+        if (!(cycles > 0))
+            return 0;
+        // Nyquist at most
+        if (cycles >= 0.5)
+            return 1u << 31;
+        return (UINT32)(cycles * 4294967296.0 + 0.5);
+    }
+
+    constexpr KeyIncrements make_key_increments(const KeyFrequencies& frequencies, DWORD sampleRate) {
+        KeyIncrements increments{};
+        for (unsigned int key = 0; key < keys; key++)
+            increments[key] = constexpr_phase_increment(frequencies[key], sampleRate);
+        return increments;
+    }
+
+    constexpr std::array<KeyIncrements, tunings> make_rate_increments(DWORD sampleRate) {
+        std::array<KeyIncrements, tunings> increments{};
+        for (unsigned int tuning = 0; tuning < tunings; tuning++)
+            increments[tuning] = make_key_increments(keyFrequencies[tuning], sampleRate);
+        return increments;
+    }
+
+    constexpr std::array<KeyIncrements, tunings> keyIncrements[] = {
+        make_rate_increments(tabulatedRates[0]),
+        make_rate_increments(tabulatedRates[1]),
+        make_rate_increments(tabulatedRates[2]),
+        make_rate_increments(tabulatedRates[3])
+    };
+
+    static_assert(sizeof(keyIncrements) / sizeof(keyIncrements[0]) == sizeof(tabulatedRates) / sizeof(tabulatedRates[0]),
+        "one table of increments per tabulated rate");
+}
+
+UINT32 phase_increment(double frequency, DWORD sampleRate)
+{
+    return sampleRate != 0 ? constexpr_phase_increment(frequency, sampleRate) : 0;
+}
+
+const float* get_wavetable(Waveform waveform, UINT32 increment)
+{
+    const std::array<Wavetable, wavetableOctaves>* tables = nullptr;
+    switch (waveform) {
+    case Waveform::Square:
+        tables = &squareTables;
+        break;
+    case Waveform::Sawtooth:
+        tables = &sawtoothTables;
+        break;
+    case Waveform::Triangle:
+        tables = &triangleTables;
+        break;
+    default:
+        return sineTable.data();
+    }
+
+    for (unsigned int octave = 0; octave < wavetableOctaves; octave++) {
+        if (increment <= (1u << (lowestOctaveIncrementBits + octave)))
+            return (*tables)[octave].data();
+    }
+    // Above a quarter of the sample rate, only the fundamental is below Nyquist
+    return sineTable.data();
+}
+
+double get_key_frequency(Tuning tuning, BYTE key)
+{
+    return keyFrequencies[(int)tuning][key & (keys - 1)];
+}
+
+UINT32 get_key_increment(Tuning tuning, BYTE key, DWORD sampleRate)
+{
+    for (size_t rate = 0; rate < sizeof(tabulatedRates) / sizeof(tabulatedRates[0]); rate++) {
+        if (tabulatedRates[rate] == sampleRate)
+            return keyIncrements[rate][(int)tuning][key & (keys - 1)];
+    }
+    return phase_increment(get_key_frequency(tuning, key), sampleRate);
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <windows.h>
+
+enum class Waveform {
+	Sine,
+	Square,
+	Sawtooth,
+	Triangle
+};
+
+enum class Tuning {
+	EqualTemperament,
+	JustIntonation,								// 5-limit ratios from C
+	Pythagorean									// stacked fifths from C
+};
+
+// Single cycles of the waveforms, band-limited per octave of pitch: the table for a phase increment holds only
+// the harmonics below Nyquist at that increment, so that reading it does not alias. The tables, and the
+// frequencies and increments of the keys for the usual sample rates, are generated at compile time; nothing
+// is computed at startup.
+const unsigned int wavetableBits = 10;
+const unsigned int wavetableSize = 1 << wavetableBits;
+
+// Phases and increments are in 2^32 per cycle, so that a 32-bit phase accumulator wraps on its own.
+UINT32 phase_increment(double frequency, DWORD sampleRate);
+
+// wavetableSize + 1 samples, the last repeating the first, for a voice advancing by increment every sample
+const float* get_wavetable(Waveform waveform, UINT32 increment);
+
+// Frequency of a MIDI key, A4 being key 69 at 440Hz in equal temperament; the other tunings share its C4
+double get_key_frequency(Tuning tuning, BYTE key);
+// From the tables for 44.1, 48, 88.2 and 96kHz, computed from the frequency at other rates
+UINT32 get_key_increment(Tuning tuning, BYTE key, DWORD sampleRate);
+
+// Linear interpolation between the two samples around phase
+inline float read_wavetable(const float* table, UINT32 phase) {
+	const unsigned int fractionBits = 32 - wavetableBits;
+	auto index = phase >> fractionBits;
+	auto fraction = (float)(phase & ((1u << fractionBits) - 1)) * (1.0f / (1u << fractionBits));
+	return table[index] + (table[index + 1] - table[index]) * fraction;
+}
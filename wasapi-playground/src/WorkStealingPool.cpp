@@ -0,0 +1,277 @@
+#include "WorkStealingPool.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#include <xmmintrin.h>
+#define POOL_PAUSE() _mm_pause()
+#else
+#define POOL_PAUSE() std::this_thread::yield()
+#endif
+
+namespace {
+    // Failed attempts to find a task before a lane gives its core away for a moment
+    const int spinsBeforeYield = 64;
+
+    // The workers also poll, in case a wake-up was missed
+    const DWORD wakeTimeoutMs = 20;
+
+    const unsigned int maxWorkers = 31;
+
+    size_t round_up_to_power_of_two(size_t value) {
+        size_t power = 1;
+        while (power < value)
+            power <<= 1;
+        return power;
+    }
+
+    std::int64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void back_off(int& spins) {
+        if (++spins < spinsBeforeYield) {
+            POOL_PAUSE();
+            return;
+        }
+        std::this_thread::yield();
+        spins = 0;
+    }
+}
+
+WorkStealingPool::Deque::Deque(size_t capacity) :
+    mask(round_up_to_power_of_two(capacity) - 1),
+    tasks(new std::atomic<size_t>[mask + 1]),
+    top(0),
+    bottom(0)
+{
+}
+
+void WorkStealingPool::Deque::push(size_t task)
+{
+    auto b = bottom.load(std::memory_order_relaxed);
+    tasks[b & mask].store(task, std::memory_order_relaxed);
+    // Publishes the task, and whatever its producer wrote before pushing it, to the thieves
+    bottom.store(b + 1, std::memory_order_release);
+}
+
+bool WorkStealingPool::Deque::pop(size_t& task)
+{
+    auto b = bottom.load(std::memory_order_relaxed) - 1;
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto t = top.load(std::memory_order_relaxed);
+
+    if (t > b) {
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return false;
+    }
+
+    task = tasks[b & mask].load(std::memory_order_relaxed);
+    if (t < b)
+        return true;
+
+    // The last task: a thief may be taking it at the same time
+    bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    bottom.store(b + 1, std::memory_order_relaxed);
+    return won;
+}
+
+bool WorkStealingPool::Deque::steal(size_t& task)
+{
+    auto t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto b = bottom.load(std::memory_order_acquire);
+    if (t >= b)
+        return false;
+
+    task = tasks[t & mask].load(std::memory_order_relaxed);
+    return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+}
+
+WorkStealingPool::WorkStealingPool(unsigned int workerCount, size_t maxTasks, DWORD spinMicroseconds) :
+    executor(nullptr),
+    total(0),
+    completed(0),
+    generation(0),
+    runStartNs(0),
+    activeWorkers(0),
+    running(true),
+    spinMicroseconds(spinMicroseconds),
+    runs(0),
+    steals(0),
+    kernelWakes(0),
+    joins(0),
+    totalWakeNs(0),
+    maxWakeNs(0)
+{
+    workerCount = (std::min)(workerCount, maxWorkers);
+    for (unsigned int lane = 0; lane <= workerCount; lane++)
+        deques.push_back(std::make_unique<Deque>(maxTasks));
+
+    laneTasks.reset(new std::atomic<UINT64>[workerCount + 1]);
+    for (unsigned int lane = 0; lane <= workerCount; lane++)
+        laneTasks[lane] = 0;
+
+    sleeping.reset(new std::atomic_bool[workerCount + 1]);
+    for (unsigned int lane = 0; lane <= workerCount; lane++)
+        sleeping[lane] = false;
+
+    // Complete before the first worker starts: they keep a pointer to their name and read the events
+    for (unsigned int lane = 1; lane <= workerCount; lane++) {
+        names.push_back("pool worker " + std::to_string(lane));
+        wakeEvents.push_back(CreateEvent(NULL, FALSE, FALSE, NULL));
+    }
+    for (unsigned int lane = 1; lane <= workerCount; lane++) {
+        workers.push_back(std::make_unique<AudioWorker>(names[lane - 1].c_str(), [this, lane]() { worker_loop(lane); }));
+        workers.back()->resume();
+    }
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    running = false;
+    for (size_t i = 0; i < workers.size(); i++) {
+        SetEvent(wakeEvents[i]);
+        workers[i]->wait_until_idle();
+    }
+    workers.clear();
+
+    for (auto event : wakeEvents)
+        CloseHandle(event);
+}
+
+unsigned int WorkStealingPool::get_lanes() const
+{
+    return (unsigned int)deques.size();
+}
+
+unsigned int WorkStealingPool::default_workers()
+{
+    auto threads = std::thread::hardware_concurrency();
+    return threads > 1 ? threads - 1 : 0;
+}
+
+void WorkStealingPool::run(const size_t* ready, size_t readyCount, size_t taskCount, const Executor& runExecutor)
+{
+    if (taskCount == 0)
+        return;
+
+    completed.store(0, std::memory_order_relaxed);
+    total.store(taskCount, std::memory_order_relaxed);
+    for (size_t i = 0; i < readyCount; i++)
+        deques[0]->push(ready[i]);
+    runStartNs.store(now_ns(), std::memory_order_relaxed);
+    generation.fetch_add(1, std::memory_order_relaxed);
+    executor.store(&runExecutor, std::memory_order_seq_cst);
+
+    // A worker marks itself sleeping before it checks for a run one last time: either it sees this run, or
+    // this sees it asleep
+    for (unsigned int lane = 1; lane < deques.size(); lane++) {
+        if (sleeping[lane].load(std::memory_order_seq_cst)) {
+            SetEvent(wakeEvents[lane - 1]);
+            kernelWakes.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    work(0, runExecutor);
+
+    // A worker that saw the executor may still be looking for work: the next run must not start under it
+    executor.store(nullptr, std::memory_order_seq_cst);
+    int spins = 0;
+    while (activeWorkers.load(std::memory_order_seq_cst) != 0)
+        back_off(spins);
+
+    runs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void WorkStealingPool::push(unsigned int lane, size_t task)
+{
+    deques[lane]->push(task);
+}
+
+void WorkStealingPool::worker_loop(unsigned int lane)
+{
+    UINT64 joined = 0;
+    auto spinUntilNs = now_ns();
+    auto has_new_run = [&]() {
+        return executor.load(std::memory_order_seq_cst) != nullptr && generation.load(std::memory_order_relaxed) != joined;
+    };
+
+    while (running) {
+        if (!has_new_run()) {
+            if (now_ns() < spinUntilNs) {
+                POOL_PAUSE();
+                continue;
+            }
+
+            sleeping[lane].store(true, std::memory_order_seq_cst);
+            if (!has_new_run())
+                WaitForSingleObject(wakeEvents[lane - 1], wakeTimeoutMs);
+            sleeping[lane].store(false, std::memory_order_relaxed);
+            continue;
+        }
+
+        activeWorkers.fetch_add(1, std::memory_order_seq_cst);
+        if (auto runExecutor = executor.load(std::memory_order_seq_cst); runExecutor != nullptr) {
+            joined = generation.load(std::memory_order_relaxed);
+            auto wakeNs = (UINT64)(std::max)(now_ns() - runStartNs.load(std::memory_order_relaxed), (std::int64_t)0);
+            joins.fetch_add(1, std::memory_order_relaxed);
+            totalWakeNs.fetch_add(wakeNs, std::memory_order_relaxed);
+            if (wakeNs > maxWakeNs.load(std::memory_order_relaxed))
+                maxWakeNs.store(wakeNs, std::memory_order_relaxed);
+
+            work(lane, *runExecutor);
+            spinUntilNs = now_ns() + (std::int64_t)spinMicroseconds * 1000;
+        }
+        activeWorkers.fetch_sub(1, std::memory_order_seq_cst);
+    }
+}
+
+bool WorkStealingPool::steal(unsigned int lane, size_t& task)
+{
+    auto lanes = (unsigned int)deques.size();
+    for (unsigned int i = 1; i < lanes; i++) {
+        if (deques[(lane + i) % lanes]->steal(task)) {
+            steals.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkStealingPool::work(unsigned int lane, const Executor& runExecutor)
+{
+    TRACE_SCOPE("pool work");
+
+    int spins = 0;
+    while (completed.load(std::memory_order_acquire) < total.load(std::memory_order_relaxed)) {
+        size_t task;
+        if (!deques[lane]->pop(task) && !steal(lane, task)) {
+            back_off(spins);
+            continue;
+        }
+
+        spins = 0;
+        runExecutor(task, lane);
+        laneTasks[lane].fetch_add(1, std::memory_order_relaxed);
+        completed.fetch_add(1, std::memory_order_acq_rel);
+    }
+}
+
+WorkStealingStats WorkStealingPool::get_stats() const
+{
+    WorkStealingStats stats;
+    stats.runs = runs.load(std::memory_order_relaxed);
+    for (size_t lane = 0; lane < deques.size(); lane++)
+        stats.tasks.push_back(laneTasks[lane].load(std::memory_order_relaxed));
+    stats.steals = steals.load(std::memory_order_relaxed);
+    stats.kernelWakes = kernelWakes.load(std::memory_order_relaxed);
+    auto joinCount = joins.load(std::memory_order_relaxed);
+    stats.wakeUs = joinCount != 0 ? totalWakeNs.load(std::memory_order_relaxed) / 1e3 / joinCount : 0;
+    stats.maxWakeUs = maxWakeNs.load(std::memory_order_relaxed) / 1e3;
+    return stats;
+}
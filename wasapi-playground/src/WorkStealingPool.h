@@ -0,0 +1,103 @@
+#pragma once
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+
+#include <windows.h>
+
+#include "AudioWorker.h"
+
+struct WorkStealingStats {
+	UINT64 runs = 0;
+	std::vector<UINT64> tasks;					// per lane, lane 0 being the thread calling run()
+	UINT64 steals = 0;
+	UINT64 kernelWakes = 0;						// workers that had to be woken through their event
+	double wakeUs = 0;							// from the start of a run to a worker joining it, on average
+	double maxWakeUs = 0;
+};
+
+// Runs batches of tasks on a fixed set of audio threads, once per period: the thread calling run() works as
+// lane 0 and the workers as the other lanes. Every lane has its own deque, pushes and pops its own end of it
+// and steals from the other end of the others' when it runs out, so that independent tasks spread over the
+// cores without a shared queue. Tasks are indices; a task makes the tasks that waited on it ready with push().
+// Nothing allocates, locks or waits on the kernel once constructed, except for the wake-up of the workers:
+// a worker spins for spinMicroseconds after a run before it sleeps, so that runs following each other closely
+// find it awake, and only the sleeping ones are signaled.
+class WorkStealingPool
+{
+public:
+	// Runs task on lane. Called from every lane at once.
+	typedef std::function<void(size_t task, unsigned int lane)> Executor;
+
+	// 0 workers runs everything on the calling thread. maxTasks bounds the tasks of one run.
+	WorkStealingPool(unsigned int workers, size_t maxTasks, DWORD spinMicroseconds = 0);
+	WorkStealingPool(const WorkStealingPool& other) = delete;
+	~WorkStealingPool();
+
+	// Worker threads, plus the calling thread
+	unsigned int get_lanes() const;
+
+	// Pushes the ready tasks on lane 0, wakes the workers and works until total tasks ran. One run at a time;
+	// executor must stay valid until run() returns.
+	void run(const size_t* ready, size_t readyCount, size_t total, const Executor& executor);
+
+	// From inside the executor, on the lane it was given
+	void push(unsigned int lane, size_t task);
+
+	WorkStealingStats get_stats() const;
+
+	// Workers for the cores the calling thread does not use: the hardware threads minus one
+	static unsigned int default_workers();
+
+private:
+	// Chase-Lev deque of fixed capacity: the owner pushes and pops at the bottom, thieves take from the top
+	class Deque
+	{
+	public:
+		Deque(size_t capacity);
+
+		void push(size_t task);
+		bool pop(size_t& task);
+		bool steal(size_t& task);
+
+	private:
+		const size_t mask;
+		std::unique_ptr<std::atomic<size_t>[]> tasks;
+		alignas(64) std::atomic<std::int64_t> top;
+		alignas(64) std::atomic<std::int64_t> bottom;
+	};
+
+	void worker_loop(unsigned int lane);
+	void work(unsigned int lane, const Executor& executor);
+	bool steal(unsigned int lane, size_t& task);
+
+	std::vector<std::unique_ptr<Deque>> deques;
+
+	// The run in progress: nullptr between runs
+	std::atomic<const Executor*> executor;
+	std::atomic<size_t> total;
+	std::atomic<size_t> completed;
+	// Incremented by every run, so that a worker joins each run once
+	std::atomic<UINT64> generation;
+	std::atomic<std::int64_t> runStartNs;
+	// Workers inside a run: run() waits for all of them to leave before it returns
+	std::atomic<unsigned int> activeWorkers;
+
+	std::atomic_bool running;
+	const DWORD spinMicroseconds;
+	std::unique_ptr<std::atomic_bool[]> sleeping;
+	std::vector<HANDLE> wakeEvents;
+	std::vector<std::string> names;
+	std::vector<std::unique_ptr<AudioWorker>> workers;
+
+	std::atomic<UINT64> runs;
+	std::unique_ptr<std::atomic<UINT64>[]> laneTasks;
+	std::atomic<UINT64> steals;
+	std::atomic<UINT64> kernelWakes;
+	std::atomic<UINT64> joins;
+	std::atomic<UINT64> totalWakeNs;
+	std::atomic<UINT64> maxWakeNs;
+};
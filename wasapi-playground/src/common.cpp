@@ -4,20 +4,28 @@
 
 std::wstring string_to_wstring(const std::string& s)
 {
-    std::wstring temp;
-    for (const auto& c : s) {
-        temp += c;
-    }
-    return temp;
+    if (s.empty())
+        return std::wstring();
+
+    // input is UTF-8, ask for the required length first
+    auto length = MultiByteToWideChar(CP_UTF8, 0, s.data(), (int)s.size(), nullptr, 0);
+    std::wstring out(length, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, s.data(), (int)s.size(), out.data(), length);
+    return out;
 }
 
 std::string LPCWSTR_to_string(const LPCWSTR& s)
 {
-    std::string out;
-    for (size_t i = 0; i < wcslen(s); i++)
-    {
-        out += s[i];
-    }
+    if (s == nullptr || s[0] == L'\0')
+        return std::string();
+
+    // -1 makes the length include the null terminator, which std::string doesn't need
+    auto length = WideCharToMultiByte(CP_UTF8, 0, s, -1, nullptr, 0, nullptr, nullptr);
+    if (length <= 1)
+        return std::string();
+
+    std::string out(length - 1, '\0');
+    WideCharToMultiByte(CP_UTF8, 0, s, -1, out.data(), length, nullptr, nullptr);
     return out;
 }
 
@@ -38,3 +46,61 @@ std::optional<AudioStreamInfo> get_stream_info(IAudioClient* audioClient)
 
     return info;
 }
+
+
+WAVEFORMATEXTENSIBLE make_float_format(DWORD samplesPerSec, WORD channels)
+{
+    StreamFormat format;
+    format.sampleRate = samplesPerSec;
+    format.channels = channels;
+    return make_wave_format(format);
+}
+
+WAVEFORMATEXTENSIBLE make_wave_format(const StreamFormat& streamFormat)
+{
+    WAVEFORMATEXTENSIBLE format{};
+    format.Format.wFormatTag = WAVE_FORMAT_EXTENSIBLE;
+    format.Format.nChannels = streamFormat.channels;
+    format.Format.nSamplesPerSec = streamFormat.sampleRate;
+    format.Format.wBitsPerSample = streamFormat.bitsPerSample;
+    format.Format.nBlockAlign = streamFormat.block_align();
+    format.Format.nAvgBytesPerSec = streamFormat.sampleRate * format.Format.nBlockAlign;
+    format.Format.cbSize = sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX);
+    format.Samples.wValidBitsPerSample = streamFormat.validBitsPerSample;
+    format.SubFormat = streamFormat.isFloat ? KSDATAFORMAT_SUBTYPE_IEEE_FLOAT : KSDATAFORMAT_SUBTYPE_PCM;
+
+    if (streamFormat.channelMask != 0)
+        format.dwChannelMask = streamFormat.channelMask;
+    else
+        format.dwChannelMask = streamFormat.channels == 1 ? SPEAKER_FRONT_CENTER : streamFormat.channels == 2 ? SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT : 0;
+
+    return format;
+}
+
+WAVEFORMATEX* allocate_wave_format(const StreamFormat& streamFormat)
+{
+    // Same allocator as the formats returned by WASAPI, so they can all be released with CoTaskMemFree()
+    auto format = reinterpret_cast<WAVEFORMATEXTENSIBLE*>(CoTaskMemAlloc(sizeof(WAVEFORMATEXTENSIBLE)));
+    if (format != nullptr)
+        *format = make_wave_format(streamFormat);
+    return reinterpret_cast<WAVEFORMATEX*>(format);
+}
+
+StreamFormat to_stream_format(const WAVEFORMATEX* format)
+{
+    StreamFormat streamFormat;
+    streamFormat.sampleRate = format->nSamplesPerSec;
+    streamFormat.channels = format->nChannels;
+    streamFormat.bitsPerSample = format->wBitsPerSample;
+    streamFormat.validBitsPerSample = format->wBitsPerSample;
+    streamFormat.isFloat = format->wFormatTag == WAVE_FORMAT_IEEE_FLOAT;
+
+    if (format->wFormatTag == WAVE_FORMAT_EXTENSIBLE && format->cbSize >= 22) {
+        auto extensible = reinterpret_cast<const WAVEFORMATEXTENSIBLE*>(format);
+        streamFormat.validBitsPerSample = extensible->Samples.wValidBitsPerSample;
+        streamFormat.isFloat = extensible->SubFormat == KSDATAFORMAT_SUBTYPE_IEEE_FLOAT;
+        streamFormat.channelMask = extensible->dwChannelMask;
+    }
+
+    return streamFormat;
+}
\ No newline at end of file
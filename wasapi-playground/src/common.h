@@ -6,6 +6,8 @@
 #include <optional>
 #include <AudioClient.h>
 
+#include "StreamFormat.h"
+
 template <class T> void SafeRelease(T** ppT)
 {
     if (*ppT)
@@ -23,6 +25,10 @@ struct AudioStreamInfo {
 std::wstring string_to_wstring(const std::string& s);
 std::string LPCWSTR_to_string(const LPCWSTR& s);
 std::optional<AudioStreamInfo> get_stream_info(IAudioClient* audioClient);
+WAVEFORMATEXTENSIBLE make_float_format(DWORD samplesPerSec, WORD channels);
+WAVEFORMATEXTENSIBLE make_wave_format(const StreamFormat& format);
+WAVEFORMATEX* allocate_wave_format(const StreamFormat& format);
+StreamFormat to_stream_format(const WAVEFORMATEX* format);
 
 enum class AudioDeviceDirection {
     Input,
@@ -5,6 +5,7 @@
 
 #include "log.h"
 #include "DeviceEnumerator.h"
+#include "ChannelMatrix.h"
 
 using std::cout;
 using std::endl;
@@ -66,6 +67,7 @@ void log_wave_format_ex(const WAVEFORMATEXTENSIBLE& format, unsigned int level)
     cout << indent(level) << "samples in one block of audio data: " << format.Samples.wSamplesPerBlock << endl;
     cout << indent(level) << "Bits of precision in the signal: " << format.Samples.wValidBitsPerSample << endl;
     cout << indent(level) << "Channel mask: " << std::bitset<sizeof(DWORD) * 8>(format.dwChannelMask) << endl;
+    cout << indent(level) << "Speakers: " << channel_layout_name(format.Format.nChannels, format.dwChannelMask) << endl;
     cout << indent(level) << "tag: " << formatTag << endl;
 }
 
@@ -144,3 +146,16 @@ void log_device_details(const AudioDeviceDetails& deviceInfo)
     cout << "**********" << endl << endl;
 }
 
+
+
+void log_stream_configuration(const StreamConfiguration& configuration)
+{
+    const auto& format = configuration.format;
+    cout << "*** STREAM CONFIGURATION" << endl;
+    cout << indent(0) << "format: " << format.sampleRate << "Hz, " << format.channels << " channels, "
+        << format.validBitsPerSample << "/" << format.bitsPerSample << " bits " << (format.isFloat ? "float" : "integer") << endl;
+    cout << indent(0) << "period: " << configuration.periodInFrames << " frames" << (configuration.usesEnginePeriod ? "" : " (default)") << endl;
+    cout << indent(0) << "estimated latency: " << configuration.latencyMs << "ms" << endl;
+    cout << indent(0) << "estimated CPU load: " << configuration.estimatedCpuLoad * 100 << "%" << endl;
+    cout << "**********" << endl << endl;
+}
\ No newline at end of file
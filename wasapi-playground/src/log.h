@@ -5,4 +5,5 @@
 #include "DeviceEnumerator.h"
 
 void log_all_devices_list(const AudioDeviceList& all_devices);
-void log_device_details(const AudioDeviceDetails& deviceInfo);
\ No newline at end of file
+void log_device_details(const AudioDeviceDetails& deviceInfo);
+void log_stream_configuration(const StreamConfiguration& configuration);
\ No newline at end of file
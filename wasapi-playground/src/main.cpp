@@ -3,6 +3,20 @@
 #include "main_capture.hpp"
 #include "main_render.hpp"
 #include "main_log.hpp"
+#include "main_migration.hpp"
+#include "main_low_latency.hpp"
+#include "main_trace.hpp"
+#include "main_metrics.hpp"
+#include "main_realtime.hpp"
+#include "main_latency.hpp"
+#include "main_playback.hpp"
+#include "main_mixer.hpp"
+#include "main_channels.hpp"
+#include "main_effects.hpp"
+#include "main_convolution.hpp"
+#include "main_graph.hpp"
+#include "main_polysynth.hpp"
+#include "main_sequencer.hpp"
 
 #include "DeviceNotificationProvider.h"
 
@@ -15,9 +29,9 @@ int device_events() {
 	cout << " - Will log events when devices are added or removed" << endl;
 	cout << " - Press ESC to exit" << endl;
 
-	notifications.subscribe_to_global_events([](std::string id, DeviceEvent evt) {
+	notifications.subscribe_to_global_events([](DeviceHandle device, DeviceEvent evt) {
 		if (evt != DeviceEvent::PropertyChanged)
-			cout << "Device event: " << (int)evt << " id: " << id<<endl;
+			cout << "Device event: " << (int)evt << " id: " << DeviceIdTable::instance().get_id(device) << endl;
 	});
 
 	while (GetAsyncKeyState(VK_ESCAPE) == 0)
@@ -69,5 +83,67 @@ int main()
 		return main_stream_capture();
 	case 4:
 		return log_volume_change();
+	case 5:
+		return main_follow_default();
+	case 6:
+		return main_simulated_migration();
+	case 7:
+		return main_simulated_low_latency();
+	case 8:
+		return main_simulated_exclusive();
+	case 9:
+		return main_simulated_trace();
+	case 10:
+		return main_simulated_metrics();
+	case 11:
+		return main_device_profiles();
+	case 12:
+		return main_simulated_start_latency();
+	case 13:
+		return main_simulated_realtime_checks();
+	case 14:
+		return main_simulated_render_ahead();
+	case 15:
+		return main_simulated_watchdog();
+	case 16:
+		return main_simulated_duplex();
+	case 17:
+		return main_measure_latency();
+	case 18:
+		return main_simulated_latency();
+	case 19:
+		return main_simulated_retroactive();
+	case 20:
+		return main_play_wav_file();
+	case 21:
+		return main_simulated_file_playback();
+	case 22:
+		return main_mixer();
+	case 23:
+		return main_simulated_mixer();
+	case 24:
+		return main_channel_matrices();
+	case 25:
+		return main_effects();
+	case 26:
+		return main_simulated_effects();
+	case 27:
+		return main_convolution();
+	case 28:
+		return main_simulated_convolution();
+	case 29:
+		return main_audio_graph();
+	case 30:
+		return main_simulated_audio_graph();
+	case 31:
+		return main_poly_synth();
+	case 32:
+		return main_simulated_poly_synth();
+	case 33:
+		return main_midi_file();
+	case 34:
+		return main_simulated_midi_rendering();
+	case 35:
+		return main_simulated_negotiation();
 	}
 }
@@ -4,18 +4,25 @@
 #include <string>
 #include <future>
 #include <bitset>
-#include <deque>
+#include <algorithm>
 
 #include "log.h"
 #include "DeviceEnumerator.h"
 #include "AudioRenderer.h"
 #include "AudioCapturer.h"
+#include "SpscRing.h"
+#include "DuplexEngine.h"
+#include "SimulatedLoopback.h"
+#include "main_clients.hpp"
 
 using std::cout;
 using std::endl;
 
 const unsigned int bufferSizeLenghtMs = 16;
 
+// Samples buffered between the capture and the render thread while streaming, about 2s at 48kHz
+const size_t passthroughCapacity = 1 << 17;
+
 int main_stream_capture() {
     DeviceEnumerator deviceEnumerator;
     const auto& allDevices = deviceEnumerator.get_all_devices_summary();
@@ -46,24 +53,16 @@ int main_stream_capture() {
         outDeviceChoice = 0;
     }
 
-    auto inDevicePointer = deviceEnumerator.get_device_by_id(inDevices[inDeviceChoice].id);
-    auto outDevicePointer = deviceEnumerator.get_device_by_id(outDevices[outDeviceChoice].id);
+    auto inDevicePointer = deviceEnumerator.get_device_by_handle(inDevices[inDeviceChoice].handle);
+    auto outDevicePointer = deviceEnumerator.get_device_by_handle(outDevices[outDeviceChoice].handle);
 
     log_device_details(inDevicePointer->get_info());
     log_device_details(outDevicePointer->get_info());
 
-    AudioCapturer capturer(std::move(inDevicePointer));
-    AudioRenderer renderer(std::move(outDevicePointer));
-
-    if (auto error = capturer.initialize(bufferSizeLenghtMs); error.has_value()) {
-        cout << "Audio Capturer failed to initialize. Aborting" << endl;
+    auto capturer = open_client(std::move(inDevicePointer), &AudioCapturer::initialize, bufferSizeLenghtMs);
+    auto renderer = open_client(std::move(outDevicePointer), &AudioRenderer::initialize, bufferSizeLenghtMs);
+    if (capturer == nullptr || renderer == nullptr)
         return -1;
-    }
-
-    if (auto error = renderer.initialize(bufferSizeLenghtMs); error.has_value()) {
-        cout << "Audio Renderer failed to initialize. Aborting" << endl;
-        return -1;
-    }
 
     cout << "- Keep pressed Q to record" << endl;
     cout << "- Keep pressed W to play last recorded audio" << endl;
@@ -78,7 +77,7 @@ int main_stream_capture() {
 
         AudioRecording lastRecording;
         std::future<AudioRecording> recordingFuture;
-        std::deque<float> dataBuffer;
+        SpscRing<float> dataBuffer(passthroughCapacity);
 
         while (true) {
             auto isRecDown = std::bitset<16>(GetAsyncKeyState('Q')).test(15);
@@ -88,7 +87,7 @@ int main_stream_capture() {
             //stop recording
             if (isRecording && !isRecDown) {
                 isRecording = false;
-                capturer.stop();
+                capturer->stop();
                 lastRecording = recordingFuture.get();
 
                 cout << "Got " << lastRecording.data.size() << " samples (" << (float)lastRecording.durationMs / 1000.0 << "s)" << endl;
@@ -98,22 +97,22 @@ int main_stream_capture() {
             else if (isPlaying && !isPlayDown) {
                 cout << " Stop playing!" << endl;
                 isPlaying = false;
-                renderer.stop();
+                renderer->stop();
             }
 
             // stop streaming
             else if (isStreaming && !isStreamingDown) {
                 cout << " Stop streaming!" << endl;
                 isStreaming = false;
-                capturer.stop();
-                renderer.stop();
+                capturer->stop();
+                renderer->stop();
                 dataBuffer.clear();
             }
 
             // start recording
             else if (isRecDown && !isRecording && !isStreaming && !isPlaying) {
                 cout << "Now recording... ";
-                recordingFuture = capturer.start_recording();
+                recordingFuture = capturer->start_recording();
                 isRecording = true;
             }
 
@@ -123,7 +122,7 @@ int main_stream_capture() {
                 isPlaying = true;
                 if (lastRecording.durationMs != 0) {
                     cout << "Now playing... ";
-                    renderer.start([&](FrameInfo info) {
+                    renderer->start([&](FrameInfo info) {
                         auto currentFrame = info.ordinalNumber % lastRecording.data.size();
                         return (double)lastRecording.data[currentFrame];
                     });
@@ -138,25 +137,19 @@ int main_stream_capture() {
                 cout << "Now Streaming... ";
                 isStreaming = true;
 
-                capturer.start_streaming([&dataBuffer](BYTE* inBuffer, UINT32 framesNum) {
+                capturer->start_streaming([&dataBuffer](BYTE* inBuffer, UINT32 framesNum) {
                     if (inBuffer == nullptr || framesNum == 0)
                         return;
 
+                    // When the renderer falls behind, the newest samples are dropped
                     auto floatBuffer = reinterpret_cast<float*>(inBuffer);
-                    for (size_t i = 0; i < framesNum; i++)
-                    {
-                        dataBuffer.push_back(floatBuffer[i]);
-                    }
+                    dataBuffer.push(floatBuffer, framesNum);
                 });
 
-                renderer.start([&dataBuffer](FrameInfo frame) {
-                    if (!dataBuffer.empty()) {
-                        double frame = dataBuffer.front();
-                        dataBuffer.pop_front();
-                        return frame;
-                    }
-
-                    return 0.0;
+                renderer->start([&dataBuffer](FrameInfo frame) {
+                    float sample = 0;
+                    dataBuffer.pop(sample);
+                    return (double)sample;
                 });
             }
 
@@ -171,4 +164,161 @@ int main_stream_capture() {
 
     readCommands.join();
     return 0;
-}
\ No newline at end of file
+}
+// Round trip through the duplex engine: a simulated loopback cable connects the output to the input, the callback
+// writes a click every 250ms and measures how many frames later it is captured
+int main_simulated_duplex() {
+    SimulatedEndpointConfig outputConfig;
+    outputConfig.friendlyName = "Simulated speakers";
+    SimulatedEndpointConfig inputConfig;
+    inputConfig.id = L"{0.0.1.00000000}.{simulated}";
+    inputConfig.friendlyName = "Simulated microphone";
+    inputConfig.direction = EDataFlow::eCapture;
+
+    auto output = new SimulatedDevice(outputConfig);
+    auto input = new SimulatedDevice(inputConfig);
+    SimulatedLoopback cable(output, input);
+
+    DuplexEngine engine(std::make_unique<AudioDevice>(input), std::make_unique<AudioDevice>(output));
+    if (auto error = engine.initialize(); error.has_value()) {
+        cout << "Duplex engine failed to initialize: " << std::hex << error.value() << std::dec << endl;
+        return -1;
+    }
+
+    const UINT32 rate = outputConfig.mixFormat.Format.nSamplesPerSec;
+    UINT64 position = 0;
+    UINT64 clickPosition = 0;
+    bool waitingClick = false;
+    std::vector<UINT64> roundTrips;
+    roundTrips.reserve(64);
+
+    // Runs on the duplex thread only, the engine is stopped before the results are read
+    engine.start([&](const DuplexBuffers& buffers) {
+        for (UINT32 i = 0; i < buffers.frames; i++) {
+            if (waitingClick && buffers.input[(size_t)i * buffers.inputChannels] > 0.5f) {
+                if (roundTrips.size() < roundTrips.capacity())
+                    roundTrips.push_back(position + i - clickPosition);
+                waitingClick = false;
+            }
+
+            float sample = 0;
+            if (!waitingClick && (position + i) % (rate / 4) == 0) {
+                sample = 1.0f;
+                clickPosition = position + i;
+                waitingClick = true;
+            }
+
+            for (WORD channel = 0; channel < buffers.outputChannels; channel++)
+                buffers.output[(size_t)i * buffers.outputChannels + channel] = sample;
+        }
+        position += buffers.frames;
+    });
+
+    Sleep(3000);
+    engine.stop();
+
+    auto stats = engine.get_stats();
+    cout << "Duplex at a period of " << engine.get_period() << " frames: " << stats.cycles << " cycles, " << stats.outputUnderruns
+        << " output underruns, " << stats.droppedInputFrames << " dropped input frames, slowest cycle " << stats.maxCycleMs << "ms" << endl;
+
+    if (roundTrips.empty()) {
+        cout << "No click came back through the loopback" << endl;
+        return -1;
+    }
+
+    std::sort(roundTrips.begin(), roundTrips.end());
+    cout << "Round trip over " << roundTrips.size() << " clicks: min " << 1000.0 * roundTrips.front() / rate << "ms, median "
+        << 1000.0 * roundTrips[roundTrips.size() / 2] / rate << "ms, max " << 1000.0 * roundTrips.back() / rate << "ms" << endl;
+    return 0;
+}
+
+// Keeps the last two seconds of a simulated microphone while a reader thread takes snapshots of the last
+// second. The microphone records a frame counter: a snapshot may only have gaps where the endpoint dropped
+// frames, never because the snapshot raced with the capture thread, and every drop is reported as a lost packet.
+int main_simulated_retroactive() {
+    SimulatedEndpointConfig inputConfig;
+    inputConfig.id = L"{0.0.1.00000000}.{simulated}";
+    inputConfig.friendlyName = "Simulated microphone";
+    inputConfig.direction = EDataFlow::eCapture;
+
+    // The counter wraps before floats lose integer precision
+    const UINT64 counterPeriod = 1 << 20;
+
+    // Where the endpoint resumed after dropping frames, written by the capture thread and read once it stopped
+    std::vector<UINT64> drops;
+    drops.reserve(1024);
+    UINT64 nextPosition = 0;
+
+    auto input = new SimulatedDevice(inputConfig);
+    input->set_capture_source([counterPeriod, &drops, &nextPosition](float* buffer, UINT32 frames, WORD channels, UINT64 position, UINT64 _) {
+        if (position != nextPosition && drops.size() < drops.capacity())
+            drops.push_back(position % counterPeriod);
+        nextPosition = position + frames;
+
+        for (UINT32 i = 0; i < frames; i++)
+            for (WORD j = 0; j < channels; j++)
+                buffer[(size_t)i * channels + j] = (float)((position + i) % counterPeriod);
+    });
+
+    auto capturer = open_simulated(input, &AudioCapturer::initialize, bufferSizeLenghtMs);
+    if (capturer == nullptr)
+        return -1;
+
+    if (!capturer->start_retroactive(2)) {
+        cout << "Failed to start the retroactive capture" << endl;
+        return -1;
+    }
+
+    // Counter values the recording resumes at after a gap
+    auto find_gaps = [counterPeriod](const AudioRecording& recording) {
+        std::vector<UINT64> gaps;
+        for (size_t i = recording.channels; i < recording.data.size(); i += recording.channels) {
+            auto step = (UINT64)recording.data[i] + counterPeriod - (UINT64)recording.data[i - recording.channels];
+            if (step % counterPeriod != 1)
+                gaps.push_back((UINT64)recording.data[i]);
+        }
+        return gaps;
+    };
+
+    std::vector<UINT64> snapshotGaps;
+    auto reader = std::thread([&]() {
+        for (int i = 0; i < 12; i++) {
+            Sleep(300);
+            auto snapshotStart = std::chrono::steady_clock::now();
+            auto lastSecond = capturer->snapshot_retroactive(1000);
+            auto snapshotMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - snapshotStart).count();
+
+            auto gaps = find_gaps(lastSecond);
+            snapshotGaps.insert(snapshotGaps.end(), gaps.begin(), gaps.end());
+            cout << "Snapshot " << i << ": " << lastSecond.durationMs << "ms, " << gaps.size() << " gaps, copied in " << snapshotMs << "ms" << endl;
+        }
+    });
+
+    reader.join();
+    capturer->stop();
+
+    auto everything = capturer->snapshot_retroactive();
+    auto gaps = find_gaps(everything);
+    snapshotGaps.insert(snapshotGaps.end(), gaps.begin(), gaps.end());
+    auto lostPackets = capturer->get_metrics().underruns.load();
+    cout << "After stop: " << everything.durationMs << "ms kept out of " << capturer->get_metrics().frames / inputConfig.mixFormat.Format.nSamplesPerSec
+        << "s captured, " << lostPackets << " lost packets, " << drops.size() << " drops" << endl;
+
+    // Every drop is a lost packet, and a gap in the recording anywhere else is a race
+    bool ok = lostPackets == drops.size();
+    for (auto gap : snapshotGaps) {
+        if (std::find(drops.begin(), drops.end(), gap) == drops.end()) {
+            cout << "Gap at frame " << gap << " where the endpoint dropped nothing" << endl;
+            ok = false;
+        }
+    }
+
+    // The buffer kept all the drops that happened within its last two seconds
+    auto keptFrom = everything.data.empty() ? counterPeriod : (UINT64)everything.data.front();
+    auto keptDrops = std::count_if(drops.begin(), drops.end(), [keptFrom](UINT64 drop) { return drop > keptFrom; });
+    if ((size_t)keptDrops != gaps.size()) {
+        cout << keptDrops << " drops in the kept buffer, but " << gaps.size() << " gaps" << endl;
+        ok = false;
+    }
+    return ok ? 0 : -1;
+}
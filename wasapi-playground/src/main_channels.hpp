@@ -0,0 +1,188 @@
+#include <iostream>
+#include <iomanip>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "SimulatedDevice.h"
+#include "AudioRenderer.h"
+#include "ChannelMatrix.h"
+#include "main_clients.hpp"
+
+using std::cout;
+using std::endl;
+
+struct ChannelLayout {
+    const char* name;
+    WORD channels;
+    DWORD mask;
+};
+
+const ChannelLayout layoutMono = { "mono", 1, SPEAKER_FRONT_CENTER };
+const ChannelLayout layoutStereo = { "stereo", 2, SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT };
+const ChannelLayout layoutQuad = { "quad", 4, SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT | SPEAKER_BACK_LEFT | SPEAKER_BACK_RIGHT };
+const ChannelLayout layout51 = { "5.1", 6, 0 };
+const ChannelLayout layout51Side = { "5.1 side", 6, SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT | SPEAKER_FRONT_CENTER | SPEAKER_LOW_FREQUENCY | SPEAKER_SIDE_LEFT | SPEAKER_SIDE_RIGHT };
+const ChannelLayout layout71 = { "7.1", 8, 0 };
+
+void print_channel_matrix(const ChannelMatrix& matrix, const ChannelLayout& input, const ChannelLayout& output) {
+    auto inputNames = channel_layout_name(input.channels, input.mask != 0 ? input.mask : default_channel_mask(input.channels));
+    auto outputNames = channel_layout_name(output.channels, output.mask != 0 ? output.mask : default_channel_mask(output.channels));
+    cout << input.name << " (" << inputNames << ") to " << output.name << " (" << outputNames << ")" << endl;
+
+    for (WORD out = 0; out < matrix.get_outputs(); out++) {
+        cout << "   ";
+        for (WORD in = 0; in < matrix.get_inputs(); in++)
+            cout << std::setw(7) << std::fixed << std::setprecision(3) << matrix.get_gain(out, in);
+        cout << endl;
+    }
+    cout.unsetf(std::ios::fixed);
+}
+
+// The matrix product one gain at a time, to check the kernels against
+void apply_channel_matrix_reference(const ChannelMatrix& matrix, const float* input, float* output, size_t frames) {
+    auto inputs = matrix.get_inputs();
+    auto outputs = matrix.get_outputs();
+    for (size_t frame = 0; frame < frames; frame++) {
+        for (WORD out = 0; out < outputs; out++) {
+            float sum = 0;
+            for (WORD in = 0; in < inputs; in++)
+                sum += matrix.get_gain(out, in) * input[frame * inputs + in];
+            output[frame * outputs + out] = sum;
+        }
+    }
+}
+
+// Checks a matrix against the reference and times both. Returns the largest difference.
+float benchmark_channel_matrix(const char* name, const ChannelMatrix& matrix) {
+    const size_t frames = 1 << 16;
+    const int runs = 20;
+
+    std::mt19937 random(42);
+    std::uniform_real_distribution<float> samples(-1.0f, 1.0f);
+    std::vector<float> input(frames * matrix.get_inputs());
+    for (auto& sample : input)
+        sample = samples(random);
+
+    std::vector<float> output(frames * matrix.get_outputs());
+    std::vector<float> expected(frames * matrix.get_outputs());
+
+    auto time_ns_per_frame = [&](auto&& run) {
+        auto best = std::chrono::nanoseconds::max();
+        for (int i = 0; i < runs; i++) {
+            auto start = std::chrono::steady_clock::now();
+            run();
+            best = (std::min)(best, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start));
+        }
+        return (double)best.count() / frames;
+    };
+
+    auto kernelNs = time_ns_per_frame([&]() { matrix.apply(input.data(), output.data(), frames); });
+    auto referenceNs = time_ns_per_frame([&]() { apply_channel_matrix_reference(matrix, input.data(), expected.data(), frames); });
+
+    float error = 0;
+    for (size_t i = 0; i < output.size(); i++)
+        error = (std::max)(error, std::abs(output[i] - expected[i]));
+
+    cout << "  " << std::left << std::setw(20) << name << std::right << std::setw(8) << kernelNs << "ns/frame, reference "
+        << std::setw(8) << referenceNs << "ns/frame, largest difference " << error << (matrix.is_identity() ? " (copy)" : "") << endl;
+    return error;
+}
+
+// Standard matrices between the common layouts, a custom routing, and the kernels checked and timed against
+// a plain matrix product. Then a simulated 5.1 endpoint: a mono source must only play on the center speaker,
+// and a mixer panned hard left only on the front left one.
+int main_channel_matrices() {
+    struct Conversion {
+        const char* name;
+        ChannelLayout input;
+        ChannelLayout output;
+    };
+    const Conversion conversions[] = {
+        { "mono to stereo", layoutMono, layoutStereo },
+        { "stereo to mono", layoutStereo, layoutMono },
+        { "stereo to 5.1", layoutStereo, layout51 },
+        { "5.1 to stereo", layout51, layoutStereo },
+        { "7.1 to 5.1 side", layout71, layout51Side },
+        { "7.1 to quad", layout71, layoutQuad },
+        { "5.1 to 7.1", layout51, layout71 },
+        { "7.1 to 7.1", layout71, layout71 }
+    };
+
+    for (const auto& conversion : conversions)
+        print_channel_matrix(ChannelMatrix::between(conversion.input.channels, conversion.input.mask, conversion.output.channels, conversion.output.mask), conversion.input, conversion.output);
+
+    // A 4-microphone array without speaker positions, the outer pair to left and right, the inner pair in both
+    ChannelMatrix array(4, 2);
+    array.set_gain(0, 0, 1.0f);
+    array.set_gain(1, 3, 1.0f);
+    for (WORD output = 0; output < 2; output++) {
+        array.set_gain(output, 1, 0.5f);
+        array.set_gain(output, 2, 0.5f);
+    }
+
+    ChannelMatrix swapped(2, 2);
+    swapped.set_gain(0, 1, 1.0f);
+    swapped.set_gain(1, 0, 1.0f);
+
+    cout << endl << "Kernels:" << endl;
+    float error = 0;
+    for (const auto& conversion : conversions) {
+        auto matrix = ChannelMatrix::between(conversion.input.channels, conversion.input.mask, conversion.output.channels, conversion.output.mask);
+        error = (std::max)(error, benchmark_channel_matrix(conversion.name, matrix));
+    }
+    error = (std::max)(error, benchmark_channel_matrix("4-mic array", array));
+    error = (std::max)(error, benchmark_channel_matrix("swapped stereo", swapped));
+
+    // Levels of every channel of the simulated endpoint
+    SimulatedEndpointConfig config;
+    config.friendlyName = "Simulated 5.1 speakers";
+    config.mixFormat = make_float_format(48000, 6);
+    auto endpoint = new SimulatedDevice(config);
+
+    std::vector<std::atomic<float>> peaks(6);
+    endpoint->set_render_sink([&peaks](const float* buffer, UINT32 frames, WORD channels, UINT64, UINT64) {
+        for (UINT32 i = 0; i < frames; i++) {
+            for (WORD channel = 0; channel < channels && channel < peaks.size(); channel++)
+                peaks[channel] = (std::max)(peaks[channel].load(), std::abs(buffer[(size_t)i * channels + channel]));
+        }
+    });
+
+    auto renderer = open_simulated(endpoint, &AudioRenderer::initialize, 16);
+    if (renderer == nullptr)
+        return -1;
+
+    auto play_and_check = [&](const char* name, int expectedChannel) {
+        Sleep(300);
+        renderer->stop();
+
+        cout << "  " << name << ":";
+        bool placed = true;
+        for (size_t channel = 0; channel < peaks.size(); channel++) {
+            auto peak = peaks[channel].exchange(0);
+            cout << " " << peak;
+            placed = placed && ((int)channel == expectedChannel ? peak > 0.4f : peak == 0);
+        }
+        cout << (placed ? "" : " WRONG") << endl;
+        return placed;
+    };
+
+    cout << endl << config.friendlyName << ", peak of every channel:" << endl;
+    renderer->start([](FrameInfo frame) {
+        return 0.5 * sin(440.0 * 2 * 3.14159265358979 * frame.time);
+    });
+    bool placed = play_and_check("mono source", 2);
+
+    // A stereo block with only the left channel
+    renderer->start_interleaved([](float* samples, UINT32 frames, WORD channels) {
+        for (UINT32 i = 0; i < frames; i++) {
+            samples[(size_t)i * channels] = 0.5f;
+            samples[(size_t)i * channels + 1] = 0.0f;
+        }
+    }, 2, layoutStereo.mask);
+    placed = play_and_check("stereo, left only", 0) && placed;
+
+    return error < 1e-5f && placed ? 0 : -1;
+}
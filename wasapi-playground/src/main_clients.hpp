@@ -0,0 +1,35 @@
+#pragma once
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <type_traits>
+
+#include "AudioDevice.h"
+#include "AudioRenderer.h"
+#include "AudioCapturer.h"
+#include "SimulatedDevice.h"
+
+// Opens a renderer or a capturer on the device with one of its initialize methods and the arguments it takes,
+// for instance open_client(std::move(device), &AudioRenderer::initialize_low_latency, 480). Prints why and
+// returns nullptr when there is no device or it fails to initialize.
+template<typename Client, typename... Parameters, typename... Arguments>
+std::unique_ptr<Client> open_client(std::unique_ptr<AudioDevice> device, std::optional<HRESULT>(Client::* initialize)(Parameters...), Arguments&&... arguments) {
+    const char* name = std::is_same_v<Client, AudioRenderer> ? "Audio Renderer" : "Audio Capturer";
+    if (device == nullptr) {
+        std::cout << name << ": no device. Aborting" << std::endl;
+        return nullptr;
+    }
+
+    auto client = std::make_unique<Client>(std::move(device));
+    if (auto error = (client.get()->*initialize)(std::forward<Arguments>(arguments)...); error.has_value()) {
+        std::cout << name << " failed to initialize: " << std::hex << error.value() << std::dec << ". Aborting" << std::endl;
+        return nullptr;
+    }
+    return client;
+}
+
+// Same, on a simulated endpoint, which the client takes over
+template<typename Client, typename... Parameters, typename... Arguments>
+std::unique_ptr<Client> open_simulated(SimulatedDevice* endpoint, std::optional<HRESULT>(Client::* initialize)(Parameters...), Arguments&&... arguments) {
+    return open_client(std::make_unique<AudioDevice>(endpoint), initialize, std::forward<Arguments>(arguments)...);
+}
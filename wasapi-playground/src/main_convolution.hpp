@@ -0,0 +1,250 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <random>
+#include <vector>
+
+#include "DeviceEnumerator.h"
+#include "SimulatedDevice.h"
+#include "AudioRenderer.h"
+#include "EffectChain.h"
+#include "Convolver.h"
+#include "WavFile.h"
+#include "main_clients.hpp"
+
+using std::cout;
+using std::endl;
+
+// Exponentially decaying noise, a rough room: seconds long, a 60dB decay over that time, one channel of its own
+// noise per channel so that a stereo response sounds wide
+AudioRecording make_room_response(double seconds, DWORD sampleRate, WORD channels, unsigned int seed = 1) {
+    AudioRecording response;
+    response.channels = channels;
+    response.samplesPerSecond = sampleRate;
+    auto frames = (size_t)(seconds * sampleRate);
+    response.durationMs = (unsigned long)(seconds * 1000);
+    response.data.resize(frames * channels);
+
+    std::mt19937 random(seed);
+    std::normal_distribution<float> noise(0.0f, 0.05f);
+    for (size_t i = 0; i < frames; i++) {
+        auto envelope = (float)std::pow(10.0, -3.0 * i / frames);
+        for (WORD channel = 0; channel < channels; channel++)
+            response.data[i * channels + channel] = envelope * noise(random);
+    }
+    return response;
+}
+
+// Plucks through a convolution reverb on the default output, with the smallest period the endpoint supports:
+// the response is impulse_response.wav from the working directory, or a synthetic room without it.
+// Press ESC to stop.
+int main_convolution() {
+    DeviceEnumerator deviceEnumerator;
+    auto renderer = open_client(deviceEnumerator.get_default_output(), &AudioRenderer::initialize_low_latency, 0);
+    if (renderer == nullptr)
+        return -1;
+
+    auto format = renderer->get_format();
+    AudioRecording response;
+    if (auto error = read_wav_file(L"impulse_response.wav", response); error.has_value()) {
+        cout << "No impulse_response.wav, using a synthetic room" << endl;
+        response = make_room_response(2.5, format->nSamplesPerSec, 2);
+    }
+
+    auto period = renderer->get_engine_period() != 0 ? renderer->get_engine_period() : format->nSamplesPerSec / 100;
+    auto convolver = std::make_unique<Convolver>(response, period, 0.35f);
+    auto& reverb = *convolver;
+    auto chain = std::make_shared<EffectChain>();
+    chain->add(std::move(convolver));
+    renderer->set_effects(chain);
+    chain->prepare(format->nSamplesPerSec, format->nChannels);
+    cout << response.durationMs << "ms response in " << reverb.get_partitions() << " partitions of " << reverb.get_latency()
+        << " frames, for a period of " << period << " frames" << endl;
+
+    // A decaying note every half second, up a pentatonic scale
+    renderer->start([](FrameInfo frame) {
+        const double scale[] = { 261.63, 293.66, 329.63, 392.0, 440.0 };
+        auto note = (long long)(frame.time * 2);
+        auto sinceNote = frame.time - note * 0.5;
+        return 0.4 * std::exp(-sinceNote * 12) * sin(2 * 3.14159265358979 * scale[note % 5] * frame.time);
+    });
+
+    cout << "Press ESC to stop." << endl;
+    for (int step = 0; GetAsyncKeyState(VK_ESCAPE) == 0; step++) {
+        if (step % 30 == 0)
+            print_effect_chain_stats(*chain);
+        Sleep(100);
+    }
+
+    renderer->stop();
+    return 0;
+}
+
+// The convolver against the plain sum over the response, fed in blocks that never match its partitions.
+// Returns the largest difference relative to the largest output.
+float check_convolver(UINT32 blockFrames, size_t responseFrames) {
+    const WORD channels = 2;
+    const UINT32 frames = 16384;
+    const UINT32 feedFrames = 100;
+
+    AudioRecording response = make_room_response((double)responseFrames / 48000, 48000, channels, 3);
+    std::mt19937 random(5);
+    std::uniform_real_distribution<float> noise(-0.5f, 0.5f);
+    std::vector<float> input((size_t)frames * channels);
+    for (auto& sample : input)
+        sample = noise(random);
+
+    Convolver convolver(response, blockFrames);
+    convolver.prepare(48000, channels);
+    auto output = input;
+    for (UINT32 done = 0; done < frames; done += feedFrames)
+        convolver.process(output.data() + (size_t)done * channels, (std::min)(feedFrames, frames - done));
+
+    auto latency = convolver.get_latency();
+    auto responseLength = response.data.size() / channels;
+    float difference = 0, peak = 0;
+    for (UINT32 frame = latency; frame < frames; frame++) {
+        for (WORD channel = 0; channel < channels; channel++) {
+            double sum = 0;
+            for (size_t k = 0; k < responseLength && k <= frame - latency; k++)
+                sum += (double)response.data[k * channels + channel] * input[(size_t)(frame - latency - k) * channels + channel];
+            difference = (std::max)(difference, (float)std::abs(output[(size_t)frame * channels + channel] - sum));
+            peak = (std::max)(peak, (float)std::abs(sum));
+        }
+    }
+
+    return difference / peak;
+}
+
+// Cost of the convolver on a stereo stream as the response grows, for a few partition sizes, in ns per frame
+// and in share of one core at 48kHz; next to it, the plain sum over the response, which grows with its length.
+void benchmark_convolver() {
+    const DWORD sampleRate = 48000;
+    const WORD channels = 2;
+    const double lengths[] = { 0.05, 0.25, 0.5, 1.0, 2.0, 4.0 };
+    const UINT32 blockSizes[] = { 128, 256, 512, 1024 };
+    const double realtimeNsPerFrame = 1e9 / sampleRate;
+
+    std::mt19937 random(9);
+    std::uniform_real_distribution<float> noise(-0.5f, 0.5f);
+    std::vector<float> input((size_t)sampleRate * channels);
+    for (auto& sample : input)
+        sample = noise(random);
+    std::vector<float> samples(input.size());
+
+    cout << "Stereo, ns/frame (share of one core)" << endl << "  response ";
+    for (auto blockFrames : blockSizes)
+        cout << std::setw(12) << blockFrames << " frames" << std::setw(4) << "";
+    cout << std::setw(20) << "direct" << endl;
+
+    for (auto seconds : lengths) {
+        auto response = make_room_response(seconds, sampleRate, channels);
+        cout << "  " << std::setw(6) << (int)(seconds * 1000) << "ms ";
+
+        for (auto blockFrames : blockSizes) {
+            Convolver convolver(response, blockFrames);
+            convolver.prepare(sampleRate, channels);
+            samples = input;
+
+            // Whole periods, as a render thread would call it
+            auto start = std::chrono::steady_clock::now();
+            auto frames = (UINT32)(input.size() / channels);
+            for (UINT32 done = 0; done + blockFrames <= frames; done += blockFrames)
+                convolver.process(samples.data() + (size_t)done * channels, blockFrames);
+            auto ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / frames;
+            cout << std::fixed << std::setprecision(1) << std::setw(10) << ns << " (" << std::setw(5) << 100 * ns / realtimeNsPerFrame << "%)";
+        }
+
+        // The plain sum, timed on a few frames: it is too slow for more
+        auto responseFrames = response.data.size() / channels;
+        const size_t directFrames = 256;
+        std::vector<float> history(responseFrames * channels + directFrames * channels);
+        volatile float sink = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t frame = 0; frame < directFrames; frame++) {
+            for (WORD channel = 0; channel < channels; channel++) {
+                float sum = 0;
+                for (size_t k = 0; k < responseFrames; k++)
+                    sum += response.data[k * channels + channel] * history[(frame + responseFrames - k) * channels + channel];
+                sink = sum;
+            }
+        }
+        auto ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / directFrames;
+        cout << std::setw(12) << ns << " (" << std::setw(5) << 100 * ns / realtimeNsPerFrame << "%)" << endl;
+    }
+    cout.unsetf(std::ios::fixed);
+}
+
+// Checks the convolver against the plain sum, times it against the response length, then plays an impulse on
+// a simulated endpoint through a response read back from a WAV file: an echo 100 frames into the response
+// must be heard exactly one partition plus 100 frames after the impulse.
+int main_simulated_convolution() {
+    float error = 0;
+    const UINT32 checkedBlocks[] = { 64, 256 };
+    for (auto blockFrames : checkedBlocks) {
+        auto relative = check_convolver(blockFrames, 3000);
+        error = (std::max)(error, relative);
+        cout << "Partitions of " << blockFrames << " frames against the plain sum: largest difference " << relative << " of the peak" << endl;
+    }
+    cout << endl;
+    benchmark_convolver();
+    cout << endl;
+
+    const std::wstring path = L"simulated_response.wav";
+    const UINT32 echoFrame = 100;
+    AudioRecording written;
+    written.channels = 1;
+    written.samplesPerSecond = 48000;
+    written.data.resize(4800);
+    written.data[echoFrame] = 1.0f;
+    AudioRecording response;
+    if (!write_wav_file(path, written) || read_wav_file(path, response).has_value()) {
+        cout << "Unable to write and read back the impulse response" << endl;
+        return -1;
+    }
+    std::filesystem::remove(path);
+
+    SimulatedEndpointConfig config;
+    config.friendlyName = "Simulated speakers";
+    auto endpoint = new SimulatedDevice(config);
+
+    // Render thread only, read once the stream is stopped. Reserved, so the sink never allocates on the audio thread.
+    std::vector<UINT64> hits;
+    hits.reserve(2);
+    endpoint->set_render_sink([&hits](const float* buffer, UINT32 frames, WORD channels, UINT64 position, UINT64) {
+        for (UINT32 i = 0; i < frames && hits.size() < 2; i++) {
+            if (std::abs(buffer[(size_t)i * channels + 1]) > 0.1f)
+                hits.push_back(position + i);
+        }
+    });
+
+    auto renderer = open_simulated(endpoint, &AudioRenderer::initialize_low_latency, 0);
+    if (renderer == nullptr)
+        return -1;
+
+    // An impulse on the right channel only, the response is all wet
+    auto convolver = std::make_unique<Convolver>(response, renderer->get_engine_period());
+    auto latency = convolver->get_latency();
+    auto chain = std::make_shared<EffectChain>();
+    chain->add(std::move(convolver));
+    renderer->set_effects(chain);
+
+    UINT64 renderedFrames = 0;
+    renderer->start_interleaved([&renderedFrames](float* samples, UINT32 frames, WORD channels) {
+        for (UINT32 i = 0; i < frames; i++, renderedFrames++) {
+            for (WORD channel = 0; channel < channels; channel++)
+                samples[(size_t)i * channels + channel] = channel != 0 && renderedFrames == 0 ? 1.0f : 0.0f;
+        }
+    });
+    Sleep(300);
+    renderer->stop();
+
+    bool placed = hits.size() == 1 && hits[0] == latency + echoFrame;
+    cout << "Period of " << renderer->get_engine_period() << " frames, partitions of " << latency << ": echo at frame "
+        << (hits.empty() ? 0 : hits[0]) << ", expected " << latency + echoFrame << (placed ? "" : ", WRONG") << endl;
+    print_effect_chain_stats(*chain);
+
+    return error < 1e-4f && placed ? 0 : -1;
+}
@@ -0,0 +1,237 @@
+#include <iostream>
+#include <iomanip>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <thread>
+#include <vector>
+
+#include "DeviceEnumerator.h"
+#include "SimulatedDevice.h"
+#include "AudioRenderer.h"
+#include "AudioGraph.h"
+#include "Convolver.h"
+#include "WavFile.h"
+#include "main_clients.hpp"
+
+using std::cout;
+using std::endl;
+
+void print_audio_graph_stats(AudioGraph& graph) {
+    auto stats = graph.get_stats();
+    for (const auto& node : stats.nodes) {
+        cout << "  node " << node.id << " " << node.name << ": " << node.nsPerFrame << "ns/frame, slowest block "
+            << node.maxBlockMs << "ms" << endl;
+    }
+    cout << "  " << stats.periods << " periods, " << stats.nsPerFrame << "ns/frame, parallelism " << stats.parallelism
+        << ", " << stats.swaps << " schedules swapped in, " << stats.pool.steals << " tasks stolen, per lane:";
+    for (auto tasks : stats.pool.tasks)
+        cout << " " << tasks;
+    cout << endl;
+}
+
+// A sine source, its own filter, chorus and reverb, on its way to the mix: one branch of the graph
+UINT64 add_voice_branch(AudioGraph& graph, UINT64 mix, double frequency, DWORD sampleRate) {
+    auto source = graph.add_node(std::make_shared<SourceNode>(2, [phase = 0.0, step = 2 * 3.14159265358979 * frequency / sampleRate](float* samples, UINT32 frames, WORD channels) mutable {
+        for (UINT32 i = 0; i < frames; i++) {
+            auto value = 0.15f * (float)(std::sin(phase) + 0.3 * std::sin(3 * phase));
+            for (WORD channel = 0; channel < channels; channel++)
+                samples[(size_t)i * channels + channel] = value;
+            phase += step;
+        }
+        phase = std::fmod(phase, 2 * 3.14159265358979);
+    }, "sine"));
+
+    auto chain = std::make_shared<EffectChain>();
+    chain->add(std::make_unique<StateVariableFilter>(SvfMode::LowPass, (float)frequency * 4, 2.0f));
+    chain->add(std::make_unique<Chorus>(0.5f + (float)frequency / 1000));
+    chain->add(std::make_unique<Reverb>(1.5f, 0.4f, 0.3f));
+    auto effects = graph.add_node(std::make_shared<EffectNode>(2, chain, "voice effects"));
+
+    graph.connect(source, effects);
+    graph.connect(effects, mix);
+    return source;
+}
+
+// Four voices in parallel branches on the default output, then a fifth one added while the graph plays.
+// Press ESC to stop.
+int main_audio_graph() {
+    DeviceEnumerator deviceEnumerator;
+    auto renderer = open_client(deviceEnumerator.get_default_output(), &AudioRenderer::initialize, 16);
+    if (renderer == nullptr)
+        return -1;
+
+    AudioGraphConfig config;
+    config.sampleRate = renderer->get_format()->nSamplesPerSec;
+    AudioGraph graph(config);
+
+    auto mix = graph.add_node(std::make_shared<MixNode>(2, 0.7f));
+    graph.set_output(mix);
+    const double chord[] = { 220.0, 277.18, 329.63, 415.3 };
+    for (auto frequency : chord)
+        add_voice_branch(graph, mix, frequency, config.sampleRate);
+    if (auto error = graph.commit(); error.has_value()) {
+        cout << "Unable to compile the graph" << endl;
+        return -1;
+    }
+
+    renderer->start_interleaved([&graph](float* samples, UINT32 frames, WORD channels) { graph.render(samples, frames, channels); },
+        graph.get_output_channels(), SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT);
+    cout << "Running on " << WorkStealingPool::default_workers() + 1 << " threads. Press ESC to stop." << endl;
+
+    for (int step = 0; GetAsyncKeyState(VK_ESCAPE) == 0; step++) {
+        if (step == 30) {
+            add_voice_branch(graph, mix, 554.37, config.sampleRate);
+            graph.commit();
+        }
+        if (step % 30 == 0)
+            print_audio_graph_stats(graph);
+        Sleep(100);
+    }
+
+    renderer->stop();
+    return 0;
+}
+
+// Branches heavy enough to be worth spreading: a source into a convolution reverb, all summed
+void build_convolution_graph(AudioGraph& graph, int branches, DWORD sampleRate) {
+    auto mix = graph.add_node(std::make_shared<MixNode>(2, 1.0f / branches));
+    graph.set_output(mix);
+
+    for (int branch = 0; branch < branches; branch++) {
+        auto frequency = 110.0 * (branch + 1);
+        auto source = graph.add_node(std::make_shared<SourceNode>(2, [phase = 0.0, step = 2 * 3.14159265358979 * frequency / sampleRate](float* samples, UINT32 frames, WORD channels) mutable {
+            for (UINT32 i = 0; i < frames; i++, phase += step) {
+                for (WORD channel = 0; channel < channels; channel++)
+                    samples[(size_t)i * channels + channel] = 0.5f * (float)std::sin(phase + channel);
+            }
+        }, "sine"));
+
+        AudioRecording response;
+        response.channels = 1;
+        response.samplesPerSecond = sampleRate;
+        response.data.resize(sampleRate / 2);
+        for (size_t i = 0; i < response.data.size(); i++)
+            response.data[i] = (float)(std::exp(-6.0 * i / response.data.size()) * std::sin(i * 0.37 * (branch + 1)) * 0.05);
+
+        auto chain = std::make_shared<EffectChain>();
+        chain->add(std::make_unique<Convolver>(response, 256));
+        auto effects = graph.add_node(std::make_shared<EffectNode>(2, chain, "convolver"));
+        graph.connect(source, effects);
+        graph.connect(effects, mix);
+    }
+    graph.commit();
+}
+
+// Renders the same graph offline on one thread and on the pool: the output must be identical, only faster
+// where there are cores. Then a simulated endpoint plays a graph whose branches are added and removed while it
+// runs: every period must come from a whole schedule, never from silence or a half-built one.
+int main_simulated_audio_graph() {
+    const DWORD sampleRate = 48000;
+    const UINT64 offlineFrames = 5 * sampleRate;
+    const int branches = 8;
+
+    // Cycles are refused
+    {
+        AudioGraph graph;
+        auto a = graph.add_node(std::make_shared<MixNode>(1));
+        auto b = graph.add_node(std::make_shared<MixNode>(1));
+        auto c = graph.add_node(std::make_shared<MixNode>(1));
+        bool refused = graph.connect(a, b) && graph.connect(b, c) && !graph.connect(c, a) && !graph.connect(b, b);
+        cout << "Cycle " << (refused ? "refused" : "ACCEPTED") << endl;
+        if (!refused)
+            return -1;
+    }
+
+    auto render_timed = [&](unsigned int workers, AudioRecording& recording) {
+        AudioGraphConfig config;
+        config.sampleRate = sampleRate;
+        config.workers = workers;
+        AudioGraph graph(config);
+        build_convolution_graph(graph, branches, sampleRate);
+
+        auto start = std::chrono::steady_clock::now();
+        recording = graph.render_offline(offlineFrames, 480);
+        auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        cout << "  " << workers + 1 << " thread(s): " << seconds << "s for " << offlineFrames / sampleRate << "s of audio, "
+            << (double)offlineFrames / sampleRate / seconds << "x realtime" << endl;
+        print_audio_graph_stats(graph);
+        return seconds;
+    };
+
+    cout << "Offline, " << branches << " convolution branches:" << endl;
+    AudioRecording serial, parallel;
+    auto serialSeconds = render_timed(0, serial);
+    auto parallelSeconds = render_timed((std::max)(WorkStealingPool::default_workers(), 1u), parallel);
+    bool identical = serial.data == parallel.data;
+    cout << "  speedup " << serialSeconds / parallelSeconds << ", outputs " << (identical ? "identical" : "DIFFERENT") << endl;
+
+    const std::wstring path = L"graph_offline.wav";
+    bool written = write_wav_file(path, parallel);
+    std::filesystem::remove(path);
+
+    // Every branch adds 0.125 of DC: a period holds a whole multiple of it, the same on every frame
+    SimulatedEndpointConfig endpointConfig;
+    endpointConfig.friendlyName = "Simulated speakers";
+    auto endpoint = new SimulatedDevice(endpointConfig);
+
+    // Sink thread only, read once the stream is stopped
+    UINT64 badPeriods = 0, periods = 0, silentPeriods = 0;
+    endpoint->set_render_sink([&](const float* buffer, UINT32 frames, WORD channels, UINT64, UINT64) {
+        if (frames == 0)
+            return;
+        periods++;
+        auto level = buffer[0];
+        auto steps = level / 0.125f;
+        bool whole = std::abs(steps - std::round(steps)) < 1e-4f;
+        for (size_t i = 0; i < (size_t)frames * channels && whole; i++)
+            whole = buffer[i] == level;
+        badPeriods += whole ? 0 : 1;
+        silentPeriods += level == 0 ? 1 : 0;
+    });
+
+    auto renderer = open_simulated(endpoint, &AudioRenderer::initialize, 16);
+    if (renderer == nullptr)
+        return -1;
+
+    AudioGraphConfig config;
+    config.sampleRate = sampleRate;
+    AudioGraph graph(config);
+    auto mix = graph.add_node(std::make_shared<MixNode>(2));
+    graph.set_output(mix);
+    auto add_dc_branch = [&]() {
+        auto source = graph.add_node(std::make_shared<SourceNode>(1, [](float* samples, UINT32 frames, WORD) {
+            std::fill(samples, samples + frames, 0.125f);
+        }, "dc"));
+        auto pass = graph.add_node(std::make_shared<MixNode>(2, 1.0f, "pass"));
+        graph.connect(source, pass);
+        graph.connect(pass, mix);
+        return source;
+    };
+    std::vector<UINT64> sources{ add_dc_branch() };
+    graph.commit();
+
+    renderer->start_interleaved([&graph](float* samples, UINT32 frames, WORD channels) { graph.render(samples, frames, channels); }, 2);
+
+    int commits = 1;
+    for (int edit = 0; edit < 60; edit++, commits++) {
+        if (sources.size() < 6 && (edit % 3 != 2 || sources.size() == 1))
+            sources.push_back(add_dc_branch());
+        else {
+            graph.remove_node(sources.back());
+            sources.pop_back();
+        }
+        graph.commit();
+        Sleep(7);
+    }
+    Sleep(100);
+    renderer->stop();
+
+    auto stats = graph.get_stats();
+    cout << endl << "Live edits: " << commits << " commits, " << stats.swaps << " swapped in, " << periods << " periods played, "
+        << badPeriods << " mixed up, " << silentPeriods << " silent" << endl;
+
+    bool live = badPeriods == 0 && silentPeriods == 0 && stats.swaps > 1;
+    return identical && written && live ? 0 : -1;
+}
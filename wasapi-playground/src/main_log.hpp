@@ -1,4 +1,10 @@
+#include <iostream>
+#include <fstream>
+#include <iterator>
+
 #include "DeviceEnumerator.h"
+#include "DeviceProfile.h"
+#include "AudioRenderer.h"
 #include "common.h"
 #include "log.h"
 
@@ -7,11 +13,50 @@ int main_log() {
 	auto devices = enumerator.get_all_devices_summary();
 	
 	for (const auto& deviceInfo : devices.inputDevices) {
-		log_device_details(enumerator.get_device_by_id(deviceInfo.id)->get_info());
+		log_device_details(enumerator.get_device_by_handle(deviceInfo.handle)->get_info());
 	}
 
 	for (const auto& deviceInfo : devices.outputDevices)
-		log_device_details(enumerator.get_device_by_id(deviceInfo.id)->get_info());
+		log_device_details(enumerator.get_device_by_handle(deviceInfo.handle)->get_info());
+
+	return 0;
+}
+
+// Writes the details of every endpoint to devices.json, then loads the file back and opens each output
+// profile as a simulated endpoint, the way a profile captured on another machine would be replayed
+int main_device_profiles() {
+	DeviceEnumerator enumerator;
+	auto devices = enumerator.get_all_devices_summary();
+
+	std::vector<AudioDeviceDetails> details;
+	for (const auto& deviceInfo : devices.inputDevices)
+		details.push_back(enumerator.get_device_by_handle(deviceInfo.handle)->get_info());
+	for (const auto& deviceInfo : devices.outputDevices)
+		details.push_back(enumerator.get_device_by_handle(deviceInfo.handle)->get_info());
+
+	std::string text;
+	write_device_profiles(details, text);
+	std::ofstream("devices.json", std::ios::binary) << text;
+	std::cout << "Wrote " << details.size() << " device profiles (" << text.size() << " bytes) to devices.json" << std::endl;
+
+	std::ifstream file("devices.json", std::ios::binary);
+	std::string saved((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	auto profiles = read_device_profiles(saved);
+	if (!profiles.has_value()) {
+		std::cout << "devices.json could not be parsed" << std::endl;
+		return -1;
+	}
+
+	for (const auto& profile : profiles.value()) {
+		auto config = make_simulated_config(profile);
+		if (config.direction != EDataFlow::eRender)
+			continue;
+
+		AudioRenderer audioRenderer(std::make_unique<AudioDevice>(new SimulatedDevice(config)));
+		auto error = audioRenderer.initialize_low_latency();
+		std::cout << "Simulated " << config.friendlyName << ": " << config.mixFormat.Format.nSamplesPerSec << "Hz, "
+			<< (error.has_value() ? "failed to initialize" : "engine period " + std::to_string(audioRenderer.get_engine_period()) + " frames") << std::endl;
+	}
 
 	return 0;
-}
\ No newline at end of file
+}
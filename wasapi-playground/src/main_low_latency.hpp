@@ -0,0 +1,268 @@
+#include <iostream>
+#include <atomic>
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <optional>
+
+#include "SimulatedDevice.h"
+#include "AudioRenderer.h"
+#include "main_clients.hpp"
+
+using std::cout;
+using std::endl;
+
+// Plays one second on a simulated endpoint initialized in low-latency mode, and reports the engine period it got
+void play_low_latency(SimulatedDevice* endpoint) {
+    std::atomic<UINT64> playedFrames = 0;
+    endpoint->set_render_sink([&playedFrames](const float* _, UINT32 frames, WORD __, UINT64, UINT64) { playedFrames += frames; });
+
+    const auto& config = endpoint->get_config();
+    auto audioRenderer = open_simulated(endpoint, &AudioRenderer::initialize_low_latency, 0);
+    if (audioRenderer == nullptr)
+        return;
+
+    auto period = audioRenderer->get_engine_period();
+    cout << config.friendlyName << ": engine period " << period << " frames ("
+        << 1000.0 * period / config.mixFormat.Format.nSamplesPerSec << "ms), default " << config.defaultPeriodInFrames << endl;
+
+    audioRenderer->start([](FrameInfo frame) {
+        return sin(440.0 * 2 * 3.14159265358979 * frame.time);
+    });
+
+    Sleep(1000);
+    audioRenderer->stop();
+
+    cout << "Played " << playedFrames << " frames in one second" << endl;
+}
+
+// Low-latency initialization against simulated engines: a free one, and one locked at a larger period by another stream
+int main_simulated_low_latency() {
+    SimulatedEndpointConfig config;
+    config.friendlyName = "Simulated low-latency speakers";
+    play_low_latency(new SimulatedDevice(config));
+
+    config.friendlyName = "Simulated speakers, engine locked by another stream";
+    auto lockedEndpoint = new SimulatedDevice(config);
+    lockedEndpoint->lock_engine_period(240);
+    play_low_latency(lockedEndpoint);
+
+    return 0;
+}
+
+// Exclusive mode on a simulated endpoint that only takes 24-bit PCM at 44.1kHz: the 10ms buffer (441 frames)
+// is not aligned to 128 bytes, so initialization is retried with the size the endpoint reports.
+// Half a second in, the callback stalls for 35ms, longer than the two queued buffers last: that underrun is
+// counted, and the stream recovers without a failed GetBuffer(). A loaded machine can add a few more.
+int main_simulated_exclusive() {
+    SimulatedEndpointConfig config;
+    config.friendlyName = "Simulated exclusive-only DAC";
+    config.mixFormat = make_float_format(44100, 2);
+    config.exclusiveFormats = { StreamFormat{ 44100, 2, 32, 24, false } };
+
+    std::atomic<UINT64> playedFrames = 0;
+    std::atomic<float> peak = 0;
+    auto endpoint = new SimulatedDevice(config);
+    endpoint->set_render_sink([&](const float* buffer, UINT32 frames, WORD channels, UINT64, UINT64) {
+        for (size_t i = 0; i < (size_t)frames * channels; i++)
+            peak = (std::max)(peak.load(), std::abs(buffer[i]));
+        playedFrames += frames;
+    });
+
+    auto audioRenderer = open_simulated(endpoint, &AudioRenderer::initialize_exclusive, 10);
+    if (audioRenderer == nullptr)
+        return -1;
+
+    cout << config.friendlyName << ": exclusive buffer of " << audioRenderer->get_engine_period() << " frames" << endl;
+
+    audioRenderer->start([](FrameInfo frame) {
+        if (frame.ordinalNumber == 22050)
+            std::this_thread::sleep_for(std::chrono::milliseconds(35));
+        return 0.5 * sin(440.0 * 2 * 3.14159265358979 * frame.time);
+    });
+
+    Sleep(1000);
+    audioRenderer->stop();
+
+    const auto& metrics = audioRenderer->get_metrics();
+    cout << "Played " << playedFrames << " frames in one second, peak " << peak << " (expected 0.5)" << endl;
+    cout << "Underruns: " << metrics.underruns << " (expected at least 1), errors: " << metrics.errors << endl;
+    return metrics.underruns >= 1 && metrics.errors == 0 ? 0 : -1;
+}
+
+// Start-to-first-frame benchmark: starts and stops a low-latency stream on a simulated endpoint 20 times, and
+// measures how long after start() is called the first frame of the callback would be heard. That is the time
+// until the packet holding it is released, plus the time to play whatever was queued before it.
+int main_simulated_start_latency() {
+    SimulatedEndpointConfig config;
+    config.friendlyName = "Simulated speakers";
+    auto endpoint = new SimulatedDevice(config);
+    const auto rate = config.mixFormat.Format.nSamplesPerSec;
+
+    std::mutex sinkMutex;
+    bool waitingFirstFrame = false;
+    UINT64 framesBefore = 0;
+    std::chrono::steady_clock::time_point firstFrameReleased;
+
+    endpoint->set_render_sink([&](const float* buffer, UINT32 frames, WORD channels, UINT64, UINT64) {
+        std::lock_guard lock(sinkMutex);
+        if (!waitingFirstFrame)
+            return;
+
+        for (UINT32 i = 0; i < frames; i++) {
+            if (buffer[(size_t)i * channels] != 0) {
+                firstFrameReleased = std::chrono::steady_clock::now();
+                framesBefore += i;
+                waitingFirstFrame = false;
+                return;
+            }
+        }
+        framesBefore += frames;
+    });
+
+    auto audioRenderer = open_simulated(endpoint, &AudioRenderer::initialize_low_latency, 0);
+    if (audioRenderer == nullptr)
+        return -1;
+
+    std::vector<double> latencies;
+    std::vector<double> startCalls;
+    for (int cycle = 0; cycle < 20; cycle++) {
+        {
+            std::lock_guard lock(sinkMutex);
+            waitingFirstFrame = true;
+            framesBefore = 0;
+        }
+
+        auto startTime = std::chrono::steady_clock::now();
+        audioRenderer->start([](FrameInfo frame) {
+            return 0.5 * cos(440.0 * 2 * 3.14159265358979 * frame.time);
+        });
+        startCalls.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count());
+
+        Sleep(100);
+        audioRenderer->stop();
+
+        std::lock_guard lock(sinkMutex);
+        if (!waitingFirstFrame) {
+            auto released = std::chrono::duration<double, std::milli>(firstFrameReleased - startTime).count();
+            latencies.push_back(released + 1000.0 * framesBefore / rate);
+        }
+    }
+
+    if (latencies.empty()) {
+        cout << "No frame reached the endpoint" << endl;
+        return -1;
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    std::sort(startCalls.begin(), startCalls.end());
+    auto bufferMs = 1000.0 * audioRenderer->get_metrics().bufferFrames / rate;
+
+    cout << "Start-to-first-frame over " << latencies.size() << " starts: min " << latencies.front() << "ms, median "
+        << latencies[latencies.size() / 2] << "ms, max " << latencies.back() << "ms" << endl;
+    cout << "start() call: median " << startCalls[startCalls.size() / 2] << "ms, max " << startCalls.back() << "ms" << endl;
+    cout << "A silent pre-roll would add " << bufferMs << "ms (one endpoint buffer)" << endl;
+    return 0;
+}
+
+// Plays two seconds of a generator that blocks for 30ms every 200ms, as on a page fault or a contended lock, on a
+// simulated endpoint running 10ms periods. Returns the underruns of the stream.
+std::optional<UINT64> play_stalling_generator(SimulatedDevice* endpoint, unsigned int renderAheadPeriods) {
+    auto audioRenderer = open_simulated(endpoint, &AudioRenderer::initialize_low_latency, 480);
+    if (audioRenderer == nullptr)
+        return std::nullopt;
+
+    audioRenderer->set_render_ahead(renderAheadPeriods);
+    const long stallInterval = endpoint->get_config().mixFormat.Format.nSamplesPerSec / 5;
+
+    // The stall sleeps instead of spinning, so that it is the same on any number of cores: the render thread is
+    // free to run meanwhile, only the callback is late
+    audioRenderer->start([stallInterval](FrameInfo frame) {
+        if (frame.ordinalNumber > 0 && frame.ordinalNumber % stallInterval == 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(30));
+        return 0.5 * sin(440.0 * 2 * 3.14159265358979 * frame.time);
+    });
+
+    Sleep(2000);
+    audioRenderer->stop();
+
+    const auto& metrics = audioRenderer->get_metrics();
+    cout << "  period " << audioRenderer->get_engine_period() << " frames, underruns " << metrics.underruns
+        << ", slowest render callback " << metrics.maxCallbackNs / 1e6 << "ms" << endl;
+
+    if (renderAheadPeriods > 0) {
+        auto stats = audioRenderer->get_render_ahead_stats();
+        cout << "  lookahead " << stats.targetFrames << " frames, lowest depth " << stats.minDepthFrames
+            << ", starved frames " << stats.starvedFrames << ", slowest block " << stats.maxBlockMs << "ms" << endl;
+    }
+    return metrics.underruns.load();
+}
+
+// Render-ahead against stalls: the same generator rendered on the render thread, which misses the endpoint
+// deadline at each of its 9 stalls, then 8 periods (80ms) ahead on a worker thread, which absorbs them.
+// Fails unless render-ahead removes at least three quarters of the underruns.
+int main_simulated_render_ahead() {
+    SimulatedEndpointConfig config;
+    config.friendlyName = "Simulated low-latency speakers";
+
+    cout << "Rendering on the render thread:" << endl;
+    auto direct = play_stalling_generator(new SimulatedDevice(config), 0);
+
+    cout << "Rendering 8 periods ahead:" << endl;
+    auto ahead = play_stalling_generator(new SimulatedDevice(config), 8);
+
+    if (!direct.has_value() || !ahead.has_value())
+        return -1;
+
+    bool absorbed = direct.value() >= 5 && ahead.value() * 4 <= direct.value();
+    cout << "Underruns: " << direct.value() << " on the render thread, " << ahead.value() << " rendering ahead"
+        << (absorbed ? "" : ", WRONG") << endl;
+    return absorbed ? 0 : -1;
+}
+
+// Plays two seconds of a generator that needs 1.2x real time between 0.5s and 1.5s, or half that per quality tier
+void play_overloaded_generator(SimulatedDevice* endpoint, DegradationPolicy policy, const char* policyName) {
+    auto audioRenderer = open_simulated(endpoint, &AudioRenderer::initialize_low_latency, 0);
+    if (audioRenderer == nullptr)
+        return;
+
+    std::atomic<unsigned int> qualityTier = 0;
+    WatchdogConfig watchdog;
+    watchdog.policy = policy;
+    watchdog.onQualityTier = [&qualityTier](unsigned int tier) { qualityTier = tier; };
+    audioRenderer->set_watchdog(watchdog);
+
+    const double samplePeriodNs = 1e9 / endpoint->get_config().mixFormat.Format.nSamplesPerSec;
+    audioRenderer->start([&qualityTier, samplePeriodNs](FrameInfo frame) {
+        if (frame.time > 0.5 && frame.time < 1.5) {
+            auto costNs = (long long)(1.2 * samplePeriodNs) >> qualityTier.load();
+            auto sampleEnd = std::chrono::steady_clock::now() + std::chrono::nanoseconds(costNs);
+            while (std::chrono::steady_clock::now() < sampleEnd);
+        }
+        return 0.5 * sin(440.0 * 2 * 3.14159265358979 * frame.time);
+    });
+
+    Sleep(2000);
+    audioRenderer->stop();
+
+    auto stats = audioRenderer->get_watchdog_stats();
+    cout << policyName << ": " << stats.deadlineMisses << " missed deadlines over " << stats.periods << " periods, "
+        << stats.degradations << " degradations, " << stats.recoveries << " recoveries, " << stats.substitutedPeriods
+        << " substituted periods, underruns " << audioRenderer->get_metrics().underruns << ", worst load " << stats.worstLoad << endl;
+}
+
+// Callback watchdog: the same overloaded generator under each degradation policy
+int main_simulated_watchdog() {
+    SimulatedEndpointConfig config;
+    config.friendlyName = "Simulated low-latency speakers";
+
+    play_overloaded_generator(new SimulatedDevice(config), DegradationPolicy::None, "None");
+    play_overloaded_generator(new SimulatedDevice(config), DegradationPolicy::RepeatLastBlock, "Repeat last block");
+    play_overloaded_generator(new SimulatedDevice(config), DegradationPolicy::Crossfade, "Crossfade");
+    play_overloaded_generator(new SimulatedDevice(config), DegradationPolicy::Silence, "Silence");
+    play_overloaded_generator(new SimulatedDevice(config), DegradationPolicy::DropQuality, "Drop quality");
+    return 0;
+}
@@ -0,0 +1,61 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cmath>
+
+#include "SimulatedDevice.h"
+#include "AudioRenderer.h"
+#include "AudioCapturer.h"
+#include "StreamMetrics.h"
+
+using std::cout;
+using std::endl;
+
+// Runs a render and a capture stream on simulated endpoints while an exporter writes their metrics to
+// metrics.prom every 500ms, in the format read by the Prometheus node_exporter textfile collector
+int main_simulated_metrics() {
+    SimulatedEndpointConfig renderConfig;
+    renderConfig.friendlyName = "Simulated speakers";
+
+    SimulatedEndpointConfig captureConfig;
+    captureConfig.id = L"{0.0.1.00000000}.{simulated}";
+    captureConfig.friendlyName = "Simulated microphone";
+    captureConfig.direction = EDataFlow::eCapture;
+
+    AudioRenderer audioRenderer(std::make_unique<AudioDevice>(new SimulatedDevice(renderConfig)));
+    AudioCapturer audioCapturer(std::make_unique<AudioDevice>(new SimulatedDevice(captureConfig)));
+    if (audioRenderer.initialize_low_latency().has_value() || audioCapturer.initialize(10).has_value()) {
+        cout << "Failed to initialize the simulated streams" << endl;
+        return -1;
+    }
+
+    MetricsExporter exporter("metrics.prom", MetricsFormat::Prometheus, 500);
+
+    audioRenderer.start([](FrameInfo frame) {
+        return sin(440.0 * 2 * 3.14159265358979 * frame.time);
+    });
+    audioCapturer.start_streaming([](BYTE* _, UINT32 __) {});
+
+    Sleep(2000);
+    audioRenderer.stop();
+    audioCapturer.stop();
+    exporter.export_now();
+
+    std::ifstream file("metrics.prom");
+    std::stringstream text;
+    text << file.rdbuf();
+    cout << text.str();
+
+    // A device with every character label values escape, and a tab, which they can not hold, but JSON can
+    MetricsSnapshot oddDevice = MetricsSnapshot();
+    oddDevice.streams.push_back(StreamSnapshot());
+    oddDevice.streams.back().device = "a\"b\\c\nd\te";
+    std::string prometheus, json;
+    format_metrics(oddDevice, MetricsFormat::Prometheus, prometheus);
+    format_metrics(oddDevice, MetricsFormat::Json, json);
+
+    bool escaped = prometheus.find("device=\"a\\\"b\\\\c\\nde\"") != std::string::npos
+        && json.find("\"device\":\"a\\\"b\\\\c\\u000ad\\u0009e\"") != std::string::npos;
+    cout << "Device names " << (escaped ? "escaped" : "NOT escaped") << endl;
+    return escaped ? 0 : -1;
+}
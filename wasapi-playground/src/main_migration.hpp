@@ -0,0 +1,118 @@
+#include <iostream>
+#include <future>
+#include <cmath>
+
+#include "Synthesizer.h"
+#include "DeviceEnumerator.h"
+#include "DeviceNotificationProvider.h"
+#include "SimulatedDevice.h"
+#include "AudioRenderer.h"
+#include "main_clients.hpp"
+
+using std::cout;
+using std::endl;
+
+void log_migration_stats(const MigrationStats& stats) {
+    cout << "Migrations: " << stats.migrations << " (failed attempts: " << stats.failedAttempts << ")" << endl;
+    cout << "Last gap: " << stats.lastGapMs << "ms, worst gap: " << stats.maxGapMs << "ms" << endl;
+}
+
+// Plays the synthesizer on the default output, and keeps playing when the default device changes or is unplugged
+int main_follow_default() {
+    DeviceEnumerator deviceEnumerator;
+    DeviceNotificationProvider notifications;
+
+    auto defaultDevice = deviceEnumerator.get_default_output();
+    if (defaultDevice == nullptr) {
+        cout << "No default output device" << endl;
+        return -1;
+    }
+
+    auto audioRenderer = open_client(std::move(defaultDevice), &AudioRenderer::initialize, bufferSizeLenghtMs);
+    if (audioRenderer == nullptr)
+        return -1;
+
+    audioRenderer->follow_default_device([&deviceEnumerator]() {
+        return deviceEnumerator.get_default_output();
+    });
+
+    notifications.subscribe_to_default_device_changes([&audioRenderer](EDataFlow flow, ERole role, DeviceHandle device) {
+        if (flow == EDataFlow::eRender && role == ERole::eMultimedia && device != INVALID_DEVICE_HANDLE) {
+            cout << "Default output changed to " << DeviceIdTable::instance().get_id(device) << endl;
+            audioRenderer->migrate_to_default_device();
+        }
+    });
+
+    Synthesizer synth;
+    audioRenderer->start(std::bind(&Synthesizer::sine_from_keystrokes, &synth, std::placeholders::_1));
+
+    cout << "- Press these keys to play audio: Z S X C F V G B N J M K , . /" << endl;
+    cout << "- Change the default output device, or unplug it, to see the stream follow it" << endl;
+    cout << "- Press ESC to quit." << endl;
+
+    while (GetAsyncKeyState(VK_ESCAPE) == 0)
+        Sleep(30);
+
+    audioRenderer->stop();
+    log_migration_stats(audioRenderer->get_migration_stats());
+    return 0;
+}
+
+// Same as main_follow_default(), on simulated endpoints: the first one is removed while playing
+int main_simulated_migration() {
+    SimulatedEndpointConfig firstConfig;
+    firstConfig.id = L"{0.0.0.00000000}.{simulated-first}";
+    firstConfig.friendlyName = "Simulated speakers";
+
+    SimulatedEndpointConfig secondConfig;
+    secondConfig.id = L"{0.0.0.00000000}.{simulated-second}";
+    secondConfig.friendlyName = "Simulated headphones";
+    secondConfig.mixFormat = make_float_format(44100, 2);
+
+    std::atomic<UINT64> firstFrames = 0;
+    std::atomic<UINT64> secondFrames = 0;
+
+    auto firstEndpoint = new SimulatedDevice(firstConfig);
+    firstEndpoint->set_render_sink([&firstFrames](const float* _, UINT32 frames, WORD __, UINT64, UINT64) { firstFrames += frames; });
+
+    // AudioDevice takes ownership of one reference, the other one is used to inject the removal
+    firstEndpoint->AddRef();
+    auto audioRenderer = open_simulated(firstEndpoint, &AudioRenderer::initialize, bufferSizeLenghtMs);
+    if (audioRenderer == nullptr) {
+        firstEndpoint->Release();
+        return -1;
+    }
+
+    // The replacement shows up a while after the removal: the first attempts find no endpoint and are retried
+    std::atomic<int> lookups = 0;
+    audioRenderer->follow_default_device([&secondConfig, &secondFrames, &lookups]() -> std::unique_ptr<AudioDevice> {
+        if (++lookups <= 2)
+            return nullptr;
+
+        auto secondEndpoint = new SimulatedDevice(secondConfig);
+        secondEndpoint->set_render_sink([&secondFrames](const float* _, UINT32 frames, WORD __, UINT64, UINT64) { secondFrames += frames; });
+        return std::make_unique<AudioDevice>(secondEndpoint);
+    });
+
+    audioRenderer->start([](FrameInfo frame) {
+        return sin(440.0 * 2 * 3.14159265358979 * frame.time);
+    });
+
+    Sleep(1000);
+    cout << "Removing " << firstConfig.friendlyName << " after " << firstFrames << " frames" << endl;
+    firstEndpoint->simulate_removal();
+
+    Sleep(1000);
+    audioRenderer->stop();
+
+    cout << secondConfig.friendlyName << " played " << secondFrames << " frames" << endl;
+    auto stats = audioRenderer->get_migration_stats();
+    log_migration_stats(stats);
+
+    firstEndpoint->Release();
+    if (stats.migrations != 1 || stats.failedAttempts != 2 || secondFrames == 0) {
+        cout << "The stream did not move once the replacement endpoint showed up" << endl;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,143 @@
+#include <iostream>
+#include <atomic>
+#include <cmath>
+#include <thread>
+
+#include "DeviceEnumerator.h"
+#include "SimulatedDevice.h"
+#include "AudioRenderer.h"
+#include "Mixer.h"
+#include "main_clients.hpp"
+
+using std::cout;
+using std::endl;
+
+// A mono sine source for the mixer, with its own phase
+Mixer::Source make_sine_source(double frequency, DWORD sampleRate, float level = 0.3f) {
+    return [phase = 0.0, step = 2 * 3.14159265358979 * frequency / sampleRate, level](float* samples, UINT32 frames) mutable {
+        for (UINT32 i = 0; i < frames; i++) {
+            samples[i] = level * (float)std::sin(phase);
+            phase += step;
+        }
+        phase = std::fmod(phase, 2 * 3.14159265358979);
+    };
+}
+
+void print_mixer_stats(Mixer& mixer) {
+    auto stats = mixer.get_stats();
+    for (const auto& source : stats.sources) {
+        cout << "  source " << source.id << ": gain " << source.gain << ", pan " << source.pan << ", "
+            << source.nsPerFrame << "ns/frame, slowest block " << source.maxBlockMs << "ms" << endl;
+    }
+    cout << "  peak " << stats.peak << ", " << stats.limitedFrames << " frames limited" << endl;
+}
+
+// Mixes a chord on the default output, moving the notes around the stereo field. Press ESC to stop.
+int main_mixer() {
+    DeviceEnumerator deviceEnumerator;
+    auto renderer = open_client(deviceEnumerator.get_default_output(), &AudioRenderer::initialize, 16);
+    if (renderer == nullptr)
+        return -1;
+
+    MixerConfig config;
+    config.sampleRate = renderer->get_format()->nSamplesPerSec;
+    Mixer mixer(config);
+    renderer->start_interleaved([&mixer](float* samples, UINT32 frames, WORD channels) { mixer.render(samples, frames, channels); },
+        2, SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT);
+
+    const double chord[] = { 261.63, 329.63, 392.0, 523.25 };
+    std::vector<UINT64> notes;
+    for (auto frequency : chord) {
+        notes.push_back(mixer.add_source(make_sine_source(frequency, config.sampleRate, 0.25f), 1.0f, 0.0f));
+        Sleep(500);
+    }
+
+    cout << "Press ESC to stop." << endl;
+    for (int step = 0; GetAsyncKeyState(VK_ESCAPE) == 0; step++) {
+        for (size_t i = 0; i < notes.size(); i++)
+            mixer.set_pan(notes[i], (float)std::sin(step * 0.05 + i * 1.5));
+        if (step % 50 == 0)
+            print_mixer_stats(mixer);
+        Sleep(100);
+    }
+
+    for (auto note : notes)
+        mixer.remove_source(note);
+    Sleep(100);
+    renderer->stop();
+    return 0;
+}
+
+// Adds, moves and removes sources from a control thread while a simulated endpoint plays the mix, and checks
+// that no change clicks: low sines move little from one sample to the next, a change applied at once would
+// move the output by up to the level of a source. The sources are loud enough together to drive the limiter,
+// which must keep the output under its ceiling.
+int main_simulated_mixer() {
+    SimulatedEndpointConfig endpointConfig;
+    endpointConfig.friendlyName = "Simulated speakers";
+    auto endpoint = new SimulatedDevice(endpointConfig);
+
+    // Sink thread only, read once the stream is stopped
+    float lastLeft = 0, lastRight = 0;
+    float maxJump = 0, maxLevel = 0;
+    std::atomic<UINT64> playedFrames = 0;
+    endpoint->set_render_sink([&](const float* buffer, UINT32 frames, WORD channels, UINT64, UINT64) {
+        for (UINT32 i = 0; i < frames; i++) {
+            auto left = buffer[(size_t)i * channels];
+            auto right = buffer[(size_t)i * channels + 1];
+            maxJump = (std::max)({ maxJump, std::abs(left - lastLeft), std::abs(right - lastRight) });
+            maxLevel = (std::max)({ maxLevel, std::abs(left), std::abs(right) });
+            lastLeft = left;
+            lastRight = right;
+        }
+        playedFrames += frames;
+    });
+
+    auto renderer = open_simulated(endpoint, &AudioRenderer::initialize, 16);
+    if (renderer == nullptr)
+        return -1;
+
+    MixerConfig config;
+    config.sampleRate = renderer->get_format()->nSamplesPerSec;
+    Mixer mixer(config);
+    renderer->start_interleaved([&mixer](float* samples, UINT32 frames, WORD channels) { mixer.render(samples, frames, channels); },
+        2, SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT);
+
+    // Up to 8 sines of 0.45 at once, well over full scale when they line up
+    const int maxPlaying = 8;
+    const float level = 0.45f;
+    const double highest = 110.0;
+    std::thread control([&]() {
+        std::vector<UINT64> playing;
+        for (int step = 0; step < 60; step++) {
+            auto frequency = 55.0 + (highest - 55.0) * (step % 8) / 7;
+            if (playing.size() < maxPlaying)
+                playing.push_back(mixer.add_source(make_sine_source(frequency, config.sampleRate, level), 1.0f, (step % 3) - 1.0f));
+
+            if (step % 4 == 3) {
+                mixer.remove_source(playing.front());
+                playing.erase(playing.begin());
+            }
+            for (size_t i = 0; i < playing.size(); i++) {
+                mixer.set_gain(playing[i], 0.5f + 0.5f * ((step + i) % 2));
+                mixer.set_pan(playing[i], (float)std::sin(step + i * 1.0));
+            }
+            Sleep(25);
+        }
+        for (auto id : playing)
+            mixer.remove_source(id);
+    });
+
+    control.join();
+    Sleep(200);
+    print_mixer_stats(mixer);
+    renderer->stop();
+
+    // The most the sources can move the output by from one sample to the next: their slope, and their ramps
+    auto smoothStep = (float)(maxPlaying * level * (2 * 3.14159265358979 * highest / config.sampleRate + 1.0 / config.rampFrames));
+    auto stats = mixer.get_stats();
+    cout << "Played " << playedFrames << " frames, largest step " << maxJump << " (" << smoothStep << " without clicks, "
+        << level << " for a source switched at once), peak " << maxLevel << ", " << stats.sources.size() << " sources left" << endl;
+
+    return maxJump <= smoothStep && maxLevel <= config.ceiling + 1e-6f && stats.sources.empty() ? 0 : -1;
+}
@@ -0,0 +1,125 @@
+#include <iostream>
+#include <filesystem>
+#include <atomic>
+
+#include "DeviceEnumerator.h"
+#include "SimulatedDevice.h"
+#include "AudioRenderer.h"
+#include "WavFile.h"
+#include "main_clients.hpp"
+
+using std::cout;
+using std::endl;
+
+const wchar_t* playbackFilePath = L"recording.wav";
+
+// Periods decoded ahead of the endpoint by the render-ahead worker: the reads that can wait for the disk
+// happen there, the render thread only copies from the ring
+const unsigned int filePrefetchPeriods = 16;
+
+// Feeds the renderer from the file, silence once it is over. Runs on the render-ahead worker.
+void start_file_playback(AudioRenderer& renderer, MappedWavFile& file) {
+    renderer.set_render_ahead(filePrefetchPeriods);
+    renderer.start_blocks([&file](float* samples, UINT32 frames) {
+        auto read = file.read_mono(samples, frames);
+        std::fill(samples + read, samples + frames, 0.0f);
+    });
+}
+
+// Streams a WAV or RF64 file of any size from the disk to the default output
+int main_play_wav_file() {
+    MappedWavFile file;
+    if (auto error = file.open(playbackFilePath); error.has_value()) {
+        cout << "Unable to open the file to play" << endl;
+        return -1;
+    }
+
+    const auto& layout = file.get_layout();
+    DeviceEnumerator deviceEnumerator;
+    auto renderer = open_client(deviceEnumerator.get_default_output(), &AudioRenderer::initialize, 16);
+    if (renderer == nullptr)
+        return -1;
+
+    if (renderer->get_format()->nSamplesPerSec != layout.format.sampleRate)
+        cout << "The file is at " << layout.format.sampleRate << "Hz, the endpoint at " << renderer->get_format()->nSamplesPerSec << "Hz: it will play at the wrong speed" << endl;
+
+    cout << "Playing " << layout.frames / layout.format.sampleRate << "s, " << layout.format.channels << " channels. Press ESC to stop." << endl;
+    start_file_playback(*renderer, file);
+
+    auto durationMs = layout.frames * 1000 / layout.format.sampleRate;
+    for (UINT64 elapsedMs = 0; elapsedMs < durationMs && GetAsyncKeyState(VK_ESCAPE) == 0; elapsedMs += 100)
+        Sleep(100);
+    renderer->stop();
+
+    auto stats = renderer->get_render_ahead_stats();
+    auto fileStats = file.get_stats();
+    cout << "Starved frames " << stats.starvedFrames << ", slowest block " << stats.maxBlockMs << "ms, "
+        << fileStats.views << " windows mapped" << endl;
+    return 0;
+}
+
+// Writes a stereo file, plays it from a small window on a simulated endpoint, and checks every frame played.
+// The left channel holds a ramp at twice its level and the right one silence, so that the mono downmix is the ramp.
+int main_simulated_file_playback() {
+    const std::wstring path = L"simulated_playback.wav";
+    const UINT32 rate = 48000;
+    const UINT64 frames = 6 * rate;
+    auto ramp = [](UINT64 frame) { return (float)(frame % 4096) / 4096.0f; };
+
+    AudioRecording take;
+    take.channels = 2;
+    take.samplesPerSecond = rate;
+    take.data.resize(frames * 2);
+    for (UINT64 i = 0; i < frames; i++)
+        take.data[i * 2] = 2 * ramp(i);
+
+    if (!write_wav_file(path, take)) {
+        cout << "Unable to write the file to play" << endl;
+        return -1;
+    }
+    take = AudioRecording();
+
+    // A window of 256KB: the 2.3MB of samples are played through about ten of them
+    MappedWavFile file(256 << 10);
+    if (auto error = file.open(path); error.has_value()) {
+        cout << "Unable to open the file to play" << endl;
+        return -1;
+    }
+
+    SimulatedEndpointConfig config;
+    config.friendlyName = "Simulated speakers";
+    auto endpoint = new SimulatedDevice(config);
+
+    // Sink thread only, read once the stream is stopped
+    std::atomic<UINT64> playedFrames = 0;
+    UINT64 wrongFrames = 0;
+    endpoint->set_render_sink([&](const float* buffer, UINT32 count, WORD channels, UINT64, UINT64) {
+        auto first = playedFrames.load();
+        for (UINT32 i = 0; i < count; i++) {
+            auto expected = first + i < frames ? ramp(first + i) : 0.0f;
+            if (buffer[(size_t)i * channels] != expected)
+                wrongFrames++;
+        }
+        playedFrames = first + count;
+    });
+
+    auto renderer = open_simulated(endpoint, &AudioRenderer::initialize, 16);
+    if (renderer == nullptr)
+        return -1;
+
+    start_file_playback(*renderer, file);
+    while (playedFrames < frames + rate / 10)
+        Sleep(50);
+    renderer->stop();
+
+    auto stats = renderer->get_render_ahead_stats();
+    auto fileStats = file.get_stats();
+    cout << "Played " << playedFrames << " frames, " << wrongFrames << " wrong, " << stats.starvedFrames << " starved, slowest block "
+        << stats.maxBlockMs << "ms" << endl;
+    cout << fileStats.views << " windows mapped one at a time for " << file.get_layout().dataBytes / 1024 << "KB of samples, "
+        << fileStats.mappedBytes / 1024 << "KB mapped at the end" << endl;
+
+    file.close();
+    std::filesystem::remove(path);
+    return wrongFrames == 0 && stats.starvedFrames == 0 ? 0 : -1;
+}
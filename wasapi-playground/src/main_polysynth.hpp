@@ -0,0 +1,232 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "DeviceEnumerator.h"
+#include "AudioRenderer.h"
+#include "PolySynth.h"
+#include "Wavetables.h"
+#include "Fft.h"
+#include "main_clients.hpp"
+
+using std::cout;
+using std::endl;
+
+void print_poly_synth_stats(const PolySynth& synth) {
+    auto stats = synth.get_stats();
+    cout << "  " << stats.activeVoices << " voices (peak " << stats.peakVoices << ", " << stats.stolenVoices << " stolen), "
+        << stats.nsPerFrame << "ns/frame, " << stats.parallelBlocks << " of " << stats.blocks << " blocks in parallel, "
+        << stats.pool.kernelWakes << " kernel wake-ups, workers joining after " << stats.pool.wakeUs << "us on average, "
+        << stats.pool.maxWakeUs << "us at worst" << endl;
+}
+
+// Slow clusters of up to a few hundred sawtooth voices on the default output, spread over every core.
+// Press ESC to stop.
+int main_poly_synth() {
+    DeviceEnumerator deviceEnumerator;
+    auto renderer = open_client(deviceEnumerator.get_default_output(), &AudioRenderer::initialize, 16);
+    if (renderer == nullptr)
+        return -1;
+
+    PolySynthConfig config;
+    config.sampleRate = renderer->get_format()->nSamplesPerSec;
+    config.maxVoices = 384;
+    config.gain = 0.01f;
+    config.releaseSeconds = 1.5f;
+    // Keeps the workers awake from one period to the next
+    config.spinMicroseconds = 20000;
+    PolySynth synth(config);
+
+    renderer->start_interleaved([&synth](float* samples, UINT32 frames, WORD channels) { synth.render(samples, frames, channels); }, 2);
+    cout << "Running on " << config.workers + 1 << " threads. Press ESC to stop." << endl;
+
+    std::mt19937 random(7);
+    std::uniform_int_distribution<int> chord(0, 6);
+    std::uniform_real_distribution<float> pan(0.0f, 1.0f);
+    const BYTE scale[] = { 36, 43, 48, 52, 55, 59, 62 };
+    for (int step = 0; GetAsyncKeyState(VK_ESCAPE) == 0; step++) {
+        // Every second, a new cluster of 120 voices over the notes of the chord, the previous one fading out
+        if (step % 10 == 0) {
+            for (auto note : scale)
+                synth.note_off(note);
+            for (int voice = 0; voice < 120; voice++)
+                synth.note_on(scale[chord(random)], 0.5f + pan(random) * 0.5f, pan(random));
+        }
+        if (step % 30 == 0)
+            print_poly_synth_stats(synth);
+        Sleep(100);
+    }
+
+    renderer->stop();
+    return 0;
+}
+
+// Starts voices notes at frame 0, spread over the keyboard and the stereo field
+void start_poly_synth_voices(PolySynth& synth, size_t voices) {
+    for (size_t voice = 0; voice < voices; voice++)
+        synth.schedule_note((BYTE)(24 + (voice * 7) % 72), 1.0f, 0, (voice % 16) / 15.0f);
+}
+
+// Renders the same voices offline on 1 to N threads: the output must not change, only the time it takes.
+// Lanes beyond the hardware threads share cores, their speedup is not meaningful.
+bool benchmark_poly_synth_scaling() {
+    const DWORD sampleRate = 48000;
+    const UINT64 frames = 2 * sampleRate;
+    const UINT32 blockFrames = 256;
+    auto cores = (std::max)(std::thread::hardware_concurrency(), 1u);
+    auto maxLanes = (std::max)(cores, 4u);
+
+    bool identical = true, complete = true;
+    for (size_t voices : { 64, 256, 1024 }) {
+        cout << voices << " voices, " << blockFrames << " frame blocks:" << endl;
+
+        AudioRecording reference;
+        double serialSeconds = 0;
+        for (unsigned int lanes = 1; lanes <= maxLanes; lanes++) {
+            PolySynthConfig config;
+            config.sampleRate = sampleRate;
+            config.maxVoices = voices;
+            config.maxEvents = voices;
+            config.gain = 0.002f;
+            config.workers = lanes - 1;
+            config.spinMicroseconds = 1000;
+            PolySynth synth(config);
+            start_poly_synth_voices(synth, voices);
+
+            auto start = std::chrono::steady_clock::now();
+            auto recording = synth.render_offline(frames, 2, blockFrames);
+            auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            if (lanes == 1) {
+                reference = std::move(recording);
+                serialSeconds = seconds;
+            }
+            else {
+                identical = identical && recording.data == reference.data;
+            }
+
+            auto stats = synth.get_stats();
+            complete = complete && stats.peakVoices == voices && stats.droppedEvents == 0;
+            cout << "  " << std::setw(2) << lanes << " thread(s): " << std::setw(8) << std::fixed << std::setprecision(1)
+                << stats.nsPerFrame << "ns/frame, " << std::setw(6) << (double)frames / sampleRate / seconds << "x realtime, speedup "
+                << std::setprecision(2) << serialSeconds / seconds << ", joined after " << std::setprecision(1) << stats.pool.wakeUs << "us"
+                << (lanes > cores ? " (more threads than cores)" : "") << std::defaultfloat << endl;
+        }
+    }
+    if (!complete)
+        cout << "Some voices did not start" << endl;
+    return identical && complete;
+}
+
+// Strongest bin away from the harmonics of frequency, in dB below the strongest bin: where aliases land
+double worst_alias_db(const std::vector<float>& signal, double frequency, DWORD sampleRate) {
+    const size_t size = 16384;
+    RealFft transform(size);
+    std::vector<float> windowed(size), real(transform.get_bins()), imaginary(transform.get_bins());
+    for (size_t i = 0; i < size; i++)
+        windowed[i] = signal[i] * (float)(0.5 - 0.5 * std::cos(2 * 3.14159265358979 * i / size));
+    transform.forward(windowed.data(), real.data(), imaginary.data());
+
+    double strongest = 0, strongestAlias = 0;
+    auto harmonicBins = frequency * size / sampleRate;
+    for (size_t bin = 1; bin < transform.get_bins(); bin++) {
+        double power = (double)real[bin] * real[bin] + (double)imaginary[bin] * imaginary[bin];
+        strongest = (std::max)(strongest, power);
+        auto harmonic = std::round(bin / harmonicBins);
+        if (std::abs(bin - harmonic * harmonicBins) > 8)
+            strongestAlias = (std::max)(strongestAlias, power);
+    }
+    return 10 * std::log10(strongestAlias / strongest);
+}
+
+// A high sawtooth from the tables against the naive shape the waveforms used to compute, and what a sample
+// costs either way
+bool check_wavetables() {
+    const DWORD sampleRate = 48000;
+    const BYTE key = 108;
+    auto frequency = get_key_frequency(Tuning::EqualTemperament, key);
+
+    PolySynthConfig config;
+    config.sampleRate = sampleRate;
+    config.workers = 0;
+    PolySynth synth(config);
+    synth.note_on(key, 1.0f);
+    // Past the attack
+    auto recording = synth.render_offline(20480, 1);
+    std::vector<float> table(recording.data.begin() + 4096, recording.data.end());
+
+    std::vector<float> naive(table.size());
+    for (size_t i = 0; i < naive.size(); i++) {
+        auto progress = std::fmod(frequency * i / sampleRate, 1.0);
+        naive[i] = (float)(progress * 2 - 1);
+    }
+
+    auto tableAliasDb = worst_alias_db(table, frequency, sampleRate);
+    cout << "Sawtooth at " << frequency << "Hz, strongest alias: " << tableAliasDb << "dB from the tables, "
+        << worst_alias_db(naive, frequency, sampleRate) << "dB computed per sample" << endl;
+
+    const size_t samples = 1 << 22;
+    auto increment = get_key_increment(Tuning::EqualTemperament, 69, sampleRate);
+    auto wavetable = get_wavetable(Waveform::Sine, increment);
+    double sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    UINT32 phase = 0;
+    for (size_t i = 0; i < samples; i++, phase += increment)
+        sum += read_wavetable(wavetable, phase);
+    auto tableNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / samples;
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < samples; i++)
+        sum += std::sin(2 * 3.14159265358979 * 440.0 * i / sampleRate);
+    auto sinNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / samples;
+    cout << "Sine: " << tableNs << "ns per sample from the table, " << sinNs << "ns with std::sin" << (sum == 0.5 ? " " : "") << endl;
+
+    return tableAliasDb < -60;
+}
+
+// The pool stays asleep for a few voices, a note starts on the frame it was scheduled at whatever the blocks,
+// the tables do not alias, and the output is the same on any number of threads
+int main_simulated_poly_synth() {
+    const DWORD sampleRate = 48000;
+
+    bool serialBelowThreshold = false;
+    {
+        PolySynthConfig config;
+        config.sampleRate = sampleRate;
+        config.workers = 3;
+        PolySynth synth(config);
+        start_poly_synth_voices(synth, 8);
+        synth.render_offline(sampleRate / 10);
+        auto stats = synth.get_stats();
+        serialBelowThreshold = stats.parallelBlocks == 0 && stats.pool.runs == 0;
+        cout << "8 voices: " << stats.parallelBlocks << " of " << stats.blocks << " blocks in parallel" << endl;
+    }
+
+    bool sampleAccurate = false;
+    {
+        const UINT64 noteFrame = 1000;
+        PolySynthConfig config;
+        config.sampleRate = sampleRate;
+        config.workers = 3;
+        PolySynth synth(config);
+        synth.schedule_note(60, 1.0f, noteFrame);
+        auto recording = synth.render_offline(4096, 2, 480);
+        UINT64 first = 0;
+        while (first < 4096 && recording.data[first * 2] == 0 && recording.data[first * 2 + 1] == 0)
+            first++;
+        // The band-limited sawtooth starts from 0: the note is heard from the sample after its first
+        sampleAccurate = first == noteFrame + 1;
+        cout << "Note scheduled at frame " << noteFrame << ", heard from frame " << first << endl;
+    }
+
+    bool bandLimited = check_wavetables();
+
+    cout << endl;
+    bool identical = benchmark_poly_synth_scaling();
+    cout << "Outputs " << (identical ? "identical" : "DIFFERENT") << " on every number of threads" << endl;
+
+    return serialBelowThreshold && sampleAccurate && bandLimited && identical ? 0 : -1;
+}
@@ -0,0 +1,108 @@
+#include <iostream>
+#include <string>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include "SimulatedDevice.h"
+#include "AudioRenderer.h"
+#include "AudioCapturer.h"
+#include "RealtimeCheck.h"
+#include "SpscRing.h"
+
+using std::cout;
+using std::endl;
+
+// Runs the audio paths on simulated endpoints with the realtime checks on: a passthrough from capture to
+// render, a recording, and start/stop cycles. None of them may allocate or lock on an audio thread.
+// A last run with a callback that allocates makes sure the detector itself works. Returns -1 on failure.
+int main_simulated_realtime_checks() {
+#ifdef WASAPI_REALTIME_CHECKS
+    SimulatedEndpointConfig renderConfig;
+    renderConfig.friendlyName = "Simulated speakers";
+
+    SimulatedEndpointConfig captureConfig;
+    captureConfig.id = L"{0.0.1.00000000}.{simulated}";
+    captureConfig.friendlyName = "Simulated microphone";
+    captureConfig.direction = EDataFlow::eCapture;
+
+    auto captureEndpoint = new SimulatedDevice(captureConfig);
+    captureEndpoint->set_capture_source([](float* buffer, UINT32 frames, WORD channels, UINT64 position, UINT64 _) {
+        for (UINT32 i = 0; i < frames; i++)
+            for (WORD j = 0; j < channels; j++)
+                buffer[(size_t)i * channels + j] = (float)sin(440.0 * 2 * 3.14159265358979 * (position + i) / 48000.0);
+    });
+
+    AudioRenderer audioRenderer(std::make_unique<AudioDevice>(new SimulatedDevice(renderConfig)));
+    AudioCapturer audioCapturer(std::make_unique<AudioDevice>(captureEndpoint));
+    if (audioRenderer.initialize_low_latency().has_value() || audioCapturer.initialize_low_latency().has_value()) {
+        cout << "Failed to initialize the simulated streams" << endl;
+        return -1;
+    }
+
+    SpscRing<float> passthrough(1 << 16);
+    for (int cycle = 0; cycle < 5; cycle++) {
+        audioCapturer.start_streaming([&passthrough](BYTE* data, UINT32 frames) {
+            passthrough.push(reinterpret_cast<float*>(data), frames);
+        });
+        audioRenderer.start([&passthrough](FrameInfo _) {
+            float sample = 0;
+            passthrough.pop(sample);
+            return (double)sample;
+        });
+
+        Sleep(200);
+        audioCapturer.stop();
+        audioRenderer.stop();
+    }
+
+    auto recordingFuture = audioCapturer.start_recording();
+    Sleep(500);
+    audioCapturer.stop();
+
+    // Interleaved whole frames, about as long as the stream ran
+    auto recording = recordingFuture.get();
+    bool recorded = recording.channels != 0 && recording.data.size() % recording.channels == 0
+        && recording.durationMs >= 400 && recording.durationMs <= 600;
+    cout << "Recorded " << recording.data.size() << " samples, " << recording.channels << " channels, " << recording.durationMs << "ms" << endl;
+
+    auto violations = get_realtime_violations();
+    cout << "Audio threads: " << violations.allocations << " allocations, " << violations.frees << " frees, "
+        << violations.locks << " locks" << endl;
+
+    // Self-test: callbacks that allocate on every frame must be caught, with plain and over-aligned types.
+    // The pointers escape, so that the compiler can not elide the allocations.
+    static float* volatile lastScratch = nullptr;
+    struct alignas(64) AlignedBlock { float samples[16]; };
+    static AlignedBlock* volatile lastBlock = nullptr;
+
+    audioRenderer.start([](FrameInfo frame) {
+        std::vector<float> scratch(64);
+        lastScratch = scratch.data();
+        return (double)scratch[frame.ordinalNumber % scratch.size()];
+    });
+    Sleep(100);
+    audioRenderer.stop();
+    auto afterPlain = get_realtime_violations();
+
+    audioRenderer.start([](FrameInfo frame) {
+        auto block = std::make_unique<AlignedBlock>();
+        lastBlock = block.get();
+        return (double)block->samples[frame.ordinalNumber % 16] * 0.0;
+    });
+    Sleep(100);
+    audioRenderer.stop();
+    auto afterAligned = get_realtime_violations();
+
+    bool plainDetected = afterPlain.allocations > violations.allocations;
+    bool alignedDetected = afterAligned.allocations > afterPlain.allocations;
+    bool detectorWorks = plainDetected && alignedDetected;
+    cout << "Allocating callback " << (plainDetected ? "detected" : "NOT detected") << ", over-aligned allocation "
+        << (alignedDetected ? "detected" : "NOT detected") << endl;
+
+    return violations.total() == 0 && detectorWorks && recorded ? 0 : -1;
+#else
+    cout << "Realtime checks are disabled in this build, define WASAPI_REALTIME_CHECKS (on by default in Debug)" << endl;
+    return 0;
+#endif
+}
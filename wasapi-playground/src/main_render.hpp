@@ -9,6 +9,9 @@
 #include "DeviceEnumerator.h"
 #include "AudioRenderer.h"
 #include "AudioCapturer.h"
+#include "DeviceNotificationProvider.h"
+#include "SimulatedDevice.h"
+#include "main_clients.hpp"
 
 int main_render() {
     DeviceEnumerator deviceEnumerator;
@@ -38,16 +41,16 @@ int main_render() {
     auto audioDevice = deviceEnumerator.get_device_by_id(deviceId);
     log_device_details(audioDevice->get_info());
 
-    AudioRenderer audioRenderer(std::move(audioDevice));
+    if (auto configuration = audioDevice->get_stream_configuration(NegotiationPolicy()); configuration.has_value())
+        log_stream_configuration(configuration.value());
 
-    if (auto error = audioRenderer.initialize(bufferSizeLenghtMs); error.has_value()) {
-        cout << "Audio Renderer failed to initialize. Aborting" << endl;
+    auto audioRenderer = open_client(std::move(audioDevice), &AudioRenderer::initialize_negotiated, NegotiationPolicy());
+    if (audioRenderer == nullptr)
         return -1;
-    }
 
     Synthesizer synth;
     auto synthFunction = std::bind(&Synthesizer::triangle_from_keystrokes, &synth, std::placeholders::_1);
-    audioRenderer.start(synthFunction);
+    audioRenderer->start(synthFunction);
 
     cout << "- Press these keys to play audio: Z S X C F V G B N J M K , . /\n"; 
     cout << "- Press ESC to quit.\n";
@@ -61,6 +64,112 @@ int main_render() {
 
     while (stopFuture.wait_for(std::chrono::milliseconds(100)) != std::future_status::ready);
 
-    audioRenderer.stop();
+    audioRenderer->stop();
     return 0;
-}
\ No newline at end of file
+}
+
+// Negotiates against synthetic capability tables and checks each pick: an endpoint sharing only its native
+// integer formats through the legacy engine, a float endpoint with a low-latency engine, and one whose mix
+// format rate differs from the other rates it takes. Returns -1 on any unexpected configuration.
+int main_simulated_negotiation() {
+    const EnginePeriodLimits lowLatencyEngine{ 480, 48, 144, 480 };
+    auto format = [](unsigned int sampleRate, unsigned short bits, unsigned short validBits, bool isFloat) {
+        StreamFormat streamFormat;
+        streamFormat.sampleRate = sampleRate;
+        streamFormat.bitsPerSample = bits;
+        streamFormat.validBitsPerSample = validBits;
+        streamFormat.isFloat = isFloat;
+        return streamFormat;
+    };
+
+    // Native integer formats only, no IAudioClient3 engine periods: as a device made for exclusive mode
+    DeviceCapabilities exclusiveOnly;
+    exclusiveOnly.supportedFormats = {
+        { format(48000, 32, 24, false), false, std::nullopt },
+        { format(48000, 16, 16, false), false, std::nullopt },
+    };
+    exclusiveOnly.legacyPeriodInFrames = 480;
+
+    DeviceCapabilities sharedOnly;
+    sharedOnly.supportedFormats = { { format(48000, 32, 32, true), true, lowLatencyEngine } };
+    sharedOnly.legacyPeriodInFrames = 480;
+
+    // 44.1kHz mix format on an engine stuck at its default period, 48kHz converted by the engine
+    DeviceCapabilities mismatched;
+    mismatched.supportedFormats = {
+        { format(44100, 32, 32, true), true, EnginePeriodLimits{ 441, 441, 441, 441 } },
+        { format(48000, 32, 32, true), false, lowLatencyEngine },
+        { format(48000, 16, 16, false), false, lowLatencyEngine },
+    };
+    mismatched.legacyPeriodInFrames = 441;
+
+    struct Case {
+        const char* name;
+        const DeviceCapabilities* capabilities;
+        double cpuBudget;
+        bool allowIntegerFormats;
+        std::optional<StreamConfiguration> expected;
+    };
+    auto configuration = [](const StreamFormat& format, unsigned int periodInFrames, bool usesEnginePeriod) {
+        StreamConfiguration expected;
+        expected.format = format;
+        expected.periodInFrames = periodInFrames;
+        expected.usesEnginePeriod = usesEnginePeriod;
+        return std::optional<StreamConfiguration>(expected);
+    };
+
+    const Case cases[] = {
+        { "exclusive only, float streams", &exclusiveOnly, 0.05, false, std::nullopt },
+        { "exclusive only, integer allowed", &exclusiveOnly, 0.05, true, configuration(format(48000, 32, 24, false), 480, false) },
+        { "shared only", &sharedOnly, 0.05, false, configuration(format(48000, 32, 32, true), 144, true) },
+        { "shared only, tight budget", &sharedOnly, 0.01, false, configuration(format(48000, 32, 32, true), 240, true) },
+        { "shared only, nothing fits", &sharedOnly, 0.001, false, configuration(format(48000, 32, 32, true), 480, false) },
+        { "mismatched rates", &mismatched, 0.05, false, configuration(format(48000, 32, 32, true), 144, true) },
+        { "mismatched rates, tight budget", &mismatched, 0.012, false, configuration(format(48000, 32, 32, true), 192, true) },
+        { "mismatched rates, conversion too costly", &mismatched, 0.005, false, configuration(format(44100, 32, 32, true), 441, false) },
+    };
+
+    bool allExpected = true;
+    for (const auto& testCase : cases) {
+        NegotiationPolicy policy;
+        policy.cpuBudget = testCase.cpuBudget;
+        policy.allowIntegerFormats = testCase.allowIntegerFormats;
+        auto picked = negotiate_stream_configuration(*testCase.capabilities, policy);
+
+        bool expected = picked.has_value() == testCase.expected.has_value();
+        if (expected && picked.has_value()) {
+            expected = picked.value().format == testCase.expected.value().format
+                && picked.value().periodInFrames == testCase.expected.value().periodInFrames
+                && picked.value().usesEnginePeriod == testCase.expected.value().usesEnginePeriod;
+        }
+        allExpected = allExpected && expected;
+
+        cout << testCase.name << ", budget " << testCase.cpuBudget << ": " << (expected ? "as expected" : "UNEXPECTED") << endl;
+        if (picked.has_value())
+            log_stream_configuration(picked.value());
+        else
+            cout << "  no configuration" << endl;
+    }
+
+    // The negotiation is cached per device until its format changes
+    SimulatedEndpointConfig endpointConfig;
+    endpointConfig.id = L"{0.0.0.00000000}.{simulated-negotiation}";
+    auto endpoint = new SimulatedDevice(endpointConfig);
+    endpoint->AddRef();
+    AudioDevice device(endpoint);
+    DeviceNotificationProvider notifications;
+
+    auto before = device.get_stream_configuration(NegotiationPolicy());
+    endpoint->simulate_format_change(make_float_format(44100, 2), notifications.get_notification_client());
+    auto after = device.get_stream_configuration(NegotiationPolicy());
+    endpoint->Release();
+
+    bool renegotiated = before.has_value() && after.has_value()
+        && before.value().format.sampleRate == 48000 && after.value().format.sampleRate == 44100;
+    allExpected = allExpected && renegotiated;
+    cout << "format change: " << (renegotiated ? "negotiated again" : "UNEXPECTED, kept the cached configuration") << endl;
+    if (after.has_value())
+        log_stream_configuration(after.value());
+
+    return allExpected ? 0 : -1;
+}
@@ -0,0 +1,272 @@
+#include <iostream>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <vector>
+
+#include "DeviceEnumerator.h"
+#include "AudioRenderer.h"
+#include "MidiSequencer.h"
+#include "RealtimeCheck.h"
+#include "WavFile.h"
+#include "main_clients.hpp"
+
+using std::cout;
+using std::endl;
+
+const wchar_t* midiFilePath = L"song.mid";
+
+// Big-endian, with the variable-length delta times of the format
+void put_midi_u16(std::vector<BYTE>& out, WORD value) { out.push_back((BYTE)(value >> 8)); out.push_back((BYTE)value); }
+void put_midi_u32(std::vector<BYTE>& out, UINT32 value) { put_midi_u16(out, (WORD)(value >> 16)); put_midi_u16(out, (WORD)value); }
+void put_midi_vlq(std::vector<BYTE>& out, UINT32 value) {
+    BYTE bytes[4];
+    int count = 0;
+    do {
+        bytes[count++] = value & 0x7F;
+        value >>= 7;
+    } while (value != 0 && count < 4);
+    while (count-- > 0)
+        out.push_back(bytes[count] | (count != 0 ? 0x80 : 0));
+}
+
+void put_midi_track(std::vector<BYTE>& out, const std::vector<BYTE>& track) {
+    out.insert(out.end(), { 'M', 'T', 'r', 'k' });
+    put_midi_u32(out, (UINT32)track.size());
+    out.insert(out.end(), track.begin(), track.end());
+}
+
+std::vector<BYTE> make_midi_header(WORD format, WORD tracks, WORD division) {
+    std::vector<BYTE> out = { 'M', 'T', 'h', 'd' };
+    put_midi_u32(out, 6);
+    put_midi_u16(out, format);
+    put_midi_u16(out, tracks);
+    put_midi_u16(out, division);
+    return out;
+}
+
+void put_midi_tempo(std::vector<BYTE>& track, UINT32 delta, UINT32 microsecondsPerQuarter) {
+    put_midi_vlq(track, delta);
+    track.insert(track.end(), { 0xFF, 0x51, 0x03, (BYTE)(microsecondsPerQuarter >> 16), (BYTE)(microsecondsPerQuarter >> 8), (BYTE)microsecondsPerQuarter });
+}
+
+void put_midi_end_of_track(std::vector<BYTE>& track, UINT32 delta) {
+    put_midi_vlq(track, delta);
+    track.insert(track.end(), { 0xFF, 0x2F, 0x00 });
+}
+
+// A format 1 song of bars of 4/4 at 480 ticks per quarter: a tempo map speeding up halfway, chords on
+// channel 1 in running status with note ons of velocity 0 for the note offs, an arpeggio on channel 2 with
+// note offs, and drums on channel 10, which the sequencer skips
+std::vector<BYTE> make_midi_song(unsigned int seed, int bars) {
+    const WORD ticksPerQuarter = 480;
+    std::mt19937 random(seed);
+    std::uniform_int_distribution<int> degree(0, 6);
+    const BYTE scale[] = { 0, 2, 4, 5, 7, 9, 11 };
+    auto root = (BYTE)(48 + seed % 12);
+
+    std::vector<BYTE> tempo;
+    put_midi_tempo(tempo, 0, 500000);
+    put_midi_tempo(tempo, ticksPerQuarter * 4 * (bars / 2), 400000);
+    put_midi_end_of_track(tempo, ticksPerQuarter * 4 * (bars - bars / 2));
+
+    std::vector<BYTE> chords;
+    put_midi_vlq(chords, 0);
+    chords.insert(chords.end(), { 0xB0, 10, 32 });
+    for (int bar = 0; bar < bars; bar++) {
+        auto chordRoot = degree(random);
+        for (int voice = 0; voice < 3; voice++) {
+            auto step = chordRoot + voice * 2;
+            put_midi_vlq(chords, 0);
+            if (bar == 0 && voice == 0)
+                chords.push_back(0x90);
+            chords.push_back((BYTE)(root + scale[step % 7] + 12 * (step / 7)));
+            chords.push_back(80);
+        }
+        for (int voice = 0; voice < 3; voice++) {
+            auto step = chordRoot + voice * 2;
+            put_midi_vlq(chords, voice == 0 ? ticksPerQuarter * 4 - 10 : 0);
+            chords.push_back((BYTE)(root + scale[step % 7] + 12 * (step / 7)));
+            chords.push_back(0);
+        }
+        put_midi_vlq(chords, 10);
+        chords.insert(chords.end(), { 0xB0, 10, 32 });
+    }
+    put_midi_end_of_track(chords, 0);
+
+    std::vector<BYTE> arpeggio;
+    put_midi_vlq(arpeggio, 0);
+    arpeggio.insert(arpeggio.end(), { 0xB1, 10, 96 });
+    for (int note = 0; note < bars * 8; note++) {
+        auto key = (BYTE)(root + 12 + scale[degree(random)]);
+        put_midi_vlq(arpeggio, 0);
+        arpeggio.insert(arpeggio.end(), { 0x91, key, (BYTE)(60 + note % 4 * 10) });
+        put_midi_vlq(arpeggio, ticksPerQuarter / 2);
+        arpeggio.insert(arpeggio.end(), { 0x81, key, 0 });
+    }
+    put_midi_end_of_track(arpeggio, 0);
+
+    std::vector<BYTE> drums;
+    for (int beat = 0; beat < bars * 4; beat++) {
+        put_midi_vlq(drums, 0);
+        drums.insert(drums.end(), { 0x99, 36, 100 });
+        put_midi_vlq(drums, ticksPerQuarter);
+        drums.insert(drums.end(), { 0x89, 36, 0 });
+    }
+    put_midi_end_of_track(drums, 0);
+
+    auto song = make_midi_header(1, 4, ticksPerQuarter);
+    put_midi_track(song, tempo);
+    put_midi_track(song, chords);
+    put_midi_track(song, arpeggio);
+    put_midi_track(song, drums);
+    return song;
+}
+
+bool write_midi_song(const std::wstring& path, const std::vector<BYTE>& song) {
+    std::ofstream file(std::filesystem::path(path), std::ios::binary | std::ios::trunc);
+    file.write((const char*)song.data(), song.size());
+    return (bool)file;
+}
+
+// Plays song.mid from the working directory on the default output, or a generated song without it.
+// Press ESC to stop.
+int main_midi_file() {
+    DeviceEnumerator deviceEnumerator;
+    auto renderer = open_client(deviceEnumerator.get_default_output(), &AudioRenderer::initialize, 16);
+    if (renderer == nullptr)
+        return -1;
+
+    PolySynthConfig config;
+    config.sampleRate = renderer->get_format()->nSamplesPerSec;
+    config.waveform = Waveform::Triangle;
+    config.gain = 0.1f;
+
+    MidiSequence sequence;
+    if (auto error = read_midi_file(midiFilePath, config.sampleRate, sequence); error.has_value()) {
+        cout << "No song.mid, playing a generated song" << endl;
+        auto song = make_midi_song(1, 16);
+        sequence = *parse_midi_file(song.data(), song.size(), config.sampleRate);
+    }
+    cout << sequence.tracks << " tracks, " << sequence.events.size() << " events, " << sequence.frames / config.sampleRate
+        << "s. Press ESC to stop." << endl;
+
+    MidiSequencer sequencer(std::make_shared<PolySynth>(config), std::move(sequence));
+    renderer->start_interleaved([&sequencer](float* samples, UINT32 frames, WORD channels) { sequencer.render(samples, frames, channels); }, 2);
+
+    while (!sequencer.is_finished() && GetAsyncKeyState(VK_ESCAPE) == 0)
+        Sleep(100);
+    renderer->stop();
+
+    auto stats = sequencer.get_stats();
+    cout << stats.events << " events played, " << stats.notes << " notes" << endl;
+    return 0;
+}
+
+// Parses known timings, in tempo map and SMPTE files, hears a note on the frame it was written at, survives
+// truncated files, then renders a batch of songs on one thread and on every core: the WAV files must be
+// identical, only done sooner.
+int main_simulated_midi_rendering() {
+    const DWORD sampleRate = 48000;
+
+    // 480 ticks per quarter at 120bpm, 240bpm from tick 960: the note at tick 1440 is at 1.25s
+    bool timed = false;
+    std::vector<BYTE> timing = make_midi_header(0, 1, 480);
+    {
+        std::vector<BYTE> track;
+        put_midi_tempo(track, 0, 500000);
+        put_midi_tempo(track, 960, 250000);
+        put_midi_vlq(track, 480);
+        track.insert(track.end(), { 0x90, 69, 100 });
+        put_midi_vlq(track, 480);
+        track.insert(track.end(), { 69, 0 });
+        put_midi_end_of_track(track, 0);
+        put_midi_track(timing, track);
+
+        std::vector<BYTE> smpte = make_midi_header(0, 1, 0xE728);
+        std::vector<BYTE> smpteTrack;
+        put_midi_vlq(smpteTrack, 500);
+        smpteTrack.insert(smpteTrack.end(), { 0x90, 60, 100 });
+        put_midi_end_of_track(smpteTrack, 500);
+        put_midi_track(smpte, smpteTrack);
+
+        auto sequence = parse_midi_file(timing.data(), timing.size(), sampleRate);
+        auto smpteSequence = parse_midi_file(smpte.data(), smpte.size(), sampleRate);
+        timed = sequence.has_value() && sequence->events.size() == 2 && sequence->events[0].frame == 60000
+            && sequence->events[1].frame == 72000 && sequence->frames == 72000 && smpteSequence.has_value()
+            && smpteSequence->events.size() == 1 && smpteSequence->events[0].frame == 24000 && smpteSequence->frames == 48000;
+        cout << "Tempo map and SMPTE timings " << (timed ? "exact" : "WRONG") << endl;
+    }
+
+    bool sampleAccurate = false;
+    {
+        PolySynthConfig config;
+        config.sampleRate = sampleRate;
+        MidiSequencer sequencer(std::make_shared<PolySynth>(config), *parse_midi_file(timing.data(), timing.size(), sampleRate));
+        auto recording = sequencer.render_offline(1, 441);
+        UINT64 first = 0;
+        while (first < recording.data.size() && recording.data[first] == 0)
+            first++;
+        // The band-limited sawtooth starts from 0: the note is heard from the sample after its first
+        sampleAccurate = first == 60001 && sequencer.is_finished();
+        cout << "Note written at frame 60000, heard from frame " << first << ", " << recording.durationMs << "ms rendered" << endl;
+    }
+
+    auto song = make_midi_song(3, 8);
+    size_t parsedPrefixes = 0;
+    for (size_t size = 0; size < song.size(); size++)
+        parsedPrefixes += parse_midi_file(song.data(), size, sampleRate).has_value() ? 1 : 0;
+    cout << "Truncated songs: " << parsedPrefixes << " of " << song.size() << " prefixes parsed as what they hold" << endl;
+
+    // The batch
+    const int songs = 8;
+    const std::filesystem::path directory = "midi_batch";
+    std::filesystem::create_directories(directory);
+    std::vector<MidiRenderJob> serialJobs, parallelJobs;
+    bool written = true;
+    for (int i = 0; i < songs; i++) {
+        auto name = "song" + std::to_string(i);
+        auto input = (directory / (name + ".mid")).wstring();
+        written = written && write_midi_song(input, make_midi_song(i, 12 + i));
+        serialJobs.push_back(MidiRenderJob{ input, (directory / (name + "_serial.wav")).wstring() });
+        parallelJobs.push_back(MidiRenderJob{ input, (directory / (name + "_parallel.wav")).wstring() });
+    }
+
+    PolySynthConfig config;
+    config.sampleRate = sampleRate;
+    config.gain = 0.1f;
+    auto render_timed = [&](const std::vector<MidiRenderJob>& jobs, unsigned int workers) {
+        auto start = std::chrono::steady_clock::now();
+        auto results = render_midi_files(jobs, config, workers);
+        auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        UINT64 frames = 0;
+        bool succeeded = true;
+        for (const auto& result : results) {
+            frames += result.frames;
+            succeeded = succeeded && !result.error.has_value();
+        }
+        cout << "  " << songs << " songs on " << workers + 1 << " thread(s): " << (double)frames / sampleRate << "s of audio in "
+            << seconds << "s, " << (double)frames / sampleRate / seconds << "x realtime" << endl;
+        return succeeded;
+    };
+
+    // The jobs run on the pool's audio threads, exempted from the realtime checks: none may be reported
+    cout << "Batch:" << endl;
+    auto violations = get_realtime_violations().total();
+    bool rendered = written && render_timed(serialJobs, 0) && render_timed(parallelJobs, (std::max)(WorkStealingPool::default_workers(), 1u));
+    auto batchViolations = get_realtime_violations().total() - violations;
+    cout << "  " << batchViolations << " realtime violations" << endl;
+
+    bool identical = rendered;
+    for (int i = 0; i < songs && identical; i++) {
+        AudioRecording serial, parallel;
+        identical = !read_wav_file(serialJobs[i].output, serial).has_value() && !read_wav_file(parallelJobs[i].output, parallel).has_value()
+            && !serial.data.empty() && serial.data == parallel.data;
+    }
+    cout << "  WAV files " << (identical ? "identical" : "DIFFERENT") << endl;
+    std::filesystem::remove_all(directory);
+
+    return timed && sampleAccurate && identical && batchViolations == 0 ? 0 : -1;
+}
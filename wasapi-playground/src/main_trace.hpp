@@ -0,0 +1,54 @@
+#include <iostream>
+#include <cmath>
+#include <thread>
+
+#include "SimulatedDevice.h"
+#include "AudioRenderer.h"
+#include "Trace.h"
+#include "main_clients.hpp"
+
+using std::cout;
+using std::endl;
+
+// Plays one second on a simulated low-latency endpoint and writes the trace points hit along the way to trace.json,
+// to be opened in chrome://tracing or https://ui.perfetto.dev
+int main_simulated_trace() {
+#ifdef WASAPI_TRACE
+    TRACE_THREAD("main");
+
+    SimulatedEndpointConfig config;
+    config.friendlyName = "Simulated traced speakers";
+    auto audioRenderer = open_simulated(new SimulatedDevice(config), &AudioRenderer::initialize_low_latency, 0);
+    if (audioRenderer == nullptr)
+        return -1;
+
+    audioRenderer->start([](FrameInfo frame) {
+        return sin(440.0 * 2 * 3.14159265358979 * frame.time);
+    });
+
+    Sleep(1000);
+    audioRenderer->stop();
+
+    // Threads that come and go take the buffers of those gone: one more buffer at most, however many threads
+    auto& recorder = TraceRecorder::instance();
+    auto buffersBefore = recorder.get_buffer_count();
+    for (int i = 0; i < 50; i++) {
+        std::thread([]() {
+            TRACE_THREAD("short-lived");
+            TRACE_INSTANT("short-lived thread");
+        }).join();
+    }
+    auto buffersAfter = recorder.get_buffer_count();
+    cout << "50 short-lived threads traced with " << buffersAfter - buffersBefore << " more buffer(s)" << endl;
+    if (!recorder.export_chrome_trace("trace.json")) {
+        cout << "Could not write trace.json" << endl;
+        return -1;
+    }
+
+    cout << "Trace written to trace.json, " << recorder.get_dropped_events() << " events dropped" << endl;
+    return buffersAfter <= buffersBefore + 1 ? 0 : -1;
+#else
+    cout << "Tracing is disabled in this build, define WASAPI_TRACE (on by default in Debug)" << endl;
+    return 0;
+#endif
+}